@@ -9,38 +9,453 @@
 #include <algorithm>
 #include <iterator>
 #include <fstream>
+#include <iomanip>
 #include <memory>
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <deque>
+#include <atomic>
+#include <map>
+#include <list>
+#include <unordered_map>
+#include <filesystem>
+#include <bit>
 
 #define TINYGLTF_IMPLEMENTATION
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <tiny_gltf.h>
 
+#ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #define NOMINMAX
 #include <Windows.h>
+#include <shellscalingapi.h>
+#endif
 #include <DirectXMath.h>
 #include <DirectXColors.h>
 #include <DirectXCollision.h>
-#include <shellscalingapi.h>
 
+#ifdef _WIN32
 #define VK_USE_PLATFORM_WIN32_KHR
+#endif
 #include <vulkan/vulkan.hpp>
 
 #include <imgui.h>
+#ifdef _WIN32
 #include <backends/imgui_impl_win32.h>
+#endif
 #include <backends/imgui_impl_vulkan.h>
 
 ///////////////////////////////////////////////////////////////////////////
 
-constexpr std::uint32_t G_PreferredImageCount = 2;
-constexpr std::uint32_t G_MaxFramesInFlight = 2;
+// Upper bound for the per-frame arrays; the profile picks how many are actually used (G_FramesInFlight).
+constexpr std::uint32_t G_MaxFramesInFlight = 4;
+constexpr vk::DeviceSize G_UploadRingSize = 32ULL * 1024 * 1024;
+constexpr std::uint32_t G_MinDrawsPerRecordBatch = 64;
+constexpr std::uint32_t G_GpuTimingHistory = 240;
+constexpr std::uint32_t G_TraceEventsPerThread = 1U << 16;
+constexpr std::uint32_t G_PipelineCacheMagic = 0x43504B56; // 'VKPC'
+
+// Scoped CPU trace events; on by default in debug builds, compiled out in release unless forced.
+#ifndef ENABLE_TRACE
+#ifdef NDEBUG
+#define ENABLE_TRACE 0
+#else
+#define ENABLE_TRACE 1
+#endif
+#endif
+
+///////////////////////////////////////////////////////////////////////////
+
+class ThreadPool final
+{
+public:
+	explicit ThreadPool(std::uint32_t ThreadCount = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	template<typename _Func>
+	auto Submit(_Func&& Func) -> std::future<std::invoke_result_t<std::decay_t<_Func>>>
+	{
+		using ResultType = std::invoke_result_t<std::decay_t<_Func>>;
+
+		auto Task = std::make_shared<std::packaged_task<ResultType()>>(std::forward<_Func>(Func));
+		std::future<ResultType> Future = Task->get_future();
+
+		if (M_Threads.empty()) {
+			(*Task)();
+			return Future;
+		}
+
+		{
+			std::lock_guard<std::mutex> Lock(M_Mutex);
+			M_Tasks.emplace_back([Task]() { (*Task)(); });
+		}
+		M_Condition.notify_one();
+
+		return Future;
+	}
+
+	std::uint32_t GetThreadCount() const { return std::max<std::uint32_t>(1, static_cast<std::uint32_t>(M_Threads.size())); }
+
+private:
+	void WorkerLoop();
+
+	std::vector<std::thread>          M_Threads;
+	std::deque<std::function<void()>> M_Tasks;
+	std::mutex                        M_Mutex;
+	std::condition_variable           M_Condition;
+	bool                              M_bStop = false;
+};
+
+class TaskGroup final
+{
+public:
+	explicit TaskGroup(ThreadPool& Pool) : M_Pool(Pool) {}
+	~TaskGroup() { for (auto& Future : M_Futures) if (Future.valid()) Future.wait(); }
+
+	template<typename _Func>
+	void Run(_Func&& Func) { M_Futures.push_back(M_Pool.Submit(std::forward<_Func>(Func))); }
+
+	void Wait()
+	{
+		for (auto& Future : M_Futures) Future.wait();
+		for (auto& Future : M_Futures) Future.get();
+		M_Futures.clear();
+	}
+
+private:
+	ThreadPool&                    M_Pool;
+	std::vector<std::future<void>> M_Futures;
+};
+
+///////////////////////////////////////////////////////////////////////////
+
+class TraceRecorder final
+{
+public:
+	struct Event
+	{
+		const char*   Name{nullptr};
+		std::uint64_t BeginNs{0};
+		std::uint64_t EndNs{0};
+	};
+
+	struct Stats
+	{
+		std::uint32_t ThreadCount{0};
+		std::uint64_t EventsRecorded{0};
+		std::uint64_t EventsOverwritten{0};
+	};
+
+	TraceRecorder() : M_Epoch(std::chrono::steady_clock::now()) {}
+
+	std::uint64_t Now() const
+	{
+		return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - M_Epoch).count());
+	}
+
+	// Only the owning thread writes its ring, so recording is a plain store plus a release of the count.
+	void Record(const char* Name, std::uint64_t BeginNs, std::uint64_t EndNs)
+	{
+		ThreadBuffer* Buffer = M_ThreadBuffer ? M_ThreadBuffer : RegisterThread();
+		const std::uint64_t Count = Buffer->WriteCount.load(std::memory_order_relaxed);
+		Buffer->Events[Count % G_TraceEventsPerThread] = Event{Name, BeginNs, EndNs};
+		Buffer->WriteCount.store(Count + 1, std::memory_order_release);
+	}
+
+	// Snapshots every thread's ring while they keep recording and writes Chrome trace JSON
+	// (chrome://tracing, ui.perfetto.dev). Entries overwritten during the copy are dropped.
+	std::size_t WriteChromeTrace(const std::string& FileName) const;
+
+	Stats GetStats() const;
+
+private:
+	struct ThreadBuffer
+	{
+		std::unique_ptr<Event[]>   Events;
+		std::atomic<std::uint64_t> WriteCount{0};
+		std::uint32_t              ThreadIndex{0};
+	};
+
+	ThreadBuffer* RegisterThread();
+
+	static thread_local ThreadBuffer* M_ThreadBuffer;
+
+	const std::chrono::steady_clock::time_point M_Epoch;
+	mutable std::mutex                          M_Mutex;
+	std::vector<std::unique_ptr<ThreadBuffer>>  M_ThreadBuffers;
+};
+
+class TraceScope final
+{
+public:
+	explicit TraceScope(const char* Name);
+	~TraceScope();
+
+	TraceScope(const TraceScope&) = delete;
+	TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+	const char*   M_Name;
+	std::uint64_t M_BeginNs;
+};
+
+#define TRACE_CONCAT_INNER(A, B) A##B
+#define TRACE_CONCAT(A, B) TRACE_CONCAT_INNER(A, B)
+#if ENABLE_TRACE
+#define TRACE_SCOPE(Name) const TraceScope TRACE_CONCAT(TraceScope_, __LINE__)(Name)
+#else
+#define TRACE_SCOPE(Name) do {} while (false)
+#endif
+
+///////////////////////////////////////////////////////////////////////////
+
+struct DeviceAllocation
+{
+	vk::DeviceMemory Memory{};
+	vk::DeviceSize   Offset{0};
+	vk::DeviceSize   Size{0};
+	void*            Mapped{nullptr};
+	std::uint32_t    MemoryTypeIndex{0};
+	std::uint32_t    BlockIndex{std::numeric_limits<std::uint32_t>::max()};
+
+	bool IsDedicated() const { return BlockIndex == std::numeric_limits<std::uint32_t>::max(); }
+	explicit operator bool() const { return static_cast<bool>(Memory); }
+};
+
+class DeviceAllocator final
+{
+public:
+	enum class ResourceKind : std::uint8_t
+	{
+		eBuffer,
+		eImage,
+	};
+
+	struct MemoryTypeStats
+	{
+		std::uint32_t  MemoryTypeIndex{0};
+		std::uint32_t  HeapIndex{0};
+		std::uint32_t  BlockCount{0};
+		std::uint32_t  DedicatedCount{0};
+		std::uint32_t  AllocationCount{0};
+		std::uint32_t  FreeRangeCount{0};
+		vk::DeviceSize ReservedBytes{0};
+		vk::DeviceSize UsedBytes{0};
+		vk::DeviceSize LargestFreeRange{0};
+	};
+
+	struct Stats
+	{
+		std::vector<MemoryTypeStats> MemoryTypes;
+		std::uint32_t                DeviceMemoryCount{0};
+		std::uint32_t                MaxDeviceMemoryCount{0};
+		vk::DeviceSize               ReservedBytes{0};
+		vk::DeviceSize               UsedBytes{0};
+	};
+
+	// Called for every allocation Defragment wants to relocate, with the owner it was registered under. The callee
+	// copies the contents, rebinds its resource to the new range and returns true, or returns false to leave it in
+	// place. It runs under the allocator's lock, so it must not allocate or free.
+	using MoveCallback = std::function<bool(void* Owner, const DeviceAllocation& From, const DeviceAllocation& To)>;
+
+	void Init();
+	void Shutdown();
+
+	DeviceAllocation Allocate(const vk::MemoryRequirements& MemReqs, vk::MemoryPropertyFlags Properties, ResourceKind Kind);
+	void Free(DeviceAllocation& Allocation);
+
+	// Only allocations with an owner are ever moved; dedicated allocations never are.
+	void SetOwner(const DeviceAllocation& Allocation, void* Owner);
+	std::uint32_t Defragment(std::uint32_t MemoryTypeIndex, const MoveCallback& Move);
+
+	Stats GetStats() const;
+
+private:
+	struct UsedRange
+	{
+		vk::DeviceSize Size{0};
+		vk::DeviceSize Alignment{1};
+		void*          Owner{nullptr};
+	};
+
+	struct Block
+	{
+		vk::DeviceMemory                         Memory{};
+		vk::DeviceSize                           Size{0};
+		void*                                    Mapped{nullptr};
+		ResourceKind                             Kind{ResourceKind::eBuffer};
+		std::map<vk::DeviceSize, vk::DeviceSize> FreeRanges;
+		std::map<vk::DeviceSize, UsedRange>      UsedRanges;
+		vk::DeviceSize                           UsedBytes{0};
+	};
+
+	struct MemoryType
+	{
+		std::vector<std::unique_ptr<Block>> Blocks;
+		std::uint32_t                       DedicatedCount{0};
+		vk::DeviceSize                      DedicatedBytes{0};
+	};
+
+	vk::DeviceSize PreferredBlockSize(std::uint32_t MemoryTypeIndex) const;
+	bool AllocateFromBlock(Block& TargetBlock, vk::DeviceSize Size, vk::DeviceSize Alignment, vk::DeviceSize& OutOffset);
+	void FreeToBlock(Block& TargetBlock, vk::DeviceSize Offset);
+	std::unique_ptr<Block> CreateBlock(std::uint32_t MemoryTypeIndex, vk::DeviceSize Size, ResourceKind Kind);
+	void DestroyBlock(Block& TargetBlock);
+
+	mutable std::mutex                 M_Mutex;
+	vk::PhysicalDeviceMemoryProperties M_MemoryProperties{};
+	std::vector<MemoryType>            M_MemoryTypes;
+	std::uint32_t                      M_DeviceMemoryCount{0};
+	std::uint32_t                      M_MaxDeviceMemoryCount{0};
+};
+
+// A device-local buffer registered as the owner of its allocation, so Defragment can hand it to MoveBuffer.
+struct MovableBuffer
+{
+	std::tuple<vk::Buffer, DeviceAllocation>* BufferTuple{nullptr};
+	vk::BufferUsageFlags                      UsageFlags{};
+	vk::DeviceSize                            ByteSize{0};
+};
+
+///////////////////////////////////////////////////////////////////////////
+
+class UploadManager final
+{
+public:
+	// Monotonic timeline value; an upload is complete once the timeline semaphore reaches its token.
+	using Token = std::uint64_t;
+
+	struct Stats
+	{
+		std::uint64_t  BytesUploaded{0};
+		std::uint64_t  CopiesRecorded{0};
+		std::uint64_t  BatchesSubmitted{0};
+		std::uint32_t  BatchesInFlight{0};
+		std::uint64_t  StallCount{0};
+		vk::DeviceSize RingSize{0};
+		vk::DeviceSize RingUsed{0};
+		Token          SubmittedToken{0};
+		Token          CompletedToken{0};
+	};
+
+	void Init();
+	void Shutdown();
+
+	// Copies the data into the staging ring right away and records a copy into the open batch.
+	// The returned token completes once the batch carrying the last chunk has executed.
+	Token UploadBuffer(vk::Buffer DstBuffer, vk::DeviceSize DstOffset, const void* DataPtr, vk::DeviceSize ByteSize);
+
+	Token Flush();
+	void Update();
+	bool IsComplete(Token UploadToken);
+	void Wait(Token UploadToken);
+
+	vk::Semaphore GetSemaphore() const { return M_Timeline; }
+	Stats GetStats() const;
+
+private:
+	struct Batch
+	{
+		vk::CommandBuffer CommandBuffer{};
+		Token             Value{0};
+		std::uint64_t     RingEnd{0};
+	};
+
+	bool AllocateFromRing(vk::DeviceSize Size, std::uint64_t& OutPosition);
+	void SubmitOpenBatch();
+	void RetireCompleted(Token CompletedValue);
+	Token QueryCompleted() const;
+
+	mutable std::mutex             M_Mutex;
+	vk::CommandPool                M_CommandPool{};
+	vk::Semaphore                  M_Timeline{};
+	vk::Buffer                     M_RingBuffer{};
+	DeviceAllocation               M_RingAllocation{};
+	vk::DeviceSize                 M_RingSize{0};
+	std::uint64_t                  M_RingHead{0};
+	std::uint64_t                  M_RingTail{0};
+	Batch                          M_OpenBatch{};
+	bool                           M_bOpenBatchHasCopies{false};
+	std::deque<Batch>              M_InFlightBatches;
+	std::vector<vk::CommandBuffer> M_FreeCommandBuffers;
+	Token                          M_NextValue{1};
+	Token                          M_CompletedValue{0};
+	Stats                          M_Stats{};
+};
+
+///////////////////////////////////////////////////////////////////////////
+
+class PaletteRing final
+{
+public:
+	struct Stats
+	{
+		vk::DeviceSize SliceSize{0};
+		vk::DeviceSize BytesWritten{0};
+		std::uint32_t  MatrixCount{0};
+		std::uint32_t  MatrixCapacity{0};
+		bool           bDeviceLocal{false};
+		bool           bStreamingStores{false};
+	};
+
+	// One slice of MatrixCapacity matrices per frame in flight, bound once per frame through a dynamic offset.
+	void Init(std::uint32_t MatrixCapacity);
+	void Shutdown();
+
+	void BeginFrame(std::uint32_t FrameIndex);
+	void EndFrame();
+
+	// Returns the palette base index the draws push to the vertex shader, and a write pointer into the slice.
+	std::uint32_t Allocate(std::uint32_t MatrixCount, DirectX::XMFLOAT4X4*& OutDst);
+
+	std::uint32_t GetDynamicOffset() const { return static_cast<std::uint32_t>(M_FrameIndex * M_SliceSize); }
+	vk::DescriptorSet GetDescriptorSet() const { return M_DescriptorSet; }
+	Stats GetStats() const;
+
+	// Write-combined memory only likes full sequential lines; stream the rows past the cache when SSE is available.
+	static void StoreMatrix(DirectX::XMFLOAT4X4* Dst, DirectX::FXMMATRIX Matrix)
+	{
+#if defined(_XM_SSE_INTRINSICS_)
+		_mm_stream_ps(&Dst->m[0][0], Matrix.r[0]);
+		_mm_stream_ps(&Dst->m[1][0], Matrix.r[1]);
+		_mm_stream_ps(&Dst->m[2][0], Matrix.r[2]);
+		_mm_stream_ps(&Dst->m[3][0], Matrix.r[3]);
+#else
+		DirectX::XMStoreFloat4x4(Dst, Matrix);
+#endif
+	}
+
+private:
+	vk::Buffer           M_Buffer{};
+	DeviceAllocation     M_Allocation{};
+	vk::DescriptorPool   M_DescriptorPool{};
+	vk::DescriptorSet    M_DescriptorSet{};
+	vk::DeviceSize       M_SliceSize{0};
+	std::uint32_t        M_MatrixCapacity{0};
+	std::uint32_t        M_FrameIndex{0};
+	std::uint32_t        M_MatrixCount{0};
+	bool                 M_bDeviceLocal{false};
+};
 
 ///////////////////////////////////////////////////////////////////////////
 
+class ClipCache;
+
 class VkGltfModel final
 {
-	using BufferTuple = std::tuple<vk::Buffer, vk::DeviceMemory>;
+	using BufferTuple = std::tuple<vk::Buffer, DeviceAllocation>;
 
 	enum class ChannelPath : std::uint8_t
 	{
@@ -48,6 +463,7 @@ class VkGltfModel final
 		eTranslation,
 		eRotation,
 		eScale,
+		eWeights,
 	};
 
 public:
@@ -56,6 +472,7 @@ public:
 		uint32_t FirstIndex;
 		uint32_t IndexCount;
 		uint32_t FirstVertex;
+		uint32_t VertexCount;
 	};
 
 	struct Mesh
@@ -67,13 +484,16 @@ public:
 	{
 		std::shared_ptr<Node>              Parent;
 		std::uint32_t                      Index;
+		std::uint32_t                      LinearIndex{0};
 		std::vector<std::shared_ptr<Node>> Children;
-		Mesh                               Mesh;
+		Mesh                               MeshData;
 		DirectX::XMFLOAT3                  Translation{};
 		DirectX::XMFLOAT3                  Scale{1.0f, 1.0f, 1.0f};
 		DirectX::XMFLOAT4                  Rotation{};
 		std::int32_t                       Skin{-1};
 		DirectX::XMFLOAT4X4                Matrix;
+		std::uint32_t                      FirstMorphTarget{0};
+		std::uint32_t                      MorphTargetCount{0};
 
 		DirectX::XMMATRIX                GetLocalMatrix() const
 		{
@@ -99,15 +519,29 @@ public:
 		DirectX::XMFLOAT4 JointWeights1;
 	};
 
+	// Mirrors FMorphDelta in Default.vert (std430). Only vertices a target actually moves get one.
+	struct MorphDelta
+	{
+		DirectX::XMFLOAT3 Position;
+		std::uint32_t     Target;
+		DirectX::XMFLOAT3 Normal;
+		float             Padding;
+	};
+
+	// Per vertex: its deltas are MorphDeltas[First, First + Count).
+	struct MorphRange
+	{
+		std::uint32_t First;
+		std::uint32_t Count;
+	};
+
 	struct Skin
 	{
 		std::string                                        Name;
 		std::shared_ptr<Node>                              SkeletonRoot{nullptr};
 		std::vector<DirectX::XMFLOAT4X4>                   InverseBindMatrices;
 		std::vector<std::shared_ptr<Node>>                 Joints;
-		std::array<BufferTuple, G_MaxFramesInFlight>       Ssbo;
-		std::array<void*, G_MaxFramesInFlight>             SsboMapped = {};
-		std::array<vk::DescriptorSet, G_MaxFramesInFlight> DescriptorSet;
+		std::uint32_t                                      PaletteOffset{0};
 	};
 
 
@@ -120,36 +554,147 @@ public:
 
 	struct AnimationChannel
 	{
-		ChannelPath          Path;
-		std::shared_ptr<Node> Node;
+		ChannelPath           Path;
+		std::shared_ptr<Node> TargetNode;
 		std::uint32_t         SamplerIndex;
 	};
 
-	struct Animation
+	// The decoded keys of one animation. Shared, so a clip evicted from the cache stays valid for whoever is still sampling it.
+	struct AnimationClip
 	{
-		std::string                   Name;
 		std::vector<AnimationSampler> Samplers;
-		std::vector<AnimationChannel> Channels;
-		float                         Start{std::numeric_limits<float>::max()};
-		float                         End{std::numeric_limits<float>::min()};
-		float                         CurrentTime{0.0f};
+		std::uint64_t                 Bytes{0};
+
+		std::uint64_t ComputeBytes() const
+		{
+			std::uint64_t Total = sizeof(AnimationClip) + Samplers.capacity() * sizeof(AnimationSampler);
+			for (const auto& Sampler : Samplers) {
+				Total += Sampler.Interpolation.capacity() + Sampler.Inputs.capacity() * sizeof(float) + Sampler.OutputsVec4.capacity() * sizeof(DirectX::XMFLOAT4);
+			}
+			return Total;
+		}
+	};
+
+	struct Animation
+	{
+		std::string                    Name;
+		std::shared_ptr<AnimationClip> Clip;
+		std::vector<AnimationChannel>  Channels;
+		float                          Start{std::numeric_limits<float>::max()};
+		float                          End{std::numeric_limits<float>::min()};
+	};
+
+	// Scratch for evaluating one instance; reused across instances so sampling never allocates.
+	struct Pose
+	{
+		std::vector<DirectX::XMFLOAT3> Translations;
+		std::vector<DirectX::XMFLOAT4> Rotations;
+		std::vector<DirectX::XMFLOAT3> Scales;
+		std::vector<DirectX::XMMATRIX> Globals;
+		std::vector<float>             MorphWeights;
+	};
+
+	struct PrimitiveJob
+	{
+		int           Mesh;
+		std::size_t   PrimitiveIndex;
+		std::uint32_t FirstIndex;
+		std::uint32_t IndexCount;
+		std::uint32_t FirstVertex;
+		std::uint32_t VertexCount;
+		std::uint32_t FirstMorphTarget;
+	};
+
+	struct LoadStats
+	{
+		std::uint32_t ThreadCount{0};
+		std::size_t   NumPrimitives{0};
+		std::size_t   NumSamplers{0};
+		float         ParseMs{0.0f};
+		float         NodesMs{0.0f};
+		float         DecodeMs{0.0f};
+		float         UploadMs{0.0f};
+		float         TotalMs{0.0f};
+	};
+
+	struct MorphStats
+	{
+		std::uint32_t TargetCount{0};
+		std::uint32_t AffectedVertices{0};
+		std::uint64_t DeltaCount{0};
+		std::uint64_t SparseBytes{0};
+		std::uint64_t DenseBytes{0};
+	};
+
+	enum class MemoryCategory : std::uint8_t
+	{
+		eVertices,
+		eIndices,
+		eClips,
+		ePalettes,
+		eMorphTargets,
+		eSourceData,
+		eCount,
+	};
+
+	struct MemoryStats
+	{
+		std::array<std::uint64_t, static_cast<std::size_t>(MemoryCategory::eCount)> HostBytes{};
+		std::array<std::uint64_t, static_cast<std::size_t>(MemoryCategory::eCount)> DeviceBytes{};
+
+		std::uint64_t TotalHostBytes() const { std::uint64_t Total = 0; for (auto Bytes : HostBytes) Total += Bytes; return Total; }
+		std::uint64_t TotalDeviceBytes() const { std::uint64_t Total = 0; for (auto Bytes : DeviceBytes) Total += Bytes; return Total; }
 	};
 
 public:
 	VkGltfModel();
 	~VkGltfModel();
 
-	bool LoadFromFile(std::string FileName);
-	void LoadNode(const tinygltf::Node& InputNode, std::shared_ptr<VkGltfModel::Node> NodeParent, std::uint32_t NodeIndex, std::vector<std::uint32_t>& HostIndexBuffer, std::vector<VkGltfModel::Vertex>& HostVertexBuffer);
-	void LoadSkins();
-	void LoadAnimations();
+	bool LoadFromFile(std::string FileName, ThreadPool& Pool, bool bReleaseSourceData = false, bool bStreamClips = false, bool bKeepHostGeometry = false);
+	void LoadNode(const tinygltf::Node& InputNode, std::shared_ptr<VkGltfModel::Node> NodeParent, std::uint32_t NodeIndex, std::vector<PrimitiveJob>& PrimitiveJobs);
+	void LoadPrimitive(const PrimitiveJob& Job, VkGltfModel::Vertex* DstVertices, std::uint32_t* DstIndices) const;
+	void LoadMorphTargets(const PrimitiveJob& Job, MorphRange* DstRanges, std::vector<MorphDelta>& DstDeltas) const;
+	void LoadMorphAccessor(int AccessorIndex, std::size_t VertexCount, DirectX::XMFLOAT3* DstValues) const;
+	void CreateMorphDescriptorSet();
+	void WriteMorphDescriptorSet();
+	void LoadSkins(TaskGroup& Tasks);
+	void LoadAnimations(TaskGroup& Tasks);
+	void DecodeSampler(const tinygltf::AnimationSampler& GlTFSampler, AnimationSampler& DstSampler) const;
+	std::shared_ptr<AnimationClip> DecodeClip(std::uint32_t AnimationIndex) const;
+	void InitSkinPalettes();
+	void ComputeBounds(const std::vector<VkGltfModel::Vertex>& HostVertices);
 
 	std::shared_ptr<VkGltfModel::Node> FindNode(std::shared_ptr<Node> Parent, std::uint32_t Index) const;
 	std::shared_ptr<VkGltfModel::Node> NodeFromIndex(std::uint32_t Index) const;
-	DirectX::XMMATRIX GetNodeMatrix(std::shared_ptr<VkGltfModel::Node> Node);
 
-	void UpdateJoints(std::shared_ptr<VkGltfModel::Node> Node);
-	void UpdateAnimation(float DeltaTime);
+	float WrapAnimationTime(std::uint32_t AnimationIndex, float Time) const;
+	std::shared_ptr<const AnimationClip> AcquireClip(std::uint32_t AnimationIndex) const;
+	void EvaluatePose(std::uint32_t AnimationIndex, float Time, Pose& OutPose) const;
+	void EvaluatePose(std::uint32_t AnimationIndex, const AnimationClip* Clip, float Time, Pose& OutPose) const;
+	void UpdateJoints(const Pose& InPose, DirectX::XMFLOAT4X4* DstPalette) const;
+
+	void ReleaseSourceData();
+	bool HasSourceData() const { return M_bHasSourceData; }
+	void ReleaseHostGeometry();
+	MemoryStats GetMemoryStats() const;
+
+	// Waits for the upload, then packs the model's buffers into the fullest blocks of their memory type. Only
+	// safe at a load boundary, before anything has been recorded against them. Returns the buffers moved.
+	std::uint32_t DefragmentBuffers();
+
+	static const char* MemoryCategoryName(MemoryCategory Category)
+	{
+		switch (Category)
+		{
+		case MemoryCategory::eVertices: return "Vertices";
+		case MemoryCategory::eIndices: return "Indices";
+		case MemoryCategory::eClips: return "Clips";
+		case MemoryCategory::ePalettes: return "Palettes";
+		case MemoryCategory::eMorphTargets: return "Morph targets";
+		case MemoryCategory::eSourceData: return "Source data";
+		default: return "Unknown";
+		}
+	}
 
 	void Shutdown();
 
@@ -215,6 +760,7 @@ public:
 		if (PathString == "translation") return ChannelPath::eTranslation;
 		if (PathString == "rotation") return ChannelPath::eRotation;
 		if (PathString == "scale") return ChannelPath::eScale;
+		if (PathString == "weights") return ChannelPath::eWeights;
 
 		return ChannelPath::eNone;
 	}
@@ -223,1655 +769,6749 @@ public:
 	tinygltf::Model M_Model;
 	std::vector<std::shared_ptr<Node>> M_Nodes;
 	std::vector<std::shared_ptr<Node>> M_LinearNodes;
+	std::vector<std::shared_ptr<Node>> M_NodesByIndex;
 	std::vector<Skin>      M_Skins;
 	std::vector<Animation> M_Animations;
 
-	std::tuple<vk::Buffer, vk::DeviceMemory> M_VertexBufferTuple;
-	std::tuple<vk::Buffer, vk::DeviceMemory> M_IndexBufferTuple;
-
-	vk::DescriptorPool M_SkinsDescriptorPool = {};
+	std::tuple<vk::Buffer, DeviceAllocation> M_VertexBufferTuple;
+	std::tuple<vk::Buffer, DeviceAllocation> M_IndexBufferTuple;
+
+	// Morph weights ride along in the palette, packed 16 to a matrix after the joints.
+	std::uint32_t      M_MorphTargetCount = 0;
+	std::uint32_t      M_MorphWeightOffset = 0;
+	std::vector<float> M_DefaultMorphWeights;
+	std::tuple<vk::Buffer, DeviceAllocation> M_MorphRangeBufferTuple;
+	std::tuple<vk::Buffer, DeviceAllocation> M_MorphDeltaBufferTuple;
+	// The allocator's handles back to the four buffers above.
+	std::array<MovableBuffer, 4> M_MovableBuffers{};
+	vk::DescriptorPool M_MorphDescriptorPool = {};
+	vk::DescriptorSet  M_MorphDescriptorSet = {};
+	MorphStats         M_MorphStats;
+
+	// CPU copies of the uploaded geometry, only kept when asked for at load (the vertex animation bake reads them).
+	std::vector<Vertex>     M_HostVertices;
+	std::vector<MorphRange> M_HostMorphRanges;
+	std::vector<MorphDelta> M_HostMorphDeltas;
+
+	std::uint32_t M_PaletteMatrixCount = 0;
+	DirectX::XMFLOAT4 M_BoundingSphere{0.0f, 0.0f, 0.0f, 0.0f};
+	UploadManager::Token M_UploadToken = 0;
+
+	LoadStats M_LoadStats;
+	bool M_bHasSourceData = false;
+
+	// With streaming on, M_Animations hold no keys; clips are decoded on demand through M_ClipCache.
+	bool M_bStreamClips = false;
+	ClipCache* M_ClipCache = nullptr;
 };
 
-///////////////////////////////////////////////////////////////////////////
+// Decodes clips on a background thread the first time they are asked for and keeps them under a byte
+// budget, evicting the least recently sampled. A miss returns nothing; the caller falls back to the rest pose.
+class ClipCache final
+{
+public:
+	struct Settings
+	{
+		bool          bEnabled{false};
+		std::uint64_t BudgetBytes{64ULL * 1024 * 1024};
+	};
 
-void InitWindow();
-void ShutdownWindow();
+	struct Stats
+	{
+		std::uint64_t Hits{0};
+		std::uint64_t Misses{0};
+		std::uint64_t Evictions{0};
+		std::uint64_t Decodes{0};
+		std::uint32_t ResidentClips{0};
+		std::uint64_t ResidentBytes{0};
+		std::uint32_t PendingDecodes{0};
+		float         LastDecodeMilliseconds{0.0f};
+	};
 
-bool Render(bool bClearOnly = false);
-void ImGuiRender(vk::CommandBuffer CommandBuffer);
+	void Start(const Settings& InSettings, VkGltfModel& Model);
+	void Stop();
+	bool IsRunning() const { return M_Thread.joinable(); }
 
-std::uint32_t FindMemoryTypeIndex(std::uint32_t typeFilter, vk::MemoryPropertyFlags Properties);
-vk::ShaderModule CreateShader(const std::string &fileName);
-std::tuple<vk::Buffer, vk::DeviceMemory> CreateBuffer(vk::BufferUsageFlags UsageFlags, vk::DeviceSize ByteSize, void* DataPtr, bool bDeviceLocal = false);
-vk::CommandBuffer BeginSingleUseCommandBuffer();
-void EndSingleUseCommandBuffer(vk::CommandBuffer);
+	// Thread-safe. Queues a decode on a miss.
+	std::shared_ptr<const VkGltfModel::AnimationClip> Acquire(std::uint32_t AnimationIndex);
+	void WaitForPending();
 
-void InitVulkan();
-void ShutdownVulkan();
+	const Settings& GetSettings() const { return M_Settings; }
+	Stats GetStats() const;
 
-void InitPhysicalDevice();
-void InitQueueFamilies();
-void InitDevice();
-void InitQueues();
+private:
+	struct Entry
+	{
+		std::shared_ptr<const VkGltfModel::AnimationClip> Clip;
+		std::list<std::uint32_t>::iterator                LruIt;
+		bool                                              bPending{false};
+	};
 
-void InitCommandPools();
-void InitCommandBuffers();
-void InitSyncObjects();
+	void ThreadMain();
+	void EvictOverBudget();
+
+	Settings                   M_Settings{};
+	VkGltfModel*               M_Model{nullptr};
+	std::thread                M_Thread;
+	mutable std::mutex         M_Mutex;
+	std::condition_variable    M_WakeUp;
+	std::condition_variable    M_Decoded;
+	bool                       M_bStop{false};
+	bool                       M_bDecoding{false};
+
+	std::vector<Entry>         M_Entries;
+	std::list<std::uint32_t>   M_Lru;
+	std::deque<std::uint32_t>  M_Requests;
+	std::uint64_t              M_ResidentBytes{0};
+
+	std::uint64_t              M_Hits{0};
+	std::uint64_t              M_Misses{0};
+	std::uint64_t              M_Evictions{0};
+	std::uint64_t              M_Decodes{0};
+	std::chrono::steady_clock::duration M_LastDecodeTime{};
+};
 
-void InitSurface();
+struct ModelInstance
+{
+	DirectX::XMFLOAT4X4 Transform;
+	std::uint32_t       AnimationIndex{0};
+	float               AnimationTime{0.0f};
+	std::uint32_t       PaletteBase{0};
+};
 
-void InitRenderPass();
+// Single producer, single consumer. The writer always owns a private back buffer and the reader keeps
+// the newest published one until it asks again, so neither side ever waits on the other.
+template<typename T>
+class TripleBuffer final
+{
+public:
+	T& GetWriteBuffer() { return M_Buffers[M_WriteIndex]; }
+	const T& GetReadBuffer() const { return M_Buffers[M_ReadIndex]; }
 
-void InitSwapchain();
-void CreateSwapchain();
-void DestroySwapchain();
-void RecreateSwapchain();
-void ShutdownSwapchain();
+	// Only while neither side is running.
+	std::array<T, 3>& GetAllBuffers() { return M_Buffers; }
 
-void InitImGui();
-void ShutdownImGui();
+	void Publish()
+	{
+		M_WriteIndex = M_Shared.exchange(M_WriteIndex | FreshBit, std::memory_order_acq_rel) & IndexMask;
+	}
 
-///////////////////////////////////////////////////////////////////////////
+	// Returns false and keeps the current read buffer when nothing new was published.
+	bool Acquire()
+	{
+		if (!(M_Shared.load(std::memory_order_relaxed) & FreshBit)) return false;
+		M_ReadIndex = M_Shared.exchange(M_ReadIndex, std::memory_order_acq_rel) & IndexMask;
+		return true;
+	}
 
-void InitPipeline();
-void ShutdownPipeline();
+private:
+	static constexpr std::uint32_t IndexMask = 3;
+	static constexpr std::uint32_t FreshBit = 4;
 
-void InitModel();
-void ShutdownModel();
+	std::array<T, 3>           M_Buffers{};
+	std::uint32_t              M_WriteIndex{0};
+	std::uint32_t              M_ReadIndex{1};
+	std::atomic<std::uint32_t> M_Shared{2};
+};
 
-LRESULT CALLBACK WndProc(HWND Hwnd, UINT Msg, WPARAM Wparam, LPARAM Lparam);
+// Instances playing the same clip at the same quantized time share one palette per frame. A cache serves a
+// single model, so the skeleton is implied and the key is (clip, LOD, time step). Single-threaded.
+class PoseCache final
+{
+public:
+	struct Settings
+	{
+		bool  bEnabled{false};
+		float TimeStep{1.0f / 60.0f};
+	};
 
-///////////////////////////////////////////////////////////////////////////
+	struct Stats
+	{
+		std::uint64_t Lookups{0};
+		std::uint64_t Hits{0};
+		std::uint32_t FrameInstances{0};
+		std::uint32_t FramePoses{0};
+	};
 
-HINSTANCE G_Hinstance = {};
-HWND G_Hwnd = {};
+	void Init(const Settings& InSettings);
+	bool IsEnabled() const { return M_Settings.bEnabled; }
 
-std::uint32_t G_CurrentFrame = 0;
+	void BeginFrame();
+	void EndFrame();
 
-vk::DispatchLoaderDynamic G_DLD = {};
+	// Returns the palette base for the instance's pose. Evaluate(SampleTime) runs on the first request for a key
+	// this frame and returns where it wrote the palette.
+	template<typename EvaluateFn>
+	std::uint32_t Resolve(const VkGltfModel& Model, const ModelInstance& Instance, EvaluateFn&& Evaluate)
+	{
+		// Sampling at the step itself rather than the instance's exact time keeps every sharer's pose identical.
+		float         SampleTime = Instance.AnimationTime;
+		std::uint32_t Step       = std::bit_cast<std::uint32_t>(SampleTime);
+		if (M_Settings.TimeStep > 0.0f && Instance.AnimationIndex < Model.M_Animations.size()) {
+			const float Start = Model.M_Animations[Instance.AnimationIndex].Start;
+			Step = static_cast<std::uint32_t>(std::max(Instance.AnimationTime - Start, 0.0f) / M_Settings.TimeStep);
+			SampleTime = Start + float(Step) * M_Settings.TimeStep;
+		}
 
-vk::Instance G_VkInstance = {};
-vk::PhysicalDevice G_PhysicalDevice = {};
-vk::SampleCountFlagBits G_SampleCount = vk::SampleCountFlagBits::e1;
+		// There is a single LOD today; it keeps its slot in the key.
+		const std::uint32_t Lod = 0;
+		const std::uint64_t Key = (std::uint64_t(Instance.AnimationIndex & 0xFFFFFF) << 40) | (std::uint64_t(Lod & 0xFF) << 32) | Step;
 
-std::optional<std::uint32_t> G_GraphicsQueueFamilyIndex;
-std::optional<std::uint32_t> G_PresentQueueFamilyIndex;
-std::optional<std::uint32_t> G_ComputeQueueFamilyIndex;
+		M_FrameLookups++;
+		const auto [It, bInserted] = M_Palettes.try_emplace(Key, 0U);
+		if (!bInserted) {
+			M_FrameHits++;
+			return It->second;
+		}
+		It->second = Evaluate(SampleTime);
+		return It->second;
+	}
 
-vk::Device G_Device = {};
-vk::Queue G_GraphicsQueue;
-vk::Queue G_PresentQueue;
-vk::Queue G_ComputeQueue;
+	const Settings& GetSettings() const { return M_Settings; }
+	Stats GetStats() const;
 
-vk::CommandPool G_DynamicCommandPool = {};
-vk::CommandPool G_StaticCommandPool = {};
+private:
+	Settings                                         M_Settings{};
+	std::unordered_map<std::uint64_t, std::uint32_t> M_Palettes;
+	std::uint32_t                                    M_FrameLookups{0};
+	std::uint32_t                                    M_FrameHits{0};
 
-std::array<vk::CommandBuffer, G_MaxFramesInFlight> G_CommandBuffers = {};
+	// Published once per frame so the UI can read them while the owner keeps going.
+	std::atomic<std::uint64_t>                       M_Lookups{0};
+	std::atomic<std::uint64_t>                       M_Hits{0};
+	std::atomic<std::uint32_t>                       M_FrameInstances{0};
+	std::atomic<std::uint32_t>                       M_FramePoses{0};
+};
 
-std::array<bool, G_MaxFramesInFlight> G_WaitForFences = {};
-std::array<vk::Fence, G_MaxFramesInFlight> G_InFlightFences = {};
-std::array<vk::Semaphore, G_MaxFramesInFlight> G_ImageAvailableSemaphores = {};
-std::array<vk::Semaphore, G_MaxFramesInFlight> G_RenderFinishedSemaphores = {};
+// Final palettes sampled at no less than a fixed rate, one row per clip frame, all clips in one buffer. Rows are baked the
+// first time an instance needs them and never change afterwards, so the GPU can read any row already baked.
+// Joints are stored as 3x4 affine rows (the fourth column is always 0,0,0,1), followed by the morph weights.
+class BakedPalettes final
+{
+public:
+	struct Settings
+	{
+		bool  bEnabled{false};
+		float SampleRate{30.0f};
+	};
 
-vk::SurfaceKHR G_Surface = {};
-vk::SurfaceFormatKHR G_SurfaceFormat = {};
-vk::PresentModeKHR G_SurfacePresentMode = {};
-std::uint32_t G_SurfaceImageCount = {};
-vk::Format G_DepthFormat = {};
+	// Offsets of the two bracketing rows, in vec4s, and the blend between them.
+	struct FrameRef
+	{
+		std::uint32_t Row0{0};
+		std::uint32_t Row1{0};
+		float         Alpha{0.0f};
+	};
 
-vk::RenderPass G_RenderPass = {};
+	struct Stats
+	{
+		std::uint32_t RowCount{0};
+		std::uint32_t RowsBaked{0};
+		std::uint32_t RowStride{0};
+		vk::DeviceSize BufferBytes{0};
+		vk::DeviceSize UncompressedBytes{0};
+		float         BakeMilliseconds{0.0f};
+		bool          bDeviceLocal{false};
+	};
 
-bool G_SwapchainOK = false;
-vk::Extent2D G_WindowSize = {};
-vk::Extent2D G_SwapchainExtent = {};
+	// Always creates the descriptor set; when disabled it points at a placeholder the shader never reads.
+	void Init(const Settings& InSettings, const VkGltfModel& Model);
+	void Shutdown();
+	bool IsEnabled() const { return M_Settings.bEnabled; }
+
+	// Render thread only. Bakes the bracketing rows first if needed; a clip without keys yet gets the rest pose.
+	FrameRef Resolve(std::uint32_t AnimationIndex, float Time);
+
+	vk::DescriptorSet GetDescriptorSet() const { return M_DescriptorSet; }
+	const Settings& GetSettings() const { return M_Settings; }
+	Stats GetStats() const;
+
+private:
+	void BakeRow(const VkGltfModel::AnimationClip* Clip, std::uint32_t AnimationIndex, float Time, std::uint32_t Row);
+
+	Settings                       M_Settings{};
+	const VkGltfModel*             M_Model{nullptr};
+	vk::Buffer                     M_Buffer{};
+	DeviceAllocation               M_Allocation{};
+	vk::DescriptorPool             M_DescriptorPool{};
+	vk::DescriptorSet              M_DescriptorSet{};
+	bool                           M_bDeviceLocal{false};
+
+	std::uint32_t                  M_RowStride{0};
+	std::uint32_t                  M_RowCount{0};
+	std::vector<std::uint32_t>     M_ClipFirstRow;
+	std::vector<std::uint32_t>     M_ClipFrameCount;
+	std::vector<float>             M_ClipFrameRate;
+	std::vector<std::uint8_t>      M_RowBaked;
+	std::uint32_t                  M_RowsBaked{0};
+	std::chrono::steady_clock::duration M_BakeTime{};
+
+	VkGltfModel::Pose              M_PoseScratch;
+	std::vector<DirectX::XMMATRIX> M_PaletteScratch;
+	std::vector<DirectX::XMFLOAT4> M_RowScratch;
+};
 
-vk::SwapchainKHR G_Swapchain = {};
+// Vertex animation: every clip is skinned once on the CPU, with the same math as Default.vert, at a fixed rate
+// into an atlas of per-frame vertex positions and normals. Vat.vert then plays an instance back from its clip
+// and phase alone, so there is no pose, no palette and no per-instance work on the CPU at all.
+class VertexAnimationAtlas final
+{
+public:
+	struct Settings
+	{
+		bool        bEnabled{false};
+		float       SampleRate{30.0f};
+		// Writes the atlas out after baking; baking runs for this even with playback off.
+		std::string ExportFileName;
+	};
 
-std::vector<vk::Image> G_ColorBufferImages;
-std::vector<vk::DeviceMemory> G_ColorBufferDeviceMemories;
-std::vector<vk::ImageView> G_ColorBufferImageViews;
+	// Mirrors FAtlasVertex in Vat.vert (std430): the skinned position and the octahedral normal as two snorm16s.
+	struct AtlasVertex
+	{
+		DirectX::XMFLOAT3 Position;
+		std::uint32_t     Normal;
+	};
 
-std::vector<vk::Image> G_DepthBufferImages;
-std::vector<vk::DeviceMemory> G_DepthBufferDeviceMemories;
-std::vector<vk::ImageView> G_DepthBufferImageViews;
+	// One clip's frames in the atlas. They are spread evenly from its start to its end, FrameRate apart, so the
+	// last frame equals the loop point and a loop is FrameCount - 1 frames long.
+	struct ClipRange
+	{
+		std::uint32_t FirstFrame{0};
+		std::uint32_t FrameCount{1};
+		float         FrameRate{0.0f};
+		float         StartTime{0.0f};
+	};
 
-std::vector<vk::Image> G_SwapchainImages = {};
-std::vector<vk::ImageView> G_SwapchainImageViews = {};
+	// Written at the start of the exported file, followed by the clip ranges and then the atlas itself.
+	struct FileHeader
+	{
+		std::uint32_t Magic{0x31544156}; // "VAT1"
+		std::uint32_t VertexCount{0};
+		std::uint32_t FrameCount{0};
+		std::uint32_t ClipCount{0};
+		float         SampleRate{0.0f};
+	};
 
-std::vector<vk::Framebuffer> G_Framebuffers = {};
+	struct Stats
+	{
+		std::uint32_t VertexCount{0};
+		std::uint32_t FrameCount{0};
+		std::uint32_t ClipCount{0};
+		std::uint64_t AtlasBytes{0};
+		std::uint64_t BakedVertices{0};
+		float         BakeMilliseconds{0.0f};
+		bool          bExported{false};
+	};
 
-vk::DescriptorPool G_ImguiDescriptorPool = {};
-ImGuiContext *G_ImGuiContext = {};
-ImFont *G_ConsolasFont = {};
+	// What each vertex reads: two atlas entries, against the vertex attributes and eight palette matrices.
+	static constexpr std::uint32_t AtlasFetchBytesPerVertex = 2 * sizeof(AtlasVertex);
+	static constexpr std::uint32_t PaletteFetchBytesPerVertex = sizeof(VkGltfModel::Vertex) + 8 * sizeof(DirectX::XMFLOAT4X4);
 
-vk::DescriptorSetLayout G_SkinsDescriptorSetLayout = {};
-vk::PipelineLayout G_PipelineLayout = {};
-vk::Pipeline G_Pipeline = {};
+	// The model must have been loaded with its host geometry.
+	void Init(const Settings& InSettings, const VkGltfModel& Model, ThreadPool& Pool);
+	void Shutdown();
+	bool IsEnabled() const { return M_Settings.bEnabled; }
+	bool IsBaked() const { return M_Stats.FrameCount > 0; }
+
+	std::uint32_t GetClipIndex(std::uint32_t AnimationIndex) const { return M_Clips.empty() ? 0 : std::min(AnimationIndex, static_cast<std::uint32_t>(M_Clips.size()) - 1); }
+	ClipRange GetClipRange(std::uint32_t AnimationIndex) const { return M_Clips.empty() ? ClipRange{} : M_Clips[GetClipIndex(AnimationIndex)]; }
+
+	// One clock drives every instance; they only differ by their phase.
+	void Advance(float DeltaTime) { M_Clock += double(DeltaTime); }
+	// The clock in the clip's own frames, wrapped to its loop in double so the float never outgrows one loop.
+	float GetClipClock(std::uint32_t ClipIndex) const;
+
+	UploadManager::Token GetUploadToken() const { return M_UploadToken; }
+	vk::DescriptorSet GetDescriptorSet() const { return M_DescriptorSet; }
+	const Settings& GetSettings() const { return M_Settings; }
+	const Stats& GetStats() const { return M_Stats; }
+
+private:
+	void BakeFrame(const VkGltfModel& Model, std::uint32_t AnimationIndex, const VkGltfModel::AnimationClip* Clip, float Time,
+		const std::vector<std::uint32_t>& VertexPaletteBases, const std::vector<std::uint8_t>& VertexMorphed, AtlasVertex* Dst) const;
+	void Export(const std::vector<AtlasVertex>& Atlas) const;
+
+	using BufferTuple = std::tuple<vk::Buffer, DeviceAllocation>;
+
+	Settings               M_Settings{};
+	std::vector<ClipRange> M_Clips;
+	BufferTuple            M_AtlasBufferTuple;
+	vk::DescriptorPool     M_DescriptorPool{};
+	vk::DescriptorSet      M_DescriptorSet{};
+	UploadManager::Token   M_UploadToken{0};
+	double                 M_Clock{0.0};
+	Stats                  M_Stats{};
+};
 
-VkGltfModel G_GltfModel;
+// Advances every instance at a fixed tick rate on its own thread and publishes finished palettes, laid out
+// in instance order, for the render thread to copy into the palette ring.
+class AnimationSimulation final
+{
+public:
+	struct Settings
+	{
+		bool  bEnabled{false};
+		float TickRate{60.0f};
+	};
 
-////////////////////////////////////////////////////
+	// Palettes are in instance order, unless poses are shared; then InstanceOffsets says where each instance's starts.
+	struct PoseSnapshot
+	{
+		std::vector<DirectX::XMFLOAT4X4>      Palettes;
+		std::uint32_t                         MatrixCount{0};
+		std::vector<std::uint32_t>            InstanceOffsets;
+		std::uint64_t                         Tick{0};
+		std::chrono::steady_clock::time_point PublishTime{};
+	};
 
-int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR szCmdLine, int nCmdShow)
-{
-	::SetProcessDpiAwareness(PROCESS_DPI_UNAWARE);
+	struct Stats
+	{
+		std::uint64_t Ticks{0};
+		std::uint64_t MergedTicks{0};
+		float         LastTickMilliseconds{0.0f};
+		std::uint64_t SnapshotsTaken{0};
+		std::uint64_t SnapshotsReused{0};
+		float         SnapshotAgeMilliseconds{0.0f};
+	};
 
-	G_Hinstance = hInstance;
+	// Takes a copy of the instances' animation state; the first snapshot is published before this returns.
+	void Start(const Settings& InSettings, const PoseCache::Settings& PoseCacheSettings, const VkGltfModel& Model, const std::vector<ModelInstance>& Instances);
+	void Stop();
+	bool IsRunning() const { return M_Thread.joinable(); }
+
+	// Render thread only.
+	const PoseSnapshot& AcquireSnapshot();
+
+	const Settings& GetSettings() const { return M_Settings; }
+	const PoseCache& GetPoseCache() const { return M_PoseCache; }
+	Stats GetStats() const;
+
+private:
+	void ThreadMain();
+	void Tick(float DeltaTime);
+
+	Settings                   M_Settings{};
+	const VkGltfModel*         M_Model{nullptr};
+	std::vector<ModelInstance> M_Instances;
+	VkGltfModel::Pose          M_PoseScratch;
+	TripleBuffer<PoseSnapshot> M_Snapshots;
+	PoseCache                  M_PoseCache;
+	std::thread                M_Thread;
+	std::atomic<bool>          M_bStop{false};
+
+	std::atomic<std::uint64_t> M_Ticks{0};
+	std::atomic<std::uint64_t> M_MergedTicks{0};
+
+	// Longest step a single tick takes after a stall, so a breakpoint does not fast-forward every clip.
+	static constexpr float MaxTickDelta = 0.25f;
+	std::atomic<std::uint64_t> M_LastTickNanoseconds{0};
+
+	std::uint64_t              M_SnapshotsTaken{0};
+	std::uint64_t              M_SnapshotsReused{0};
+	std::chrono::steady_clock::duration M_SnapshotAge{};
+};
 
-	InitWindow();
-	InitVulkan();
+class DrawList final
+{
+public:
+	// Mirrors FDrawData in Default.vert and Cull.comp (std430).
+	struct DrawData
+	{
+		DirectX::XMFLOAT4X4 Model;
+		DirectX::XMFLOAT4   Color;
+		DirectX::XMFLOAT4   BoundingSphere;
+		std::uint32_t       PaletteBase{0};
+		std::uint32_t       MorphWeightBase{NoMorphWeights};
+		std::uint32_t       PaletteSlot{NoPaletteSlot};
+		std::uint32_t       BakedSlot{NoBakedSlot};
+		// Vertex animation: the instance's clip in the atlas, whose clock Vat.vert reads, and its phase in the clip's frames.
+		std::uint32_t       VatFirstFrame{0};
+		std::uint32_t       VatFrameCount{0};
+		std::uint32_t       VatClip{0};
+		float               VatFrameOffset{0.0f};
+
+		static constexpr std::uint32_t NoMorphWeights = ~0U;
+
+		// With shared poses both bases above are relative to the instance's palette, whose start the
+		// vertex shader reads from word PaletteSlot at the head of the frame's slice.
+		static constexpr std::uint32_t NoPaletteSlot = ~0U;
+
+		// With baked palettes the head of the slice holds a BakedPalettes::FrameRef per instance instead,
+		// and the bases are relative to a baked row.
+		static constexpr std::uint32_t NoBakedSlot = ~0U;
+	};
 
-	ImGui::SetCurrentContext(G_ImGuiContext);
-	Render(true);
-	ImGui::SetCurrentContext(nullptr);
+	enum class DrawPath : std::uint8_t
+	{
+		eDirect,
+		eIndirect,
+		eIndirectCount,
+	};
 
-	MSG Msg = {};
-	bool bContinue = true;
+	struct Stats
+	{
+		std::uint32_t NumDraws{0};
+		// Vertices referenced by the recorded draws, before any culling.
+		std::uint64_t NumVertices{0};
+		DrawPath      Path{DrawPath::eDirect};
+	};
 
-	::ShowWindow(G_Hwnd, SW_SHOW);
-	::UpdateWindow(G_Hwnd);
+	void Init();
+	void Shutdown();
 
-	while(bContinue) {
-		for (std::uint32_t i = 0; i < std::uint32_t(1); i++) {
-			if (::PeekMessage(&Msg, nullptr, 0, 0, PM_REMOVE)) {
-				if (Msg.message == WM_QUIT) {
-					bContinue = false;
-					break;
-				}
+	// Rebuilds the persistent command and draw-data buffers. The GPU must be done with the previous list.
+	void Build(const VkGltfModel& Model, const std::vector<ModelInstance>& Instances);
 
-				if (Msg.hwnd == G_Hwnd) ImGui::SetCurrentContext(G_ImGuiContext);
-				::TranslateMessage(&Msg);
-				::DispatchMessage(&Msg);
-				ImGui::SetCurrentContext(nullptr);
+	// Recorded outside the render pass: fills this frame slot's culled command buffer from the persistent list.
+	void RecordCull(vk::CommandBuffer CommandBuffer, std::uint32_t FrameIndex, DirectX::FXMMATRIX ProjView) const;
+	// Draws [FirstDraw, FirstDraw + DrawCount) of the list; the count path can only be issued as a whole.
+	void RecordDraws(vk::CommandBuffer CommandBuffer, std::uint32_t FrameIndex, std::uint32_t FirstDraw = 0, std::uint32_t DrawCount = std::numeric_limits<std::uint32_t>::max()) const;
+	bool CanSplitDraws() const { return M_Path != DrawPath::eIndirectCount; }
 
-			} else {
-				break;
-			}
-		}
+	UploadManager::Token GetUploadToken() const { return M_UploadToken; }
+	vk::DescriptorSet GetDescriptorSet() const { return M_DrawDataDescriptorSet; }
+	Stats GetStats() const;
 
-		ImGui::SetCurrentContext(G_ImGuiContext);
-		if (!::IsIconic(G_Hwnd)) {
-			if (!Render()) {
-				RecreateSwapchain();
-				Render();
-			}
+	static const char* DrawPathName(DrawPath Path)
+	{
+		switch (Path)
+		{
+		case DrawPath::eDirect: return "Direct";
+		case DrawPath::eIndirect: return "Indirect";
+		case DrawPath::eIndirectCount: return "Indirect count";
+		default: return "Unknown";
 		}
-		ImGui::SetCurrentContext(nullptr);
 	}
 
-	ShutdownVulkan();
-	ShutdownWindow();
+private:
+	void DestroyBuffers();
 
-	return 0;
-}
+	using BufferTuple = std::tuple<vk::Buffer, DeviceAllocation>;
 
-extern IMGUI_IMPL_API LRESULT ImGui_ImplWin32_WndProcHandler(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam);
-LRESULT CALLBACK WndProc(HWND Hwnd, UINT Msg, WPARAM Wparam, LPARAM Lparam)
-{
+	std::vector<vk::DrawIndexedIndirectCommand>    M_Commands;
+	BufferTuple                                    M_CommandBufferTuple;
+	BufferTuple                                    M_DrawDataBufferTuple;
+	std::array<BufferTuple, G_MaxFramesInFlight>   M_CulledCommandBufferTuples;
+	std::array<BufferTuple, G_MaxFramesInFlight>   M_DrawCountBufferTuples;
 
-	const auto InternalWndProc = [](HWND Hwnd, UINT Msg, WPARAM Wparam, LPARAM Lparam) -> LRESULT {
-		switch(Msg)
-		{
-		case WM_SIZE:
-		{
-			G_SwapchainOK = false;
-		}
-		break;
-		case WM_ERASEBKGND:
-		{
-			return 1;
-		}
-		break;
-		case WM_DESTROY:
-		{
-			::PostQuitMessage(0);
-		}
-		break;
-		}
+	vk::DescriptorPool                                 M_DescriptorPool{};
+	vk::DescriptorSet                                  M_DrawDataDescriptorSet{};
+	std::array<vk::DescriptorSet, G_MaxFramesInFlight> M_CullDescriptorSets{};
 
-		return ::DefWindowProcA(Hwnd, Msg, Wparam, Lparam);
-	};
+	DrawPath             M_Path{DrawPath::eDirect};
+	std::uint64_t        M_NumVertices{0};
+	UploadManager::Token M_UploadToken{0};
+};
 
+class CommandRecorder final
+{
+public:
+	struct SlotStats
+	{
+		float         RecordMilliseconds{0.0f};
+		std::uint32_t DrawCount{0};
+	};
 
-	const auto Result = InternalWndProc(Hwnd, Msg, Wparam, Lparam);
-	ImGui_ImplWin32_WndProcHandler(Hwnd, Msg, Wparam, Lparam);
+	struct Stats
+	{
+		std::vector<SlotStats> Slots;
+		float                  WallMilliseconds{0.0f};
+	};
 
-	return Result;
-}
+	// One transient command pool and secondary command buffer per worker slot and frame in flight.
+	// The last slot belongs to the submitting thread and carries the UI, which runs in its own render pass.
+	void Init(std::uint32_t WorkerCount);
+	void Shutdown();
 
+	void BeginFrame(std::uint32_t FrameIndex);
 
+	// Only ever called for a given slot from one task at a time, so the pools need no locking.
+	vk::CommandBuffer BeginSecondary(std::uint32_t Slot, vk::RenderPass RenderPass, vk::Framebuffer Framebuffer);
+	void EndSecondary(std::uint32_t Slot, std::uint32_t DrawCount);
 
-void InitWindow()
-{
+	void SetWallTime(float Milliseconds) { M_WallMilliseconds = Milliseconds; }
 
-	static constexpr DWORD dwStyle = WS_CAPTION | WS_BORDER | WS_MINIMIZEBOX | WS_SYSMENU | WS_SIZEBOX | WS_MAXIMIZEBOX;
-	RECT rc = RECT{0, 0, 480, 640};
-	::AdjustWindowRectEx(&rc, dwStyle, FALSE, 0);
+	std::uint32_t GetWorkerCount() const { return M_WorkerCount; }
+	std::uint32_t GetMainSlot() const { return M_WorkerCount; }
+	bool IsEnabled() const { return M_WorkerCount > 0; }
+	// Worker secondaries recorded this frame, in slot order, ready for executeCommands.
+	std::vector<vk::CommandBuffer> CollectRecorded() const;
+	// The main slot's secondary if it was recorded this frame, otherwise null.
+	vk::CommandBuffer GetMainSecondary() const;
+	Stats GetStats() const;
 
-	const WNDCLASSEXA wcx = WNDCLASSEXA{
-		sizeof(WNDCLASSEXA),
-		0,
-		WndProc,
-		0,
-		0,
-		G_Hinstance,
-		LoadIconA(nullptr, IDI_APPLICATION),
-		LoadCursorA(nullptr, IDC_ARROW),
-		0,
-		0,
-		"VkSkelAnimTestClass",
-		LoadIconA(nullptr, IDI_APPLICATION)
+private:
+	struct Slot
+	{
+		std::array<vk::CommandPool, G_MaxFramesInFlight>   Pools{};
+		std::array<vk::CommandBuffer, G_MaxFramesInFlight> CommandBuffers{};
+		std::chrono::high_resolution_clock::time_point     StartTime;
+		SlotStats                                          LastStats;
+		bool                                               bRecorded{false};
 	};
-	::RegisterClassExA(&wcx);
-
 
-	G_Hwnd = ::CreateWindowExA(
-		0,
-		"VkSkelAnimTestClass",
-		"Vk Skeletal Animation Test",
-		dwStyle,
-		CW_USEDEFAULT,
-		CW_USEDEFAULT,
-		rc.right - rc.left,
-		rc.bottom - rc.top,
-		nullptr,
-		nullptr,
-		G_Hinstance,
-		nullptr
-	);
-}
+	std::vector<Slot>              M_Slots;
+	std::vector<SlotStats>         M_PrevFrameStats;
+	std::uint32_t                  M_WorkerCount{0};
+	std::uint32_t                  M_FrameIndex{0};
+	float                          M_WallMilliseconds{0.0f};
+};
 
-void ShutdownWindow()
+class CommandCache final
 {
-	::UnregisterClassA(
-		"VkSkelAnimTestClass",
-		G_Hinstance
-	);
-}
+public:
+	struct FrameCommands
+	{
+		vk::CommandBuffer Cull{};
+		vk::CommandBuffer Draws{};
+	};
 
+	struct Stats
+	{
+		std::uint64_t RecordedFrames{0};
+		std::uint64_t ReplayedFrames{0};
+		std::uint64_t Generation{0};
+	};
 
-bool Render(bool bClearOnly)
-{
-	if (!G_SwapchainOK) return false;
+	using RecordFunc = std::function<void(vk::CommandBuffer Cull, vk::CommandBuffer Draws)>;
 
-	if (G_WaitForFences[G_CurrentFrame]) {
-		(void)G_Device.waitForFences(1, &G_InFlightFences[G_CurrentFrame], VK_TRUE, std::numeric_limits<std::uint64_t>::max(), G_DLD);
-		G_WaitForFences[G_CurrentFrame] = false;
-	} else {
-		G_GraphicsQueue.waitIdle(G_DLD);
-	}
-	(void)G_Device.resetFences(1, &G_InFlightFences[G_CurrentFrame], G_DLD);
+	void Init();
+	void Shutdown();
 
-	std::uint32_t ImageIndex = 0;
-	try {
-		vk::ResultValue Acquire = G_Device.acquireNextImageKHR(
-			G_Swapchain, std::numeric_limits<std::uint64_t>::max(),
-			G_ImageAvailableSemaphores[G_CurrentFrame], nullptr,
-			G_DLD
-			);
+	// Bumped whenever anything baked into the scene commands changes: draw set, pipeline or swapchain.
+	void Invalidate() { M_Generation++; }
 
-		ImageIndex = Acquire.value;
-	}
-	catch (...) {
-		G_SwapchainOK = false;
-		return false;
-	}
+	// Scene secondaries for this frame slot; Record runs only when the slot's copy is stale.
+	const FrameCommands& Acquire(std::uint32_t FrameIndex, const RecordFunc& Record);
 
-	vk::CommandBuffer CommandBuffer = G_CommandBuffers[G_CurrentFrame];
-	CommandBuffer.reset({}, G_DLD);
+	// The UI changes every frame, so it gets its own one-shot secondary.
+	vk::CommandBuffer BeginUi(std::uint32_t FrameIndex);
+	void EndUi(std::uint32_t FrameIndex);
 
-	const vk::CommandBufferBeginInfo commandBufferBeginInfo = {};
-	CommandBuffer.begin(commandBufferBeginInfo, G_DLD);
+	bool IsEnabled() const { return static_cast<bool>(M_CommandPool); }
+	Stats GetStats() const;
 
-	vk::ClearColorValue ClearColor;
-	std::memcpy(&ClearColor, DirectX::Colors::Black.f, sizeof(ClearColor));
-	static constexpr vk::ClearColorValue ClearResolve(0.0f, 0.0f, 0.0f, 1.0f);
-	static constexpr vk::ClearDepthStencilValue ClearDepth(1.0f, 0);
+private:
+	vk::CommandPool                                    M_CommandPool{};
+	std::array<FrameCommands, G_MaxFramesInFlight>     M_FrameCommands{};
+	std::array<std::uint64_t, G_MaxFramesInFlight>     M_FrameGenerations{};
+	std::array<vk::CommandBuffer, G_MaxFramesInFlight> M_UiCommandBuffers{};
+	std::uint64_t                                      M_Generation{1};
+	std::uint64_t                                      M_RecordedFrames{0};
+	std::uint64_t                                      M_ReplayedFrames{0};
+};
 
-	const vk::ClearValue ClearValues[2] = {ClearColor, ClearDepth};
-	const vk::ClearValue MultiSamplesClearValues[3] = {ClearColor, ClearResolve, ClearDepth};
-	const vk::RenderPassBeginInfo RenderPassBeginInfo = vk::RenderPassBeginInfo(G_RenderPass, G_Framebuffers[ImageIndex], vk::Rect2D(vk::Offset2D(0,0), G_SwapchainExtent), (G_SampleCount == vk::SampleCountFlagBits::e1) ? 2 : 3, (G_SampleCount == vk::SampleCountFlagBits::e1) ? ClearValues : MultiSamplesClearValues);
+class FrameCapture final
+{
+public:
+	struct Stats
+	{
+		std::uint32_t CapturedFrames{0};
+		std::uint32_t WrittenFrames{0};
+		std::uint64_t BytesReadBack{0};
+		std::uint32_t EncoderStalls{0};
+		float         EncodeMilliseconds{0.0f};
+	};
 
-	CommandBuffer.beginRenderPass(&RenderPassBeginInfo, vk::SubpassContents::eInline, G_DLD);
+	// One host-visible readback buffer per frame in flight; the copy rides in the frame's own command buffer.
+	void Init(vk::Extent2D Extent, const std::string& Directory);
+	void Shutdown();
 
-	static auto PrevTime = std::chrono::high_resolution_clock::now() - std::chrono::milliseconds(1);
-	auto CurrentTime = std::chrono::high_resolution_clock::now();
-	const float DeltaTime = float(std::chrono::duration_cast<std::chrono::microseconds>(CurrentTime-PrevTime).count()) / 1000000.0f;
-	PrevTime = CurrentTime;
+	// Called once the slot's fence has signalled: hands the previous frame in this slot to a PNG encoder task.
+	void Collect(std::uint32_t FrameIndex);
+	// Recorded after the render pass, which leaves the target in TransferSrcOptimal.
+	void RecordReadback(vk::CommandBuffer CommandBuffer, std::uint32_t FrameIndex, vk::Image Image);
+	// The device must be idle: collects every slot and waits for all encoders.
+	void Flush();
 
-	if (!bClearOnly) {
-		CommandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, G_Pipeline, G_DLD);
+	bool IsEnabled() const { return M_Extent.width > 0; }
+	Stats GetStats() const;
 
-		vk::DeviceSize VertexBufferOffset = 0;
-		CommandBuffer.bindVertexBuffers(0, 1, &std::get<0>(G_GltfModel.M_VertexBufferTuple), &VertexBufferOffset, G_DLD);
-		CommandBuffer.bindIndexBuffer(std::get<0>(G_GltfModel.M_IndexBufferTuple), 0, vk::IndexType::eUint32, G_DLD);
+private:
+	using BufferTuple = std::tuple<vk::Buffer, DeviceAllocation>;
 
-		CommandBuffer.setViewport(0, vk::Viewport{0.0f, 0.0f, float(G_SwapchainExtent.width), float(G_SwapchainExtent.height), 0.0f, 1.0f}, G_DLD);
-		CommandBuffer.setScissor(0, vk::Rect2D{vk::Offset2D{0, 0}, vk::Extent2D{G_SwapchainExtent.width, G_SwapchainExtent.height}}, G_DLD);
+	struct Slot
+	{
+		BufferTuple                  Readback;
+		std::optional<std::uint32_t> PendingFrame;
+	};
 
-		const DirectX::XMMATRIX MatProj = DirectX::XMMatrixPerspectiveFovRH(-DirectX::XMConvertToRadians(35), float(G_SwapchainExtent.width) / float(G_SwapchainExtent.height), 0.01f, 100);
-		const DirectX::XMMATRIX MatView = DirectX::XMMatrixLookAtRH(DirectX::XMVectorSet(-0.0f, 1.5f, 4.0f, 0.0f), DirectX::XMVectorSet(0.0f, 0.8f, 0.0f, 0.0f), DirectX::XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
-		const DirectX::XMMATRIX MatProjView = DirectX::XMMatrixMultiply(MatView, MatProj);
-		DirectX::XMFLOAT4X4 MatProjViewDest;
-		DirectX::XMStoreFloat4x4(&MatProjViewDest, MatProjView);
+	void RetireEncodes(std::size_t MaxPending);
 
-		G_GltfModel.UpdateAnimation(DeltaTime);
+	std::array<Slot, G_MaxFramesInFlight> M_Slots{};
+	std::deque<std::future<void>>         M_Encodes;
+	std::string                           M_Directory;
+	vk::Extent2D                          M_Extent{0, 0};
+	vk::DeviceSize                        M_FrameSize{0};
+	std::uint32_t                         M_NextFrame{0};
+	std::atomic<std::uint64_t>            M_EncodeMicroseconds{0};
+	Stats                                 M_Stats{};
+};
 
-		for (auto &Node : G_GltfModel.M_LinearNodes) {
+class GpuProfiler final
+{
+public:
+	enum class Scope : std::uint8_t
+	{
+		eFrame,
+		eCull,
+		eScene,
+		eUpscale,
+		eUi,
+		eReadback,
+		eCount,
+	};
 
-			if (Node->Skin < 0) continue;
+	static constexpr std::uint32_t ScopeCount = static_cast<std::uint32_t>(Scope::eCount);
 
-			const DirectX::XMMATRIX MatModel = DirectX::XMMatrixRotationY(DirectX::XMConvertToRadians(30.0f));
-			DirectX::XMFLOAT4X4 MatModelDest;
-			DirectX::XMStoreFloat4x4(&MatModelDest, MatModel);
+	// One timestamp query pool per frame in flight; a slot's results are read when its fence comes around again.
+	void Init();
+	void Shutdown();
 
-			CommandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, G_PipelineLayout, 0, G_GltfModel.M_Skins[Node->Skin].DescriptorSet[G_CurrentFrame], nullptr, G_DLD);
+	// Reads the slot's previous timings, resets its queries and opens the frame scope. Outside any render pass.
+	void BeginFrame(vk::CommandBuffer CommandBuffer, std::uint32_t FrameIndex);
+	void EndFrame(vk::CommandBuffer CommandBuffer);
+	// The device must be idle: reads the slots no later frame came around to.
+	void Flush();
 
-			for (auto& Primitive : Node->Mesh.Primitives) {
+	// Each scope may be written once per frame, from the primary or from a secondary that runs in it.
+	void BeginScope(vk::CommandBuffer CommandBuffer, Scope TargetScope) const;
+	void EndScope(vk::CommandBuffer CommandBuffer, Scope TargetScope) const;
 
+	bool IsEnabled() const { return static_cast<bool>(M_QueryPools[0]); }
 
-				CommandBuffer.pushConstants(G_PipelineLayout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(DirectX::XMFLOAT4X4), &MatProjViewDest, G_DLD);
-				CommandBuffer.pushConstants(G_PipelineLayout, vk::ShaderStageFlagBits::eVertex, sizeof(DirectX::XMFLOAT4X4), sizeof(DirectX::XMFLOAT4X4), &MatModelDest, G_DLD);
-				CommandBuffer.pushConstants(G_PipelineLayout, vk::ShaderStageFlagBits::eFragment, sizeof(DirectX::XMFLOAT4X4) + sizeof(DirectX::XMFLOAT4X4), sizeof(DirectX::XMFLOAT3), DirectX::Colors::SkyBlue.f, G_DLD);
+	// Rolling per-scope history in milliseconds, laid out for ImGui::PlotLines.
+	const float* GetHistory(Scope TargetScope) const { return M_History[static_cast<std::size_t>(TargetScope)].data(); }
+	std::uint32_t GetHistoryCount() const { return M_HistoryCount; }
+	std::uint32_t GetHistoryOffset() const { return M_HistoryCount < G_GpuTimingHistory ? 0 : M_HistoryHead; }
+	float GetAverage(Scope TargetScope) const;
+	// Bumped every time a frame's timings are read back, so callers can pick up each sample exactly once.
+	std::uint64_t GetSampleCount() const { return M_SampleCount; }
+	float GetLatest(Scope TargetScope) const { return M_HistoryCount ? M_History[static_cast<std::size_t>(TargetScope)][(M_HistoryHead + G_GpuTimingHistory - 1) % G_GpuTimingHistory] : 0.0f; }
 
-				CommandBuffer.drawIndexed(Primitive.IndexCount, 1, Primitive.FirstIndex, Primitive.FirstVertex, 0, G_DLD);
-			}
-		}
+	void WriteCsv(const std::string& FileName) const;
 
-		ImGuiRender(CommandBuffer);
+	static const char* ScopeName(Scope TargetScope)
+	{
+		switch (TargetScope)
+		{
+		case Scope::eFrame: return "Frame";
+		case Scope::eCull: return "Cull";
+		case Scope::eScene: return "Scene";
+		case Scope::eUpscale: return "Upscale";
+		case Scope::eUi: return "UI";
+		case Scope::eReadback: return "Readback";
+		default: return "Unknown";
+		}
 	}
 
-	CommandBuffer.endRenderPass(G_DLD);
+private:
+	void ReadResults(std::uint32_t FrameIndex);
+
+	std::array<vk::QueryPool, G_MaxFramesInFlight>                 M_QueryPools{};
+	std::array<bool, G_MaxFramesInFlight>                          M_bPending{};
+	std::array<std::array<float, G_GpuTimingHistory>, ScopeCount>  M_History{};
+	std::uint32_t                                                  M_HistoryHead{0};
+	std::uint32_t                                                  M_HistoryCount{0};
+	std::uint32_t                                                  M_FrameIndex{0};
+	std::uint64_t                                                  M_TimestampMask{0};
+	float                                                          M_TimestampPeriod{0.0f};
+	std::uint64_t                                                  M_SampleCount{0};
+};
 
-	CommandBuffer.end(G_DLD);
+class FrameTelemetry final
+{
+public:
+	enum class Metric : std::uint8_t
+	{
+		eFrame,
+		eAnimation,
+		eRecording,
+		eFenceWait,
+		eGpu,
+		eRenderScale,
+		eSnapshotAge,
+		eCount,
+	};
 
-	const vk::Semaphore waitSemaphores[] = { G_ImageAvailableSemaphores[G_CurrentFrame]};
-	const vk::Semaphore signalSemaphores[] = { G_RenderFinishedSemaphores[G_CurrentFrame]};
-	static constexpr vk::PipelineStageFlags waitStages[] = { vk::PipelineStageFlagBits::eColorAttachmentOutput };
-	const vk::SubmitInfo submitInfo = vk::SubmitInfo(1, waitSemaphores, waitStages, 1, &CommandBuffer, 1, signalSemaphores);
-	try {
-		G_WaitForFences[G_CurrentFrame] = true;
-		G_GraphicsQueue.submit(submitInfo, G_InFlightFences[G_CurrentFrame], G_DLD);
-	}
-	catch (...) {
-		G_WaitForFences[G_CurrentFrame] = false;
-		G_SwapchainOK = false;
-		return false;
-	}
+	static constexpr std::uint32_t MetricCount = static_cast<std::uint32_t>(Metric::eCount);
 
-	const vk::SwapchainKHR Swapchains[1] = {G_Swapchain};
-	const vk::PresentInfoKHR presentInfo = vk::PresentInfoKHR(1, signalSemaphores, 1, Swapchains, &ImageIndex);
-	try {
-		(void)G_PresentQueue.presentKHR(presentInfo, G_DLD);
-	}
-	catch (...) {
-		G_SwapchainOK = false;
-		return false;
-	}
+	// In MetricUnit: milliseconds for durations, the plain value for gauges.
+	struct Summary
+	{
+		std::uint64_t Count{0};
+		float         P50{0.0f};
+		float         P95{0.0f};
+		float         P99{0.0f};
+		float         Max{0.0f};
+	};
 
-	G_CurrentFrame = (G_CurrentFrame + 1) % G_MaxFramesInFlight;
+	struct Window
+	{
+		std::uint32_t                       Index{0};
+		float                               EndSeconds{0.0f};
+		std::array<Summary, MetricCount>    Metrics{};
+	};
 
-	return true;
-}
+	// Samples accumulate into one histogram per metric; every IntervalSeconds the window is summarised,
+	// appended to the sink (CSV, or JSON lines for a .json/.jsonl name) and cleared.
+	void Init(const std::string& FileName, float IntervalSeconds);
+	void Shutdown();
 
-void ImGuiRender(vk::CommandBuffer CommandBuffer)
-{
-	ImGui_ImplVulkan_NewFrame();
-	ImGui_ImplWin32_NewFrame();
-	ImGui::NewFrame();
+	// Durations are kept in nanoseconds, gauges in fixed point with GaugeResolution steps per unit.
+	void Record(Metric TargetMetric, std::uint64_t Nanoseconds) { M_Histograms[static_cast<std::size_t>(TargetMetric)].Record(Nanoseconds); }
+	void Record(Metric TargetMetric, std::chrono::steady_clock::duration Duration)
+	{
+		Record(TargetMetric, static_cast<std::uint64_t>(std::max<std::int64_t>(0, std::chrono::duration_cast<std::chrono::nanoseconds>(Duration).count())));
+	}
+	void RecordGauge(Metric TargetMetric, double Value)
+	{
+		M_Histograms[static_cast<std::size_t>(TargetMetric)].Record(static_cast<std::uint64_t>(std::max(Value, 0.0) * GaugeResolution + 0.5));
+	}
+	void Update();
 
-//	ImGui::Begin("Control", nullptr);
-//	ImGui::PushFont(G_ConsolasFont);
-//	ImGui::PopFont();
-//	ImGui::End();
+	const Window& GetLastWindow() const { return M_LastWindow; }
 
-	static bool bFirst = true;
-	if (bFirst) {
-		ImGui::SetWindowFocus(nullptr);
-		bFirst = false;
+	static const char* MetricName(Metric TargetMetric)
+	{
+		switch (TargetMetric)
+		{
+		case Metric::eFrame: return "Frame";
+		case Metric::eAnimation: return "Animation";
+		case Metric::eRecording: return "Recording";
+		case Metric::eFenceWait: return "FenceWait";
+		case Metric::eGpu: return "GPU";
+		case Metric::eRenderScale: return "RenderScale";
+		case Metric::eSnapshotAge: return "SnapshotAge";
+		default: return "Unknown";
+		}
 	}
 
-	ImGui::Render();
-	ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), CommandBuffer);
-}
+	static bool IsGauge(Metric TargetMetric) { return TargetMetric == Metric::eRenderScale; }
+	static const char* MetricUnit(Metric TargetMetric) { return IsGauge(TargetMetric) ? "" : "ms"; }
 
+private:
+	static constexpr double GaugeResolution = 1000000.0;
 
-std::uint32_t FindMemoryTypeIndex(std::uint32_t typeFilter, vk::MemoryPropertyFlags Properties)
-{
-	vk::PhysicalDeviceMemoryProperties MemProperties = G_PhysicalDevice.getMemoryProperties(G_DLD);
+	// Log-linear buckets in the style of HdrHistogram: linear below SubBucketCount, then SubBucketCount / 2
+	// buckets per power of two, which bounds the relative error to under 1% across the whole u64 range.
+	class Histogram final
+	{
+	public:
+		static constexpr std::uint32_t SubBucketBits = 7;
+		static constexpr std::uint32_t SubBucketCount = 1U << SubBucketBits;
+		static constexpr std::uint32_t HalfSubBucketCount = SubBucketCount / 2;
+		static constexpr std::uint32_t BucketCount = SubBucketCount + (64 - SubBucketBits) * HalfSubBucketCount;
 
-	for (std::uint32_t i = 0; i < MemProperties.memoryTypeCount; i++) {
-		if ((typeFilter & (1 << i)) && MemProperties.memoryTypes[i].propertyFlags == Properties) {
-			return i;
+		void Record(std::uint64_t Value)
+		{
+			M_Counts[BucketIndex(Value)]++;
+			M_TotalCount++;
+			M_Max = std::max(M_Max, Value);
 		}
-	}
 
-	for (std::uint32_t i = 0; i < MemProperties.memoryTypeCount; i++) {
-		if ((typeFilter & (1 << i)) && (MemProperties.memoryTypes[i].propertyFlags & Properties) == Properties) {
-			return i;
+		std::uint64_t ValueAtPercentile(double Percentile) const;
+		std::uint64_t GetTotalCount() const { return M_TotalCount; }
+		std::uint64_t GetMax() const { return M_Max; }
+		void Reset() { M_Counts = {}; M_TotalCount = 0; M_Max = 0; }
+
+	private:
+		static std::uint32_t BucketIndex(std::uint64_t Value)
+		{
+			if (Value < SubBucketCount) return static_cast<std::uint32_t>(Value);
+			const std::uint32_t Shift = static_cast<std::uint32_t>(std::bit_width(Value)) - SubBucketBits;
+			return SubBucketCount + (Shift - 1) * HalfSubBucketCount + static_cast<std::uint32_t>((Value >> Shift) - HalfSubBucketCount);
 		}
-	}
 
-	throw std::runtime_error("failed to find suitable memory type!");
-}
+		// Midpoint of the bucket's value range.
+		static std::uint64_t BucketValue(std::uint32_t Index)
+		{
+			if (Index < SubBucketCount) return Index;
+			const std::uint32_t Shift = (Index - SubBucketCount) / HalfSubBucketCount + 1;
+			const std::uint64_t Sub = HalfSubBucketCount + (Index - SubBucketCount) % HalfSubBucketCount;
+			return (Sub << Shift) + (std::uint64_t(1) << (Shift - 1));
+		}
 
-vk::ShaderModule CreateShader(const std::string &fileName)
+		std::array<std::uint32_t, BucketCount> M_Counts{};
+		std::uint64_t                          M_TotalCount{0};
+		std::uint64_t                          M_Max{0};
+	};
+
+	void CloseWindow();
+
+	std::array<Histogram, MetricCount>    M_Histograms{};
+	Window                                M_LastWindow{};
+	std::ofstream                         M_Sink;
+	bool                                  M_bJson{false};
+	float                                 M_IntervalSeconds{5.0f};
+	std::uint32_t                         M_WindowIndex{0};
+	std::chrono::steady_clock::time_point M_StartTime{};
+	std::chrono::steady_clock::time_point M_WindowStartTime{};
+};
+
+class DynamicResolution final
 {
-	const std::string FilePath = std::string(APP_SOURCE_PATH) + std::string("/shaders/") + fileName;
-	std::ifstream Ifs = std::ifstream(FilePath, std::ios::binary | std::ios::in);
+public:
+	struct Settings
+	{
+		bool  bEnabled{false};
+		float MinScale{0.5f};
+		float MaxScale{1.0f};
+		float BudgetMilliseconds{16.0f};
+	};
 
-	if (!Ifs.is_open()) {
-		throw std::runtime_error("Could not open shader file");
-	}
+	struct Stats
+	{
+		float         Scale{1.0f};
+		float         LastMilliseconds{0.0f};
+		float         FilteredMilliseconds{0.0f};
+		std::uint32_t Adjustments{0};
+	};
 
-	const std::vector<char> Buf = std::vector<char>(std::istreambuf_iterator<char>(Ifs), std::istreambuf_iterator<char>());
-	Ifs.close();
+	// The scene targets are allocated at the output size, so the scale never goes above 1.
+	void Init(const Settings& InSettings);
+
+	// Fed with each GPU frame time as it is read back; returns true when the scale changed.
+	bool Update(float GpuMilliseconds);
+
+	float GetScale() const { return M_Scale; }
+	vk::Extent2D GetRenderExtent(vk::Extent2D OutputExtent) const;
+	const Settings& GetSettings() const { return M_Settings; }
+	Stats GetStats() const;
+
+private:
+	static constexpr float FilterWeight = 0.1f;
+	static constexpr float Headroom = 0.9f;
+	static constexpr float Hysteresis = 0.05f;
+	static constexpr float MinStep = 0.01f;
+	static constexpr float MaxGrowStep = 0.05f;
+
+	Settings      M_Settings{};
+	float         M_Scale{1.0f};
+	float         M_LastMilliseconds{0.0f};
+	float         M_FilteredMilliseconds{0.0f};
+	std::uint32_t M_SettleFrames{0};
+	std::uint32_t M_Adjustments{0};
+};
 
-	const vk::ShaderModuleCreateInfo ShaderModuleCI = vk::ShaderModuleCreateInfo(
-		{},
-		Buf.size(),
-		reinterpret_cast<const std::uint32_t*>(Buf.data())
-		);
+// Paces the CPU against the GPU with one timeline semaphore. Each frame submit signals the next value and its
+// slot remembers it, so reusing a slot waits for exactly the frame that last owned its resources.
+class FrameScheduler final
+{
+public:
+	struct Stats
+	{
+		std::uint64_t SubmittedValue{0};
+		std::uint64_t CompletedValue{0};
+		std::uint64_t BlockingWaits{0};
+	};
 
-	return G_Device.createShaderModule(ShaderModuleCI, nullptr, G_DLD);
-}
+	void Init();
+	void Shutdown();
+
+	void WaitForSlot(std::uint32_t FrameIndex);
+
+	// The value the next submit signals; it only counts as submitted once the submit went through.
+	std::uint64_t GetNextValue() const { return M_SubmittedValue + 1; }
+	void OnSubmitted(std::uint32_t FrameIndex, std::uint64_t SignaledValue);
+
+	std::uint64_t GetSubmittedValue() const { return M_SubmittedValue; }
+	std::uint64_t GetCompletedValue() const { return M_CompletedValue; }
+	vk::Semaphore GetSemaphore() const { return M_Timeline; }
+	Stats GetStats() const;
 
-std::tuple<vk::Buffer, vk::DeviceMemory> CreateBuffer(vk::BufferUsageFlags UsageFlags, vk::DeviceSize ByteSize, void* DataPtr, bool bDeviceLocal)
+private:
+	vk::Semaphore M_Timeline{};
+	std::array<std::uint64_t, G_MaxFramesInFlight> M_SlotValues{};
+	std::uint64_t M_SubmittedValue{0};
+	std::uint64_t M_CompletedValue{0};
+	std::uint64_t M_BlockingWaits{0};
+};
+
+// Keeps resources alive until the frame timeline passes the last frame that may reference them, so swapchain
+// recreation never has to idle the device.
+class RetireQueue final
 {
-	const vk::BufferCreateInfo BufferCI = vk::BufferCreateInfo(
-		{},
-		ByteSize,
-		(bDeviceLocal ? (UsageFlags | vk::BufferUsageFlagBits::eTransferSrc) : UsageFlags),
-		vk::SharingMode::eExclusive,
-		0,
-		nullptr
-		);
+public:
+	struct Stats
+	{
+		std::uint32_t Pending{0};
+		std::uint64_t Retired{0};
+		std::uint64_t Released{0};
+	};
 
-	const vk::Buffer Buffer = G_Device.createBuffer(BufferCI, nullptr, G_DLD);
+	// Runs Release once the frame timeline reaches FrameValue; immediately if it already has.
+	void Retire(std::uint64_t FrameValue, std::function<void()> Release);
+	void Collect(std::uint64_t CompletedValue);
 
-	const vk::MemoryRequirements MemReqs = G_Device.getBufferMemoryRequirements(Buffer, G_DLD);
-	const std::uint32_t MemTypeIndex = FindMemoryTypeIndex(MemReqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-	const vk::MemoryAllocateInfo MemAI = vk::MemoryAllocateInfo(MemReqs.size, MemTypeIndex);
+	// Only safe once the device is idle.
+	void Flush();
 
-	vk::DeviceMemory BufferMemory = G_Device.allocateMemory(MemAI, nullptr, G_DLD);
-	G_Device.bindBufferMemory(Buffer, BufferMemory, 0, G_DLD);
+	Stats GetStats() const;
 
-	void* Mapped =G_Device.mapMemory(BufferMemory, 0, vk::WholeSize, vk::MemoryMapFlags(), G_DLD);
-	if (DataPtr) {
-		std::memcpy(Mapped, DataPtr, ByteSize);
-	} else {
-		std::memset(Mapped, 0, ByteSize);
-	}
-	G_Device.unmapMemory(BufferMemory, G_DLD);
+private:
+	struct Entry
+	{
+		std::uint64_t         FrameValue{0};
+		std::function<void()> Release;
+	};
 
-	if (bDeviceLocal) {
-		const vk::BufferCreateInfo LocalBufferCI = vk::BufferCreateInfo(
-			{},
-			ByteSize,
-			UsageFlags | vk::BufferUsageFlagBits::eTransferDst,
-			vk::SharingMode::eExclusive,
-			0,
-			nullptr
-			);
+	void ReleaseCompleted();
 
-		const vk::Buffer LocalBuffer = G_Device.createBuffer(LocalBufferCI, nullptr, G_DLD);
-		const vk::MemoryRequirements LocalMemReqs = G_Device.getBufferMemoryRequirements(LocalBuffer, G_DLD);
-		const std::uint32_t LocalMemTypeIndex = FindMemoryTypeIndex(LocalMemReqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
-		const vk::MemoryAllocateInfo LocalMemAI = vk::MemoryAllocateInfo(LocalMemReqs.size, LocalMemTypeIndex);
+	std::deque<Entry> M_Entries;
+	std::uint64_t M_CompletedValue{0};
+	std::uint64_t M_Retired{0};
+	std::uint64_t M_Released{0};
+};
 
-		const vk::DeviceMemory LocalBufferMemory = G_Device.allocateMemory(LocalMemAI, nullptr, G_DLD);
-		G_Device.bindBufferMemory(LocalBuffer, LocalBufferMemory, 0, G_DLD);
+///////////////////////////////////////////////////////////////////////////
 
-		const vk::CommandBuffer CommandBuffer = BeginSingleUseCommandBuffer();
-		const vk::BufferCopy BufferCopy = vk::BufferCopy(0, 0, ByteSize);
-		CommandBuffer.copyBuffer(Buffer, LocalBuffer, BufferCopy, G_DLD);
-		EndSingleUseCommandBuffer(CommandBuffer);
+#ifdef _WIN32
+void InitWindow();
+void ShutdownWindow();
+#endif
+int RunHeadless();
 
-		G_Device.freeMemory(BufferMemory, nullptr, G_DLD);
-		G_Device.destroyBuffer(Buffer, nullptr, G_DLD);
+bool Render(bool bClearOnly = false);
+void RecordModelDraws(vk::CommandBuffer CommandBuffer, const DirectX::XMFLOAT4X4& ProjView, std::uint32_t FirstDraw, std::uint32_t DrawCount);
+void RecordUpscale(vk::CommandBuffer CommandBuffer, std::uint32_t FrameIndex, std::uint32_t ImageIndex);
+void ImGuiRender(vk::CommandBuffer CommandBuffer);
 
-		return std::make_tuple(LocalBuffer, LocalBufferMemory);
-	}
+std::uint32_t FindMemoryTypeIndex(std::uint32_t typeFilter, vk::MemoryPropertyFlags Properties);
+bool HasMemoryType(std::uint32_t typeFilter, vk::MemoryPropertyFlags Properties);
+vk::ShaderModule CreateShader(const std::string &fileName);
+std::tuple<vk::Buffer, DeviceAllocation> CreateBuffer(vk::BufferUsageFlags UsageFlags, vk::DeviceSize ByteSize, void* DataPtr, bool bDeviceLocal = false, UploadManager::Token* OutUploadToken = nullptr);
+void DestroyBuffer(std::tuple<vk::Buffer, DeviceAllocation>& BufferTuple);
+vk::Buffer CreateLocalBuffer(vk::BufferUsageFlags UsageFlags, vk::DeviceSize ByteSize);
+bool MoveBuffer(MovableBuffer& Target, const DeviceAllocation& To);
+vk::CommandBuffer BeginSingleUseCommandBuffer();
+void EndSingleUseCommandBuffer(vk::CommandBuffer);
 
-	return std::make_tuple(Buffer, BufferMemory);
-}
+void InitVulkan();
+void ShutdownVulkan();
 
-vk::CommandBuffer BeginSingleUseCommandBuffer()
-{
-	const vk::CommandBufferAllocateInfo CommandBufferAI = vk::CommandBufferAllocateInfo(G_StaticCommandPool, vk::CommandBufferLevel::ePrimary, 1);
-	vk::CommandBuffer CommandBuffer = G_Device.allocateCommandBuffers(CommandBufferAI, G_DLD)[0];
-	const vk::CommandBufferBeginInfo CommandBufferBI = vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
-	CommandBuffer.begin(CommandBufferBI, G_DLD);
+void InitPhysicalDevice();
+void InitQueueFamilies();
+void InitDevice();
+void InitQueues();
 
-	return CommandBuffer;
-}
+void InitCommandPools();
+void InitCommandBuffers();
+void InitSyncObjects();
 
-void EndSingleUseCommandBuffer(vk::CommandBuffer CommandBuffer)
+void InitSurface();
+void InitOffscreenFormat();
+void InitDepthFormat();
+void InitUpscaleFilter();
+
+void InitRenderPass();
+
+struct Attachment
 {
-	CommandBuffer.end(G_DLD);
-	const vk::SubmitInfo SI = vk::SubmitInfo(0, nullptr, 0, 1, &CommandBuffer, 0, nullptr);
-	G_GraphicsQueue.submit(SI, nullptr, G_DLD);
-	G_GraphicsQueue.waitIdle(G_DLD);
-}
+	vk::Image        Image{};
+	DeviceAllocation Allocation{};
+	vk::ImageView    View{};
+	bool             bLazilyAllocated{false};
+};
 
-void InitVulkan()
+struct AttachmentStats
 {
-	G_DLD.init();
+	std::uint32_t  FrameCount{0};
+	std::uint32_t  ImageCount{0};
+	vk::DeviceSize TransientBytes{0};
+	vk::DeviceSize LazilyAllocatedBytes{0};
+	vk::DeviceSize SceneColorBytes{0};
+};
 
-	const std::uint32_t VkApiVersion = vk::enumerateInstanceVersion(G_DLD) & (~std::uint32_t(0xFFFU));
-	const vk::ApplicationInfo AppInfo = vk::ApplicationInfo(
-		"VkSkeletalAnimationExample",
-		VK_MAKE_API_VERSION(0, 1, 0, 0),
-		"VkSkeletalAnimationExampleEngine",
-		VK_MAKE_API_VERSION(0, 1, 0, 0),
-		VkApiVersion
-		);
+bool CreateAttachment(vk::Format Format, vk::SampleCountFlagBits Samples, vk::ImageUsageFlags Usage, vk::ImageAspectFlags Aspect, Attachment& OutAttachment);
+void DestroyAttachment(Attachment& TargetAttachment);
+vk::DeviceSize QueryCommittedAttachmentBytes();
 
-	static constexpr std::array<const char*, 1> RequiredInstanceLayers = {
-		"VK_LAYER_KHRONOS_validation",
-	};
-	static constexpr std::array<const char*, 3> RequiredInstanceExtensions = {
-		VK_KHR_SURFACE_EXTENSION_NAME,
-		VK_KHR_WIN32_SURFACE_EXTENSION_NAME,
-		VK_EXT_DEBUG_UTILS_EXTENSION_NAME,
-	};
-	const std::vector<vk::LayerProperties> SupportedInstanceLayers = vk::enumerateInstanceLayerProperties(G_DLD);
-	const std::vector<vk::ExtensionProperties> SupportedInstanceExtensions = vk::enumerateInstanceExtensionProperties(nullptr, G_DLD);
+void InitSwapchain();
+void CreateSwapchain();
+bool CreateSurfaceSwapchain();
+bool CreateOffscreenImages();
+void DestroySwapchain();
+void RecreateSwapchain();
+void ShutdownSwapchain();
 
-	for (const char* RequiredLayer : RequiredInstanceLayers) {
-		if (std::find_if(SupportedInstanceLayers.begin(), SupportedInstanceLayers.end(), [&RequiredLayer](const vk::LayerProperties& LayerProperties) {return std::strcmp(LayerProperties.layerName.data(), RequiredLayer) == 0; }) == SupportedInstanceLayers.end())
-			throw std::runtime_error("Vulkan doesn't support required layers");
-	}
-	for (const char* RequiredExtension : RequiredInstanceExtensions) {
-		if (std::find_if(SupportedInstanceExtensions.begin(), SupportedInstanceExtensions.end(), [&RequiredExtension](const vk::ExtensionProperties& ExtensionProperties) {return std::strcmp(ExtensionProperties.extensionName.data(), RequiredExtension) == 0; }) == SupportedInstanceExtensions.end())
-			throw std::runtime_error("Vulkan doesn't support required extensions");
-	}
+void InitImGui();
+void ShutdownImGui();
 
-	const vk::InstanceCreateInfo VkInstanceCI = vk::InstanceCreateInfo(
-		{},
-		&AppInfo,
-		static_cast<std::uint32_t>(RequiredInstanceLayers.size()), RequiredInstanceLayers.data(),
-		static_cast<std::uint32_t>(RequiredInstanceExtensions.size()), RequiredInstanceExtensions.data()
-		);
-	G_VkInstance = vk::createInstance(VkInstanceCI, nullptr, G_DLD);
-	G_DLD.init(G_VkInstance);
+///////////////////////////////////////////////////////////////////////////
 
+// Prepended to the driver's cache blob on disk. The driver checks its own header too, but not the driver
+// version, and a truncated or stale file should never reach it.
+struct PipelineCacheFileHeader
+{
+	std::uint32_t Magic{0};
+	std::uint32_t HeaderSize{0};
+	std::uint32_t VendorID{0};
+	std::uint32_t DeviceID{0};
+	std::uint32_t DriverVersion{0};
+	std::uint8_t  PipelineCacheUUID[VK_UUID_SIZE]{};
+	std::uint8_t  DriverUUID[VK_UUID_SIZE]{};
+	std::uint32_t Reserved{0}; // Explicit so the bytes written ahead of DataSize are never uninitialized padding
+	std::uint64_t DataSize{0};
+	std::uint64_t DataHash{0};
+};
+static_assert(sizeof(PipelineCacheFileHeader) == 72, "PipelineCacheFileHeader must not contain implicit padding");
 
-	InitPhysicalDevice();
-	InitQueueFamilies();
-	InitDevice();
-	InitQueues();
-	InitCommandPools();
-	InitCommandBuffers();
-	InitSyncObjects();
-	InitSurface();
-	InitRenderPass();
+struct PipelineStats
+{
+	std::string CacheStatus;
+	std::size_t LoadedBytes{0};
+	std::size_t SavedBytes{0};
+	float       GraphicsMilliseconds{0.0f};
+	float       ComputeMilliseconds{0.0f};
+	float       WallMilliseconds{0.0f};
+};
 
-	InitSwapchain();
-	InitImGui();
+void InitPipelineCache();
+void ShutdownPipelineCache();
+PipelineCacheFileHeader MakePipelineCacheHeader();
 
-	InitPipeline();
-	InitModel();
-}
+// Creates the layouts right away and queues the pipeline compiles on PipelineTasks.
+void InitPipeline(TaskGroup& PipelineTasks);
+void ShutdownPipeline();
 
-void ShutdownVulkan()
-{
-	if (G_Device) {
-		G_Device.waitIdle(G_DLD);
+void InitModel();
+void InitModelInstances();
+std::uint32_t GetPaletteRemapMatrixCount();
+void UpdateModelInstances(float DeltaTime);
+void ShutdownModel();
+std::vector<VkGltfModel::LoadStats> RunImportBenchmark();
 
+// Everything here costs frame time, so it is chosen per run instead of fixed at compile time.
+struct PerformanceProfile
+{
+	const char*        Name;
+	bool               bValidation;
+	std::uint32_t      MaxSampleCount;
+	vk::PresentModeKHR PresentMode;
+	std::uint32_t      FramesInFlight;
+	std::uint32_t      ImageCount;
+};
 
-		ShutdownModel();
-		ShutdownPipeline();
+constexpr PerformanceProfile G_PerformanceProfiles[] = {
+	{"debug",       true,  8, vk::PresentModeKHR::eFifo,      2, 2},
+	{"profile",     false, 4, vk::PresentModeKHR::eFifo,      2, 2},
+	{"release",     false, 4, vk::PresentModeKHR::eMailbox,   2, 3},
+	{"low-latency", false, 2, vk::PresentModeKHR::eMailbox,   1, 3},
+	{"throughput",  false, 1, vk::PresentModeKHR::eImmediate, 4, 3},
+};
 
-		ShutdownImGui();
-		ShutdownSwapchain();
+const PerformanceProfile& FindPerformanceProfile(const std::string& Name);
+const char* PresentModeName(vk::PresentModeKHR PresentMode);
+std::vector<std::string> ReadConfigFile(const std::string& FileName);
+void ParseCommandLine(const std::vector<std::string>& Args);
 
-		if (G_RenderPass) {
-			G_Device.destroyRenderPass(G_RenderPass, nullptr, G_DLD);
-			G_RenderPass = nullptr;
-		}
+#ifdef _WIN32
+LRESULT CALLBACK WndProc(HWND Hwnd, UINT Msg, WPARAM Wparam, LPARAM Lparam);
+#endif
 
-		if (G_Surface) {
-			G_VkInstance.destroySurfaceKHR(G_Surface, nullptr, G_DLD);
-			G_Surface = nullptr;
-		}
+///////////////////////////////////////////////////////////////////////////
 
-		for (auto& Item : G_InFlightFences) {
-			if (Item) {
-				G_Device.destroyFence(Item, nullptr, G_DLD);
-				Item = nullptr;
-			}
-		}
+#ifdef _WIN32
+HINSTANCE G_Hinstance = {};
+HWND G_Hwnd = {};
+#endif
 
-		for (auto& Item : G_RenderFinishedSemaphores) {
-			if (Item) {
-				G_Device.destroySemaphore(Item, nullptr, G_DLD);
-				Item = nullptr;
-			}
-		}
+#ifdef NDEBUG
+PerformanceProfile G_Profile = FindPerformanceProfile("release");
+#else
+PerformanceProfile G_Profile = FindPerformanceProfile("debug");
+#endif
+std::uint32_t G_FramesInFlight = G_Profile.FramesInFlight;
 
-		for (auto& Item : G_ImageAvailableSemaphores) {
-			if (Item) {
-				G_Device.destroySemaphore(Item, nullptr, G_DLD);
-				Item = nullptr;
-			}
-		}
+std::uint32_t G_CurrentFrame = 0;
 
-		for (auto& Item : G_CommandBuffers) {
-			if (Item) {
-				G_Device.freeCommandBuffers(G_DynamicCommandPool, Item, G_DLD);
-				Item = nullptr;
-			}
-		}
+vk::DispatchLoaderDynamic G_DLD = {};
 
-		if (G_DynamicCommandPool) {
-			G_Device.destroyCommandPool(G_DynamicCommandPool, nullptr, G_DLD);
-			G_DynamicCommandPool = nullptr;
-		}
+vk::Instance G_VkInstance = {};
+std::vector<const char*> G_EnabledLayers;
+vk::PhysicalDevice G_PhysicalDevice = {};
+vk::SampleCountFlagBits G_SampleCount = vk::SampleCountFlagBits::e1;
 
-		if (G_StaticCommandPool) {
-			G_Device.destroyCommandPool(G_StaticCommandPool, nullptr, G_DLD);
-			G_StaticCommandPool = nullptr;
-		}
+std::optional<std::uint32_t> G_GraphicsQueueFamilyIndex;
+std::optional<std::uint32_t> G_PresentQueueFamilyIndex;
+std::optional<std::uint32_t> G_ComputeQueueFamilyIndex;
+std::optional<std::uint32_t> G_TransferQueueFamilyIndex;
 
-		G_Device.destroy(nullptr, G_DLD);
-		G_Device = nullptr;
+vk::Device G_Device = {};
+DeviceAllocator G_DeviceAllocator;
+UploadManager G_UploadManager;
+vk::Queue G_GraphicsQueue;
+vk::Queue G_PresentQueue;
+vk::Queue G_ComputeQueue;
+vk::Queue G_TransferQueue;
+
+vk::CommandPool G_DynamicCommandPool = {};
+vk::CommandPool G_StaticCommandPool = {};
+
+std::array<vk::CommandBuffer, G_MaxFramesInFlight> G_CommandBuffers = {};
+CommandRecorder G_CommandRecorder;
+CommandCache G_CommandCache;
+FrameCapture G_FrameCapture;
+GpuProfiler G_GpuProfiler;
+FrameTelemetry G_FrameTelemetry;
+FrameScheduler G_FrameScheduler;
+RetireQueue G_RetireQueue;
+
+std::array<vk::Semaphore, G_MaxFramesInFlight> G_ImageAvailableSemaphores = {};
+std::array<vk::Semaphore, G_MaxFramesInFlight> G_RenderFinishedSemaphores = {};
+
+vk::SurfaceKHR G_Surface = {};
+vk::SurfaceFormatKHR G_SurfaceFormat = {};
+vk::PresentModeKHR G_SurfacePresentMode = {};
+std::uint32_t G_SurfaceImageCount = {};
+vk::Format G_DepthFormat = {};
+
+bool G_bMultiDrawIndirect = false;
+bool G_bDrawIndirectCount = false;
+
+// The scene renders into G_SceneColors at G_RenderExtent; the UI pass draws over the upscaled result.
+vk::RenderPass G_RenderPass = {};
+vk::RenderPass G_UiRenderPass = {};
+
+bool G_SwapchainOK = false;
+vk::Extent2D G_WindowSize = {};
+vk::Extent2D G_SwapchainExtent = {};
+vk::Extent2D G_RenderExtent = {};
+vk::Filter G_UpscaleFilter = vk::Filter::eLinear;
+DynamicResolution::Settings G_DynamicResolutionSettings;
+DynamicResolution G_DynamicResolution;
+
+vk::SwapchainKHR G_Swapchain = {};
+std::uint32_t G_SwapchainRecreations = 0;
+float G_SwapchainRecreateMilliseconds = 0.0f;
+
+// Render targets are only touched by the frame that records them, so there is one set per frame in flight rather than per swapchain image.
+std::array<Attachment, G_MaxFramesInFlight> G_ColorBuffers;
+std::array<Attachment, G_MaxFramesInFlight> G_DepthBuffers;
+std::array<Attachment, G_MaxFramesInFlight> G_SceneColors;
+AttachmentStats G_AttachmentStats;
+
+std::vector<vk::Image> G_SwapchainImages = {};
+std::vector<vk::ImageView> G_SwapchainImageViews = {};
+
+// Headless mode renders into these instead of swapchain images, one per frame in flight.
+std::vector<DeviceAllocation> G_OffscreenImageAllocations;
+
+std::array<vk::Framebuffer, G_MaxFramesInFlight> G_Framebuffers = {};
+std::vector<vk::Framebuffer> G_UiFramebuffers = {};
+
+vk::DescriptorPool G_ImguiDescriptorPool = {};
+ImGuiContext *G_ImGuiContext = {};
+ImFont *G_ConsolasFont = {};
+
+vk::DescriptorSetLayout G_SkinsDescriptorSetLayout = {};
+vk::DescriptorSetLayout G_DrawDataDescriptorSetLayout = {};
+vk::DescriptorSetLayout G_MorphDescriptorSetLayout = {};
+vk::DescriptorSetLayout G_BakedAnimationDescriptorSetLayout = {};
+vk::PipelineLayout G_PipelineLayout = {};
+vk::Pipeline G_Pipeline = {};
+vk::Pipeline G_VatPipeline = {};
+
+vk::DescriptorSetLayout G_CullDescriptorSetLayout = {};
+vk::PipelineLayout G_CullPipelineLayout = {};
+vk::Pipeline G_CullPipeline = {};
+
+vk::PipelineCache G_PipelineCache = {};
+std::string G_PipelineCacheFileName = "PipelineCache.bin";
+PipelineStats G_PipelineStats;
+
+std::string G_ModelFileName = "Bot_Running.glb";
+std::uint32_t G_ImportThreadCount = 0;
+bool G_bImportBenchmark = false;
+std::vector<VkGltfModel::LoadStats> G_ImportBenchmarkResults;
+bool G_bReleaseSourceData = false;
+std::uint32_t G_InstanceCount = 1;
+bool G_bDirectDraws = false;
+std::uint32_t G_RecordThreadCount = 0;
+bool G_bReplayCommands = false;
+
+bool G_bHeadless = false;
+vk::Extent2D G_HeadlessExtent = vk::Extent2D{1280, 720};
+std::uint32_t G_HeadlessFrameCount = 60;
+float G_AnimationStartTime = 0.0f;
+float G_HeadlessTimeStep = 1.0f / 60.0f;
+float G_HeadlessDeltaTime = 0.0f;
+std::uint32_t G_AnimationClip = 0;
+std::string G_CaptureDirectory;
+std::string G_GpuTimingsFileName;
+std::string G_TelemetryFileName;
+float G_TelemetryInterval = 5.0f;
+
+std::unique_ptr<ThreadPool> G_ThreadPool;
+TraceRecorder G_TraceRecorder;
+std::string G_TraceFileName;
+
+VkGltfModel G_GltfModel;
+std::vector<ModelInstance> G_ModelInstances;
+PaletteRing G_PaletteRing;
+DrawList G_DrawList;
+AnimationSimulation::Settings G_AnimationSimulationSettings;
+AnimationSimulation G_AnimationSimulation;
+PoseCache::Settings G_PoseCacheSettings;
+PoseCache G_PoseCache;
+BakedPalettes::Settings G_BakedPalettesSettings;
+BakedPalettes G_BakedPalettes;
+VertexAnimationAtlas::Settings G_VertexAnimationAtlasSettings;
+VertexAnimationAtlas G_VertexAnimationAtlas;
+ClipCache::Settings G_ClipCacheSettings;
+ClipCache G_ClipCache;
+
+inline TraceScope::TraceScope(const char* Name) : M_Name(Name), M_BeginNs(G_TraceRecorder.Now()) {}
+inline TraceScope::~TraceScope() { G_TraceRecorder.Record(M_Name, M_BeginNs, G_TraceRecorder.Now()); }
+
+////////////////////////////////////////////////////
+
+#ifdef _WIN32
+int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR szCmdLine, int nCmdShow)
+{
+	::SetProcessDpiAwareness(PROCESS_DPI_UNAWARE);
+
+	G_Hinstance = hInstance;
+
+	std::vector<std::string> Args;
+	for (const char* Cursor = szCmdLine; Cursor && *Cursor;) {
+		while (*Cursor == ' ' || *Cursor == '\t') Cursor++;
+		if (!*Cursor) break;
+
+		std::string Arg;
+		if (*Cursor == '"') {
+			Cursor++;
+			while (*Cursor && *Cursor != '"') Arg.push_back(*Cursor++);
+			if (*Cursor == '"') Cursor++;
+		} else {
+			while (*Cursor && *Cursor != ' ' && *Cursor != '\t') Arg.push_back(*Cursor++);
+		}
+		Args.push_back(Arg);
 	}
+	ParseCommandLine(Args);
 
-	if (G_VkInstance) {
-		G_VkInstance.destroy(nullptr, G_DLD);
-		G_VkInstance = nullptr;
+	if (G_bHeadless) {
+		return RunHeadless();
 	}
-}
 
-void InitPhysicalDevice()
-{
-	const std::vector<vk::PhysicalDevice> AvailableDevices = G_VkInstance.enumeratePhysicalDevices(G_DLD);
-	static constexpr std::array<const char*, 1> RequiredDeviceLayers = {
-		"VK_LAYER_KHRONOS_validation",
-	};
-	static constexpr std::array<const char*, 1> RequiredDeviceExtensions = {
-		VK_KHR_SWAPCHAIN_EXTENSION_NAME,
-	};
+	G_ThreadPool = std::make_unique<ThreadPool>(G_ImportThreadCount);
+	G_FrameTelemetry.Init(G_TelemetryFileName, G_TelemetryInterval);
 
-	std::vector<vk::PhysicalDevice> SuitablePhysicalDevices;
+	InitWindow();
+	InitVulkan();
 
-	for (auto PhysDevice : AvailableDevices) {
-		bool bAllExtensionsSupported = true;
-		bool bAllLayersSupported = true;
+	ImGui::SetCurrentContext(G_ImGuiContext);
+	Render(true);
+	ImGui::SetCurrentContext(nullptr);
 
-		const std::vector<vk::ExtensionProperties> SupportedDeviceExtensions = PhysDevice.enumerateDeviceExtensionProperties(nullptr, G_DLD);
-		const std::vector<vk::LayerProperties> SupportedDeviceLayers = PhysDevice.enumerateDeviceLayerProperties(G_DLD);
+	MSG Msg = {};
+	bool bContinue = true;
 
-		for (const char* RequiredLayer : RequiredDeviceLayers) {
-			if (std::find_if(SupportedDeviceLayers.begin(), SupportedDeviceLayers.end(), [&RequiredLayer](const vk::LayerProperties& ExtensionProperties) {return std::strcmp(ExtensionProperties.layerName.data(), RequiredLayer) == 0; }) == SupportedDeviceLayers.end()) {
-				bAllLayersSupported = false;
-				break;
-			}
-		}
-		for (const char* RequiredExtension : RequiredDeviceExtensions) {
-			if (std::find_if(SupportedDeviceExtensions.begin(), SupportedDeviceExtensions.end(), [&RequiredExtension](const vk::ExtensionProperties& ExtensionProperties) {return std::strcmp(ExtensionProperties.extensionName.data(), RequiredExtension) == 0; }) == SupportedDeviceExtensions.end()) {
-				bAllExtensionsSupported = false;
+	::ShowWindow(G_Hwnd, SW_SHOW);
+	::UpdateWindow(G_Hwnd);
+
+	while(bContinue) {
+		for (std::uint32_t i = 0; i < std::uint32_t(1); i++) {
+			if (::PeekMessage(&Msg, nullptr, 0, 0, PM_REMOVE)) {
+				if (Msg.message == WM_QUIT) {
+					bContinue = false;
+					break;
+				}
+
+				if (Msg.hwnd == G_Hwnd) ImGui::SetCurrentContext(G_ImGuiContext);
+				::TranslateMessage(&Msg);
+				::DispatchMessage(&Msg);
+				ImGui::SetCurrentContext(nullptr);
+
+			} else {
 				break;
 			}
 		}
-		if (bAllLayersSupported && bAllExtensionsSupported) {
-			SuitablePhysicalDevices.push_back(PhysDevice);
-		}
-	}
 
-	if (!SuitablePhysicalDevices.empty()) {
-		for (auto Item : SuitablePhysicalDevices) {
-			auto Props = Item.getProperties(G_DLD);
-			if (Props.deviceType == vk::PhysicalDeviceType::eDiscreteGpu) {
-				G_PhysicalDevice = Item;
-				break;
+		ImGui::SetCurrentContext(G_ImGuiContext);
+		if (!::IsIconic(G_Hwnd)) {
+			if (!Render()) {
+				RecreateSwapchain();
+				Render();
 			}
 		}
-
-		if (!G_PhysicalDevice)
-			G_PhysicalDevice = SuitablePhysicalDevices[0];
+		ImGui::SetCurrentContext(nullptr);
 	}
 
-	if (!G_PhysicalDevice)
-		throw std::runtime_error("Could not find any suitable physical device");
+	if (!G_TraceFileName.empty()) {
+		G_TraceRecorder.WriteChromeTrace(G_TraceFileName);
+	}
 
+	ShutdownVulkan();
+	ShutdownWindow();
 
-	const vk::PhysicalDeviceProperties PhysDeviceProps = G_PhysicalDevice.getProperties(G_DLD);
+	G_FrameTelemetry.Shutdown();
+	G_ThreadPool.reset();
 
-	const vk::SampleCountFlags SampleCountFlags = PhysDeviceProps.limits.framebufferColorSampleCounts & PhysDeviceProps.limits.framebufferDepthSampleCounts;
-	if (SampleCountFlags & vk::SampleCountFlagBits::e8) { G_SampleCount = vk::SampleCountFlagBits::e8; }
-	else if (SampleCountFlags & vk::SampleCountFlagBits::e4) { G_SampleCount = vk::SampleCountFlagBits::e4; }
-	else if (SampleCountFlags & vk::SampleCountFlagBits::e2) { G_SampleCount = vk::SampleCountFlagBits::e2; }
-	else { G_SampleCount = vk::SampleCountFlagBits::e1; }
+	return 0;
+}
+#else
+int main(int argc, char** argv)
+{
+	const std::vector<std::string> Args = std::vector<std::string>(argv + 1, argv + argc);
+	ParseCommandLine(Args);
 
+	// Only the offscreen backend exists off Windows.
+	G_bHeadless = true;
+	return RunHeadless();
 }
+#endif
 
-void InitQueueFamilies()
+int RunHeadless()
 {
+	G_ThreadPool = std::make_unique<ThreadPool>(G_ImportThreadCount);
+	G_FrameTelemetry.Init(G_TelemetryFileName, G_TelemetryInterval);
 
-	G_GraphicsQueueFamilyIndex.reset();
-	G_PresentQueueFamilyIndex.reset();
-	G_ComputeQueueFamilyIndex.reset();
+	InitVulkan();
 
-	const std::vector<vk::QueueFamilyProperties> QueueFamilies = G_PhysicalDevice.getQueueFamilyProperties(G_DLD);
+	// Every frame should show the model, so wait for it and its clips to become resident up front.
+	G_UploadManager.Wait(std::max({G_GltfModel.M_UploadToken, G_DrawList.GetUploadToken(), G_VertexAnimationAtlas.GetUploadToken()}));
+	G_ClipCache.WaitForPending();
 
-	std::vector<vk::Bool32> SupportsPresent = std::vector<vk::Bool32>(QueueFamilies.size(), vk::False);
-	for (std::uint32_t i = 0; i < QueueFamilies.size(); i++) {
-		SupportsPresent[i] = G_PhysicalDevice.getWin32PresentationSupportKHR(i, G_DLD);
-	}
+	const auto StartTime = std::chrono::high_resolution_clock::now();
 
-	for (std::uint32_t i = 0; i < QueueFamilies.size(); i++) {
-		if (QueueFamilies[i].queueFlags & vk::QueueFlagBits::eGraphics) {
-			if (SupportsPresent[i] == vk::True) {
-				G_GraphicsQueueFamilyIndex = static_cast<std::uint32_t>(i);
-				G_PresentQueueFamilyIndex = static_cast<std::uint32_t>(i);
-				break;
-			}
-			if (!G_GraphicsQueueFamilyIndex.has_value()) {
-				G_GraphicsQueueFamilyIndex = static_cast<std::uint32_t>(i);
-			}
+	G_HeadlessDeltaTime = 0.0f;
+	for (std::uint32_t i = 0; i < G_HeadlessFrameCount; i++) {
+		if (!Render()) {
+			throw std::runtime_error("Failed to render a headless frame");
 		}
+		G_HeadlessDeltaTime = G_HeadlessTimeStep;
 	}
-	if (!G_PresentQueueFamilyIndex.has_value()) {
-		for (std::uint32_t i = 0; i < QueueFamilies.size(); i++) {
-			if (SupportsPresent[i] == vk::True) {
-				G_PresentQueueFamilyIndex = static_cast<std::uint32_t>(i);
-				break;
-			}
-		}
+	G_Device.waitIdle(G_DLD);
+
+	// The run only counts as done once the last PNG is on disk.
+	if (G_FrameCapture.IsEnabled()) {
+		G_FrameCapture.Flush();
 	}
 
-	for (std::uint32_t i = 0; i < QueueFamilies.size(); i++) {
-		if (QueueFamilies[i].queueFlags & vk::QueueFlagBits::eCompute) {
-			if (!(QueueFamilies[i].queueFlags & vk::QueueFlagBits::eGraphics)) {
-				G_ComputeQueueFamilyIndex = static_cast<std::uint32_t>(i);
-				break;
-			}
+	const auto EndTime = std::chrono::high_resolution_clock::now();
+	const double TotalMs = double(std::chrono::duration_cast<std::chrono::microseconds>(EndTime - StartTime).count()) / 1000.0;
+
+	const vk::PhysicalDeviceProperties PhysDeviceProps = G_PhysicalDevice.getProperties(G_DLD);
+	std::cout << PhysDeviceProps.deviceName.data() << ": " << G_HeadlessFrameCount << " frames at "
+		<< G_SwapchainExtent.width << 'x' << G_SwapchainExtent.height << " in " << TotalMs << " ms ("
+		<< (G_HeadlessFrameCount ? TotalMs / G_HeadlessFrameCount : 0.0) << " ms/frame, "
+		<< (TotalMs > 0.0 ? 1000.0 * G_HeadlessFrameCount / TotalMs : 0.0) << " frames/s)" << std::endl;
+	std::cout << "Profile " << G_Profile.Name << ": validation " << (G_EnabledLayers.empty() ? "off" : "on") << ", "
+		<< static_cast<std::uint32_t>(G_SampleCount) << "x MSAA, " << G_FramesInFlight << " frames in flight" << std::endl;
+	if (!G_ImportBenchmarkResults.empty()) {
+		std::cout << "Import benchmark (ImportBenchmark.csv):";
+		for (const VkGltfModel::LoadStats& Stats : G_ImportBenchmarkResults) {
+			std::cout << ' ' << Stats.ThreadCount << " threads " << Stats.TotalMs << " ms" << (&Stats != &G_ImportBenchmarkResults.back() ? "," : "");
 		}
+		std::cout << std::endl;
+	}
+	if (G_AnimationSimulation.IsRunning()) {
+		const AnimationSimulation::Stats SimulationStats = G_AnimationSimulation.GetStats();
+		std::cout << "Animation thread: " << SimulationStats.Ticks << " ticks (" << SimulationStats.MergedTicks << " merged), "
+			<< SimulationStats.SnapshotsTaken << " snapshots taken, " << SimulationStats.SnapshotsReused << " reused" << std::endl;
+	}
+	if (G_GltfModel.M_MorphStats.TargetCount > 0) {
+		const VkGltfModel::MorphStats& MorphStats = G_GltfModel.M_MorphStats;
+		std::cout << "Morph targets: " << MorphStats.TargetCount << " targets, " << MorphStats.DeltaCount << " deltas on " << MorphStats.AffectedVertices
+			<< " vertices, " << MorphStats.SparseBytes << " bytes (dense " << MorphStats.DenseBytes << " bytes)" << std::endl;
+	}
+	if (G_VertexAnimationAtlas.IsBaked()) {
+		const VertexAnimationAtlas::Stats& VatStats = G_VertexAnimationAtlas.GetStats();
+		std::cout << "Vertex animation: " << VatStats.ClipCount << " clips, " << VatStats.FrameCount << " frames of " << VatStats.VertexCount << " vertices at "
+			<< G_VertexAnimationAtlas.GetSettings().SampleRate << " Hz, atlas " << VatStats.AtlasBytes << " bytes, baked "
+			<< (VatStats.BakeMilliseconds > 0.0f ? double(VatStats.BakedVertices) / (double(VatStats.BakeMilliseconds) * 1000.0) : 0.0) << " M vertices/s on the CPU";
+		if (VatStats.bExported) std::cout << ", written to " << G_VertexAnimationAtlas.GetSettings().ExportFileName;
+		std::cout << std::endl;
+	}
+	{
+		// The scene scope only covers the model draws, so runs with and without --vertex-animation compare directly.
+		// The count is what the draw list submits; compute culling can only lower what the GPU actually shades.
+		const std::uint64_t FrameVertices = G_DrawList.GetStats().NumVertices;
+		const float SceneMilliseconds = G_GpuProfiler.IsEnabled() ? G_GpuProfiler.GetAverage(GpuProfiler::Scope::eScene) : 0.0f;
+		const bool bVertexAnimation = G_VertexAnimationAtlas.IsEnabled();
+		std::cout << "Vertex throughput (" << (bVertexAnimation ? "vertex animation" : "palette skinning") << "): " << FrameVertices << " vertices/frame submitted before culling, "
+			<< (SceneMilliseconds > 0.0f ? double(FrameVertices) / (double(SceneMilliseconds) * 1000.0) : 0.0) << " M vertices/s on the GPU, "
+			<< (bVertexAnimation ? VertexAnimationAtlas::AtlasFetchBytesPerVertex : VertexAnimationAtlas::PaletteFetchBytesPerVertex) << " bytes fetched per vertex" << std::endl;
+	}
+	if (G_BakedPalettes.IsEnabled()) {
+		const BakedPalettes::Stats BakedStats = G_BakedPalettes.GetStats();
+		std::cout << "Baked palettes: " << BakedStats.RowsBaked << " of " << BakedStats.RowCount << " rows at " << G_BakedPalettes.GetSettings().SampleRate << " Hz, "
+			<< BakedStats.BufferBytes << " bytes (" << BakedStats.UncompressedBytes << " as 4x4), " << BakedStats.BakeMilliseconds << " ms baking" << std::endl;
+	}
+	if (G_PoseCache.IsEnabled()) {
+		const PoseCache::Stats PoseStats = G_AnimationSimulation.IsRunning() ? G_AnimationSimulation.GetPoseCache().GetStats() : G_PoseCache.GetStats();
+		std::cout << "Shared poses: " << PoseStats.FramePoses << " poses for " << PoseStats.FrameInstances << " instances, "
+			<< (PoseStats.Lookups ? 100.0 * double(PoseStats.Hits) / double(PoseStats.Lookups) : 0.0) << "% hit rate at a "
+			<< G_PoseCache.GetSettings().TimeStep << " s step" << std::endl;
+	}
+	if (G_ClipCache.IsRunning()) {
+		const ClipCache::Stats ClipStats = G_ClipCache.GetStats();
+		std::cout << "Clip cache: " << ClipStats.ResidentClips << " clips, " << ClipStats.ResidentBytes << " / " << G_ClipCache.GetSettings().BudgetBytes
+			<< " bytes, " << ClipStats.Hits << " hits, " << ClipStats.Misses << " misses, " << ClipStats.Evictions << " evictions" << std::endl;
+	}
+	std::cout << "Frame timeline at " << G_FrameScheduler.GetStats().SubmittedValue << ", blocked on the GPU for "
+		<< G_FrameScheduler.GetStats().BlockingWaits << " frames" << std::endl;
+	std::cout << "Render scale " << G_DynamicResolution.GetScale() << " (" << G_RenderExtent.width << 'x' << G_RenderExtent.height << "), "
+		<< G_DynamicResolution.GetStats().Adjustments << " adjustments" << std::endl;
+	std::cout << "Attachments: " << G_AttachmentStats.FrameCount << " sets for " << G_AttachmentStats.ImageCount << " images, depth/MSAA "
+		<< G_AttachmentStats.TransientBytes << " bytes (" << G_AttachmentStats.LazilyAllocatedBytes << " lazily allocated, "
+		<< QueryCommittedAttachmentBytes() << " committed), scene color " << G_AttachmentStats.SceneColorBytes << " bytes" << std::endl;
+
+	if (!G_GpuTimingsFileName.empty() && G_GpuProfiler.IsEnabled()) {
+		G_GpuProfiler.Flush();
+		G_GpuProfiler.WriteCsv(G_GpuTimingsFileName);
 	}
 
-	if (!G_ComputeQueueFamilyIndex.has_value()) {
-		for (std::uint32_t i = 0; i < QueueFamilies.size(); i++) {
-			if (QueueFamilies[i].queueFlags & vk::QueueFlagBits::eCompute) {
-				G_ComputeQueueFamilyIndex = static_cast<std::uint32_t>(i);
-				break;
-			}
-		}
+	if (!G_TraceFileName.empty()) {
+		std::cout << "Wrote " << G_TraceRecorder.WriteChromeTrace(G_TraceFileName) << " trace events to " << G_TraceFileName << std::endl;
 	}
 
-	if (!G_GraphicsQueueFamilyIndex.has_value() ||
-		!G_PresentQueueFamilyIndex.has_value() ||
-		!G_ComputeQueueFamilyIndex.has_value()) {
-		throw std::runtime_error("Failed to find all required queue families");
+	// Closes the last partial window, so short runs still get one summary.
+	G_FrameTelemetry.Shutdown();
+	const FrameTelemetry::Window& LastWindow = G_FrameTelemetry.GetLastWindow();
+	for (std::uint32_t i = 0; i < FrameTelemetry::MetricCount; i++) {
+		const FrameTelemetry::Metric TargetMetric = static_cast<FrameTelemetry::Metric>(i);
+		const FrameTelemetry::Summary& Summary = LastWindow.Metrics[i];
+		const std::string Unit = FrameTelemetry::IsGauge(TargetMetric) ? "" : std::string(" ") + FrameTelemetry::MetricUnit(TargetMetric);
+		std::cout << FrameTelemetry::MetricName(TargetMetric) << ": p50 " << Summary.P50 << Unit << ", p95 "
+			<< Summary.P95 << Unit << ", p99 " << Summary.P99 << Unit << ", max " << Summary.Max << Unit << " (" << Summary.Count << " samples)" << std::endl;
 	}
 
-}
+	if (G_FrameCapture.IsEnabled()) {
+		const FrameCapture::Stats CaptureStats = G_FrameCapture.GetStats();
+		std::cout << "Wrote " << CaptureStats.WrittenFrames << " frames to " << G_CaptureDirectory << ": "
+			<< double(CaptureStats.BytesReadBack) / (1024.0 * 1024.0) << " MiB read back, "
+			<< CaptureStats.EncodeMilliseconds << " ms encoding across workers, "
+			<< CaptureStats.EncoderStalls << " encoder stalls" << std::endl;
+	}
 
-void InitDevice()
-{
-	std::set<std::uint32_t> UniqueIndices;
-	UniqueIndices.insert(G_GraphicsQueueFamilyIndex.value());
-	UniqueIndices.insert(G_PresentQueueFamilyIndex.value());
-	UniqueIndices.insert(G_ComputeQueueFamilyIndex.value());
+	ShutdownVulkan();
 
-	std::vector<vk::DeviceQueueCreateInfo> QueueCIs;
-	const float QueuePriority = 1.0f;
-	for (std::uint32_t QueueFamilyIndex : UniqueIndices) {
-		QueueCIs.push_back(
-			vk::DeviceQueueCreateInfo(
-				{},
-				QueueFamilyIndex,
-				1,
-				&QueuePriority
-				)
-			);
-	}
+	std::cout << "Pipeline cache " << G_PipelineCacheFileName << ": " << G_PipelineStats.CacheStatus << ", loaded " << G_PipelineStats.LoadedBytes
+		<< " bytes, saved " << G_PipelineStats.SavedBytes << " bytes; pipelines ready after " << G_PipelineStats.WallMilliseconds << " ms" << std::endl;
 
-	static constexpr std::array<const char*, 1> EnabledLayers = {
-		"VK_LAYER_KHRONOS_validation",
-	};
-	static constexpr std::array<const char*, 1> EnabledExtensions = {
-		VK_KHR_SWAPCHAIN_EXTENSION_NAME,
-	};
-	vk::PhysicalDeviceFeatures EnabledFeatures = vk::PhysicalDeviceFeatures{};
-	//EnabledFeatures.setTessellationShader(vk::True);
-	EnabledFeatures.setFillModeNonSolid(vk::True);
+	G_ThreadPool.reset();
 
-	const vk::DeviceCreateInfo DeviceCI = vk::DeviceCreateInfo(
-		{},
-		static_cast<std::uint32_t>(QueueCIs.size()), QueueCIs.data(),
-		static_cast<std::uint32_t>(EnabledLayers.size()), EnabledLayers.data(),
-		static_cast<std::uint32_t>(EnabledExtensions.size()), EnabledExtensions.data(),
-		&EnabledFeatures
-	);
+	return 0;
+}
 
-	G_Device = G_PhysicalDevice.createDevice(DeviceCI, nullptr, G_DLD);
-	if (!G_Device)
-		throw std::runtime_error("Failed to create logical device");
-	G_DLD.init(G_Device);
+const PerformanceProfile& FindPerformanceProfile(const std::string& Name)
+{
+	for (const PerformanceProfile& Profile : G_PerformanceProfiles) {
+		if (Name == Profile.Name) return Profile;
+	}
+	throw std::runtime_error("Unknown performance profile: " + Name);
 }
 
-void InitQueues()
+const char* PresentModeName(vk::PresentModeKHR PresentMode)
 {
-	G_GraphicsQueue = G_Device.getQueue(G_GraphicsQueueFamilyIndex.value(), 0, G_DLD);
-	G_PresentQueue = G_Device.getQueue(G_PresentQueueFamilyIndex.value(), 0, G_DLD);
-	G_ComputeQueue = G_Device.getQueue(G_ComputeQueueFamilyIndex.value(), 0, G_DLD);
+	switch (PresentMode) {
+	case vk::PresentModeKHR::eImmediate:   return "immediate";
+	case vk::PresentModeKHR::eMailbox:     return "mailbox";
+	case vk::PresentModeKHR::eFifo:        return "fifo";
+	case vk::PresentModeKHR::eFifoRelaxed: return "fifo-relaxed";
+	default:                               return "other";
+	}
 }
 
-void InitCommandPools()
+std::vector<std::string> ReadConfigFile(const std::string& FileName)
 {
-	const vk::CommandPoolCreateInfo DynamicCommandPoolCI = vk::CommandPoolCreateInfo{
-		vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
-		G_GraphicsQueueFamilyIndex.value()
-	};
-	G_DynamicCommandPool = G_Device.createCommandPool(DynamicCommandPoolCI, nullptr, G_DLD);
+	std::ifstream Ifs = std::ifstream(FileName, std::ios::in);
+	if (!Ifs.is_open()) {
+		throw std::runtime_error("Could not open config file " + FileName);
+	}
 
-	const vk::CommandPoolCreateInfo StaticCommandPoolCI = vk::CommandPoolCreateInfo{
-		{},
-		G_GraphicsQueueFamilyIndex.value()
-	};
-	G_StaticCommandPool = G_Device.createCommandPool(StaticCommandPoolCI, nullptr, G_DLD);
+	// One "key value" per line, using the command line names without the dashes; '#' starts a comment.
+	std::vector<std::string> Args;
+	std::string Line;
+	while (std::getline(Ifs, Line)) {
+		Line = Line.substr(0, Line.find('#'));
+		const std::size_t KeyBegin = Line.find_first_not_of(" \t\r");
+		if (KeyBegin == std::string::npos) continue;
+		const std::size_t KeyEnd = std::min(Line.find_first_of(" \t\r", KeyBegin), Line.size());
+		Args.push_back("--" + Line.substr(KeyBegin, KeyEnd - KeyBegin));
+
+		const std::size_t ValueBegin = Line.find_first_not_of(" \t\r", KeyEnd);
+		if (ValueBegin != std::string::npos) {
+			Args.push_back(Line.substr(ValueBegin, Line.find_last_not_of(" \t\r") + 1 - ValueBegin));
+		}
+	}
+	return Args;
 }
 
-void InitCommandBuffers()
+void ParseCommandLine(const std::vector<std::string>& InArgs)
 {
-	const vk::CommandBufferAllocateInfo CommandBufferAI = vk::CommandBufferAllocateInfo(
-		G_DynamicCommandPool,
-		vk::CommandBufferLevel::ePrimary,
-		G_MaxFramesInFlight
-	);
-
-	const std::vector<vk::CommandBuffer> CmdBuffers = G_Device.allocateCommandBuffers(CommandBufferAI, G_DLD);
-	for (std::uint32_t i = 0; i < G_MaxFramesInFlight; i++) {
-		G_CommandBuffers[i] = CmdBuffers[i];
+	// Individual settings win over the profile whatever order they come in.
+	std::vector<std::string> Args = InArgs;
+	std::optional<bool> bValidation;
+	std::optional<std::uint32_t> MaxSampleCount;
+	std::optional<vk::PresentModeKHR> PresentMode;
+	std::optional<std::uint32_t> FramesInFlight;
+	std::optional<std::uint32_t> ImageCount;
+
+	for (std::size_t i = 0; i < Args.size(); i++) {
+		const std::string Arg = Args[i];
+		const bool bHasValue = (i + 1) < Args.size();
+
+		if (Arg == "--config" && bHasValue) {
+			const std::vector<std::string> ConfigArgs = ReadConfigFile(Args[++i]);
+			Args.insert(Args.begin() + std::ptrdiff_t(i + 1), ConfigArgs.begin(), ConfigArgs.end());
+		} else if (Arg == "--profile" && bHasValue) {
+			G_Profile = FindPerformanceProfile(Args[++i]);
+		} else if (Arg == "--validation" && bHasValue) {
+			bValidation = (Args[++i] != "off" && Args[i] != "0");
+		} else if (Arg == "--msaa" && bHasValue) {
+			MaxSampleCount = std::max(1U, static_cast<std::uint32_t>(std::stoul(Args[++i])));
+		} else if (Arg == "--present-mode" && bHasValue) {
+			const std::string& Name = Args[++i];
+			if (Name == "immediate") PresentMode = vk::PresentModeKHR::eImmediate;
+			else if (Name == "mailbox") PresentMode = vk::PresentModeKHR::eMailbox;
+			else if (Name == "fifo") PresentMode = vk::PresentModeKHR::eFifo;
+			else if (Name == "fifo-relaxed") PresentMode = vk::PresentModeKHR::eFifoRelaxed;
+			else throw std::runtime_error("Unknown present mode: " + Name);
+		} else if (Arg == "--frames-in-flight" && bHasValue) {
+			FramesInFlight = static_cast<std::uint32_t>(std::stoul(Args[++i]));
+		} else if (Arg == "--image-count" && bHasValue) {
+			ImageCount = static_cast<std::uint32_t>(std::stoul(Args[++i]));
+		} else if (Arg == "--dynamic-resolution") {
+			G_DynamicResolutionSettings.bEnabled = true;
+		} else if (Arg == "--gpu-budget" && bHasValue) {
+			G_DynamicResolutionSettings.BudgetMilliseconds = std::stof(Args[++i]);
+		} else if (Arg == "--min-render-scale" && bHasValue) {
+			G_DynamicResolutionSettings.MinScale = std::stof(Args[++i]);
+		} else if (Arg == "--render-scale" && bHasValue) {
+			G_DynamicResolutionSettings.MaxScale = std::stof(Args[++i]);
+		} else if (Arg == "--model" && bHasValue) {
+			G_ModelFileName = Args[++i];
+		} else if (Arg == "--import-threads" && bHasValue) {
+			G_ImportThreadCount = static_cast<std::uint32_t>(std::stoul(Args[++i]));
+		} else if (Arg == "--import-benchmark") {
+			G_bImportBenchmark = true;
+		} else if (Arg == "--release-source-data") {
+			G_bReleaseSourceData = true;
+		} else if (Arg == "--instances" && bHasValue) {
+			G_InstanceCount = std::max(1U, static_cast<std::uint32_t>(std::stoul(Args[++i])));
+		} else if (Arg == "--direct-draws") {
+			G_bDirectDraws = true;
+		} else if (Arg == "--record-threads" && bHasValue) {
+			G_RecordThreadCount = static_cast<std::uint32_t>(std::stoul(Args[++i]));
+		} else if (Arg == "--replay-commands") {
+			G_bReplayCommands = true;
+		} else if (Arg == "--headless") {
+			G_bHeadless = true;
+		} else if (Arg == "--width" && bHasValue) {
+			G_HeadlessExtent.width = std::max(1U, static_cast<std::uint32_t>(std::stoul(Args[++i])));
+		} else if (Arg == "--height" && bHasValue) {
+			G_HeadlessExtent.height = std::max(1U, static_cast<std::uint32_t>(std::stoul(Args[++i])));
+		} else if (Arg == "--frames" && bHasValue) {
+			G_HeadlessFrameCount = static_cast<std::uint32_t>(std::stoul(Args[++i]));
+		} else if (Arg == "--time" && bHasValue) {
+			G_AnimationStartTime = std::stof(Args[++i]);
+		} else if (Arg == "--time-step" && bHasValue) {
+			G_HeadlessTimeStep = std::stof(Args[++i]);
+		} else if (Arg == "--animation-thread") {
+			G_AnimationSimulationSettings.bEnabled = true;
+		} else if (Arg == "--animation-rate" && bHasValue) {
+			G_AnimationSimulationSettings.TickRate = std::max(1.0f, std::stof(Args[++i]));
+		} else if (Arg == "--shared-poses") {
+			G_PoseCacheSettings.bEnabled = true;
+		} else if (Arg == "--pose-step" && bHasValue) {
+			G_PoseCacheSettings.TimeStep = std::max(0.0f, std::stof(Args[++i]));
+		} else if (Arg == "--baked-palettes") {
+			G_BakedPalettesSettings.bEnabled = true;
+		} else if (Arg == "--bake-rate" && bHasValue) {
+			G_BakedPalettesSettings.SampleRate = std::max(1.0f, std::stof(Args[++i]));
+		} else if (Arg == "--vertex-animation") {
+			G_VertexAnimationAtlasSettings.bEnabled = true;
+		} else if (Arg == "--vat-rate" && bHasValue) {
+			G_VertexAnimationAtlasSettings.SampleRate = std::max(1.0f, std::stof(Args[++i]));
+		} else if (Arg == "--vat-export" && bHasValue) {
+			G_VertexAnimationAtlasSettings.ExportFileName = Args[++i];
+		} else if (Arg == "--clip-streaming") {
+			G_ClipCacheSettings.bEnabled = true;
+		} else if (Arg == "--clip-budget" && bHasValue) {
+			G_ClipCacheSettings.BudgetBytes = std::stoull(Args[++i]) * 1024 * 1024;
+		} else if (Arg == "--clip" && bHasValue) {
+			G_AnimationClip = static_cast<std::uint32_t>(std::stoul(Args[++i]));
+		} else if (Arg == "--capture" && bHasValue) {
+			G_CaptureDirectory = Args[++i];
+		} else if (Arg == "--gpu-timings" && bHasValue) {
+			G_GpuTimingsFileName = Args[++i];
+		} else if (Arg == "--telemetry" && bHasValue) {
+			G_TelemetryFileName = Args[++i];
+		} else if (Arg == "--telemetry-interval" && bHasValue) {
+			G_TelemetryInterval = std::stof(Args[++i]);
+		} else if (Arg == "--pipeline-cache" && bHasValue) {
+			G_PipelineCacheFileName = Args[++i];
+		} else if (Arg == "--trace" && bHasValue) {
+			G_TraceFileName = Args[++i];
+		}
 	}
+
+	if (bValidation) G_Profile.bValidation = *bValidation;
+	if (MaxSampleCount) G_Profile.MaxSampleCount = *MaxSampleCount;
+	if (PresentMode) G_Profile.PresentMode = *PresentMode;
+	if (FramesInFlight) G_Profile.FramesInFlight = *FramesInFlight;
+	if (ImageCount) G_Profile.ImageCount = *ImageCount;
+
+	G_Profile.FramesInFlight = std::clamp(G_Profile.FramesInFlight, 1U, G_MaxFramesInFlight);
+	G_FramesInFlight = G_Profile.FramesInFlight;
 }
 
-void InitSyncObjects()
+#ifdef _WIN32
+extern IMGUI_IMPL_API LRESULT ImGui_ImplWin32_WndProcHandler(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam);
+LRESULT CALLBACK WndProc(HWND Hwnd, UINT Msg, WPARAM Wparam, LPARAM Lparam)
 {
-	const vk::SemaphoreCreateInfo SemaphoreCI = {};
-	const vk::FenceCreateInfo FenceCI = vk::FenceCreateInfo(vk::FenceCreateFlagBits::eSignaled);
 
-	for (std::size_t i = 0; i < G_MaxFramesInFlight; i++) {
-		G_ImageAvailableSemaphores[i] = G_Device.createSemaphore(SemaphoreCI, nullptr, G_DLD);
-		G_RenderFinishedSemaphores[i] = G_Device.createSemaphore(SemaphoreCI, nullptr, G_DLD);
-		G_InFlightFences[i] = G_Device.createFence(FenceCI, nullptr, G_DLD);
-		G_WaitForFences[i] = true;
-	}
+	const auto InternalWndProc = [](HWND Hwnd, UINT Msg, WPARAM Wparam, LPARAM Lparam) -> LRESULT {
+		switch(Msg)
+		{
+		case WM_SIZE:
+		case WM_DISPLAYCHANGE:
+		{
+			G_SwapchainOK = false;
+		}
+		break;
+		case WM_ERASEBKGND:
+		{
+			return 1;
+		}
+		break;
+		case WM_DESTROY:
+		{
+			::PostQuitMessage(0);
+		}
+		break;
+		}
+
+		return ::DefWindowProcA(Hwnd, Msg, Wparam, Lparam);
+	};
+
+
+	const auto Result = InternalWndProc(Hwnd, Msg, Wparam, Lparam);
+	ImGui_ImplWin32_WndProcHandler(Hwnd, Msg, Wparam, Lparam);
+
+	return Result;
 }
 
-void InitSurface()
+
+
+void InitWindow()
 {
-	const vk::Win32SurfaceCreateInfoKHR SurfaceCI = vk::Win32SurfaceCreateInfoKHR({}, G_Hinstance, G_Hwnd, {});
 
-	G_Surface = G_VkInstance.createWin32SurfaceKHR(SurfaceCI, nullptr, G_DLD);
-	if (!G_Device)
-		throw std::runtime_error("Failed to create win32 surface");
+	static constexpr DWORD dwStyle = WS_CAPTION | WS_BORDER | WS_MINIMIZEBOX | WS_SYSMENU | WS_SIZEBOX | WS_MAXIMIZEBOX;
+	RECT rc = RECT{0, 0, 480, 640};
+	::AdjustWindowRectEx(&rc, dwStyle, FALSE, 0);
+
+	const WNDCLASSEXA wcx = WNDCLASSEXA{
+		sizeof(WNDCLASSEXA),
+		0,
+		WndProc,
+		0,
+		0,
+		G_Hinstance,
+		LoadIconA(nullptr, IDI_APPLICATION),
+		LoadCursorA(nullptr, IDC_ARROW),
+		0,
+		0,
+		"VkSkelAnimTestClass",
+		LoadIconA(nullptr, IDI_APPLICATION)
+	};
+	::RegisterClassExA(&wcx);
 
 
-	const std::vector<vk::SurfaceFormatKHR> SurfaceFormats = G_PhysicalDevice.getSurfaceFormatsKHR(G_Surface, G_DLD);
-	if (SurfaceFormats.empty())
-		throw std::runtime_error("The surface doesn't support any format");
+	G_Hwnd = ::CreateWindowExA(
+		0,
+		"VkSkelAnimTestClass",
+		"Vk Skeletal Animation Test",
+		dwStyle,
+		CW_USEDEFAULT,
+		CW_USEDEFAULT,
+		rc.right - rc.left,
+		rc.bottom - rc.top,
+		nullptr,
+		nullptr,
+		G_Hinstance,
+		nullptr
+	);
+}
 
-	G_SurfaceFormat = SurfaceFormats[0];
-	for (auto& SurfaceFormat : SurfaceFormats) {
-		if (SurfaceFormat.format == vk::Format::eB8G8R8A8Unorm && SurfaceFormat.colorSpace == vk::ColorSpaceKHR::eSrgbNonlinear) {
-			G_SurfaceFormat = SurfaceFormat;
-			break;
-		}
+void ShutdownWindow()
+{
+	::UnregisterClassA(
+		"VkSkelAnimTestClass",
+		G_Hinstance
+	);
+}
+#endif
+
+
+bool Render(bool bClearOnly)
+{
+	TRACE_SCOPE("Render");
+
+	if (!G_SwapchainOK) return false;
+
+	const auto FenceWaitStartTime = std::chrono::steady_clock::now();
+	{
+		TRACE_SCOPE("WaitForFrame");
+		G_FrameScheduler.WaitForSlot(G_CurrentFrame);
+		G_RetireQueue.Collect(G_FrameScheduler.GetCompletedValue());
 	}
+	G_FrameTelemetry.Record(FrameTelemetry::Metric::eFenceWait, std::chrono::steady_clock::now() - FenceWaitStartTime);
 
-	const std::vector<vk::PresentModeKHR> PresentModes = G_PhysicalDevice.getSurfacePresentModesKHR(G_Surface, G_DLD);
-	if (PresentModes.empty())
-		throw std::runtime_error("The surface doesn't support any present mode");
+	if (G_FrameCapture.IsEnabled()) {
+		G_FrameCapture.Collect(G_CurrentFrame);
+	}
 
-	G_SurfacePresentMode = PresentModes[0];
-	if (G_SurfacePresentMode != vk::PresentModeKHR::eFifo) {
-		for (auto& PresentMode : PresentModes) {
-			if (PresentMode == vk::PresentModeKHR::eFifo) {
-				G_SurfacePresentMode = PresentMode;
-				break;
+	std::uint32_t ImageIndex = 0;
+	if (G_bHeadless) {
+		// One offscreen target per frame slot, so the slot's fence already guards it.
+		ImageIndex = G_CurrentFrame;
+	} else {
+		try {
+			TRACE_SCOPE("AcquireNextImage");
+			vk::ResultValue Acquire = G_Device.acquireNextImageKHR(
+				G_Swapchain, std::numeric_limits<std::uint64_t>::max(),
+				G_ImageAvailableSemaphores[G_CurrentFrame], nullptr,
+				G_DLD
+				);
+
+			ImageIndex = Acquire.value;
+			if (Acquire.result == vk::Result::eSuboptimalKHR) {
+				// Still presentable; recreate after this frame instead of dropping it.
+				G_SwapchainOK = false;
 			}
 		}
+		catch (...) {
+			G_SwapchainOK = false;
+			return false;
+		}
 	}
-	if (G_SurfacePresentMode != vk::PresentModeKHR::eMailbox && G_SurfacePresentMode != vk::PresentModeKHR::eFifo) {
-		for (auto& PresentMode : PresentModes) {
-			if (PresentMode == vk::PresentModeKHR::eMailbox) {
-				G_SurfacePresentMode = PresentMode;
-				break;
+
+	vk::CommandBuffer CommandBuffer = G_CommandBuffers[G_CurrentFrame];
+	CommandBuffer.reset({}, G_DLD);
+
+	const auto RecordStartTime = std::chrono::steady_clock::now();
+	const vk::CommandBufferBeginInfo commandBufferBeginInfo = {};
+	CommandBuffer.begin(commandBufferBeginInfo, G_DLD);
+
+	const std::uint64_t GpuSampleCount = G_GpuProfiler.GetSampleCount();
+	G_GpuProfiler.BeginFrame(CommandBuffer, G_CurrentFrame);
+	if (G_GpuProfiler.GetSampleCount() != GpuSampleCount) {
+		const float GpuMilliseconds = G_GpuProfiler.GetLatest(GpuProfiler::Scope::eFrame);
+		G_FrameTelemetry.Record(FrameTelemetry::Metric::eGpu, static_cast<std::uint64_t>(double(GpuMilliseconds) * 1000000.0));
+
+		// The viewport is baked into the cached scene commands.
+		if (G_DynamicResolution.Update(GpuMilliseconds)) {
+			G_CommandCache.Invalidate();
+		}
+	}
+	G_RenderExtent = G_DynamicResolution.GetRenderExtent(G_SwapchainExtent);
+	G_FrameTelemetry.RecordGauge(FrameTelemetry::Metric::eRenderScale, G_DynamicResolution.GetScale());
+
+	vk::ClearColorValue ClearColor;
+	std::memcpy(&ClearColor, DirectX::Colors::Black.f, sizeof(ClearColor));
+	static constexpr vk::ClearColorValue ClearResolve(0.0f, 0.0f, 0.0f, 1.0f);
+	static constexpr vk::ClearDepthStencilValue ClearDepth(1.0f, 0);
+
+	const vk::ClearValue ClearValues[2] = {ClearColor, ClearDepth};
+	const vk::ClearValue MultiSamplesClearValues[3] = {ClearColor, ClearResolve, ClearDepth};
+	const vk::RenderPassBeginInfo RenderPassBeginInfo = vk::RenderPassBeginInfo(G_RenderPass, G_Framebuffers[G_CurrentFrame], vk::Rect2D(vk::Offset2D(0,0), G_RenderExtent), (G_SampleCount == vk::SampleCountFlagBits::e1) ? 2 : 3, (G_SampleCount == vk::SampleCountFlagBits::e1) ? ClearValues : MultiSamplesClearValues);
+	const vk::RenderPassBeginInfo UiRenderPassBeginInfo = vk::RenderPassBeginInfo(G_UiRenderPass, G_UiFramebuffers[ImageIndex], vk::Rect2D(vk::Offset2D(0,0), G_SwapchainExtent), 0, nullptr);
+
+	static auto PrevTime = std::chrono::high_resolution_clock::now() - std::chrono::milliseconds(1);
+	auto CurrentTime = std::chrono::high_resolution_clock::now();
+	// Headless frames advance by a fixed step so runs are reproducible.
+	const float DeltaTime = G_bHeadless ? G_HeadlessDeltaTime : float(std::chrono::duration_cast<std::chrono::microseconds>(CurrentTime-PrevTime).count()) / 1000000.0f;
+	G_FrameTelemetry.Record(FrameTelemetry::Metric::eFrame, static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(CurrentTime - PrevTime).count()));
+	PrevTime = CurrentTime;
+
+	// Submit whatever was queued since the last frame and skip the model until its data has landed.
+	G_UploadManager.Update();
+	const UploadManager::Token ReadyToken = std::max({G_GltfModel.M_UploadToken, G_DrawList.GetUploadToken(), G_VertexAnimationAtlas.GetUploadToken()});
+	const bool bModelReady = G_UploadManager.IsComplete(ReadyToken);
+	const bool bDrawModel = !bClearOnly && bModelReady;
+	const bool bDrawUi = !bClearOnly && !G_bHeadless;
+
+	// Pull the camera back far enough to frame the whole crowd grid.
+	const float GridSide = std::ceil(std::sqrt(float(G_ModelInstances.size())));
+	const float CameraDistance = 4.0f + 1.2f * (GridSide - 1.0f);
+
+	const DirectX::XMMATRIX MatProj = DirectX::XMMatrixPerspectiveFovRH(-DirectX::XMConvertToRadians(35), float(G_SwapchainExtent.width) / float(G_SwapchainExtent.height), 0.01f, 100 + CameraDistance);
+	const DirectX::XMMATRIX MatView = DirectX::XMMatrixLookAtRH(DirectX::XMVectorSet(-0.0f, 1.5f + 0.3f * (GridSide - 1.0f), CameraDistance, 0.0f), DirectX::XMVectorSet(0.0f, 0.8f, 0.0f, 0.0f), DirectX::XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+	const DirectX::XMMATRIX MatProjView = DirectX::XMMatrixMultiply(MatView, MatProj);
+
+	DirectX::XMFLOAT4X4 MatProjViewDest;
+	DirectX::XMStoreFloat4x4(&MatProjViewDest, MatProjView);
+
+	// Palettes are written through mapped memory, so they update even when the commands are replayed.
+	const CommandCache::FrameCommands* CachedCommands = nullptr;
+	std::chrono::steady_clock::duration AnimationDuration = std::chrono::steady_clock::duration::zero();
+	if (bDrawModel) {
+		const auto AnimationStartTime = std::chrono::steady_clock::now();
+		UpdateModelInstances(DeltaTime);
+		AnimationDuration = std::chrono::steady_clock::now() - AnimationStartTime;
+		G_FrameTelemetry.Record(FrameTelemetry::Metric::eAnimation, AnimationDuration);
+
+		G_GpuProfiler.BeginScope(CommandBuffer, GpuProfiler::Scope::eCull);
+		if (G_CommandCache.IsEnabled()) {
+			// The scene timestamps are baked into the cached secondary; the slot's query pool matches it.
+			CachedCommands = &G_CommandCache.Acquire(G_CurrentFrame, [&MatProjView, &MatProjViewDest](vk::CommandBuffer Cull, vk::CommandBuffer Draws) {
+				TRACE_SCOPE("RecordSceneCommands");
+				G_DrawList.RecordCull(Cull, G_CurrentFrame, MatProjView);
+				G_GpuProfiler.BeginScope(Draws, GpuProfiler::Scope::eScene);
+				RecordModelDraws(Draws, MatProjViewDest, 0, G_DrawList.GetStats().NumDraws);
+				G_GpuProfiler.EndScope(Draws, GpuProfiler::Scope::eScene);
+			});
+			CommandBuffer.executeCommands(CachedCommands->Cull, G_DLD);
+		} else {
+			G_DrawList.RecordCull(CommandBuffer, G_CurrentFrame, MatProjView);
+		}
+		G_GpuProfiler.EndScope(CommandBuffer, GpuProfiler::Scope::eCull);
+	}
+
+	// The UI is recorded into a secondary on the cached and multi-threaded paths, inline otherwise.
+	vk::CommandBuffer UiSecondary = nullptr;
+	if (G_CommandCache.IsEnabled()) {
+		CommandBuffer.beginRenderPass(&RenderPassBeginInfo, vk::SubpassContents::eSecondaryCommandBuffers, G_DLD);
+		if (CachedCommands) {
+			CommandBuffer.executeCommands(CachedCommands->Draws, G_DLD);
+		}
+
+		if (bDrawUi) {
+			UiSecondary = G_CommandCache.BeginUi(G_CurrentFrame);
+			ImGuiRender(UiSecondary);
+			G_CommandCache.EndUi(G_CurrentFrame);
+		}
+	} else if (G_CommandRecorder.IsEnabled()) {
+		CommandBuffer.beginRenderPass(&RenderPassBeginInfo, vk::SubpassContents::eSecondaryCommandBuffers, G_DLD);
+
+		const auto WallStartTime = std::chrono::high_resolution_clock::now();
+		G_CommandRecorder.BeginFrame(G_CurrentFrame);
+		const vk::Framebuffer Framebuffer = G_Framebuffers[G_CurrentFrame];
+
+		// Split the list into contiguous batches, one per worker slot, but never below the batch minimum.
+		TaskGroup RecordTasks(*G_ThreadPool);
+		if (bDrawModel) {
+			const std::uint32_t NumDraws = G_DrawList.GetStats().NumDraws;
+			const std::uint32_t BatchCount = G_DrawList.CanSplitDraws() ? std::clamp(NumDraws / G_MinDrawsPerRecordBatch, 1U, G_CommandRecorder.GetWorkerCount()) : 1;
+			const std::uint32_t DrawsPerBatch = (NumDraws + BatchCount - 1) / BatchCount;
+
+			for (std::uint32_t Batch = 0; Batch < BatchCount; Batch++) {
+				RecordTasks.Run([Batch, BatchCount, NumDraws, DrawsPerBatch, Framebuffer, &MatProjViewDest]() {
+					const std::uint32_t FirstDraw = std::min(Batch * DrawsPerBatch, NumDraws);
+					const std::uint32_t DrawCount = std::min(DrawsPerBatch, NumDraws - FirstDraw);
+
+					TRACE_SCOPE("RecordBatch");
+
+					// The batches execute in slot order, so the scene scope opens in the first and closes in the last.
+					vk::CommandBuffer Secondary = G_CommandRecorder.BeginSecondary(Batch, G_RenderPass, Framebuffer);
+					if (Batch == 0) G_GpuProfiler.BeginScope(Secondary, GpuProfiler::Scope::eScene);
+					RecordModelDraws(Secondary, MatProjViewDest, FirstDraw, DrawCount);
+					if (Batch == BatchCount - 1) G_GpuProfiler.EndScope(Secondary, GpuProfiler::Scope::eScene);
+					G_CommandRecorder.EndSecondary(Batch, DrawCount);
+				});
 			}
 		}
+
+		// ImGui is not thread safe; record it here while the workers run.
+		if (bDrawUi) {
+			const std::uint32_t MainSlot = G_CommandRecorder.GetMainSlot();
+			vk::CommandBuffer Secondary = G_CommandRecorder.BeginSecondary(MainSlot, G_UiRenderPass, G_UiFramebuffers[ImageIndex]);
+			ImGuiRender(Secondary);
+			G_CommandRecorder.EndSecondary(MainSlot, 0);
+		}
+
+		RecordTasks.Wait();
+
+		const std::vector<vk::CommandBuffer> Secondaries = G_CommandRecorder.CollectRecorded();
+		if (!Secondaries.empty()) {
+			CommandBuffer.executeCommands(Secondaries, G_DLD);
+		}
+		UiSecondary = G_CommandRecorder.GetMainSecondary();
+
+		const auto WallEndTime = std::chrono::high_resolution_clock::now();
+		G_CommandRecorder.SetWallTime(float(std::chrono::duration_cast<std::chrono::microseconds>(WallEndTime - WallStartTime).count()) / 1000.0f);
+	} else {
+		CommandBuffer.beginRenderPass(&RenderPassBeginInfo, vk::SubpassContents::eInline, G_DLD);
+
+		if (bDrawModel) {
+			G_GpuProfiler.BeginScope(CommandBuffer, GpuProfiler::Scope::eScene);
+			RecordModelDraws(CommandBuffer, MatProjViewDest, 0, G_DrawList.GetStats().NumDraws);
+			G_GpuProfiler.EndScope(CommandBuffer, GpuProfiler::Scope::eScene);
+		}
 	}
 
-	vk::SurfaceCapabilitiesKHR SurfaceCapabilities = G_PhysicalDevice.getSurfaceCapabilitiesKHR(G_Surface, G_DLD);
-	G_SurfaceImageCount = std::min(
-		SurfaceCapabilities.maxImageCount,
-		std::max(SurfaceCapabilities.minImageCount, G_PreferredImageCount)
-	);
+	CommandBuffer.endRenderPass(G_DLD);
 
+	G_GpuProfiler.BeginScope(CommandBuffer, GpuProfiler::Scope::eUpscale);
+	RecordUpscale(CommandBuffer, G_CurrentFrame, ImageIndex);
+	G_GpuProfiler.EndScope(CommandBuffer, GpuProfiler::Scope::eUpscale);
 
-	static constexpr std::array<vk::Format, 5> CandidateDepthFormats = std::array<vk::Format, 5>(
-		{
-			vk::Format::eD32SfloatS8Uint,
-			vk::Format::eD24UnormS8Uint,
-			vk::Format::eD16UnormS8Uint,
-			vk::Format::eD32Sfloat,
-			vk::Format::eD16Unorm,
+	// Also runs without any UI: it moves the output image into its present or readback layout.
+	if (UiSecondary) {
+		CommandBuffer.beginRenderPass(&UiRenderPassBeginInfo, vk::SubpassContents::eSecondaryCommandBuffers, G_DLD);
+		CommandBuffer.executeCommands(UiSecondary, G_DLD);
+	} else {
+		CommandBuffer.beginRenderPass(&UiRenderPassBeginInfo, vk::SubpassContents::eInline, G_DLD);
+		if (bDrawUi) {
+			ImGuiRender(CommandBuffer);
 		}
-	);
+	}
+	CommandBuffer.endRenderPass(G_DLD);
 
-	G_DepthFormat = vk::Format::eUndefined;
-	for (auto& Fmt : CandidateDepthFormats) {
-		const vk::FormatProperties FormatProps = G_PhysicalDevice.getFormatProperties(Fmt, G_DLD);
-		if ((FormatProps.optimalTilingFeatures & vk::FormatFeatureFlagBits::eDepthStencilAttachment) == vk::FormatFeatureFlagBits::eDepthStencilAttachment) {
-			G_DepthFormat = Fmt;
-			break;
+	if (G_FrameCapture.IsEnabled()) {
+		G_GpuProfiler.BeginScope(CommandBuffer, GpuProfiler::Scope::eReadback);
+		G_FrameCapture.RecordReadback(CommandBuffer, G_CurrentFrame, G_SwapchainImages[ImageIndex]);
+		G_GpuProfiler.EndScope(CommandBuffer, GpuProfiler::Scope::eReadback);
+	}
+
+	G_GpuProfiler.EndFrame(CommandBuffer);
+	CommandBuffer.end(G_DLD);
+
+	// Everything between begin and end except the animation update, which is tracked on its own.
+	const auto RecordEndTime = std::chrono::steady_clock::now();
+	G_FrameTelemetry.Record(FrameTelemetry::Metric::eRecording, (RecordEndTime - RecordStartTime) - AnimationDuration);
+
+	// The host already saw the upload complete; the timeline wait is what makes the copies visible to this queue.
+	const vk::Semaphore waitSemaphores[] = { G_ImageAvailableSemaphores[G_CurrentFrame], G_UploadManager.GetSemaphore()};
+	const vk::Semaphore signalSemaphores[] = { G_RenderFinishedSemaphores[G_CurrentFrame], G_FrameScheduler.GetSemaphore()};
+	// The swapchain image is first written by the upscale blit, so the scene can render before it is acquired.
+	static constexpr vk::PipelineStageFlags waitStages[] = { vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlags(vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eVertexInput | vk::PipelineStageFlagBits::eVertexShader) };
+	const std::uint64_t waitValues[] = { 0, bModelReady ? ReadyToken : 0 };
+	const std::uint64_t FrameValue = G_FrameScheduler.GetNextValue();
+	const std::uint64_t signalValues[] = { 0, FrameValue };
+
+	// Headless frames have nothing to acquire or present, so they only wait on uploads and only signal the frame timeline.
+	const std::uint32_t FirstWait = G_bHeadless ? 1 : 0;
+	const std::uint32_t WaitCount = 2 - FirstWait;
+	const std::uint32_t FirstSignal = G_bHeadless ? 1 : 0;
+	const std::uint32_t SignalCount = 2 - FirstSignal;
+	const vk::TimelineSemaphoreSubmitInfo timelineSubmitInfo = vk::TimelineSemaphoreSubmitInfo(WaitCount, waitValues + FirstWait, SignalCount, signalValues + FirstSignal);
+	vk::SubmitInfo submitInfo = vk::SubmitInfo(WaitCount, waitSemaphores + FirstWait, waitStages + FirstWait, 1, &CommandBuffer, SignalCount, signalSemaphores + FirstSignal);
+	submitInfo.setPNext(&timelineSubmitInfo);
+	try {
+		TRACE_SCOPE("QueueSubmit");
+		G_GraphicsQueue.submit(submitInfo, nullptr, G_DLD);
+		G_FrameScheduler.OnSubmitted(G_CurrentFrame, FrameValue);
+	}
+	catch (...) {
+		G_SwapchainOK = false;
+		return false;
+	}
+
+	if (!G_bHeadless) {
+		const vk::SwapchainKHR Swapchains[1] = {G_Swapchain};
+		const vk::PresentInfoKHR presentInfo = vk::PresentInfoKHR(1, signalSemaphores, 1, Swapchains, &ImageIndex);
+		try {
+			TRACE_SCOPE("Present");
+			if (G_PresentQueue.presentKHR(presentInfo, G_DLD) == vk::Result::eSuboptimalKHR) {
+				G_SwapchainOK = false;
+			}
+		}
+		catch (...) {
+			G_SwapchainOK = false;
+			return false;
 		}
 	}
-	if (G_DepthFormat == vk::Format::eUndefined)
-		throw std::runtime_error("Failed to find proper depth format");
 
+	G_CurrentFrame = (G_CurrentFrame + 1) % G_FramesInFlight;
+	G_FrameTelemetry.Update();
+
+	return true;
 }
 
-void InitRenderPass()
+void RecordModelDraws(vk::CommandBuffer CommandBuffer, const DirectX::XMFLOAT4X4& ProjView, std::uint32_t FirstDraw, std::uint32_t DrawCount)
 {
+	TRACE_SCOPE("RecordModelDraws");
 
-	if (G_SampleCount == vk::SampleCountFlagBits::e1) {
+	// Secondaries inherit no state, so every batch binds the full set.
+	const bool bVertexAnimation = G_VertexAnimationAtlas.IsEnabled();
+	CommandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, bVertexAnimation ? G_VatPipeline : G_Pipeline, G_DLD);
 
-		const std::array<vk::AttachmentDescription, 2> attachments = {
-			vk::AttachmentDescription(
-				{},
-				G_SurfaceFormat.format,
-				vk::SampleCountFlagBits::e1,
-				vk::AttachmentLoadOp::eClear,
-				vk::AttachmentStoreOp::eStore,
-				vk::AttachmentLoadOp::eDontCare,
-				vk::AttachmentStoreOp::eDontCare,
-				vk::ImageLayout::eUndefined,
-				vk::ImageLayout::ePresentSrcKHR
-				),
-			vk::AttachmentDescription(
-				{},
-				G_DepthFormat,
-				vk::SampleCountFlagBits::e1,
-				vk::AttachmentLoadOp::eClear,
-				vk::AttachmentStoreOp::eDontCare,
-				vk::AttachmentLoadOp::eDontCare,
-				vk::AttachmentStoreOp::eDontCare,
-				vk::ImageLayout::eUndefined,
-				vk::ImageLayout::eDepthStencilAttachmentOptimal
-				),
-			};
+	vk::DeviceSize VertexBufferOffset = 0;
+	CommandBuffer.bindVertexBuffers(0, 1, &std::get<0>(G_GltfModel.M_VertexBufferTuple), &VertexBufferOffset, G_DLD);
+	CommandBuffer.bindIndexBuffer(std::get<0>(G_GltfModel.M_IndexBufferTuple), 0, vk::IndexType::eUint32, G_DLD);
 
-		static constexpr std::array<vk::AttachmentReference, 1> ColorAttachmentRefs = {
-			vk::AttachmentReference(0, vk::ImageLayout::eColorAttachmentOptimal),
-		};
-		static constexpr std::array<vk::AttachmentReference, 1> DepthAttachmentRefs = {
-			vk::AttachmentReference(1, vk::ImageLayout::eDepthStencilAttachmentOptimal),
-		};
+	CommandBuffer.setViewport(0, vk::Viewport{0.0f, 0.0f, float(G_RenderExtent.width), float(G_RenderExtent.height), 0.0f, 1.0f}, G_DLD);
+	CommandBuffer.setScissor(0, vk::Rect2D{vk::Offset2D{0, 0}, G_RenderExtent}, G_DLD);
 
-		static constexpr vk::SubpassDescription subpass = vk::SubpassDescription(
-			{},
-			vk::PipelineBindPoint::eGraphics,
-			0,
-			nullptr,
-			1,
-			&ColorAttachmentRefs[0],
-			nullptr,
-			&DepthAttachmentRefs[0],
-			0,
-			nullptr
-			);
+	// All palettes of this frame live in one slice of the ring: bind it once, index per draw.
+	const vk::DescriptorSet PaletteDescriptorSet = G_PaletteRing.GetDescriptorSet();
+	const std::uint32_t PaletteDynamicOffset = G_PaletteRing.GetDynamicOffset();
+	CommandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, G_PipelineLayout, 0, 1, &PaletteDescriptorSet, 1, &PaletteDynamicOffset, G_DLD);
+	CommandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, G_PipelineLayout, 2, 1, &G_GltfModel.M_MorphDescriptorSet, 0, nullptr, G_DLD);
+	const vk::DescriptorSet BakedAnimationDescriptorSet = bVertexAnimation ? G_VertexAnimationAtlas.GetDescriptorSet() : G_BakedPalettes.GetDescriptorSet();
+	CommandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, G_PipelineLayout, 3, 1, &BakedAnimationDescriptorSet, 0, nullptr, G_DLD);
 
-		const vk::RenderPassCreateInfo renderPassCI = vk::RenderPassCreateInfo(
-			{},
-			static_cast<std::uint32_t>(attachments.size()),
-			attachments.data(),
-			1,
-			&subpass
-			);
+	CommandBuffer.pushConstants(G_PipelineLayout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(DirectX::XMFLOAT4X4), &ProjView, G_DLD);
 
-		G_RenderPass = G_Device.createRenderPass(renderPassCI, nullptr, G_DLD);
-		if (!G_RenderPass)
-			throw std::runtime_error("Failed to create renderpass");
+	G_DrawList.RecordDraws(CommandBuffer, G_CurrentFrame, FirstDraw, DrawCount);
+}
 
+void RecordUpscale(vk::CommandBuffer CommandBuffer, std::uint32_t FrameIndex, std::uint32_t ImageIndex)
+{
+	// The blit overwrites the whole output image, so its old contents are discarded. The stage matches the acquire wait.
+	const vk::ImageMemoryBarrier ToTransferDst = vk::ImageMemoryBarrier(
+		{}, vk::AccessFlagBits::eTransferWrite,
+		vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal,
+		VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
+		G_SwapchainImages[ImageIndex],
+		vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1)
+		);
+	CommandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer, {}, nullptr, nullptr, ToTransferDst, G_DLD);
+
+	// The scene pass leaves its color target in TransferSrcOptimal with only the render area written.
+	const vk::ImageSubresourceLayers Subresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1);
+	const vk::ImageBlit Region = vk::ImageBlit(
+		Subresource,
+		{vk::Offset3D(0, 0, 0), vk::Offset3D(std::int32_t(G_RenderExtent.width), std::int32_t(G_RenderExtent.height), 1)},
+		Subresource,
+		{vk::Offset3D(0, 0, 0), vk::Offset3D(std::int32_t(G_SwapchainExtent.width), std::int32_t(G_SwapchainExtent.height), 1)}
+		);
+	CommandBuffer.blitImage(G_SceneColors[FrameIndex].Image, vk::ImageLayout::eTransferSrcOptimal, G_SwapchainImages[ImageIndex], vk::ImageLayout::eTransferDstOptimal, Region, G_UpscaleFilter, G_DLD);
+}
 
+void ImGuiRender(vk::CommandBuffer CommandBuffer)
+{
+	TRACE_SCOPE("ImGuiRender");
+	ImGui_ImplVulkan_NewFrame();
+#ifdef _WIN32
+	ImGui_ImplWin32_NewFrame();
+#endif
+	ImGui::NewFrame();
+
+//	ImGui::Begin("Control", nullptr);
+//	ImGui::PushFont(G_ConsolasFont);
+//	ImGui::PopFont();
+//	ImGui::End();
+
+	ImGui::Begin("Stats", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
+
+	if (ImGui::CollapsingHeader("Profile")) {
+		ImGui::Text("Profile: %s, validation: %s", G_Profile.Name, G_EnabledLayers.empty() ? "off" : "on");
+		ImGui::Text("MSAA: %ux, present mode: %s", static_cast<std::uint32_t>(G_SampleCount), PresentModeName(G_SurfacePresentMode));
+		ImGui::Text("Frames in flight: %u, swapchain images: %u", G_FramesInFlight, G_SurfaceImageCount);
+	}
+
+	if (ImGui::CollapsingHeader("Device memory")) {
+		static constexpr float MiB = 1.0f / (1024.0f * 1024.0f);
+		const DeviceAllocator::Stats AllocatorStats = G_DeviceAllocator.GetStats();
+
+		ImGui::Text("Device memory objects: %u / %u", AllocatorStats.DeviceMemoryCount, AllocatorStats.MaxDeviceMemoryCount);
+		ImGui::Text("Reserved: %.2f MiB, used: %.2f MiB", float(AllocatorStats.ReservedBytes) * MiB, float(AllocatorStats.UsedBytes) * MiB);
+		for (const auto& TypeStats : AllocatorStats.MemoryTypes) {
+			ImGui::Text("Type %u (heap %u): %u blocks, %u dedicated, %u allocations",
+				TypeStats.MemoryTypeIndex, TypeStats.HeapIndex, TypeStats.BlockCount, TypeStats.DedicatedCount, TypeStats.AllocationCount);
+			ImGui::Text("    %.2f / %.2f MiB, %u free ranges, largest %.2f MiB",
+				float(TypeStats.UsedBytes) * MiB, float(TypeStats.ReservedBytes) * MiB, TypeStats.FreeRangeCount, float(TypeStats.LargestFreeRange) * MiB);
+		}
+	}
+
+	if (ImGui::CollapsingHeader("Uploads")) {
+		static constexpr float MiB = 1.0f / (1024.0f * 1024.0f);
+		const UploadManager::Stats UploadStats = G_UploadManager.GetStats();
+
+		ImGui::Text("Uploaded: %.2f MiB in %llu copies, %llu batches", float(UploadStats.BytesUploaded) * MiB,
+			static_cast<unsigned long long>(UploadStats.CopiesRecorded), static_cast<unsigned long long>(UploadStats.BatchesSubmitted));
+		ImGui::Text("In flight: %u batches, ring %.2f / %.2f MiB, %llu stalls", UploadStats.BatchesInFlight,
+			float(UploadStats.RingUsed) * MiB, float(UploadStats.RingSize) * MiB, static_cast<unsigned long long>(UploadStats.StallCount));
+		ImGui::Text("Timeline: submitted %llu, completed %llu",
+			static_cast<unsigned long long>(UploadStats.SubmittedToken), static_cast<unsigned long long>(UploadStats.CompletedToken));
+	}
+
+	if (ImGui::CollapsingHeader("Palettes")) {
+		static constexpr float KiB = 1.0f / 1024.0f;
+		const PaletteRing::Stats PaletteStats = G_PaletteRing.GetStats();
+
+		ImGui::Text("Instances: %u, matrices: %u / %u per frame", static_cast<std::uint32_t>(G_ModelInstances.size()), PaletteStats.MatrixCount, PaletteStats.MatrixCapacity);
+		ImGui::Text("Written: %.1f KiB, slice: %.1f KiB x %u", float(PaletteStats.BytesWritten) * KiB, float(PaletteStats.SliceSize) * KiB, G_FramesInFlight);
+		ImGui::Text("Memory: %s, streaming stores: %s", PaletteStats.bDeviceLocal ? "device local" : "system", PaletteStats.bStreamingStores ? "yes" : "no");
+	}
+
+	if (ImGui::CollapsingHeader("Morph targets")) {
+		static constexpr float KiB = 1.0f / 1024.0f;
+		const VkGltfModel::MorphStats& MorphStats = G_GltfModel.M_MorphStats;
+
+		ImGui::Text("Targets: %u, weight matrices: %u per instance", MorphStats.TargetCount, (MorphStats.TargetCount + 15) / 16);
+		ImGui::Text("Deltas: %llu on %u vertices", static_cast<unsigned long long>(MorphStats.DeltaCount), MorphStats.AffectedVertices);
+		ImGui::Text("Sparse: %.1f KiB, dense: %.1f KiB", float(MorphStats.SparseBytes) * KiB, float(MorphStats.DenseBytes) * KiB);
+	}
+
+	if (ImGui::CollapsingHeader("Simulation")) {
+		if (!G_AnimationSimulation.IsRunning()) {
+			ImGui::Text("Animating on the render thread (--animation-thread to decouple)");
+		} else {
+			const AnimationSimulation::Stats SimulationStats = G_AnimationSimulation.GetStats();
+			ImGui::Text("%.0f Hz, %llu ticks (%llu merged), last tick %.3f ms", G_AnimationSimulation.GetSettings().TickRate,
+				static_cast<unsigned long long>(SimulationStats.Ticks), static_cast<unsigned long long>(SimulationStats.MergedTicks), SimulationStats.LastTickMilliseconds);
+			ImGui::Text("Snapshots: %llu new, %llu reused, age %.2f ms", static_cast<unsigned long long>(SimulationStats.SnapshotsTaken),
+				static_cast<unsigned long long>(SimulationStats.SnapshotsReused), SimulationStats.SnapshotAgeMilliseconds);
+		}
+	}
+
+	if (ImGui::CollapsingHeader("Vertex animation")) {
+		if (!G_VertexAnimationAtlas.IsBaked()) {
+			ImGui::Text("Palette skinning (--vertex-animation to play from an atlas)");
+		} else {
+			static constexpr float MiB = 1.0f / (1024.0f * 1024.0f);
+			const VertexAnimationAtlas::Stats& VatStats = G_VertexAnimationAtlas.GetStats();
+			ImGui::Text("%u clips, %u frames of %u vertices at %.0f Hz", VatStats.ClipCount, VatStats.FrameCount, VatStats.VertexCount, G_VertexAnimationAtlas.GetSettings().SampleRate);
+			ImGui::Text("Atlas: %.2f MiB, baked in %.1f ms%s", float(VatStats.AtlasBytes) * MiB, VatStats.BakeMilliseconds, VatStats.bExported ? " (exported)" : "");
+			ImGui::Text("Per vertex: %u bytes fetched (palette skinning %u)", VertexAnimationAtlas::AtlasFetchBytesPerVertex, VertexAnimationAtlas::PaletteFetchBytesPerVertex);
+		}
+	}
+
+	if (ImGui::CollapsingHeader("Baked palettes")) {
+		if (!G_BakedPalettes.IsEnabled()) {
+			ImGui::Text("Palettes evaluated every frame (--baked-palettes to bake)");
+		} else {
+			static constexpr float MiB = 1.0f / (1024.0f * 1024.0f);
+			const BakedPalettes::Stats BakedStats = G_BakedPalettes.GetStats();
+			ImGui::Text("%.0f Hz, rows: %u / %u baked, %u vec4 each", G_BakedPalettes.GetSettings().SampleRate, BakedStats.RowsBaked, BakedStats.RowCount, BakedStats.RowStride);
+			ImGui::Text("Buffer: %.2f MiB (%.2f MiB as 4x4), %s", float(BakedStats.BufferBytes) * MiB, float(BakedStats.UncompressedBytes) * MiB, BakedStats.bDeviceLocal ? "device local" : "system");
+			ImGui::Text("Baking: %.3f ms total", BakedStats.BakeMilliseconds);
+		}
+	}
+
+	if (ImGui::CollapsingHeader("Shared poses")) {
+		if (!G_PoseCache.IsEnabled()) {
+			ImGui::Text("Every instance evaluates its own pose (--shared-poses to share)");
+		} else {
+			const PoseCache::Stats PoseStats = G_AnimationSimulation.IsRunning() ? G_AnimationSimulation.GetPoseCache().GetStats() : G_PoseCache.GetStats();
+			ImGui::Text("Step: %.2f ms, last frame: %u poses for %u instances", G_PoseCache.GetSettings().TimeStep * 1000.0f, PoseStats.FramePoses, PoseStats.FrameInstances);
+			ImGui::Text("Hit rate: %.1f%% (%llu / %llu)", PoseStats.Lookups ? 100.0f * float(PoseStats.Hits) / float(PoseStats.Lookups) : 0.0f,
+				static_cast<unsigned long long>(PoseStats.Hits), static_cast<unsigned long long>(PoseStats.Lookups));
+		}
+	}
+
+	if (ImGui::CollapsingHeader("Clip cache")) {
+		if (!G_ClipCache.IsRunning()) {
+			ImGui::Text("All clips decoded at load (--clip-streaming to stream)");
+		} else {
+			static constexpr float MiB = 1.0f / (1024.0f * 1024.0f);
+			const ClipCache::Stats ClipStats = G_ClipCache.GetStats();
+			const std::uint64_t Lookups = ClipStats.Hits + ClipStats.Misses;
+			ImGui::Text("Resident: %u / %u clips, %.2f / %.2f MiB", ClipStats.ResidentClips, static_cast<std::uint32_t>(G_GltfModel.M_Animations.size()),
+				float(ClipStats.ResidentBytes) * MiB, float(G_ClipCache.GetSettings().BudgetBytes) * MiB);
+			ImGui::Text("Hits: %llu (%.1f%%), misses: %llu, evictions: %llu", static_cast<unsigned long long>(ClipStats.Hits),
+				Lookups ? 100.0f * float(ClipStats.Hits) / float(Lookups) : 0.0f, static_cast<unsigned long long>(ClipStats.Misses), static_cast<unsigned long long>(ClipStats.Evictions));
+			ImGui::Text("Decodes: %llu, pending %u, last %.3f ms", static_cast<unsigned long long>(ClipStats.Decodes), ClipStats.PendingDecodes, ClipStats.LastDecodeMilliseconds);
+		}
+	}
+
+	if (ImGui::CollapsingHeader("Draws")) {
+		const DrawList::Stats DrawStats = G_DrawList.GetStats();
+
+		ImGui::Text("Draws: %u, path: %s", DrawStats.NumDraws, DrawList::DrawPathName(DrawStats.Path));
+		ImGui::Text("multiDrawIndirect: %s, drawIndirectCount: %s", G_bMultiDrawIndirect ? "yes" : "no", G_bDrawIndirectCount ? "yes" : "no");
+	}
+
+	if (ImGui::CollapsingHeader("Recording")) {
+		const CommandRecorder::Stats RecordStats = G_CommandRecorder.GetStats();
+
+		if (G_CommandCache.IsEnabled()) {
+			const CommandCache::Stats CacheStats = G_CommandCache.GetStats();
+			ImGui::Text("Replaying cached scene commands (generation %llu)", static_cast<unsigned long long>(CacheStats.Generation));
+			ImGui::Text("Frames recorded: %llu, replayed: %llu",
+				static_cast<unsigned long long>(CacheStats.RecordedFrames), static_cast<unsigned long long>(CacheStats.ReplayedFrames));
+		} else if (RecordStats.Slots.empty()) {
+			ImGui::Text("Inline on the main thread (--record-threads N for secondaries)");
+		} else {
+			ImGui::Text("Workers: %u, wall: %.3f ms", G_CommandRecorder.GetWorkerCount(), RecordStats.WallMilliseconds);
+			for (std::size_t i = 0; i < RecordStats.Slots.size(); i++) {
+				const bool bMainSlot = (i == G_CommandRecorder.GetMainSlot());
+				ImGui::Text("%s %2u: %.3f ms, %u draws", bMainSlot ? "Main  " : "Worker", static_cast<std::uint32_t>(i), RecordStats.Slots[i].RecordMilliseconds, RecordStats.Slots[i].DrawCount);
+			}
+		}
+	}
+
+	if (ImGui::CollapsingHeader("Frame times", ImGuiTreeNodeFlags_DefaultOpen)) {
+		const FrameTelemetry::Window& LastWindow = G_FrameTelemetry.GetLastWindow();
+
+		ImGui::Text("Window %u, ending at %.1f s", LastWindow.Index, LastWindow.EndSeconds);
+		ImGui::Text("%-12s %8s %8s %8s %8s %7s", "", "p50", "p95", "p99", "max", "count");
+		for (std::uint32_t i = 0; i < FrameTelemetry::MetricCount; i++) {
+			const FrameTelemetry::Metric TargetMetric = static_cast<FrameTelemetry::Metric>(i);
+			const FrameTelemetry::Summary& Summary = LastWindow.Metrics[i];
+			const std::string Label = FrameTelemetry::IsGauge(TargetMetric) ? FrameTelemetry::MetricName(TargetMetric) : std::string(FrameTelemetry::MetricName(TargetMetric)) + " ms";
+			ImGui::Text("%-12s %8.3f %8.3f %8.3f %8.3f %7llu", Label.c_str(),
+				Summary.P50, Summary.P95, Summary.P99, Summary.Max, static_cast<unsigned long long>(Summary.Count));
+		}
+	}
+
+	if (ImGui::CollapsingHeader("Resolution")) {
+		const DynamicResolution::Stats ResolutionStats = G_DynamicResolution.GetStats();
+		const DynamicResolution::Settings& ResolutionSettings = G_DynamicResolution.GetSettings();
+
+		ImGui::Text("Render %ux%u -> output %ux%u (scale %.3f)", G_RenderExtent.width, G_RenderExtent.height, G_SwapchainExtent.width, G_SwapchainExtent.height, ResolutionStats.Scale);
+		if (ResolutionSettings.bEnabled) {
+			ImGui::Text("Budget %.2f ms, scale %.2f - %.2f", ResolutionSettings.BudgetMilliseconds, ResolutionSettings.MinScale, ResolutionSettings.MaxScale);
+			ImGui::Text("GPU %.3f ms (filtered %.3f), %u adjustments", ResolutionStats.LastMilliseconds, ResolutionStats.FilteredMilliseconds, ResolutionStats.Adjustments);
+		} else {
+			ImGui::Text("Fixed scale (--dynamic-resolution to adapt to --gpu-budget)");
+		}
+	}
+
+	if (ImGui::CollapsingHeader("Swapchain")) {
+		const RetireQueue::Stats RetireStats = G_RetireQueue.GetStats();
+		ImGui::Text("%u images, %s", static_cast<std::uint32_t>(G_SwapchainImages.size()), PresentModeName(G_SurfacePresentMode));
+		ImGui::Text("Recreated %u times, last took %.2f ms", G_SwapchainRecreations, G_SwapchainRecreateMilliseconds);
+		ImGui::Text("Retired %llu, released %llu, %u pending", static_cast<unsigned long long>(RetireStats.Retired), static_cast<unsigned long long>(RetireStats.Released), RetireStats.Pending);
+	}
+
+	if (ImGui::CollapsingHeader("Frame pacing")) {
+		const FrameScheduler::Stats SchedulerStats = G_FrameScheduler.GetStats();
+		ImGui::Text("%u frames in flight", G_FramesInFlight);
+		ImGui::Text("Timeline: submitted %llu, completed %llu", static_cast<unsigned long long>(SchedulerStats.SubmittedValue), static_cast<unsigned long long>(SchedulerStats.CompletedValue));
+		ImGui::Text("Blocked on the GPU for %llu frames", static_cast<unsigned long long>(SchedulerStats.BlockingWaits));
+	}
+
+	if (ImGui::CollapsingHeader("Attachments")) {
+		const double MiB = 1.0 / (1024.0 * 1024.0);
+		const double PerImageTransientBytes = G_AttachmentStats.FrameCount ? double(G_AttachmentStats.TransientBytes) / G_AttachmentStats.FrameCount * G_AttachmentStats.ImageCount : 0.0;
+
+		ImGui::Text("%u attachment sets for %u swapchain images", G_AttachmentStats.FrameCount, G_AttachmentStats.ImageCount);
+		ImGui::Text("Depth/MSAA %.2f MiB (%.2f MiB if per image)", G_AttachmentStats.TransientBytes * MiB, PerImageTransientBytes * MiB);
+		ImGui::Text("Lazily allocated %.2f MiB, committed %.2f MiB", G_AttachmentStats.LazilyAllocatedBytes * MiB, QueryCommittedAttachmentBytes() * MiB);
+		ImGui::Text("Scene color %.2f MiB", G_AttachmentStats.SceneColorBytes * MiB);
+	}
+
+	if (ImGui::CollapsingHeader("GPU timings")) {
+		if (!G_GpuProfiler.IsEnabled()) {
+			ImGui::Text("Timestamps are not supported on the graphics queue");
+		} else {
+			// Read back G_FramesInFlight frames late, when each slot's fence comes around.
+			for (std::uint32_t i = 0; i < GpuProfiler::ScopeCount; i++) {
+				const GpuProfiler::Scope Scope = static_cast<GpuProfiler::Scope>(i);
+				const std::uint32_t Count = G_GpuProfiler.GetHistoryCount();
+				const float* History = G_GpuProfiler.GetHistory(Scope);
+				const float Latest = Count ? History[(G_GpuProfiler.GetHistoryOffset() + Count - 1) % G_GpuTimingHistory] : 0.0f;
+
+				char Overlay[64];
+				std::snprintf(Overlay, sizeof(Overlay), "%.3f ms (avg %.3f)", Latest, G_GpuProfiler.GetAverage(Scope));
+				ImGui::PlotLines(GpuProfiler::ScopeName(Scope), History, int(Count), int(G_GpuProfiler.GetHistoryOffset()), Overlay, 0.0f, FLT_MAX, ImVec2(240.0f, 40.0f));
+			}
+			if (ImGui::Button("Export CSV")) {
+				G_GpuProfiler.WriteCsv(G_GpuTimingsFileName.empty() ? "GpuTimings.csv" : G_GpuTimingsFileName);
+			}
+		}
+	}
+
+	if (ImGui::CollapsingHeader("Pipelines")) {
+		ImGui::Text("Cache %s: %s, loaded %.1f KiB", G_PipelineCacheFileName.c_str(), G_PipelineStats.CacheStatus.c_str(), float(G_PipelineStats.LoadedBytes) / 1024.0f);
+		ImGui::Text("Graphics: %.3f ms, cull: %.3f ms, wall with model load: %.3f ms",
+			G_PipelineStats.GraphicsMilliseconds, G_PipelineStats.ComputeMilliseconds, G_PipelineStats.WallMilliseconds);
+	}
+
+	if (ImGui::CollapsingHeader("Tracing")) {
+#if ENABLE_TRACE
+		const TraceRecorder::Stats TraceStats = G_TraceRecorder.GetStats();
+		ImGui::Text("Threads: %u, events: %llu, overwritten: %llu", TraceStats.ThreadCount,
+			static_cast<unsigned long long>(TraceStats.EventsRecorded), static_cast<unsigned long long>(TraceStats.EventsOverwritten));
+		if (ImGui::Button("Write trace")) {
+			G_TraceRecorder.WriteChromeTrace(G_TraceFileName.empty() ? "Trace.json" : G_TraceFileName);
+		}
+#else
+		ImGui::Text("Compiled out (build with ENABLE_TRACE=1)");
+#endif
+	}
+
+	if (ImGui::CollapsingHeader("Model memory")) {
+		static constexpr float KiB = 1.0f / 1024.0f;
+		const VkGltfModel::MemoryStats ModelStats = G_GltfModel.GetMemoryStats();
+
+		for (std::size_t i = 0; i < static_cast<std::size_t>(VkGltfModel::MemoryCategory::eCount); i++) {
+			ImGui::Text("%-12s host %10.1f KiB, device %10.1f KiB", VkGltfModel::MemoryCategoryName(static_cast<VkGltfModel::MemoryCategory>(i)),
+				float(ModelStats.HostBytes[i]) * KiB, float(ModelStats.DeviceBytes[i]) * KiB);
+		}
+		ImGui::Text("%-12s host %10.1f KiB, device %10.1f KiB", "Total", float(ModelStats.TotalHostBytes()) * KiB, float(ModelStats.TotalDeviceBytes()) * KiB);
+	}
+
+	ImGui::End();
+
+	static bool bFirst = true;
+	if (bFirst) {
+		ImGui::SetWindowFocus(nullptr);
+		bFirst = false;
+	}
+
+	ImGui::Render();
+	G_GpuProfiler.BeginScope(CommandBuffer, GpuProfiler::Scope::eUi);
+	ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), CommandBuffer);
+	G_GpuProfiler.EndScope(CommandBuffer, GpuProfiler::Scope::eUi);
+}
+
+
+std::uint32_t FindMemoryTypeIndex(std::uint32_t typeFilter, vk::MemoryPropertyFlags Properties)
+{
+	vk::PhysicalDeviceMemoryProperties MemProperties = G_PhysicalDevice.getMemoryProperties(G_DLD);
+
+	for (std::uint32_t i = 0; i < MemProperties.memoryTypeCount; i++) {
+		if ((typeFilter & (1 << i)) && MemProperties.memoryTypes[i].propertyFlags == Properties) {
+			return i;
+		}
+	}
+
+	for (std::uint32_t i = 0; i < MemProperties.memoryTypeCount; i++) {
+		if ((typeFilter & (1 << i)) && (MemProperties.memoryTypes[i].propertyFlags & Properties) == Properties) {
+			return i;
+		}
+	}
+
+	throw std::runtime_error("failed to find suitable memory type!");
+}
+
+bool HasMemoryType(std::uint32_t typeFilter, vk::MemoryPropertyFlags Properties)
+{
+	vk::PhysicalDeviceMemoryProperties MemProperties = G_PhysicalDevice.getMemoryProperties(G_DLD);
+
+	for (std::uint32_t i = 0; i < MemProperties.memoryTypeCount; i++) {
+		if ((typeFilter & (1 << i)) && (MemProperties.memoryTypes[i].propertyFlags & Properties) == Properties) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+vk::ShaderModule CreateShader(const std::string &fileName)
+{
+	const std::string FilePath = std::string(APP_SOURCE_PATH) + std::string("/shaders/") + fileName;
+	std::ifstream Ifs = std::ifstream(FilePath, std::ios::binary | std::ios::in);
+
+	if (!Ifs.is_open()) {
+		throw std::runtime_error("Could not open shader file");
+	}
+
+	const std::vector<char> Buf = std::vector<char>(std::istreambuf_iterator<char>(Ifs), std::istreambuf_iterator<char>());
+	Ifs.close();
+
+	const vk::ShaderModuleCreateInfo ShaderModuleCI = vk::ShaderModuleCreateInfo(
+		{},
+		Buf.size(),
+		reinterpret_cast<const std::uint32_t*>(Buf.data())
+		);
+
+	return G_Device.createShaderModule(ShaderModuleCI, nullptr, G_DLD);
+}
+
+std::tuple<vk::Buffer, DeviceAllocation> CreateBuffer(vk::BufferUsageFlags UsageFlags, vk::DeviceSize ByteSize, void* DataPtr, bool bDeviceLocal, UploadManager::Token* OutUploadToken)
+{
+	TRACE_SCOPE("CreateBuffer");
+	if (bDeviceLocal) {
+		const vk::Buffer LocalBuffer = CreateLocalBuffer(UsageFlags, ByteSize);
+		const vk::MemoryRequirements LocalMemReqs = G_Device.getBufferMemoryRequirements(LocalBuffer, G_DLD);
+		const DeviceAllocation LocalBufferAllocation = G_DeviceAllocator.Allocate(LocalMemReqs, vk::MemoryPropertyFlagBits::eDeviceLocal, DeviceAllocator::ResourceKind::eBuffer);
+		G_Device.bindBufferMemory(LocalBuffer, LocalBufferAllocation.Memory, LocalBufferAllocation.Offset, G_DLD);
+
+		const UploadManager::Token UploadToken = G_UploadManager.UploadBuffer(LocalBuffer, 0, DataPtr, ByteSize);
+		if (OutUploadToken) {
+			*OutUploadToken = UploadToken;
+		} else {
+			G_UploadManager.Wait(UploadToken);
+		}
+
+		return std::make_tuple(LocalBuffer, LocalBufferAllocation);
+	}
+
+	const vk::BufferCreateInfo BufferCI = vk::BufferCreateInfo(
+		{},
+		ByteSize,
+		UsageFlags,
+		vk::SharingMode::eExclusive,
+		0,
+		nullptr
+		);
+
+	const vk::Buffer Buffer = G_Device.createBuffer(BufferCI, nullptr, G_DLD);
+
+	const vk::MemoryRequirements MemReqs = G_Device.getBufferMemoryRequirements(Buffer, G_DLD);
+	DeviceAllocation BufferAllocation = G_DeviceAllocator.Allocate(MemReqs, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, DeviceAllocator::ResourceKind::eBuffer);
+	G_Device.bindBufferMemory(Buffer, BufferAllocation.Memory, BufferAllocation.Offset, G_DLD);
+
+	if (DataPtr) {
+		std::memcpy(BufferAllocation.Mapped, DataPtr, ByteSize);
+	} else {
+		std::memset(BufferAllocation.Mapped, 0, ByteSize);
+	}
+
+	return std::make_tuple(Buffer, BufferAllocation);
+}
+
+void DestroyBuffer(std::tuple<vk::Buffer, DeviceAllocation>& BufferTuple)
+{
+	if (std::get<0>(BufferTuple)) {
+		G_Device.destroyBuffer(std::get<0>(BufferTuple), nullptr, G_DLD);
+		std::get<0>(BufferTuple) = nullptr;
+	}
+	G_DeviceAllocator.Free(std::get<1>(BufferTuple));
+}
+
+vk::Buffer CreateLocalBuffer(vk::BufferUsageFlags UsageFlags, vk::DeviceSize ByteSize)
+{
+	// Shared between the transfer and graphics families so no queue ownership transfer is needed. Transfer source
+	// as well, so Defragment can copy the buffer out again.
+	const std::uint32_t QueueFamilyIndices[] = {G_GraphicsQueueFamilyIndex.value(), G_TransferQueueFamilyIndex.value()};
+	const bool bConcurrent = (QueueFamilyIndices[0] != QueueFamilyIndices[1]);
+
+	const vk::BufferCreateInfo LocalBufferCI = vk::BufferCreateInfo(
+		{},
+		ByteSize,
+		UsageFlags | vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc,
+		bConcurrent ? vk::SharingMode::eConcurrent : vk::SharingMode::eExclusive,
+		bConcurrent ? 2 : 0,
+		bConcurrent ? QueueFamilyIndices : nullptr
+		);
+
+	return G_Device.createBuffer(LocalBufferCI, nullptr, G_DLD);
+}
+
+bool MoveBuffer(MovableBuffer& Target, const DeviceAllocation& To)
+{
+	TRACE_SCOPE("MoveBuffer");
+	auto& [OldBuffer, Allocation] = *Target.BufferTuple;
+
+	const vk::Buffer NewBuffer = CreateLocalBuffer(Target.UsageFlags, Target.ByteSize);
+	const vk::MemoryRequirements MemReqs = G_Device.getBufferMemoryRequirements(NewBuffer, G_DLD);
+	if (MemReqs.size > To.Size || To.Offset % MemReqs.alignment != 0 || !(MemReqs.memoryTypeBits & (1U << To.MemoryTypeIndex))) {
+		G_Device.destroyBuffer(NewBuffer, nullptr, G_DLD);
+		return false;
+	}
+	G_Device.bindBufferMemory(NewBuffer, To.Memory, To.Offset, G_DLD);
+
+	const vk::CommandBuffer CommandBuffer = BeginSingleUseCommandBuffer();
+	CommandBuffer.copyBuffer(OldBuffer, NewBuffer, vk::BufferCopy(0, 0, Target.ByteSize), G_DLD);
+	EndSingleUseCommandBuffer(CommandBuffer);
+
+	G_Device.destroyBuffer(OldBuffer, nullptr, G_DLD);
+	OldBuffer = NewBuffer;
+	Allocation = To;
+	return true;
+}
+
+vk::CommandBuffer BeginSingleUseCommandBuffer()
+{
+	const vk::CommandBufferAllocateInfo CommandBufferAI = vk::CommandBufferAllocateInfo(G_StaticCommandPool, vk::CommandBufferLevel::ePrimary, 1);
+	vk::CommandBuffer CommandBuffer = G_Device.allocateCommandBuffers(CommandBufferAI, G_DLD)[0];
+	const vk::CommandBufferBeginInfo CommandBufferBI = vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+	CommandBuffer.begin(CommandBufferBI, G_DLD);
+
+	return CommandBuffer;
+}
+
+void EndSingleUseCommandBuffer(vk::CommandBuffer CommandBuffer)
+{
+	CommandBuffer.end(G_DLD);
+	const vk::SubmitInfo SI = vk::SubmitInfo(0, nullptr, 0, 1, &CommandBuffer, 0, nullptr);
+
+	// Wait on a private fence instead of idling the whole queue, then give the command buffer back.
+	const vk::Fence Fence = G_Device.createFence(vk::FenceCreateInfo{}, nullptr, G_DLD);
+	G_GraphicsQueue.submit(SI, Fence, G_DLD);
+	(void)G_Device.waitForFences(1, &Fence, VK_TRUE, std::numeric_limits<std::uint64_t>::max(), G_DLD);
+	G_Device.destroyFence(Fence, nullptr, G_DLD);
+	G_Device.freeCommandBuffers(G_StaticCommandPool, CommandBuffer, G_DLD);
+}
+
+void DeviceAllocator::Init()
+{
+	M_MemoryProperties = G_PhysicalDevice.getMemoryProperties(G_DLD);
+	M_MaxDeviceMemoryCount = G_PhysicalDevice.getProperties(G_DLD).limits.maxMemoryAllocationCount;
+	M_MemoryTypes.clear();
+	M_MemoryTypes.resize(M_MemoryProperties.memoryTypeCount);
+	M_DeviceMemoryCount = 0;
+}
+
+void DeviceAllocator::Shutdown()
+{
+	std::lock_guard<std::mutex> Lock(M_Mutex);
+
+	for (auto& Type : M_MemoryTypes) {
+		for (auto& TypeBlock : Type.Blocks) {
+			if (TypeBlock) DestroyBlock(*TypeBlock);
+		}
+		Type.Blocks.clear();
+	}
+	M_MemoryTypes.clear();
+}
+
+vk::DeviceSize DeviceAllocator::PreferredBlockSize(std::uint32_t MemoryTypeIndex) const
+{
+	static constexpr vk::DeviceSize LargeBlockSize = 64ULL * 1024 * 1024;
+	static constexpr vk::DeviceSize SmallHeapBlockSize = 16ULL * 1024 * 1024;
+	static constexpr vk::DeviceSize SmallHeapLimit = 1024ULL * 1024 * 1024;
+
+	const vk::MemoryHeap& Heap = M_MemoryProperties.memoryHeaps[M_MemoryProperties.memoryTypes[MemoryTypeIndex].heapIndex];
+	return (Heap.size <= SmallHeapLimit) ? SmallHeapBlockSize : LargeBlockSize;
+}
+
+std::unique_ptr<DeviceAllocator::Block> DeviceAllocator::CreateBlock(std::uint32_t MemoryTypeIndex, vk::DeviceSize Size, ResourceKind Kind)
+{
+	if (M_MaxDeviceMemoryCount && M_DeviceMemoryCount >= M_MaxDeviceMemoryCount)
+		throw std::runtime_error("Exceeded maxMemoryAllocationCount");
+
+	const vk::MemoryAllocateInfo MemAI = vk::MemoryAllocateInfo(Size, MemoryTypeIndex);
+
+	auto NewBlock = std::make_unique<Block>();
+	NewBlock->Memory = G_Device.allocateMemory(MemAI, nullptr, G_DLD);
+	NewBlock->Size = Size;
+	NewBlock->Kind = Kind;
+	NewBlock->FreeRanges.emplace(0, Size);
+	M_DeviceMemoryCount++;
+
+	// Host-visible blocks stay mapped for their whole lifetime; a VkDeviceMemory can only be mapped once,
+	// so sub-allocations hand out pointers into this single mapping.
+	if (M_MemoryProperties.memoryTypes[MemoryTypeIndex].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible) {
+		NewBlock->Mapped = G_Device.mapMemory(NewBlock->Memory, 0, vk::WholeSize, vk::MemoryMapFlags(), G_DLD);
+	}
+
+	return NewBlock;
+}
+
+void DeviceAllocator::DestroyBlock(Block& TargetBlock)
+{
+	if (TargetBlock.Mapped) {
+		G_Device.unmapMemory(TargetBlock.Memory, G_DLD);
+		TargetBlock.Mapped = nullptr;
+	}
+	if (TargetBlock.Memory) {
+		G_Device.freeMemory(TargetBlock.Memory, nullptr, G_DLD);
+		TargetBlock.Memory = nullptr;
+		M_DeviceMemoryCount--;
+	}
+}
+
+bool DeviceAllocator::AllocateFromBlock(Block& TargetBlock, vk::DeviceSize Size, vk::DeviceSize Alignment, vk::DeviceSize& OutOffset)
+{
+	// Best fit over the free list: pick the smallest range that still fits after alignment.
+	auto BestIt = TargetBlock.FreeRanges.end();
+	vk::DeviceSize BestWaste = std::numeric_limits<vk::DeviceSize>::max();
+
+	for (auto It = TargetBlock.FreeRanges.begin(); It != TargetBlock.FreeRanges.end(); ++It) {
+		const vk::DeviceSize AlignedOffset = (It->first + Alignment - 1) / Alignment * Alignment;
+		const vk::DeviceSize Padding = AlignedOffset - It->first;
+		if (It->second < Padding + Size) continue;
+
+		const vk::DeviceSize Waste = It->second - Size;
+		if (Waste < BestWaste) {
+			BestWaste = Waste;
+			BestIt = It;
+			if (Waste == Padding) break;
+		}
+	}
+
+	if (BestIt == TargetBlock.FreeRanges.end()) return false;
+
+	const vk::DeviceSize RangeOffset = BestIt->first;
+	const vk::DeviceSize RangeSize = BestIt->second;
+	const vk::DeviceSize AlignedOffset = (RangeOffset + Alignment - 1) / Alignment * Alignment;
+	const vk::DeviceSize Padding = AlignedOffset - RangeOffset;
+
+	TargetBlock.FreeRanges.erase(BestIt);
+	if (Padding > 0) {
+		TargetBlock.FreeRanges.emplace(RangeOffset, Padding);
+	}
+	if (RangeSize > Padding + Size) {
+		TargetBlock.FreeRanges.emplace(AlignedOffset + Size, RangeSize - Padding - Size);
+	}
+
+	TargetBlock.UsedRanges.emplace(AlignedOffset, UsedRange{Size, Alignment});
+	TargetBlock.UsedBytes += Size;
+
+	OutOffset = AlignedOffset;
+	return true;
+}
+
+void DeviceAllocator::FreeToBlock(Block& TargetBlock, vk::DeviceSize Offset)
+{
+	const auto UsedIt = TargetBlock.UsedRanges.find(Offset);
+	if (UsedIt == TargetBlock.UsedRanges.end()) return;
+
+	vk::DeviceSize RangeOffset = UsedIt->first;
+	vk::DeviceSize RangeSize = UsedIt->second.Size;
+	TargetBlock.UsedBytes -= RangeSize;
+	TargetBlock.UsedRanges.erase(UsedIt);
+
+	// Coalesce with the neighbouring free ranges so the free list never holds adjacent entries.
+	auto NextIt = TargetBlock.FreeRanges.lower_bound(RangeOffset);
+	if (NextIt != TargetBlock.FreeRanges.begin()) {
+		auto PrevIt = std::prev(NextIt);
+		if (PrevIt->first + PrevIt->second == RangeOffset) {
+			RangeOffset = PrevIt->first;
+			RangeSize += PrevIt->second;
+			TargetBlock.FreeRanges.erase(PrevIt);
+		}
+	}
+	if (NextIt != TargetBlock.FreeRanges.end() && RangeOffset + RangeSize == NextIt->first) {
+		RangeSize += NextIt->second;
+		TargetBlock.FreeRanges.erase(NextIt);
+	}
+
+	TargetBlock.FreeRanges.emplace(RangeOffset, RangeSize);
+}
+
+DeviceAllocation DeviceAllocator::Allocate(const vk::MemoryRequirements& MemReqs, vk::MemoryPropertyFlags Properties, ResourceKind Kind)
+{
+	std::lock_guard<std::mutex> Lock(M_Mutex);
+
+	const std::uint32_t MemoryTypeIndex = FindMemoryTypeIndex(MemReqs.memoryTypeBits, Properties);
+	MemoryType& Type = M_MemoryTypes[MemoryTypeIndex];
+
+	DeviceAllocation Allocation;
+	Allocation.MemoryTypeIndex = MemoryTypeIndex;
+	Allocation.Size = MemReqs.size;
+
+	const vk::DeviceSize BlockSize = PreferredBlockSize(MemoryTypeIndex);
+	const vk::DeviceSize Alignment = std::max<vk::DeviceSize>(1, MemReqs.alignment);
+
+	// Large resources get their own VkDeviceMemory rather than fragmenting a shared block.
+	if (MemReqs.size > BlockSize / 2) {
+		const std::unique_ptr<Block> Dedicated = CreateBlock(MemoryTypeIndex, MemReqs.size, Kind);
+		Allocation.Memory = Dedicated->Memory;
+		Allocation.Mapped = Dedicated->Mapped;
+		Type.DedicatedCount++;
+		Type.DedicatedBytes += MemReqs.size;
+		return Allocation;
+	}
+
+	// Buffers and optimally tiled images never share a block, which keeps bufferImageGranularity out of the picture.
+	for (std::size_t i = 0; i < Type.Blocks.size(); i++) {
+		Block* Candidate = Type.Blocks[i].get();
+		if (!Candidate || Candidate->Kind != Kind) continue;
+
+		vk::DeviceSize Offset = 0;
+		if (AllocateFromBlock(*Candidate, MemReqs.size, Alignment, Offset)) {
+			Allocation.Memory = Candidate->Memory;
+			Allocation.Offset = Offset;
+			Allocation.Mapped = Candidate->Mapped ? static_cast<std::uint8_t*>(Candidate->Mapped) + Offset : nullptr;
+			Allocation.BlockIndex = static_cast<std::uint32_t>(i);
+			return Allocation;
+		}
+	}
+
+	std::size_t NewBlockIndex = Type.Blocks.size();
+	for (std::size_t i = 0; i < Type.Blocks.size(); i++) {
+		if (!Type.Blocks[i]) {
+			NewBlockIndex = i;
+			break;
+		}
+	}
+	if (NewBlockIndex == Type.Blocks.size()) {
+		Type.Blocks.emplace_back();
+	}
+	Type.Blocks[NewBlockIndex] = CreateBlock(MemoryTypeIndex, BlockSize, Kind);
+
+	Block& NewBlock = *Type.Blocks[NewBlockIndex];
+	vk::DeviceSize Offset = 0;
+	AllocateFromBlock(NewBlock, MemReqs.size, Alignment, Offset);
+
+	Allocation.Memory = NewBlock.Memory;
+	Allocation.Offset = Offset;
+	Allocation.Mapped = NewBlock.Mapped ? static_cast<std::uint8_t*>(NewBlock.Mapped) + Offset : nullptr;
+	Allocation.BlockIndex = static_cast<std::uint32_t>(NewBlockIndex);
+	return Allocation;
+}
+
+void DeviceAllocator::Free(DeviceAllocation& Allocation)
+{
+	if (!Allocation) return;
+
+	std::lock_guard<std::mutex> Lock(M_Mutex);
+
+	MemoryType& Type = M_MemoryTypes[Allocation.MemoryTypeIndex];
+
+	if (Allocation.IsDedicated()) {
+		if (Allocation.Mapped) {
+			G_Device.unmapMemory(Allocation.Memory, G_DLD);
+		}
+		G_Device.freeMemory(Allocation.Memory, nullptr, G_DLD);
+		M_DeviceMemoryCount--;
+		Type.DedicatedCount--;
+		Type.DedicatedBytes -= Allocation.Size;
+	} else {
+		Block& OwnerBlock = *Type.Blocks[Allocation.BlockIndex];
+		FreeToBlock(OwnerBlock, Allocation.Offset);
+
+		// Keep one empty block around per memory type so load/unload cycles don't thrash vkAllocateMemory.
+		if (OwnerBlock.UsedRanges.empty()) {
+			const auto EmptyBlocks = std::count_if(Type.Blocks.begin(), Type.Blocks.end(), [&OwnerBlock](const std::unique_ptr<Block>& Item) {
+				return Item && Item->UsedRanges.empty() && Item->Kind == OwnerBlock.Kind;
+			});
+			if (EmptyBlocks > 1) {
+				DestroyBlock(OwnerBlock);
+				Type.Blocks[Allocation.BlockIndex].reset();
+			}
+		}
+	}
+
+	Allocation = DeviceAllocation{};
+}
+
+void DeviceAllocator::SetOwner(const DeviceAllocation& Allocation, void* Owner)
+{
+	if (!Allocation || Allocation.IsDedicated()) return;
+
+	std::lock_guard<std::mutex> Lock(M_Mutex);
+
+	Block& OwnerBlock = *M_MemoryTypes[Allocation.MemoryTypeIndex].Blocks[Allocation.BlockIndex];
+	const auto UsedIt = OwnerBlock.UsedRanges.find(Allocation.Offset);
+	if (UsedIt != OwnerBlock.UsedRanges.end()) {
+		UsedIt->second.Owner = Owner;
+	}
+}
+
+std::uint32_t DeviceAllocator::Defragment(std::uint32_t MemoryTypeIndex, const MoveCallback& Move)
+{
+	std::lock_guard<std::mutex> Lock(M_Mutex);
+
+	if (MemoryTypeIndex >= M_MemoryTypes.size()) return 0;
+	MemoryType& Type = M_MemoryTypes[MemoryTypeIndex];
+
+	// Drain the emptiest blocks into the free space of fuller ones so whole blocks can be returned.
+	std::vector<std::uint32_t> Order;
+	for (std::uint32_t i = 0; i < Type.Blocks.size(); i++) {
+		if (Type.Blocks[i]) Order.push_back(i);
+	}
+	std::sort(Order.begin(), Order.end(), [&Type](std::uint32_t A, std::uint32_t B) {
+		return Type.Blocks[A]->UsedBytes > Type.Blocks[B]->UsedBytes;
+	});
+
+	std::uint32_t MoveCount = 0;
+	for (auto SrcIt = Order.rbegin(); SrcIt != Order.rend(); ++SrcIt) {
+		Block& SrcBlock = *Type.Blocks[*SrcIt];
+
+		const std::vector<std::pair<vk::DeviceSize, UsedRange>> UsedRanges(SrcBlock.UsedRanges.begin(), SrcBlock.UsedRanges.end());
+		for (const auto& [SrcOffset, SrcRange] : UsedRanges) {
+			if (!SrcRange.Owner) continue;
+			const vk::DeviceSize SrcSize = SrcRange.Size;
+			for (std::uint32_t DstIndex : Order) {
+				if (DstIndex == *SrcIt) break;
+				Block& DstBlock = *Type.Blocks[DstIndex];
+				if (DstBlock.Kind != SrcBlock.Kind) continue;
+
+				vk::DeviceSize DstOffset = 0;
+				if (!AllocateFromBlock(DstBlock, SrcSize, SrcRange.Alignment, DstOffset)) continue;
+
+				DeviceAllocation From;
+				From.Memory = SrcBlock.Memory;
+				From.Offset = SrcOffset;
+				From.Size = SrcSize;
+				From.Mapped = SrcBlock.Mapped ? static_cast<std::uint8_t*>(SrcBlock.Mapped) + SrcOffset : nullptr;
+				From.MemoryTypeIndex = MemoryTypeIndex;
+				From.BlockIndex = *SrcIt;
+
+				DeviceAllocation To = From;
+				To.Memory = DstBlock.Memory;
+				To.Offset = DstOffset;
+				To.Mapped = DstBlock.Mapped ? static_cast<std::uint8_t*>(DstBlock.Mapped) + DstOffset : nullptr;
+				To.BlockIndex = DstIndex;
+
+				if (Move(SrcRange.Owner, From, To)) {
+					DstBlock.UsedRanges[DstOffset].Owner = SrcRange.Owner;
+					FreeToBlock(SrcBlock, SrcOffset);
+					MoveCount++;
+				} else {
+					FreeToBlock(DstBlock, DstOffset);
+				}
+				break;
+			}
+		}
+	}
+
+	for (auto& TypeBlock : Type.Blocks) {
+		if (TypeBlock && TypeBlock->UsedRanges.empty()) {
+			DestroyBlock(*TypeBlock);
+			TypeBlock.reset();
+		}
+	}
+
+	return MoveCount;
+}
+
+DeviceAllocator::Stats DeviceAllocator::GetStats() const
+{
+	std::lock_guard<std::mutex> Lock(M_Mutex);
+
+	Stats Result;
+	Result.DeviceMemoryCount = M_DeviceMemoryCount;
+	Result.MaxDeviceMemoryCount = M_MaxDeviceMemoryCount;
+
+	for (std::uint32_t i = 0; i < M_MemoryTypes.size(); i++) {
+		const MemoryType& Type = M_MemoryTypes[i];
+
+		MemoryTypeStats TypeStats;
+		TypeStats.MemoryTypeIndex = i;
+		TypeStats.HeapIndex = M_MemoryProperties.memoryTypes[i].heapIndex;
+		TypeStats.DedicatedCount = Type.DedicatedCount;
+		TypeStats.AllocationCount = Type.DedicatedCount;
+		TypeStats.ReservedBytes = Type.DedicatedBytes;
+		TypeStats.UsedBytes = Type.DedicatedBytes;
+
+		for (const auto& TypeBlock : Type.Blocks) {
+			if (!TypeBlock) continue;
+
+			TypeStats.BlockCount++;
+			TypeStats.AllocationCount += static_cast<std::uint32_t>(TypeBlock->UsedRanges.size());
+			TypeStats.FreeRangeCount += static_cast<std::uint32_t>(TypeBlock->FreeRanges.size());
+			TypeStats.ReservedBytes += TypeBlock->Size;
+			TypeStats.UsedBytes += TypeBlock->UsedBytes;
+			for (const auto& Range : TypeBlock->FreeRanges) {
+				TypeStats.LargestFreeRange = std::max(TypeStats.LargestFreeRange, Range.second);
+			}
+		}
+
+		if (TypeStats.ReservedBytes == 0) continue;
+
+		Result.ReservedBytes += TypeStats.ReservedBytes;
+		Result.UsedBytes += TypeStats.UsedBytes;
+		Result.MemoryTypes.push_back(TypeStats);
+	}
+
+	return Result;
+}
+
+void UploadManager::Init()
+{
+	const vk::CommandPoolCreateInfo CommandPoolCI = vk::CommandPoolCreateInfo{
+		vk::CommandPoolCreateFlagBits::eResetCommandBuffer | vk::CommandPoolCreateFlagBits::eTransient,
+		G_TransferQueueFamilyIndex.value()
+	};
+	M_CommandPool = G_Device.createCommandPool(CommandPoolCI, nullptr, G_DLD);
+
+	vk::SemaphoreTypeCreateInfo SemaphoreTypeCI = vk::SemaphoreTypeCreateInfo(vk::SemaphoreType::eTimeline, 0);
+	vk::SemaphoreCreateInfo SemaphoreCI = vk::SemaphoreCreateInfo{};
+	SemaphoreCI.setPNext(&SemaphoreTypeCI);
+	M_Timeline = G_Device.createSemaphore(SemaphoreCI, nullptr, G_DLD);
+
+	const vk::BufferCreateInfo RingBufferCI = vk::BufferCreateInfo(
+		{},
+		G_UploadRingSize,
+		vk::BufferUsageFlagBits::eTransferSrc,
+		vk::SharingMode::eExclusive,
+		0,
+		nullptr
+		);
+	M_RingBuffer = G_Device.createBuffer(RingBufferCI, nullptr, G_DLD);
+
+	const vk::MemoryRequirements MemReqs = G_Device.getBufferMemoryRequirements(M_RingBuffer, G_DLD);
+	M_RingAllocation = G_DeviceAllocator.Allocate(MemReqs, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, DeviceAllocator::ResourceKind::eBuffer);
+	G_Device.bindBufferMemory(M_RingBuffer, M_RingAllocation.Memory, M_RingAllocation.Offset, G_DLD);
+
+	M_RingSize = G_UploadRingSize;
+	M_RingHead = 0;
+	M_RingTail = 0;
+	M_NextValue = 1;
+	M_CompletedValue = 0;
+	M_Stats = Stats{};
+	M_Stats.RingSize = M_RingSize;
+}
+
+void UploadManager::Shutdown()
+{
+	if (!M_Timeline) return;
+
+	Wait(Flush());
+
+	std::lock_guard<std::mutex> Lock(M_Mutex);
+
+	if (M_OpenBatch.CommandBuffer) {
+		M_FreeCommandBuffers.push_back(M_OpenBatch.CommandBuffer);
+		M_OpenBatch = Batch{};
+	}
+	if (!M_FreeCommandBuffers.empty()) {
+		G_Device.freeCommandBuffers(M_CommandPool, M_FreeCommandBuffers, G_DLD);
+		M_FreeCommandBuffers.clear();
+	}
+
+	if (M_RingBuffer) {
+		G_Device.destroyBuffer(M_RingBuffer, nullptr, G_DLD);
+		M_RingBuffer = nullptr;
+	}
+	G_DeviceAllocator.Free(M_RingAllocation);
+
+	G_Device.destroySemaphore(M_Timeline, nullptr, G_DLD);
+	M_Timeline = nullptr;
+
+	G_Device.destroyCommandPool(M_CommandPool, nullptr, G_DLD);
+	M_CommandPool = nullptr;
+}
+
+bool UploadManager::AllocateFromRing(vk::DeviceSize Size, std::uint64_t& OutPosition)
+{
+	// Head and tail are running byte counters; a chunk never straddles the end of the ring.
+	static constexpr std::uint64_t Alignment = 16;
+
+	std::uint64_t Position = (M_RingHead + Alignment - 1) / Alignment * Alignment;
+	if ((Position % M_RingSize) + Size > M_RingSize) {
+		Position = (Position / M_RingSize + 1) * M_RingSize;
+	}
+	if (Position + Size - M_RingTail > M_RingSize) return false;
+
+	M_RingHead = Position + Size;
+	OutPosition = Position;
+	return true;
+}
+
+UploadManager::Token UploadManager::UploadBuffer(vk::Buffer DstBuffer, vk::DeviceSize DstOffset, const void* DataPtr, vk::DeviceSize ByteSize)
+{
+	std::unique_lock<std::mutex> Lock(M_Mutex);
+
+	const vk::DeviceSize MaxChunkSize = M_RingSize / 2;
+	const std::uint8_t* SrcBytes = static_cast<const std::uint8_t*>(DataPtr);
+
+	for (vk::DeviceSize Copied = 0; Copied < ByteSize;) {
+		const vk::DeviceSize ChunkSize = std::min(ByteSize - Copied, MaxChunkSize);
+
+		std::uint64_t Position = 0;
+		while (!AllocateFromRing(ChunkSize, Position)) {
+			// The ring is full: push out what we have and block on the oldest batch to reclaim its range.
+			if (M_bOpenBatchHasCopies) SubmitOpenBatch();
+			if (M_InFlightBatches.empty())
+				throw std::runtime_error("Upload ring is too small for the requested copy");
+
+			const Token OldestValue = M_InFlightBatches.front().Value;
+			const vk::SemaphoreWaitInfo WaitInfo = vk::SemaphoreWaitInfo({}, 1, &M_Timeline, &OldestValue);
+			(void)G_Device.waitSemaphores(WaitInfo, std::numeric_limits<std::uint64_t>::max(), G_DLD);
+			RetireCompleted(QueryCompleted());
+			M_Stats.StallCount++;
+		}
+
+		const vk::DeviceSize RingOffset = Position % M_RingSize;
+		std::uint8_t* Dst = static_cast<std::uint8_t*>(M_RingAllocation.Mapped) + RingOffset;
+		if (SrcBytes) {
+			std::memcpy(Dst, SrcBytes + Copied, ChunkSize);
+		} else {
+			std::memset(Dst, 0, ChunkSize);
+		}
+
+		if (!M_OpenBatch.CommandBuffer) {
+			if (M_FreeCommandBuffers.empty()) {
+				const vk::CommandBufferAllocateInfo CommandBufferAI = vk::CommandBufferAllocateInfo(M_CommandPool, vk::CommandBufferLevel::ePrimary, 1);
+				M_OpenBatch.CommandBuffer = G_Device.allocateCommandBuffers(CommandBufferAI, G_DLD)[0];
+			} else {
+				M_OpenBatch.CommandBuffer = M_FreeCommandBuffers.back();
+				M_FreeCommandBuffers.pop_back();
+				M_OpenBatch.CommandBuffer.reset({}, G_DLD);
+			}
+		}
+		if (!M_bOpenBatchHasCopies) {
+			const vk::CommandBufferBeginInfo CommandBufferBI = vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+			M_OpenBatch.CommandBuffer.begin(CommandBufferBI, G_DLD);
+			M_bOpenBatchHasCopies = true;
+		}
+
+		const vk::BufferCopy BufferCopy = vk::BufferCopy(RingOffset, DstOffset + Copied, ChunkSize);
+		M_OpenBatch.CommandBuffer.copyBuffer(M_RingBuffer, DstBuffer, BufferCopy, G_DLD);
+
+		M_Stats.BytesUploaded += ChunkSize;
+		M_Stats.CopiesRecorded++;
+		Copied += ChunkSize;
+	}
+
+	// The open batch will be submitted with the next timeline value.
+	return M_NextValue;
+}
+
+void UploadManager::SubmitOpenBatch()
+{
+	M_OpenBatch.CommandBuffer.end(G_DLD);
+	M_OpenBatch.Value = M_NextValue++;
+	M_OpenBatch.RingEnd = M_RingHead;
+
+	const vk::TimelineSemaphoreSubmitInfo TimelineSI = vk::TimelineSemaphoreSubmitInfo(0, nullptr, 1, &M_OpenBatch.Value);
+	vk::SubmitInfo SI = vk::SubmitInfo(0, nullptr, nullptr, 1, &M_OpenBatch.CommandBuffer, 1, &M_Timeline);
+	SI.setPNext(&TimelineSI);
+	G_TransferQueue.submit(SI, nullptr, G_DLD);
+
+	M_InFlightBatches.push_back(M_OpenBatch);
+	M_OpenBatch = Batch{};
+	M_bOpenBatchHasCopies = false;
+
+	M_Stats.BatchesSubmitted++;
+	M_Stats.SubmittedToken = M_InFlightBatches.back().Value;
+}
+
+void UploadManager::RetireCompleted(Token CompletedValue)
+{
+	M_CompletedValue = std::max(M_CompletedValue, CompletedValue);
+
+	while (!M_InFlightBatches.empty() && M_InFlightBatches.front().Value <= M_CompletedValue) {
+		M_RingTail = M_InFlightBatches.front().RingEnd;
+		M_FreeCommandBuffers.push_back(M_InFlightBatches.front().CommandBuffer);
+		M_InFlightBatches.pop_front();
+	}
+	if (M_InFlightBatches.empty() && !M_bOpenBatchHasCopies) {
+		M_RingTail = M_RingHead;
+	}
+}
+
+UploadManager::Token UploadManager::QueryCompleted() const
+{
+	return G_Device.getSemaphoreCounterValue(M_Timeline, G_DLD);
+}
+
+UploadManager::Token UploadManager::Flush()
+{
+	std::lock_guard<std::mutex> Lock(M_Mutex);
+
+	if (M_bOpenBatchHasCopies) SubmitOpenBatch();
+	return M_NextValue - 1;
+}
+
+void UploadManager::Update()
+{
+	std::lock_guard<std::mutex> Lock(M_Mutex);
+
+	if (M_bOpenBatchHasCopies) SubmitOpenBatch();
+	if (!M_InFlightBatches.empty()) RetireCompleted(QueryCompleted());
+}
+
+bool UploadManager::IsComplete(Token UploadToken)
+{
+	std::lock_guard<std::mutex> Lock(M_Mutex);
+
+	if (UploadToken <= M_CompletedValue) return true;
+	if (UploadToken >= M_NextValue) return false;
+
+	RetireCompleted(QueryCompleted());
+	return UploadToken <= M_CompletedValue;
+}
+
+void UploadManager::Wait(Token UploadToken)
+{
+	TRACE_SCOPE("UploadManager::Wait");
+	{
+		std::lock_guard<std::mutex> Lock(M_Mutex);
+		if (UploadToken <= M_CompletedValue) return;
+		if (UploadToken >= M_NextValue && M_bOpenBatchHasCopies) SubmitOpenBatch();
+		UploadToken = std::min(UploadToken, M_NextValue - 1);
+	}
+
+	const vk::SemaphoreWaitInfo WaitInfo = vk::SemaphoreWaitInfo({}, 1, &M_Timeline, &UploadToken);
+	(void)G_Device.waitSemaphores(WaitInfo, std::numeric_limits<std::uint64_t>::max(), G_DLD);
+
+	std::lock_guard<std::mutex> Lock(M_Mutex);
+	RetireCompleted(QueryCompleted());
+}
+
+UploadManager::Stats UploadManager::GetStats() const
+{
+	std::lock_guard<std::mutex> Lock(M_Mutex);
+
+	Stats Result = M_Stats;
+	Result.BatchesInFlight = static_cast<std::uint32_t>(M_InFlightBatches.size());
+	Result.RingUsed = M_RingHead - M_RingTail;
+	Result.CompletedToken = M_CompletedValue;
+	return Result;
+}
+
+void PaletteRing::Init(std::uint32_t MatrixCapacity)
+{
+	const vk::PhysicalDeviceLimits Limits = G_PhysicalDevice.getProperties(G_DLD).limits;
+	const vk::DeviceSize Alignment = std::max<vk::DeviceSize>(Limits.minStorageBufferOffsetAlignment, 64);
+
+	M_MatrixCapacity = std::max(MatrixCapacity, 1U);
+	M_SliceSize = (vk::DeviceSize(M_MatrixCapacity) * sizeof(DirectX::XMFLOAT4X4) + Alignment - 1) / Alignment * Alignment;
+
+	const vk::BufferCreateInfo BufferCI = vk::BufferCreateInfo(
+		{},
+		M_SliceSize * G_FramesInFlight,
+		vk::BufferUsageFlagBits::eStorageBuffer,
+		vk::SharingMode::eExclusive,
+		0,
+		nullptr
+		);
+	M_Buffer = G_Device.createBuffer(BufferCI, nullptr, G_DLD);
+
+	// Prefer host-visible VRAM (resizable BAR) so the vertex shader reads palettes locally; fall back to system memory.
+	const vk::MemoryRequirements MemReqs = G_Device.getBufferMemoryRequirements(M_Buffer, G_DLD);
+	const vk::MemoryPropertyFlags DeviceLocalFlags = vk::MemoryPropertyFlagBits::eDeviceLocal | vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+	const vk::PhysicalDeviceMemoryProperties MemoryProperties = G_PhysicalDevice.getMemoryProperties(G_DLD);
+
+	M_bDeviceLocal = false;
+	for (std::uint32_t i = 0; i < MemoryProperties.memoryTypeCount; i++) {
+		if ((MemReqs.memoryTypeBits & (1U << i)) && (MemoryProperties.memoryTypes[i].propertyFlags & DeviceLocalFlags) == DeviceLocalFlags) {
+			M_bDeviceLocal = true;
+			break;
+		}
+	}
+
+	M_Allocation = G_DeviceAllocator.Allocate(MemReqs, M_bDeviceLocal ? DeviceLocalFlags : (vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent), DeviceAllocator::ResourceKind::eBuffer);
+	G_Device.bindBufferMemory(M_Buffer, M_Allocation.Memory, M_Allocation.Offset, G_DLD);
+
+	const vk::DescriptorPoolSize PoolSize(vk::DescriptorType::eStorageBufferDynamic, 1);
+	const vk::DescriptorPoolCreateInfo DescriptorPoolCI = vk::DescriptorPoolCreateInfo({}, 1, 1, &PoolSize);
+	M_DescriptorPool = G_Device.createDescriptorPool(DescriptorPoolCI, nullptr, G_DLD);
+
+	const vk::DescriptorSetAllocateInfo DescriptorSetAI = vk::DescriptorSetAllocateInfo(M_DescriptorPool, 1, &G_SkinsDescriptorSetLayout);
+	M_DescriptorSet = G_Device.allocateDescriptorSets(DescriptorSetAI, G_DLD)[0];
+
+	const vk::DescriptorBufferInfo DescriptorBI = vk::DescriptorBufferInfo(M_Buffer, 0, M_SliceSize);
+	const vk::WriteDescriptorSet Write = vk::WriteDescriptorSet(M_DescriptorSet, 0, 0, 1, vk::DescriptorType::eStorageBufferDynamic, nullptr, &DescriptorBI, nullptr);
+	G_Device.updateDescriptorSets(Write, nullptr, G_DLD);
+
+	M_FrameIndex = 0;
+	M_MatrixCount = 0;
+}
+
+void PaletteRing::Shutdown()
+{
+	if (M_DescriptorPool) {
+		G_Device.destroyDescriptorPool(M_DescriptorPool, nullptr, G_DLD);
+		M_DescriptorPool = nullptr;
+		M_DescriptorSet = nullptr;
+	}
+
+	if (M_Buffer) {
+		G_Device.destroyBuffer(M_Buffer, nullptr, G_DLD);
+		M_Buffer = nullptr;
+	}
+	G_DeviceAllocator.Free(M_Allocation);
+}
+
+void PaletteRing::BeginFrame(std::uint32_t FrameIndex)
+{
+	M_FrameIndex = FrameIndex;
+	M_MatrixCount = 0;
+}
+
+void PaletteRing::EndFrame()
+{
+#if defined(_XM_SSE_INTRINSICS_)
+	// Streaming stores are weakly ordered; fence them before the submit that makes the GPU read them.
+	_mm_sfence();
+#endif
+}
+
+std::uint32_t PaletteRing::Allocate(std::uint32_t MatrixCount, DirectX::XMFLOAT4X4*& OutDst)
+{
+	if (M_MatrixCount + MatrixCount > M_MatrixCapacity)
+		throw std::runtime_error("Palette ring overflow");
+
+	const std::uint32_t Base = M_MatrixCount;
+	M_MatrixCount += MatrixCount;
+
+	OutDst = reinterpret_cast<DirectX::XMFLOAT4X4*>(static_cast<std::uint8_t*>(M_Allocation.Mapped) + M_FrameIndex * M_SliceSize) + Base;
+	return Base;
+}
+
+PaletteRing::Stats PaletteRing::GetStats() const
+{
+	Stats Result;
+	Result.SliceSize = M_SliceSize;
+	Result.BytesWritten = vk::DeviceSize(M_MatrixCount) * sizeof(DirectX::XMFLOAT4X4);
+	Result.MatrixCount = M_MatrixCount;
+	Result.MatrixCapacity = M_MatrixCapacity;
+	Result.bDeviceLocal = M_bDeviceLocal;
+#if defined(_XM_SSE_INTRINSICS_)
+	Result.bStreamingStores = true;
+#endif
+	return Result;
+}
+
+void DrawList::Init()
+{
+	// Indirect draws address per-draw data through firstInstance, so both features are needed for anything but the direct path.
+	if (G_bDirectDraws || !G_bMultiDrawIndirect) {
+		M_Path = DrawPath::eDirect;
+	} else {
+		M_Path = G_bDrawIndirectCount ? DrawPath::eIndirectCount : DrawPath::eIndirect;
+	}
+
+	const vk::DescriptorPoolSize PoolSize(vk::DescriptorType::eStorageBuffer, 1 + 4 * G_FramesInFlight);
+	const vk::DescriptorPoolCreateInfo DescriptorPoolCI = vk::DescriptorPoolCreateInfo({}, 1 + G_FramesInFlight, 1, &PoolSize);
+	M_DescriptorPool = G_Device.createDescriptorPool(DescriptorPoolCI, nullptr, G_DLD);
+}
+
+void DrawList::Shutdown()
+{
+	DestroyBuffers();
+
+	if (M_DescriptorPool) {
+		G_Device.destroyDescriptorPool(M_DescriptorPool, nullptr, G_DLD);
+		M_DescriptorPool = nullptr;
+	}
+}
+
+void DrawList::DestroyBuffers()
+{
+	if (!G_Device) return;
+
+	G_UploadManager.Wait(M_UploadToken);
+	M_UploadToken = 0;
+
+	DestroyBuffer(M_CommandBufferTuple);
+	DestroyBuffer(M_DrawDataBufferTuple);
+	for (std::uint32_t i = 0; i < G_FramesInFlight; i++) {
+		DestroyBuffer(M_CulledCommandBufferTuples[i]);
+		DestroyBuffer(M_DrawCountBufferTuples[i]);
+	}
+	M_Commands.clear();
+}
+
+void DrawList::Build(const VkGltfModel& Model, const std::vector<ModelInstance>& Instances)
+{
+	DestroyBuffers();
+	G_Device.resetDescriptorPool(M_DescriptorPool, {}, G_DLD);
+
+	std::vector<DrawData> DrawDatas;
+	M_NumVertices = 0;
+
+	for (std::size_t InstanceIndex = 0; InstanceIndex < Instances.size(); InstanceIndex++) {
+		const ModelInstance& Instance = Instances[InstanceIndex];
+		const DirectX::XMMATRIX Transform = DirectX::XMLoadFloat4x4(&Instance.Transform);
+
+		// UpdateModelInstances hands out palettes in instance order, so the base is known up front; shared
+		// poses break that order and go through the per-frame remap table instead.
+		const bool bSharedPoses = G_PoseCacheSettings.bEnabled;
+		const bool bBaked = G_BakedPalettesSettings.bEnabled;
+		const std::uint32_t InstancePaletteBase = (bSharedPoses || bBaked) ? 0 : static_cast<std::uint32_t>(InstanceIndex) * Model.M_PaletteMatrixCount;
+
+		// The phase is fixed here; the clock that moves every instance along lives in the frame's slice.
+		const VertexAnimationAtlas::ClipRange VatClip = G_VertexAnimationAtlas.GetClipRange(Instance.AnimationIndex);
+		const float VatFrameOffset = (Instance.AnimationTime - VatClip.StartTime) * VatClip.FrameRate;
+
+		DirectX::XMFLOAT4 BoundingSphere = Model.M_BoundingSphere;
+		DirectX::XMStoreFloat3(reinterpret_cast<DirectX::XMFLOAT3*>(&BoundingSphere), DirectX::XMVector3Transform(DirectX::XMLoadFloat3(reinterpret_cast<const DirectX::XMFLOAT3*>(&Model.M_BoundingSphere)), Transform));
+
+		for (const auto& Node : Model.M_LinearNodes) {
+			if (Node->Skin < 0) continue;
+
+			for (const auto& Primitive : Node->MeshData.Primitives) {
+				DrawData Data{};
+				Data.Model = Instance.Transform;
+				std::memcpy(&Data.Color, DirectX::Colors::SkyBlue.f, sizeof(Data.Color));
+				Data.BoundingSphere = BoundingSphere;
+				Data.PaletteBase = InstancePaletteBase + Model.M_Skins[Node->Skin].PaletteOffset;
+				Data.MorphWeightBase = (Node->MorphTargetCount > 0) ? InstancePaletteBase + Model.M_MorphWeightOffset : DrawData::NoMorphWeights;
+				Data.PaletteSlot = bSharedPoses ? static_cast<std::uint32_t>(InstanceIndex) : DrawData::NoPaletteSlot;
+				Data.BakedSlot = bBaked ? static_cast<std::uint32_t>(InstanceIndex) : DrawData::NoBakedSlot;
+				Data.VatFirstFrame = VatClip.FirstFrame;
+				Data.VatFrameCount = VatClip.FrameCount;
+				Data.VatClip = G_VertexAnimationAtlas.GetClipIndex(Instance.AnimationIndex);
+				Data.VatFrameOffset = VatFrameOffset;
+
+				const vk::DrawIndexedIndirectCommand Command = vk::DrawIndexedIndirectCommand(
+					Primitive.IndexCount,
+					1,
+					Primitive.FirstIndex,
+					static_cast<std::int32_t>(Primitive.FirstVertex),
+					static_cast<std::uint32_t>(DrawDatas.size())
+				);
+
+				M_Commands.push_back(Command);
+				DrawDatas.push_back(Data);
+				M_NumVertices += Primitive.VertexCount;
+			}
+		}
+	}
+
+	if (M_Commands.empty()) return;
+
+	const vk::DeviceSize CommandsByteSize = M_Commands.size() * sizeof(vk::DrawIndexedIndirectCommand);
+
+	UploadManager::Token Token = 0;
+	M_CommandBufferTuple = CreateBuffer(vk::BufferUsageFlagBits::eStorageBuffer, CommandsByteSize, M_Commands.data(), true, &Token);
+	M_DrawDataBufferTuple = CreateBuffer(vk::BufferUsageFlagBits::eStorageBuffer, DrawDatas.size() * sizeof(DrawData), DrawDatas.data(), true, &Token);
+
+	if (M_Path != DrawPath::eDirect) {
+		const std::uint32_t ZeroCount = 0;
+		for (std::uint32_t i = 0; i < G_FramesInFlight; i++) {
+			M_CulledCommandBufferTuples[i] = CreateBuffer(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer, CommandsByteSize, M_Commands.data(), true, &Token);
+			M_DrawCountBufferTuples[i] = CreateBuffer(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer | vk::BufferUsageFlagBits::eTransferDst, sizeof(std::uint32_t), const_cast<std::uint32_t*>(&ZeroCount), true, &Token);
+		}
+	}
+	M_UploadToken = Token;
+	G_UploadManager.Flush();
+
+	const vk::DescriptorSetAllocateInfo DrawDataSetAI = vk::DescriptorSetAllocateInfo(M_DescriptorPool, 1, &G_DrawDataDescriptorSetLayout);
+	M_DrawDataDescriptorSet = G_Device.allocateDescriptorSets(DrawDataSetAI, G_DLD)[0];
+
+	const vk::DescriptorBufferInfo DrawDataBI = vk::DescriptorBufferInfo(std::get<0>(M_DrawDataBufferTuple), 0, vk::WholeSize);
+	const vk::WriteDescriptorSet DrawDataWrite = vk::WriteDescriptorSet(M_DrawDataDescriptorSet, 0, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &DrawDataBI, nullptr);
+	G_Device.updateDescriptorSets(DrawDataWrite, nullptr, G_DLD);
+
+	if (M_Path == DrawPath::eDirect) return;
+
+	for (std::uint32_t i = 0; i < G_FramesInFlight; i++) {
+		const vk::DescriptorSetAllocateInfo CullSetAI = vk::DescriptorSetAllocateInfo(M_DescriptorPool, 1, &G_CullDescriptorSetLayout);
+		M_CullDescriptorSets[i] = G_Device.allocateDescriptorSets(CullSetAI, G_DLD)[0];
+
+		const vk::DescriptorBufferInfo CullBIs[4] = {
+			vk::DescriptorBufferInfo(std::get<0>(M_CommandBufferTuple), 0, vk::WholeSize),
+			vk::DescriptorBufferInfo(std::get<0>(M_DrawDataBufferTuple), 0, vk::WholeSize),
+			vk::DescriptorBufferInfo(std::get<0>(M_CulledCommandBufferTuples[i]), 0, vk::WholeSize),
+			vk::DescriptorBufferInfo(std::get<0>(M_DrawCountBufferTuples[i]), 0, vk::WholeSize),
+		};
+		const vk::WriteDescriptorSet CullWrite = vk::WriteDescriptorSet(M_CullDescriptorSets[i], 0, 0, 4, vk::DescriptorType::eStorageBuffer, nullptr, CullBIs, nullptr);
+		G_Device.updateDescriptorSets(CullWrite, nullptr, G_DLD);
+	}
+}
+
+void DrawList::RecordCull(vk::CommandBuffer CommandBuffer, std::uint32_t FrameIndex, DirectX::FXMMATRIX ProjView) const
+{
+	if (M_Path == DrawPath::eDirect || M_Commands.empty()) return;
+
+	struct CullPushConstants
+	{
+		DirectX::XMFLOAT4 FrustumPlanes[6];
+		std::uint32_t     NumDraws;
+		std::uint32_t     bCompact;
+	};
+
+	// Gribb-Hartmann plane extraction; DirectXMath uses row vectors, so the clip-space rows are the matrix columns.
+	DirectX::XMFLOAT4X4 M;
+	DirectX::XMStoreFloat4x4(&M, ProjView);
+
+	const auto NormalizedPlane = [](float A, float B, float C, float D) {
+		const float InvLength = 1.0f / std::sqrt(A * A + B * B + C * C);
+		return DirectX::XMFLOAT4(A * InvLength, B * InvLength, C * InvLength, D * InvLength);
+	};
+	const auto ClipPlane = [&M, &NormalizedPlane](int Column, float Sign) {
+		return NormalizedPlane(M.m[0][3] + Sign * M.m[0][Column], M.m[1][3] + Sign * M.m[1][Column], M.m[2][3] + Sign * M.m[2][Column], M.m[3][3] + Sign * M.m[3][Column]);
+	};
+
+	CullPushConstants PushConstants;
+	PushConstants.FrustumPlanes[0] = ClipPlane(0, 1.0f);
+	PushConstants.FrustumPlanes[1] = ClipPlane(0, -1.0f);
+	PushConstants.FrustumPlanes[2] = ClipPlane(1, 1.0f);
+	PushConstants.FrustumPlanes[3] = ClipPlane(1, -1.0f);
+	PushConstants.FrustumPlanes[4] = ClipPlane(2, -1.0f);
+	// Clip depth is [0, w], so the near plane is the z row on its own.
+	PushConstants.FrustumPlanes[5] = NormalizedPlane(M.m[0][2], M.m[1][2], M.m[2][2], M.m[3][2]);
+	PushConstants.NumDraws = static_cast<std::uint32_t>(M_Commands.size());
+	PushConstants.bCompact = (M_Path == DrawPath::eIndirectCount) ? 1 : 0;
+
+	if (M_Path == DrawPath::eIndirectCount) {
+		CommandBuffer.fillBuffer(std::get<0>(M_DrawCountBufferTuples[FrameIndex]), 0, sizeof(std::uint32_t), 0, G_DLD);
+
+		const vk::MemoryBarrier FillBarrier = vk::MemoryBarrier(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+		CommandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, {}, FillBarrier, nullptr, nullptr, G_DLD);
+	}
+
+	CommandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, G_CullPipeline, G_DLD);
+	CommandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, G_CullPipelineLayout, 0, M_CullDescriptorSets[FrameIndex], nullptr, G_DLD);
+	CommandBuffer.pushConstants(G_CullPipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(CullPushConstants), &PushConstants, G_DLD);
+	CommandBuffer.dispatch((PushConstants.NumDraws + 63) / 64, 1, 1, G_DLD);
+
+	const vk::MemoryBarrier CullBarrier = vk::MemoryBarrier(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eIndirectCommandRead);
+	CommandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eDrawIndirect, {}, CullBarrier, nullptr, nullptr, G_DLD);
+}
+
+void DrawList::RecordDraws(vk::CommandBuffer CommandBuffer, std::uint32_t FrameIndex, std::uint32_t FirstDraw, std::uint32_t DrawCount) const
+{
+	const std::uint32_t TotalDraws = static_cast<std::uint32_t>(M_Commands.size());
+	if (FirstDraw >= TotalDraws) return;
+
+	const vk::DescriptorSet DrawDataDescriptorSet = M_DrawDataDescriptorSet;
+	CommandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, G_PipelineLayout, 1, DrawDataDescriptorSet, nullptr, G_DLD);
+
+	const std::uint32_t NumDraws = std::min(DrawCount, TotalDraws - FirstDraw);
+	static constexpr std::uint32_t Stride = sizeof(vk::DrawIndexedIndirectCommand);
+
+	switch (M_Path)
+	{
+	case DrawPath::eIndirectCount:
+		CommandBuffer.drawIndexedIndirectCount(std::get<0>(M_CulledCommandBufferTuples[FrameIndex]), 0, std::get<0>(M_DrawCountBufferTuples[FrameIndex]), 0, TotalDraws, Stride, G_DLD);
+		break;
+	case DrawPath::eIndirect:
+		CommandBuffer.drawIndexedIndirect(std::get<0>(M_CulledCommandBufferTuples[FrameIndex]), vk::DeviceSize(FirstDraw) * Stride, NumDraws, Stride, G_DLD);
+		break;
+	default:
+		for (std::uint32_t i = FirstDraw; i < FirstDraw + NumDraws; i++) {
+			const vk::DrawIndexedIndirectCommand& Command = M_Commands[i];
+			CommandBuffer.drawIndexed(Command.indexCount, Command.instanceCount, Command.firstIndex, Command.vertexOffset, Command.firstInstance, G_DLD);
+		}
+		break;
+	}
+}
+
+DrawList::Stats DrawList::GetStats() const
+{
+	Stats Result;
+	Result.NumDraws = static_cast<std::uint32_t>(M_Commands.size());
+	Result.NumVertices = M_NumVertices;
+	Result.Path = M_Path;
+	return Result;
+}
+
+void CommandRecorder::Init(std::uint32_t WorkerCount)
+{
+	M_WorkerCount = WorkerCount;
+	if (M_WorkerCount == 0) return;
+
+	const vk::CommandPoolCreateInfo CommandPoolCI = vk::CommandPoolCreateInfo{
+		vk::CommandPoolCreateFlagBits::eTransient,
+		G_GraphicsQueueFamilyIndex.value()
+	};
+
+	M_Slots.resize(M_WorkerCount + 1);
+	M_PrevFrameStats.resize(M_WorkerCount + 1);
+	for (auto& Slot : M_Slots) {
+		for (std::uint32_t i = 0; i < G_FramesInFlight; i++) {
+			Slot.Pools[i] = G_Device.createCommandPool(CommandPoolCI, nullptr, G_DLD);
+
+			const vk::CommandBufferAllocateInfo CommandBufferAI = vk::CommandBufferAllocateInfo(Slot.Pools[i], vk::CommandBufferLevel::eSecondary, 1);
+			Slot.CommandBuffers[i] = G_Device.allocateCommandBuffers(CommandBufferAI, G_DLD)[0];
+		}
+	}
+}
+
+void CommandRecorder::Shutdown()
+{
+	for (auto& Slot : M_Slots) {
+		for (std::uint32_t i = 0; i < G_FramesInFlight; i++) {
+			if (Slot.Pools[i]) {
+				G_Device.destroyCommandPool(Slot.Pools[i], nullptr, G_DLD);
+				Slot.Pools[i] = nullptr;
+				Slot.CommandBuffers[i] = nullptr;
+			}
+		}
+	}
+	M_Slots.clear();
+	M_PrevFrameStats.clear();
+	M_WorkerCount = 0;
+}
+
+void CommandRecorder::BeginFrame(std::uint32_t FrameIndex)
+{
+	// The frame's fence has been waited on, so every secondary from this slot of the ring is retired.
+	// Stats are snapshotted here because the UI reads them while the workers are recording.
+	M_FrameIndex = FrameIndex;
+	for (std::size_t i = 0; i < M_Slots.size(); i++) {
+		G_Device.resetCommandPool(M_Slots[i].Pools[M_FrameIndex], {}, G_DLD);
+		M_PrevFrameStats[i] = M_Slots[i].LastStats;
+		M_Slots[i].LastStats = SlotStats{};
+		M_Slots[i].bRecorded = false;
+	}
+}
+
+vk::CommandBuffer CommandRecorder::BeginSecondary(std::uint32_t SlotIndex, vk::RenderPass RenderPass, vk::Framebuffer Framebuffer)
+{
+	Slot& CurrentSlot = M_Slots[SlotIndex];
+	CurrentSlot.StartTime = std::chrono::high_resolution_clock::now();
+
+	const vk::CommandBufferInheritanceInfo InheritanceInfo = vk::CommandBufferInheritanceInfo(RenderPass, 0, Framebuffer);
+	const vk::CommandBufferBeginInfo BeginInfo = vk::CommandBufferBeginInfo(
+		vk::CommandBufferUsageFlagBits::eOneTimeSubmit | vk::CommandBufferUsageFlagBits::eRenderPassContinue,
+		&InheritanceInfo
+	);
+
+	vk::CommandBuffer CommandBuffer = CurrentSlot.CommandBuffers[M_FrameIndex];
+	CommandBuffer.begin(BeginInfo, G_DLD);
+	return CommandBuffer;
+}
+
+void CommandRecorder::EndSecondary(std::uint32_t SlotIndex, std::uint32_t DrawCount)
+{
+	Slot& CurrentSlot = M_Slots[SlotIndex];
+	CurrentSlot.CommandBuffers[M_FrameIndex].end(G_DLD);
+
+	const auto EndTime = std::chrono::high_resolution_clock::now();
+	CurrentSlot.LastStats.RecordMilliseconds = float(std::chrono::duration_cast<std::chrono::microseconds>(EndTime - CurrentSlot.StartTime).count()) / 1000.0f;
+	CurrentSlot.LastStats.DrawCount = DrawCount;
+	CurrentSlot.bRecorded = true;
+}
+
+std::vector<vk::CommandBuffer> CommandRecorder::CollectRecorded() const
+{
+	std::vector<vk::CommandBuffer> Result;
+	for (std::uint32_t i = 0; i < M_WorkerCount; i++) {
+		if (M_Slots[i].bRecorded) Result.push_back(M_Slots[i].CommandBuffers[M_FrameIndex]);
+	}
+	return Result;
+}
+
+vk::CommandBuffer CommandRecorder::GetMainSecondary() const
+{
+	const Slot& MainSlot = M_Slots[GetMainSlot()];
+	return MainSlot.bRecorded ? MainSlot.CommandBuffers[M_FrameIndex] : vk::CommandBuffer{};
+}
+
+CommandRecorder::Stats CommandRecorder::GetStats() const
+{
+	Stats Result;
+	Result.Slots = M_PrevFrameStats;
+	Result.WallMilliseconds = M_WallMilliseconds;
+	return Result;
+}
+
+void CommandCache::Init()
+{
+	const vk::CommandPoolCreateInfo CommandPoolCI = vk::CommandPoolCreateInfo{
+		vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
+		G_GraphicsQueueFamilyIndex.value()
+	};
+	M_CommandPool = G_Device.createCommandPool(CommandPoolCI, nullptr, G_DLD);
+
+	const vk::CommandBufferAllocateInfo CommandBufferAI = vk::CommandBufferAllocateInfo(M_CommandPool, vk::CommandBufferLevel::eSecondary, 3 * G_FramesInFlight);
+	const std::vector<vk::CommandBuffer> CommandBuffers = G_Device.allocateCommandBuffers(CommandBufferAI, G_DLD);
+	for (std::uint32_t i = 0; i < G_FramesInFlight; i++) {
+		M_FrameCommands[i].Cull = CommandBuffers[3 * i + 0];
+		M_FrameCommands[i].Draws = CommandBuffers[3 * i + 1];
+		M_UiCommandBuffers[i] = CommandBuffers[3 * i + 2];
+		M_FrameGenerations[i] = 0;
+	}
+}
+
+void CommandCache::Shutdown()
+{
+	if (M_CommandPool) {
+		G_Device.destroyCommandPool(M_CommandPool, nullptr, G_DLD);
+		M_CommandPool = nullptr;
+	}
+	M_FrameCommands = {};
+	M_UiCommandBuffers = {};
+	M_FrameGenerations = {};
+}
+
+const CommandCache::FrameCommands& CommandCache::Acquire(std::uint32_t FrameIndex, const RecordFunc& Record)
+{
+	FrameCommands& Commands = M_FrameCommands[FrameIndex];
+
+	if (M_FrameGenerations[FrameIndex] == M_Generation) {
+		M_ReplayedFrames++;
+		return Commands;
+	}
+
+	// No one-time-submit: these are executed again every time the slot comes around. The slot's fence
+	// has been waited on, so neither buffer is pending and both may be reset.
+	const vk::CommandBufferInheritanceInfo CullInheritanceInfo = vk::CommandBufferInheritanceInfo();
+	const vk::CommandBufferBeginInfo CullBeginInfo = vk::CommandBufferBeginInfo({}, &CullInheritanceInfo);
+
+	const vk::CommandBufferInheritanceInfo DrawsInheritanceInfo = vk::CommandBufferInheritanceInfo(G_RenderPass, 0, nullptr);
+	const vk::CommandBufferBeginInfo DrawsBeginInfo = vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eRenderPassContinue, &DrawsInheritanceInfo);
+
+	Commands.Cull.reset({}, G_DLD);
+	Commands.Draws.reset({}, G_DLD);
+	Commands.Cull.begin(CullBeginInfo, G_DLD);
+	Commands.Draws.begin(DrawsBeginInfo, G_DLD);
+
+	Record(Commands.Cull, Commands.Draws);
+
+	Commands.Cull.end(G_DLD);
+	Commands.Draws.end(G_DLD);
+
+	M_FrameGenerations[FrameIndex] = M_Generation;
+	M_RecordedFrames++;
+	return Commands;
+}
+
+vk::CommandBuffer CommandCache::BeginUi(std::uint32_t FrameIndex)
+{
+	const vk::CommandBufferInheritanceInfo InheritanceInfo = vk::CommandBufferInheritanceInfo(G_UiRenderPass, 0, nullptr);
+	const vk::CommandBufferBeginInfo BeginInfo = vk::CommandBufferBeginInfo(
+		vk::CommandBufferUsageFlagBits::eOneTimeSubmit | vk::CommandBufferUsageFlagBits::eRenderPassContinue,
+		&InheritanceInfo
+	);
+
+	vk::CommandBuffer CommandBuffer = M_UiCommandBuffers[FrameIndex];
+	CommandBuffer.reset({}, G_DLD);
+	CommandBuffer.begin(BeginInfo, G_DLD);
+	return CommandBuffer;
+}
+
+void CommandCache::EndUi(std::uint32_t FrameIndex)
+{
+	M_UiCommandBuffers[FrameIndex].end(G_DLD);
+}
+
+CommandCache::Stats CommandCache::GetStats() const
+{
+	Stats Result;
+	Result.RecordedFrames = M_RecordedFrames;
+	Result.ReplayedFrames = M_ReplayedFrames;
+	Result.Generation = M_Generation;
+	return Result;
+}
+
+void FrameCapture::Init(vk::Extent2D Extent, const std::string& Directory)
+{
+	M_Extent = Extent;
+	M_Directory = Directory;
+	M_FrameSize = vk::DeviceSize(Extent.width) * Extent.height * 4;
+	M_NextFrame = 0;
+	M_Stats = {};
+	M_EncodeMicroseconds = 0;
+
+	std::filesystem::create_directories(M_Directory);
+
+	// The CPU reads every byte back, so cached memory is worth a lot when the device offers it.
+	const vk::MemoryPropertyFlags CachedFlags = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent | vk::MemoryPropertyFlagBits::eHostCached;
+	const vk::PhysicalDeviceMemoryProperties MemoryProperties = G_PhysicalDevice.getMemoryProperties(G_DLD);
+
+	for (std::uint32_t SlotIndex = 0; SlotIndex < G_FramesInFlight; SlotIndex++) {
+		Slot& CaptureSlot = M_Slots[SlotIndex];
+		const vk::BufferCreateInfo BufferCI = vk::BufferCreateInfo({}, M_FrameSize, vk::BufferUsageFlagBits::eTransferDst, vk::SharingMode::eExclusive, 0, nullptr);
+		const vk::Buffer Buffer = G_Device.createBuffer(BufferCI, nullptr, G_DLD);
+		const vk::MemoryRequirements MemReqs = G_Device.getBufferMemoryRequirements(Buffer, G_DLD);
+
+		bool bCached = false;
+		for (std::uint32_t i = 0; i < MemoryProperties.memoryTypeCount; i++) {
+			if ((MemReqs.memoryTypeBits & (1U << i)) && (MemoryProperties.memoryTypes[i].propertyFlags & CachedFlags) == CachedFlags) {
+				bCached = true;
+				break;
+			}
+		}
+
+		const DeviceAllocation Allocation = G_DeviceAllocator.Allocate(MemReqs, bCached ? CachedFlags : (vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent), DeviceAllocator::ResourceKind::eBuffer);
+		G_Device.bindBufferMemory(Buffer, Allocation.Memory, Allocation.Offset, G_DLD);
+
+		CaptureSlot.Readback = std::make_tuple(Buffer, Allocation);
+		CaptureSlot.PendingFrame.reset();
+	}
+}
+
+void FrameCapture::Shutdown()
+{
+	RetireEncodes(0);
+
+	for (Slot& CaptureSlot : M_Slots) {
+		DestroyBuffer(CaptureSlot.Readback);
+		CaptureSlot.PendingFrame.reset();
+	}
+	M_Extent = vk::Extent2D{0, 0};
+}
+
+void FrameCapture::Collect(std::uint32_t FrameIndex)
+{
+	Slot& CaptureSlot = M_Slots[FrameIndex];
+	if (!CaptureSlot.PendingFrame) return;
+
+	// Copy out right away so the readback buffer can take the next frame; the encoders are far slower than a memcpy.
+	auto Pixels = std::make_shared<std::vector<std::uint8_t>>(M_FrameSize);
+	std::memcpy(Pixels->data(), std::get<1>(CaptureSlot.Readback).Mapped, M_FrameSize);
+
+	std::string FrameNumber = std::to_string(CaptureSlot.PendingFrame.value());
+	FrameNumber.insert(0, std::max<std::size_t>(5, FrameNumber.size()) - FrameNumber.size(), '0');
+	const std::string FilePath = M_Directory + "/frame_" + FrameNumber + ".png";
+	CaptureSlot.PendingFrame.reset();
+
+	// Keep a bounded number of frames queued so a slow disk can't grow memory without limit.
+	RetireEncodes(2 * std::size_t(G_ThreadPool->GetThreadCount()));
+
+	const vk::Extent2D Extent = M_Extent;
+	M_Encodes.push_back(G_ThreadPool->Submit([this, Pixels, FilePath, Extent]() {
+		const auto StartTime = std::chrono::high_resolution_clock::now();
+		if (!stbi_write_png(FilePath.c_str(), int(Extent.width), int(Extent.height), 4, Pixels->data(), int(Extent.width * 4))) {
+			throw std::runtime_error("Failed to write " + FilePath);
+		}
+		const auto EndTime = std::chrono::high_resolution_clock::now();
+		M_EncodeMicroseconds += std::uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(EndTime - StartTime).count());
+	}));
+}
+
+void FrameCapture::RecordReadback(vk::CommandBuffer CommandBuffer, std::uint32_t FrameIndex, vk::Image Image)
+{
+	Slot& CaptureSlot = M_Slots[FrameIndex];
+
+	const vk::BufferImageCopy Region = vk::BufferImageCopy(
+		0, 0, 0,
+		vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1),
+		vk::Offset3D(0, 0, 0),
+		vk::Extent3D(M_Extent.width, M_Extent.height, 1)
+		);
+	CommandBuffer.copyImageToBuffer(Image, vk::ImageLayout::eTransferSrcOptimal, std::get<0>(CaptureSlot.Readback), Region, G_DLD);
+
+	// Makes the copy visible to the host once the frame fence signals.
+	const vk::BufferMemoryBarrier HostBarrier = vk::BufferMemoryBarrier(
+		vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eHostRead,
+		VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
+		std::get<0>(CaptureSlot.Readback), 0, VK_WHOLE_SIZE
+		);
+	CommandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost, {}, nullptr, HostBarrier, nullptr, G_DLD);
+
+	CaptureSlot.PendingFrame = M_NextFrame++;
+	M_Stats.CapturedFrames++;
+	M_Stats.BytesReadBack += M_FrameSize;
+}
+
+void FrameCapture::Flush()
+{
+	for (std::uint32_t i = 0; i < G_FramesInFlight; i++) {
+		// Oldest slot first so the files finish roughly in order.
+		Collect((G_CurrentFrame + i) % G_FramesInFlight);
+	}
+	RetireEncodes(0);
+}
+
+void FrameCapture::RetireEncodes(std::size_t MaxPending)
+{
+	while (!M_Encodes.empty()) {
+		std::future<void>& Oldest = M_Encodes.front();
+		const bool bReady = Oldest.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+		if (!bReady && M_Encodes.size() <= MaxPending) break;
+
+		if (!bReady) M_Stats.EncoderStalls++;
+		Oldest.get();
+		M_Encodes.pop_front();
+		M_Stats.WrittenFrames++;
+	}
+}
+
+FrameCapture::Stats FrameCapture::GetStats() const
+{
+	Stats Result = M_Stats;
+	Result.EncodeMilliseconds = float(M_EncodeMicroseconds.load()) / 1000.0f;
+	return Result;
+}
+
+void GpuProfiler::Init()
+{
+	const std::uint32_t ValidBits = G_PhysicalDevice.getQueueFamilyProperties(G_DLD)[G_GraphicsQueueFamilyIndex.value()].timestampValidBits;
+	M_TimestampPeriod = G_PhysicalDevice.getProperties(G_DLD).limits.timestampPeriod;
+	if (ValidBits == 0 || M_TimestampPeriod <= 0.0f) return;
+
+	M_TimestampMask = (ValidBits >= 64) ? ~std::uint64_t(0) : ((std::uint64_t(1) << ValidBits) - 1);
+
+	const vk::QueryPoolCreateInfo QueryPoolCI = vk::QueryPoolCreateInfo({}, vk::QueryType::eTimestamp, 2 * ScopeCount);
+	for (std::uint32_t i = 0; i < G_FramesInFlight; i++) {
+		M_QueryPools[i] = G_Device.createQueryPool(QueryPoolCI, nullptr, G_DLD);
+		M_bPending[i] = false;
+	}
+
+	M_History = {};
+	M_HistoryHead = 0;
+	M_HistoryCount = 0;
+}
+
+void GpuProfiler::Shutdown()
+{
+	for (auto& QueryPool : M_QueryPools) {
+		if (QueryPool) {
+			G_Device.destroyQueryPool(QueryPool, nullptr, G_DLD);
+			QueryPool = nullptr;
+		}
+	}
+	M_bPending = {};
+}
+
+void GpuProfiler::BeginFrame(vk::CommandBuffer CommandBuffer, std::uint32_t FrameIndex)
+{
+	if (!IsEnabled()) return;
+
+	M_FrameIndex = FrameIndex;
+	if (M_bPending[FrameIndex]) {
+		ReadResults(FrameIndex);
+	}
+
+	CommandBuffer.resetQueryPool(M_QueryPools[FrameIndex], 0, 2 * ScopeCount, G_DLD);
+	M_bPending[FrameIndex] = true;
+
+	BeginScope(CommandBuffer, Scope::eFrame);
+}
+
+void GpuProfiler::EndFrame(vk::CommandBuffer CommandBuffer)
+{
+	EndScope(CommandBuffer, Scope::eFrame);
+}
+
+void GpuProfiler::Flush()
+{
+	for (std::uint32_t i = 0; i < G_FramesInFlight; i++) {
+		const std::uint32_t FrameIndex = (G_CurrentFrame + i) % G_FramesInFlight;
+		if (M_bPending[FrameIndex]) {
+			ReadResults(FrameIndex);
+			M_bPending[FrameIndex] = false;
+		}
+	}
+}
+
+void GpuProfiler::BeginScope(vk::CommandBuffer CommandBuffer, Scope TargetScope) const
+{
+	if (!IsEnabled()) return;
+	CommandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, M_QueryPools[M_FrameIndex], 2 * static_cast<std::uint32_t>(TargetScope), G_DLD);
+}
+
+void GpuProfiler::EndScope(vk::CommandBuffer CommandBuffer, Scope TargetScope) const
+{
+	if (!IsEnabled()) return;
+	CommandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, M_QueryPools[M_FrameIndex], 2 * static_cast<std::uint32_t>(TargetScope) + 1, G_DLD);
+}
+
+void GpuProfiler::ReadResults(std::uint32_t FrameIndex)
+{
+	// The slot's fence has been waited on, so this never blocks. Scopes that did not run this frame stay
+	// unavailable after the reset and are recorded as zero.
+	std::array<std::uint64_t, 4 * ScopeCount> Results{};
+	const vk::Result Result = G_Device.getQueryPoolResults(
+		M_QueryPools[FrameIndex], 0, 2 * ScopeCount,
+		sizeof(Results), Results.data(), 2 * sizeof(std::uint64_t),
+		vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWithAvailability,
+		G_DLD
+		);
+	if (Result != vk::Result::eSuccess && Result != vk::Result::eNotReady) return;
+
+	for (std::uint32_t i = 0; i < ScopeCount; i++) {
+		const std::uint64_t* Begin = &Results[4 * i];
+		const std::uint64_t* End = &Results[4 * i + 2];
+
+		float Milliseconds = 0.0f;
+		if (Begin[1] && End[1]) {
+			const std::uint64_t Ticks = (End[0] - Begin[0]) & M_TimestampMask;
+			Milliseconds = float(double(Ticks) * double(M_TimestampPeriod) / 1000000.0);
+		}
+		M_History[i][M_HistoryHead] = Milliseconds;
+	}
+
+	M_HistoryHead = (M_HistoryHead + 1) % G_GpuTimingHistory;
+	M_HistoryCount = std::min(M_HistoryCount + 1, G_GpuTimingHistory);
+	M_SampleCount++;
+}
+
+float GpuProfiler::GetAverage(Scope TargetScope) const
+{
+	if (M_HistoryCount == 0) return 0.0f;
+
+	const auto& History = M_History[static_cast<std::size_t>(TargetScope)];
+	float Sum = 0.0f;
+	for (std::uint32_t i = 0; i < M_HistoryCount; i++) Sum += History[i];
+	return Sum / float(M_HistoryCount);
+}
+
+void GpuProfiler::WriteCsv(const std::string& FileName) const
+{
+	std::ofstream Ofs = std::ofstream(FileName, std::ios::out | std::ios::trunc);
+	if (!Ofs.is_open()) {
+		throw std::runtime_error("Could not open " + FileName);
+	}
+
+	// Oldest sample first, one row per frame, milliseconds.
+	Ofs << "Sample";
+	for (std::uint32_t i = 0; i < ScopeCount; i++) Ofs << ',' << ScopeName(static_cast<Scope>(i));
+	Ofs << '\n';
+
+	for (std::uint32_t Row = 0; Row < M_HistoryCount; Row++) {
+		const std::uint32_t Index = (GetHistoryOffset() + Row) % G_GpuTimingHistory;
+		Ofs << Row;
+		for (std::uint32_t i = 0; i < ScopeCount; i++) Ofs << ',' << M_History[i][Index];
+		Ofs << '\n';
+	}
+}
+
+std::uint64_t FrameTelemetry::Histogram::ValueAtPercentile(double Percentile) const
+{
+	if (M_TotalCount == 0) return 0;
+
+	const std::uint64_t Target = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(std::ceil(Percentile / 100.0 * double(M_TotalCount))));
+	std::uint64_t Seen = 0;
+	for (std::uint32_t i = 0; i < BucketCount; i++) {
+		Seen += M_Counts[i];
+		if (Seen >= Target) return std::min(BucketValue(i), M_Max);
+	}
+	return M_Max;
+}
+
+void FrameTelemetry::Init(const std::string& FileName, float IntervalSeconds)
+{
+	M_IntervalSeconds = std::max(IntervalSeconds, 0.1f);
+	M_StartTime = std::chrono::steady_clock::now();
+	M_WindowStartTime = M_StartTime;
+	M_WindowIndex = 0;
+	M_LastWindow = {};
+	for (auto& Hist : M_Histograms) Hist.Reset();
+
+	if (FileName.empty()) return;
+
+	const std::string Extension = std::filesystem::path(FileName).extension().string();
+	M_bJson = (Extension == ".json" || Extension == ".jsonl");
+
+	M_Sink = std::ofstream(FileName, std::ios::out | std::ios::trunc);
+	if (!M_Sink.is_open()) {
+		throw std::runtime_error("Could not open " + FileName);
+	}
+	if (!M_bJson) {
+		M_Sink << "Window,Seconds,Metric,Unit,Count,P50,P95,P99,Max\n";
+	}
+}
+
+void FrameTelemetry::Shutdown()
+{
+	// The partial window still holds the tail of the run.
+	if (M_Histograms[static_cast<std::size_t>(Metric::eFrame)].GetTotalCount() > 0) {
+		CloseWindow();
+	}
+	if (M_Sink.is_open()) {
+		M_Sink.close();
+	}
+}
+
+void FrameTelemetry::Update()
+{
+	const float WindowSeconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - M_WindowStartTime).count();
+	if (WindowSeconds >= M_IntervalSeconds) {
+		CloseWindow();
+	}
+}
+
+void FrameTelemetry::CloseWindow()
+{
+	static constexpr double NsToMs = 1.0 / 1000000.0;
+	static constexpr double GaugeToValue = 1.0 / GaugeResolution;
+
+	const auto Now = std::chrono::steady_clock::now();
+
+	M_LastWindow.Index = M_WindowIndex++;
+	M_LastWindow.EndSeconds = std::chrono::duration<float>(Now - M_StartTime).count();
+	for (std::uint32_t i = 0; i < MetricCount; i++) {
+		Histogram& Hist = M_Histograms[i];
+		Summary& Result = M_LastWindow.Metrics[i];
+		const double ToUnit = IsGauge(static_cast<Metric>(i)) ? GaugeToValue : NsToMs;
+		Result.Count = Hist.GetTotalCount();
+		Result.P50 = float(double(Hist.ValueAtPercentile(50.0)) * ToUnit);
+		Result.P95 = float(double(Hist.ValueAtPercentile(95.0)) * ToUnit);
+		Result.P99 = float(double(Hist.ValueAtPercentile(99.0)) * ToUnit);
+		Result.Max = float(double(Hist.GetMax()) * ToUnit);
+		Hist.Reset();
+	}
+	M_WindowStartTime = Now;
+
+	if (!M_Sink.is_open()) return;
+
+	if (M_bJson) {
+		M_Sink << "{\"window\":" << M_LastWindow.Index << ",\"seconds\":" << M_LastWindow.EndSeconds << ",\"metrics\":{";
+		for (std::uint32_t i = 0; i < MetricCount; i++) {
+			const Summary& Result = M_LastWindow.Metrics[i];
+			M_Sink << (i ? "," : "") << '"' << MetricName(static_cast<Metric>(i)) << "\":{\"unit\":\"" << MetricUnit(static_cast<Metric>(i)) << "\",\"count\":" << Result.Count
+				<< ",\"p50\":" << Result.P50 << ",\"p95\":" << Result.P95
+				<< ",\"p99\":" << Result.P99 << ",\"max\":" << Result.Max << '}';
+		}
+		M_Sink << "}}\n";
+	} else {
+		for (std::uint32_t i = 0; i < MetricCount; i++) {
+			const Summary& Result = M_LastWindow.Metrics[i];
+			M_Sink << M_LastWindow.Index << ',' << M_LastWindow.EndSeconds << ',' << MetricName(static_cast<Metric>(i)) << ',' << MetricUnit(static_cast<Metric>(i)) << ',' << Result.Count << ','
+				<< Result.P50 << ',' << Result.P95 << ',' << Result.P99 << ',' << Result.Max << '\n';
+		}
+	}
+	M_Sink.flush();
+}
+
+void DynamicResolution::Init(const Settings& InSettings)
+{
+	M_Settings = InSettings;
+	M_Settings.MaxScale = std::clamp(M_Settings.MaxScale, 0.1f, 1.0f);
+	M_Settings.MinScale = std::clamp(M_Settings.MinScale, 0.1f, M_Settings.MaxScale);
+	M_Settings.BudgetMilliseconds = std::max(M_Settings.BudgetMilliseconds, 0.1f);
+
+	M_Scale = M_Settings.MaxScale;
+	M_LastMilliseconds = 0.0f;
+	M_FilteredMilliseconds = 0.0f;
+	M_SettleFrames = 0;
+	M_Adjustments = 0;
+}
+
+bool DynamicResolution::Update(float GpuMilliseconds)
+{
+	M_LastMilliseconds = GpuMilliseconds;
+	if (!M_Settings.bEnabled || GpuMilliseconds <= 0.0f) return false;
+
+	M_FilteredMilliseconds = (M_FilteredMilliseconds > 0.0f) ? M_FilteredMilliseconds + FilterWeight * (GpuMilliseconds - M_FilteredMilliseconds) : GpuMilliseconds;
+
+	// Timings come back frames in flight late; judge a change only once frames rendered with it arrive.
+	if (M_SettleFrames > 0) {
+		M_SettleFrames--;
+		return false;
+	}
+
+	// A frame over budget is acted on at once so a spike is cut short; headroom is only reclaimed on the average.
+	const bool bOverBudget = GpuMilliseconds > M_Settings.BudgetMilliseconds;
+	const float Measured = bOverBudget ? GpuMilliseconds : M_FilteredMilliseconds;
+
+	// GPU cost is taken to follow the pixel count, which goes with the square of the scale.
+	const float Desired = std::clamp(M_Scale * std::sqrt(M_Settings.BudgetMilliseconds * Headroom / Measured), M_Settings.MinScale, M_Settings.MaxScale);
+	if (std::abs(Desired - M_Scale) < (bOverBudget ? MinStep : Hysteresis)) return false;
+
+	M_Scale = (Desired > M_Scale) ? M_Scale + std::min(Desired - M_Scale, MaxGrowStep) : Desired;
+	M_FilteredMilliseconds = 0.0f;
+	M_SettleFrames = G_FramesInFlight + 1;
+	M_Adjustments++;
+	return true;
+}
+
+vk::Extent2D DynamicResolution::GetRenderExtent(vk::Extent2D OutputExtent) const
+{
+	return vk::Extent2D(
+		std::clamp(static_cast<std::uint32_t>(float(OutputExtent.width) * M_Scale + 0.5f), 1U, OutputExtent.width),
+		std::clamp(static_cast<std::uint32_t>(float(OutputExtent.height) * M_Scale + 0.5f), 1U, OutputExtent.height)
+		);
+}
+
+DynamicResolution::Stats DynamicResolution::GetStats() const
+{
+	Stats Result;
+	Result.Scale = M_Scale;
+	Result.LastMilliseconds = M_LastMilliseconds;
+	Result.FilteredMilliseconds = M_FilteredMilliseconds;
+	Result.Adjustments = M_Adjustments;
+	return Result;
+}
+
+void FrameScheduler::Init()
+{
+	vk::SemaphoreTypeCreateInfo SemaphoreTypeCI = vk::SemaphoreTypeCreateInfo(vk::SemaphoreType::eTimeline, 0);
+	vk::SemaphoreCreateInfo SemaphoreCI = vk::SemaphoreCreateInfo{};
+	SemaphoreCI.setPNext(&SemaphoreTypeCI);
+	M_Timeline = G_Device.createSemaphore(SemaphoreCI, nullptr, G_DLD);
+
+	M_SlotValues = {};
+	M_SubmittedValue = 0;
+	M_CompletedValue = 0;
+	M_BlockingWaits = 0;
+}
+
+void FrameScheduler::Shutdown()
+{
+	if (!M_Timeline) return;
+
+	G_Device.destroySemaphore(M_Timeline, nullptr, G_DLD);
+	M_Timeline = nullptr;
+}
+
+void FrameScheduler::WaitForSlot(std::uint32_t FrameIndex)
+{
+	const std::uint64_t SlotValue = M_SlotValues[FrameIndex];
+	if (SlotValue <= M_CompletedValue) return;
+
+	M_CompletedValue = G_Device.getSemaphoreCounterValue(M_Timeline, G_DLD);
+	if (SlotValue <= M_CompletedValue) return;
+
+	const vk::SemaphoreWaitInfo WaitInfo = vk::SemaphoreWaitInfo({}, 1, &M_Timeline, &SlotValue);
+	(void)G_Device.waitSemaphores(WaitInfo, std::numeric_limits<std::uint64_t>::max(), G_DLD);
+	M_CompletedValue = std::max(SlotValue, G_Device.getSemaphoreCounterValue(M_Timeline, G_DLD));
+	M_BlockingWaits++;
+}
+
+void FrameScheduler::OnSubmitted(std::uint32_t FrameIndex, std::uint64_t SignaledValue)
+{
+	M_SlotValues[FrameIndex] = SignaledValue;
+	M_SubmittedValue = SignaledValue;
+}
+
+FrameScheduler::Stats FrameScheduler::GetStats() const
+{
+	Stats Result;
+	Result.SubmittedValue = M_SubmittedValue;
+	Result.CompletedValue = M_CompletedValue;
+	Result.BlockingWaits = M_BlockingWaits;
+	return Result;
+}
+
+void RetireQueue::Retire(std::uint64_t FrameValue, std::function<void()> Release)
+{
+	M_Entries.push_back(Entry{FrameValue, std::move(Release)});
+	M_Retired++;
+	ReleaseCompleted();
+}
+
+void RetireQueue::Collect(std::uint64_t CompletedValue)
+{
+	M_CompletedValue = std::max(M_CompletedValue, CompletedValue);
+	ReleaseCompleted();
+}
+
+void RetireQueue::Flush()
+{
+	while (!M_Entries.empty()) {
+		M_Entries.front().Release();
+		M_Entries.pop_front();
+		M_Released++;
+	}
+}
+
+void RetireQueue::ReleaseCompleted()
+{
+	while (!M_Entries.empty() && M_Entries.front().FrameValue <= M_CompletedValue) {
+		M_Entries.front().Release();
+		M_Entries.pop_front();
+		M_Released++;
+	}
+}
+
+RetireQueue::Stats RetireQueue::GetStats() const
+{
+	Stats Result;
+	Result.Pending = static_cast<std::uint32_t>(M_Entries.size());
+	Result.Retired = M_Retired;
+	Result.Released = M_Released;
+	return Result;
+}
+
+void InitVulkan()
+{
+	G_DLD.init();
+
+	const std::uint32_t VkApiVersion = vk::enumerateInstanceVersion(G_DLD) & (~std::uint32_t(0xFFFU));
+	const vk::ApplicationInfo AppInfo = vk::ApplicationInfo(
+		"VkSkeletalAnimationExample",
+		VK_MAKE_API_VERSION(0, 1, 0, 0),
+		"VkSkeletalAnimationExampleEngine",
+		VK_MAKE_API_VERSION(0, 1, 0, 0),
+		VkApiVersion
+		);
+
+	std::vector<const char*> RequiredInstanceLayers;
+	if (G_Profile.bValidation) {
+		RequiredInstanceLayers.push_back("VK_LAYER_KHRONOS_validation");
+	}
+
+	// Headless runs need no surface at all and must also start on CI machines without the SDK layers.
+	std::vector<const char*> RequiredInstanceExtensions;
+	if (!G_bHeadless) {
+		RequiredInstanceExtensions.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
+#ifdef _WIN32
+		RequiredInstanceExtensions.push_back(VK_KHR_WIN32_SURFACE_EXTENSION_NAME);
+#endif
+		if (G_Profile.bValidation) {
+			RequiredInstanceExtensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+		}
+	}
+	const std::vector<vk::LayerProperties> SupportedInstanceLayers = vk::enumerateInstanceLayerProperties(G_DLD);
+	const std::vector<vk::ExtensionProperties> SupportedInstanceExtensions = vk::enumerateInstanceExtensionProperties(nullptr, G_DLD);
+
+	G_EnabledLayers.clear();
+	for (const char* RequiredLayer : RequiredInstanceLayers) {
+		if (std::find_if(SupportedInstanceLayers.begin(), SupportedInstanceLayers.end(), [&RequiredLayer](const vk::LayerProperties& LayerProperties) {return std::strcmp(LayerProperties.layerName.data(), RequiredLayer) == 0; }) != SupportedInstanceLayers.end()) {
+			G_EnabledLayers.push_back(RequiredLayer);
+		} else if (!G_bHeadless) {
+			throw std::runtime_error("Vulkan doesn't support required layers");
+		}
+	}
+	for (const char* RequiredExtension : RequiredInstanceExtensions) {
+		if (std::find_if(SupportedInstanceExtensions.begin(), SupportedInstanceExtensions.end(), [&RequiredExtension](const vk::ExtensionProperties& ExtensionProperties) {return std::strcmp(ExtensionProperties.extensionName.data(), RequiredExtension) == 0; }) == SupportedInstanceExtensions.end())
+			throw std::runtime_error("Vulkan doesn't support required extensions");
+	}
+
+	const vk::InstanceCreateInfo VkInstanceCI = vk::InstanceCreateInfo(
+		{},
+		&AppInfo,
+		static_cast<std::uint32_t>(G_EnabledLayers.size()), G_EnabledLayers.data(),
+		static_cast<std::uint32_t>(RequiredInstanceExtensions.size()), RequiredInstanceExtensions.data()
+		);
+	G_VkInstance = vk::createInstance(VkInstanceCI, nullptr, G_DLD);
+	G_DLD.init(G_VkInstance);
+
+
+	InitPhysicalDevice();
+	InitQueueFamilies();
+	InitDevice();
+	G_DeviceAllocator.Init();
+	InitQueues();
+	InitCommandPools();
+	InitCommandBuffers();
+	G_CommandRecorder.Init(G_RecordThreadCount);
+	if (G_bReplayCommands) {
+		G_CommandCache.Init();
+	}
+	InitSyncObjects();
+	G_GpuProfiler.Init();
+	G_DynamicResolution.Init(G_DynamicResolutionSettings);
+	G_UploadManager.Init();
+	InitPipelineCache();
+	if (G_bHeadless) {
+		InitOffscreenFormat();
+	} else {
+		InitSurface();
+	}
+	InitDepthFormat();
+	InitUpscaleFilter();
+	InitRenderPass();
+
+	InitSwapchain();
+	if (!G_bHeadless) {
+		InitImGui();
+	} else if (!G_CaptureDirectory.empty()) {
+		G_FrameCapture.Init(G_SwapchainExtent, G_CaptureDirectory);
+	}
+
+	// Cold compiles are the long pole of startup; run them on the workers while the model loads.
+	{
+		const auto PipelineStartTime = std::chrono::high_resolution_clock::now();
+		TaskGroup PipelineTasks(*G_ThreadPool);
+		InitPipeline(PipelineTasks);
+		InitModel();
+		PipelineTasks.Wait();
+		const auto PipelineEndTime = std::chrono::high_resolution_clock::now();
+		G_PipelineStats.WallMilliseconds = float(std::chrono::duration_cast<std::chrono::microseconds>(PipelineEndTime - PipelineStartTime).count()) / 1000.0f;
+	}
+}
+
+void ShutdownVulkan()
+{
+	if (G_Device) {
+		G_Device.waitIdle(G_DLD);
+
+
+		ShutdownModel();
+		ShutdownPipeline();
+		ShutdownPipelineCache();
+
+		ShutdownImGui();
+		G_FrameCapture.Shutdown();
+		ShutdownSwapchain();
+
+		if (G_UiRenderPass) {
+			G_Device.destroyRenderPass(G_UiRenderPass, nullptr, G_DLD);
+			G_UiRenderPass = nullptr;
+		}
+		if (G_RenderPass) {
+			G_Device.destroyRenderPass(G_RenderPass, nullptr, G_DLD);
+			G_RenderPass = nullptr;
+		}
+
+		if (G_Surface) {
+			G_VkInstance.destroySurfaceKHR(G_Surface, nullptr, G_DLD);
+			G_Surface = nullptr;
+		}
+
+		G_FrameScheduler.Shutdown();
+
+		for (auto& Item : G_RenderFinishedSemaphores) {
+			if (Item) {
+				G_Device.destroySemaphore(Item, nullptr, G_DLD);
+				Item = nullptr;
+			}
+		}
+
+		for (auto& Item : G_ImageAvailableSemaphores) {
+			if (Item) {
+				G_Device.destroySemaphore(Item, nullptr, G_DLD);
+				Item = nullptr;
+			}
+		}
+
+		G_GpuProfiler.Shutdown();
+		G_CommandCache.Shutdown();
+		G_CommandRecorder.Shutdown();
+
+		for (auto& Item : G_CommandBuffers) {
+			if (Item) {
+				G_Device.freeCommandBuffers(G_DynamicCommandPool, Item, G_DLD);
+				Item = nullptr;
+			}
+		}
+
+		if (G_DynamicCommandPool) {
+			G_Device.destroyCommandPool(G_DynamicCommandPool, nullptr, G_DLD);
+			G_DynamicCommandPool = nullptr;
+		}
+
+		if (G_StaticCommandPool) {
+			G_Device.destroyCommandPool(G_StaticCommandPool, nullptr, G_DLD);
+			G_StaticCommandPool = nullptr;
+		}
+
+		G_UploadManager.Shutdown();
+		G_DeviceAllocator.Shutdown();
+
+		G_Device.destroy(nullptr, G_DLD);
+		G_Device = nullptr;
+	}
+
+	if (G_VkInstance) {
+		G_VkInstance.destroy(nullptr, G_DLD);
+		G_VkInstance = nullptr;
+	}
+}
+
+void InitPhysicalDevice()
+{
+	const std::vector<vk::PhysicalDevice> AvailableDevices = G_VkInstance.enumeratePhysicalDevices(G_DLD);
+	const std::vector<const char*>& RequiredDeviceLayers = G_EnabledLayers;
+	std::vector<const char*> RequiredDeviceExtensions;
+	if (!G_bHeadless) {
+		RequiredDeviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+	}
+
+	std::vector<vk::PhysicalDevice> SuitablePhysicalDevices;
+
+	for (auto PhysDevice : AvailableDevices) {
+		bool bAllExtensionsSupported = true;
+		bool bAllLayersSupported = true;
+
+		const std::vector<vk::ExtensionProperties> SupportedDeviceExtensions = PhysDevice.enumerateDeviceExtensionProperties(nullptr, G_DLD);
+		const std::vector<vk::LayerProperties> SupportedDeviceLayers = PhysDevice.enumerateDeviceLayerProperties(G_DLD);
+
+		for (const char* RequiredLayer : RequiredDeviceLayers) {
+			if (std::find_if(SupportedDeviceLayers.begin(), SupportedDeviceLayers.end(), [&RequiredLayer](const vk::LayerProperties& ExtensionProperties) {return std::strcmp(ExtensionProperties.layerName.data(), RequiredLayer) == 0; }) == SupportedDeviceLayers.end()) {
+				bAllLayersSupported = false;
+				break;
+			}
+		}
+		for (const char* RequiredExtension : RequiredDeviceExtensions) {
+			if (std::find_if(SupportedDeviceExtensions.begin(), SupportedDeviceExtensions.end(), [&RequiredExtension](const vk::ExtensionProperties& ExtensionProperties) {return std::strcmp(ExtensionProperties.extensionName.data(), RequiredExtension) == 0; }) == SupportedDeviceExtensions.end()) {
+				bAllExtensionsSupported = false;
+				break;
+			}
+		}
+
+		// Upload completion is tracked with timeline semaphores, which are core in Vulkan 1.2.
+		bool bTimelineSemaphoreSupported = false;
+		if (PhysDevice.getProperties(G_DLD).apiVersion >= VK_API_VERSION_1_2) {
+			vk::PhysicalDeviceTimelineSemaphoreFeatures TimelineSemaphoreFeatures = vk::PhysicalDeviceTimelineSemaphoreFeatures{};
+			vk::PhysicalDeviceFeatures2 Features2 = vk::PhysicalDeviceFeatures2{};
+			Features2.setPNext(&TimelineSemaphoreFeatures);
+			PhysDevice.getFeatures2(&Features2, G_DLD);
+			bTimelineSemaphoreSupported = (TimelineSemaphoreFeatures.timelineSemaphore == vk::True);
+		}
+
+		if (bAllLayersSupported && bAllExtensionsSupported && bTimelineSemaphoreSupported) {
+			SuitablePhysicalDevices.push_back(PhysDevice);
+		}
+	}
+
+	if (!SuitablePhysicalDevices.empty()) {
+		for (auto Item : SuitablePhysicalDevices) {
+			auto Props = Item.getProperties(G_DLD);
+			if (Props.deviceType == vk::PhysicalDeviceType::eDiscreteGpu) {
+				G_PhysicalDevice = Item;
+				break;
+			}
+		}
+
+		if (!G_PhysicalDevice)
+			G_PhysicalDevice = SuitablePhysicalDevices[0];
+	}
+
+	if (!G_PhysicalDevice)
+		throw std::runtime_error("Could not find any suitable physical device");
+
+
+	const vk::PhysicalDeviceProperties PhysDeviceProps = G_PhysicalDevice.getProperties(G_DLD);
+
+	// The highest count the device supports that the profile allows.
+	const vk::SampleCountFlags SampleCountFlags = PhysDeviceProps.limits.framebufferColorSampleCounts & PhysDeviceProps.limits.framebufferDepthSampleCounts;
+	if ((SampleCountFlags & vk::SampleCountFlagBits::e8) && G_Profile.MaxSampleCount >= 8) { G_SampleCount = vk::SampleCountFlagBits::e8; }
+	else if ((SampleCountFlags & vk::SampleCountFlagBits::e4) && G_Profile.MaxSampleCount >= 4) { G_SampleCount = vk::SampleCountFlagBits::e4; }
+	else if ((SampleCountFlags & vk::SampleCountFlagBits::e2) && G_Profile.MaxSampleCount >= 2) { G_SampleCount = vk::SampleCountFlagBits::e2; }
+	else { G_SampleCount = vk::SampleCountFlagBits::e1; }
+
+}
+
+void InitQueueFamilies()
+{
+
+	G_GraphicsQueueFamilyIndex.reset();
+	G_PresentQueueFamilyIndex.reset();
+	G_ComputeQueueFamilyIndex.reset();
+	G_TransferQueueFamilyIndex.reset();
+
+	const std::vector<vk::QueueFamilyProperties> QueueFamilies = G_PhysicalDevice.getQueueFamilyProperties(G_DLD);
+
+	// Headless has nothing to present, so any graphics family will do; it doubles as the "present" family.
+	std::vector<vk::Bool32> SupportsPresent = std::vector<vk::Bool32>(QueueFamilies.size(), G_bHeadless ? vk::True : vk::False);
+#ifdef _WIN32
+	if (!G_bHeadless) {
+		for (std::uint32_t i = 0; i < QueueFamilies.size(); i++) {
+			SupportsPresent[i] = G_PhysicalDevice.getWin32PresentationSupportKHR(i, G_DLD);
+		}
+	}
+#endif
+
+	for (std::uint32_t i = 0; i < QueueFamilies.size(); i++) {
+		if (QueueFamilies[i].queueFlags & vk::QueueFlagBits::eGraphics) {
+			if (SupportsPresent[i] == vk::True) {
+				G_GraphicsQueueFamilyIndex = static_cast<std::uint32_t>(i);
+				G_PresentQueueFamilyIndex = static_cast<std::uint32_t>(i);
+				break;
+			}
+			if (!G_GraphicsQueueFamilyIndex.has_value()) {
+				G_GraphicsQueueFamilyIndex = static_cast<std::uint32_t>(i);
+			}
+		}
+	}
+	if (!G_PresentQueueFamilyIndex.has_value()) {
+		for (std::uint32_t i = 0; i < QueueFamilies.size(); i++) {
+			if (SupportsPresent[i] == vk::True) {
+				G_PresentQueueFamilyIndex = static_cast<std::uint32_t>(i);
+				break;
+			}
+		}
+	}
+
+	for (std::uint32_t i = 0; i < QueueFamilies.size(); i++) {
+		if (QueueFamilies[i].queueFlags & vk::QueueFlagBits::eCompute) {
+			if (!(QueueFamilies[i].queueFlags & vk::QueueFlagBits::eGraphics)) {
+				G_ComputeQueueFamilyIndex = static_cast<std::uint32_t>(i);
+				break;
+			}
+		}
+	}
+
+	if (!G_ComputeQueueFamilyIndex.has_value()) {
+		for (std::uint32_t i = 0; i < QueueFamilies.size(); i++) {
+			if (QueueFamilies[i].queueFlags & vk::QueueFlagBits::eCompute) {
+				G_ComputeQueueFamilyIndex = static_cast<std::uint32_t>(i);
+				break;
+			}
+		}
+	}
+
+	// A transfer-only family maps to the copy engine on most discrete GPUs; otherwise uploads share the graphics queue.
+	for (std::uint32_t i = 0; i < QueueFamilies.size(); i++) {
+		if (QueueFamilies[i].queueFlags & vk::QueueFlagBits::eTransfer) {
+			if (!(QueueFamilies[i].queueFlags & (vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute))) {
+				G_TransferQueueFamilyIndex = static_cast<std::uint32_t>(i);
+				break;
+			}
+		}
+	}
+
+	if (!G_TransferQueueFamilyIndex.has_value()) {
+		G_TransferQueueFamilyIndex = G_GraphicsQueueFamilyIndex;
+	}
+
+	if (!G_GraphicsQueueFamilyIndex.has_value() ||
+		!G_PresentQueueFamilyIndex.has_value() ||
+		!G_ComputeQueueFamilyIndex.has_value()) {
+		throw std::runtime_error("Failed to find all required queue families");
+	}
+
+}
+
+void InitDevice()
+{
+	std::set<std::uint32_t> UniqueIndices;
+	UniqueIndices.insert(G_GraphicsQueueFamilyIndex.value());
+	UniqueIndices.insert(G_PresentQueueFamilyIndex.value());
+	UniqueIndices.insert(G_ComputeQueueFamilyIndex.value());
+	UniqueIndices.insert(G_TransferQueueFamilyIndex.value());
+
+	std::vector<vk::DeviceQueueCreateInfo> QueueCIs;
+	const float QueuePriority = 1.0f;
+	for (std::uint32_t QueueFamilyIndex : UniqueIndices) {
+		QueueCIs.push_back(
+			vk::DeviceQueueCreateInfo(
+				{},
+				QueueFamilyIndex,
+				1,
+				&QueuePriority
+				)
+			);
+	}
+
+	const std::vector<const char*>& EnabledLayers = G_EnabledLayers;
+	std::vector<const char*> EnabledExtensions;
+	if (!G_bHeadless) {
+		EnabledExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+	}
+	vk::PhysicalDeviceVulkan12Features SupportedFeatures12 = vk::PhysicalDeviceVulkan12Features{};
+	vk::PhysicalDeviceFeatures2 SupportedFeatures = vk::PhysicalDeviceFeatures2{};
+	SupportedFeatures.setPNext(&SupportedFeatures12);
+	G_PhysicalDevice.getFeatures2(&SupportedFeatures, G_DLD);
+
+	G_bMultiDrawIndirect = (SupportedFeatures.features.multiDrawIndirect == vk::True) && (SupportedFeatures.features.drawIndirectFirstInstance == vk::True);
+	G_bDrawIndirectCount = G_bMultiDrawIndirect && (SupportedFeatures12.drawIndirectCount == vk::True);
+
+	vk::PhysicalDeviceFeatures EnabledFeatures = vk::PhysicalDeviceFeatures{};
+	//EnabledFeatures.setTessellationShader(vk::True);
+	EnabledFeatures.setFillModeNonSolid(vk::True);
+	EnabledFeatures.setMultiDrawIndirect(G_bMultiDrawIndirect ? vk::True : vk::False);
+	EnabledFeatures.setDrawIndirectFirstInstance(G_bMultiDrawIndirect ? vk::True : vk::False);
+
+	vk::PhysicalDeviceVulkan12Features EnabledFeatures12 = vk::PhysicalDeviceVulkan12Features{};
+	EnabledFeatures12.setTimelineSemaphore(vk::True);
+	EnabledFeatures12.setDrawIndirectCount(G_bDrawIndirectCount ? vk::True : vk::False);
+
+	vk::DeviceCreateInfo DeviceCI = vk::DeviceCreateInfo(
+		{},
+		static_cast<std::uint32_t>(QueueCIs.size()), QueueCIs.data(),
+		static_cast<std::uint32_t>(EnabledLayers.size()), EnabledLayers.data(),
+		static_cast<std::uint32_t>(EnabledExtensions.size()), EnabledExtensions.data(),
+		&EnabledFeatures
+	);
+	DeviceCI.setPNext(&EnabledFeatures12);
+
+	G_Device = G_PhysicalDevice.createDevice(DeviceCI, nullptr, G_DLD);
+	if (!G_Device)
+		throw std::runtime_error("Failed to create logical device");
+	G_DLD.init(G_Device);
+}
+
+void InitQueues()
+{
+	G_GraphicsQueue = G_Device.getQueue(G_GraphicsQueueFamilyIndex.value(), 0, G_DLD);
+	G_PresentQueue = G_Device.getQueue(G_PresentQueueFamilyIndex.value(), 0, G_DLD);
+	G_ComputeQueue = G_Device.getQueue(G_ComputeQueueFamilyIndex.value(), 0, G_DLD);
+	G_TransferQueue = G_Device.getQueue(G_TransferQueueFamilyIndex.value(), 0, G_DLD);
+}
+
+void InitCommandPools()
+{
+	const vk::CommandPoolCreateInfo DynamicCommandPoolCI = vk::CommandPoolCreateInfo{
+		vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
+		G_GraphicsQueueFamilyIndex.value()
+	};
+	G_DynamicCommandPool = G_Device.createCommandPool(DynamicCommandPoolCI, nullptr, G_DLD);
+
+	const vk::CommandPoolCreateInfo StaticCommandPoolCI = vk::CommandPoolCreateInfo{
+		{},
+		G_GraphicsQueueFamilyIndex.value()
+	};
+	G_StaticCommandPool = G_Device.createCommandPool(StaticCommandPoolCI, nullptr, G_DLD);
+}
+
+void InitCommandBuffers()
+{
+	const vk::CommandBufferAllocateInfo CommandBufferAI = vk::CommandBufferAllocateInfo(
+		G_DynamicCommandPool,
+		vk::CommandBufferLevel::ePrimary,
+		G_FramesInFlight
+	);
+
+	const std::vector<vk::CommandBuffer> CmdBuffers = G_Device.allocateCommandBuffers(CommandBufferAI, G_DLD);
+	for (std::uint32_t i = 0; i < G_FramesInFlight; i++) {
+		G_CommandBuffers[i] = CmdBuffers[i];
+	}
+}
+
+void InitSyncObjects()
+{
+	// Acquire and present only take binary semaphores; everything else is paced by the frame timeline.
+	const vk::SemaphoreCreateInfo SemaphoreCI = {};
+
+	for (std::size_t i = 0; i < G_FramesInFlight; i++) {
+		G_ImageAvailableSemaphores[i] = G_Device.createSemaphore(SemaphoreCI, nullptr, G_DLD);
+		G_RenderFinishedSemaphores[i] = G_Device.createSemaphore(SemaphoreCI, nullptr, G_DLD);
+	}
+
+	G_FrameScheduler.Init();
+}
+
+void InitSurface()
+{
+#ifdef _WIN32
+	const vk::Win32SurfaceCreateInfoKHR SurfaceCI = vk::Win32SurfaceCreateInfoKHR({}, G_Hinstance, G_Hwnd, {});
+
+	G_Surface = G_VkInstance.createWin32SurfaceKHR(SurfaceCI, nullptr, G_DLD);
+	if (!G_Device)
+		throw std::runtime_error("Failed to create win32 surface");
+#else
+	throw std::runtime_error("Windowed rendering is only available on Win32");
+#endif
+
+
+	const std::vector<vk::SurfaceFormatKHR> SurfaceFormats = G_PhysicalDevice.getSurfaceFormatsKHR(G_Surface, G_DLD);
+	if (SurfaceFormats.empty())
+		throw std::runtime_error("The surface doesn't support any format");
+
+	G_SurfaceFormat = SurfaceFormats[0];
+	for (auto& SurfaceFormat : SurfaceFormats) {
+		if (SurfaceFormat.format == vk::Format::eB8G8R8A8Unorm && SurfaceFormat.colorSpace == vk::ColorSpaceKHR::eSrgbNonlinear) {
+			G_SurfaceFormat = SurfaceFormat;
+			break;
+		}
+	}
+
+	const std::vector<vk::PresentModeKHR> PresentModes = G_PhysicalDevice.getSurfacePresentModesKHR(G_Surface, G_DLD);
+	if (PresentModes.empty())
+		throw std::runtime_error("The surface doesn't support any present mode");
+
+	// FIFO is the only mode every surface has to support.
+	G_SurfacePresentMode = vk::PresentModeKHR::eFifo;
+	if (std::find(PresentModes.begin(), PresentModes.end(), G_Profile.PresentMode) != PresentModes.end()) {
+		G_SurfacePresentMode = G_Profile.PresentMode;
+	}
+
+	// A maxImageCount of zero means there is no upper limit.
+	vk::SurfaceCapabilitiesKHR SurfaceCapabilities = G_PhysicalDevice.getSurfaceCapabilitiesKHR(G_Surface, G_DLD);
+	if (!(SurfaceCapabilities.supportedUsageFlags & vk::ImageUsageFlagBits::eTransferDst))
+		throw std::runtime_error("The surface can't be the destination of the upscale blit");
+	G_SurfaceImageCount = std::max(SurfaceCapabilities.minImageCount, G_Profile.ImageCount);
+	if (SurfaceCapabilities.maxImageCount != 0) {
+		G_SurfaceImageCount = std::min(SurfaceCapabilities.maxImageCount, G_SurfaceImageCount);
+	}
+}
+
+void InitOffscreenFormat()
+{
+	// RGBA keeps the bytes in file order for anything that reads the frames back.
+	G_SurfaceFormat = vk::SurfaceFormatKHR(vk::Format::eR8G8B8A8Unorm, vk::ColorSpaceKHR::eSrgbNonlinear);
+	G_SurfaceImageCount = G_FramesInFlight;
+
+	const vk::FormatProperties FormatProps = G_PhysicalDevice.getFormatProperties(G_SurfaceFormat.format, G_DLD);
+	if (!(FormatProps.optimalTilingFeatures & vk::FormatFeatureFlagBits::eColorAttachment))
+		throw std::runtime_error("The offscreen color format isn't renderable");
+}
+
+void InitDepthFormat()
+{
+	static constexpr std::array<vk::Format, 5> CandidateDepthFormats = std::array<vk::Format, 5>(
+		{
+			vk::Format::eD32SfloatS8Uint,
+			vk::Format::eD24UnormS8Uint,
+			vk::Format::eD16UnormS8Uint,
+			vk::Format::eD32Sfloat,
+			vk::Format::eD16Unorm,
+		}
+	);
+
+	G_DepthFormat = vk::Format::eUndefined;
+	for (auto& Fmt : CandidateDepthFormats) {
+		const vk::FormatProperties FormatProps = G_PhysicalDevice.getFormatProperties(Fmt, G_DLD);
+		if ((FormatProps.optimalTilingFeatures & vk::FormatFeatureFlagBits::eDepthStencilAttachment) == vk::FormatFeatureFlagBits::eDepthStencilAttachment) {
+			G_DepthFormat = Fmt;
+			break;
+		}
+	}
+	if (G_DepthFormat == vk::Format::eUndefined)
+		throw std::runtime_error("Failed to find proper depth format");
+
+}
+
+void InitUpscaleFilter()
+{
+	const vk::FormatProperties FormatProps = G_PhysicalDevice.getFormatProperties(G_SurfaceFormat.format, G_DLD);
+	if (!(FormatProps.optimalTilingFeatures & vk::FormatFeatureFlagBits::eBlitSrc) || !(FormatProps.optimalTilingFeatures & vk::FormatFeatureFlagBits::eBlitDst))
+		throw std::runtime_error("The color format can't be blitted");
+
+	G_UpscaleFilter = (FormatProps.optimalTilingFeatures & vk::FormatFeatureFlagBits::eSampledImageFilterLinear) ? vk::Filter::eLinear : vk::Filter::eNearest;
+}
+
+void InitRenderPass()
+{
+	// The scene target is only ever read by the upscale blit. The first dependency keeps the previous blit
+	// from this target ahead of the new color writes, the second orders the writes before this frame's blit.
+	static constexpr std::array<vk::SubpassDependency, 2> SceneDependencies = {
+		vk::SubpassDependency(
+			VK_SUBPASS_EXTERNAL,
+			0,
+			vk::PipelineStageFlagBits::eTransfer,
+			vk::PipelineStageFlagBits::eColorAttachmentOutput,
+			{},
+			vk::AccessFlagBits::eColorAttachmentWrite
+			),
+		vk::SubpassDependency(
+			0,
+			VK_SUBPASS_EXTERNAL,
+			vk::PipelineStageFlagBits::eColorAttachmentOutput,
+			vk::PipelineStageFlagBits::eTransfer,
+			vk::AccessFlagBits::eColorAttachmentWrite,
+			vk::AccessFlagBits::eTransferRead
+			),
+	};
+
+	if (G_SampleCount == vk::SampleCountFlagBits::e1) {
+
+		const std::array<vk::AttachmentDescription, 2> attachments = {
+			vk::AttachmentDescription(
+				{},
+				G_SurfaceFormat.format,
+				vk::SampleCountFlagBits::e1,
+				vk::AttachmentLoadOp::eClear,
+				vk::AttachmentStoreOp::eStore,
+				vk::AttachmentLoadOp::eDontCare,
+				vk::AttachmentStoreOp::eDontCare,
+				vk::ImageLayout::eUndefined,
+				vk::ImageLayout::eTransferSrcOptimal
+				),
+			vk::AttachmentDescription(
+				{},
+				G_DepthFormat,
+				vk::SampleCountFlagBits::e1,
+				vk::AttachmentLoadOp::eClear,
+				vk::AttachmentStoreOp::eDontCare,
+				vk::AttachmentLoadOp::eDontCare,
+				vk::AttachmentStoreOp::eDontCare,
+				vk::ImageLayout::eUndefined,
+				vk::ImageLayout::eDepthStencilAttachmentOptimal
+				),
+			};
+
+		static constexpr std::array<vk::AttachmentReference, 1> ColorAttachmentRefs = {
+			vk::AttachmentReference(0, vk::ImageLayout::eColorAttachmentOptimal),
+		};
+		static constexpr std::array<vk::AttachmentReference, 1> DepthAttachmentRefs = {
+			vk::AttachmentReference(1, vk::ImageLayout::eDepthStencilAttachmentOptimal),
+		};
+
+		static constexpr vk::SubpassDescription subpass = vk::SubpassDescription(
+			{},
+			vk::PipelineBindPoint::eGraphics,
+			0,
+			nullptr,
+			1,
+			&ColorAttachmentRefs[0],
+			nullptr,
+			&DepthAttachmentRefs[0],
+			0,
+			nullptr
+			);
+
+		const vk::RenderPassCreateInfo renderPassCI = vk::RenderPassCreateInfo(
+			{},
+			static_cast<std::uint32_t>(attachments.size()),
+			attachments.data(),
+			1,
+			&subpass,
+			static_cast<std::uint32_t>(SceneDependencies.size()),
+			SceneDependencies.data()
+			);
+
+		G_RenderPass = G_Device.createRenderPass(renderPassCI, nullptr, G_DLD);
+		if (!G_RenderPass)
+			throw std::runtime_error("Failed to create renderpass");
+
+
+	} else {
+
+		const std::array<vk::AttachmentDescription, 3> attachments = {
+			vk::AttachmentDescription(
+				{},
+				G_SurfaceFormat.format,
+				G_SampleCount,
+				vk::AttachmentLoadOp::eClear,
+				vk::AttachmentStoreOp::eDontCare,
+				vk::AttachmentLoadOp::eDontCare,
+				vk::AttachmentStoreOp::eDontCare,
+				vk::ImageLayout::eUndefined,
+				vk::ImageLayout::eColorAttachmentOptimal
+				),
+			vk::AttachmentDescription(
+				{},
+				G_SurfaceFormat.format,
+				vk::SampleCountFlagBits::e1,
+				vk::AttachmentLoadOp::eDontCare,
+				vk::AttachmentStoreOp::eStore,
+				vk::AttachmentLoadOp::eDontCare,
+				vk::AttachmentStoreOp::eDontCare,
+				vk::ImageLayout::eUndefined,
+				vk::ImageLayout::eTransferSrcOptimal
+				),
+			vk::AttachmentDescription(
+				{},
+				G_DepthFormat,
+				G_SampleCount,
+				vk::AttachmentLoadOp::eClear,
+				vk::AttachmentStoreOp::eDontCare,
+				vk::AttachmentLoadOp::eDontCare,
+				vk::AttachmentStoreOp::eDontCare,
+				vk::ImageLayout::eUndefined,
+				vk::ImageLayout::eDepthStencilAttachmentOptimal
+				),
+			};
+
+		static constexpr std::array<vk::AttachmentReference, 1> ColorAttachmentRefs = {
+			vk::AttachmentReference(0, vk::ImageLayout::eColorAttachmentOptimal),
+		};
+		static constexpr std::array<vk::AttachmentReference, 1> ResolveAttachmentRefs = {
+			vk::AttachmentReference(1, vk::ImageLayout::eColorAttachmentOptimal),
+		};
+		static constexpr std::array<vk::AttachmentReference, 1> DepthAttachmentRefs = {
+			vk::AttachmentReference(2, vk::ImageLayout::eDepthStencilAttachmentOptimal),
+		};
+
+		static constexpr vk::SubpassDescription subpass = vk::SubpassDescription(
+			{},
+			vk::PipelineBindPoint::eGraphics,
+			0,
+			nullptr,
+			1,
+			&ColorAttachmentRefs[0],
+			&ResolveAttachmentRefs[0],
+			&DepthAttachmentRefs[0],
+			0,
+			nullptr
+			);
+
+		const vk::RenderPassCreateInfo renderPassCI = vk::RenderPassCreateInfo(
+			{},
+			static_cast<std::uint32_t>(attachments.size()),
+			attachments.data(),
+			1,
+			&subpass,
+			static_cast<std::uint32_t>(SceneDependencies.size()),
+			SceneDependencies.data()
+			);
+
+		G_RenderPass = G_Device.createRenderPass(renderPassCI, nullptr, G_DLD);
+		if (!G_RenderPass)
+			throw std::runtime_error("Failed to create multisampled renderpass");
+	}
+
+	// Single-sampled and drawn straight over the upscaled scene. Offscreen targets end it ready to be
+	// copied out instead of presented.
+	const vk::ImageLayout FinalColorLayout = G_bHeadless ? vk::ImageLayout::eTransferSrcOptimal : vk::ImageLayout::ePresentSrcKHR;
+
+	const vk::AttachmentDescription UiAttachment = vk::AttachmentDescription(
+		{},
+		G_SurfaceFormat.format,
+		vk::SampleCountFlagBits::e1,
+		vk::AttachmentLoadOp::eLoad,
+		vk::AttachmentStoreOp::eStore,
+		vk::AttachmentLoadOp::eDontCare,
+		vk::AttachmentStoreOp::eDontCare,
+		vk::ImageLayout::eTransferDstOptimal,
+		FinalColorLayout
+		);
+
+	static constexpr vk::AttachmentReference UiColorAttachmentRef = vk::AttachmentReference(0, vk::ImageLayout::eColorAttachmentOptimal);
+	static constexpr vk::SubpassDescription UiSubpass = vk::SubpassDescription(
+		{},
+		vk::PipelineBindPoint::eGraphics,
+		0,
+		nullptr,
+		1,
+		&UiColorAttachmentRef,
+		nullptr,
+		nullptr,
+		0,
+		nullptr
+		);
+
+	// Waits for the blit, and in headless mode orders the final writes before the readback copy.
+	static constexpr std::array<vk::SubpassDependency, 2> UiDependencies = {
+		vk::SubpassDependency(
+			VK_SUBPASS_EXTERNAL,
+			0,
+			vk::PipelineStageFlagBits::eTransfer,
+			vk::PipelineStageFlagBits::eColorAttachmentOutput,
+			vk::AccessFlagBits::eTransferWrite,
+			vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite
+			),
+		vk::SubpassDependency(
+			0,
+			VK_SUBPASS_EXTERNAL,
+			vk::PipelineStageFlagBits::eColorAttachmentOutput,
+			vk::PipelineStageFlagBits::eTransfer,
+			vk::AccessFlagBits::eColorAttachmentWrite,
+			vk::AccessFlagBits::eTransferRead
+			),
+	};
+
+	const vk::RenderPassCreateInfo UiRenderPassCI = vk::RenderPassCreateInfo(
+		{},
+		1,
+		&UiAttachment,
+		1,
+		&UiSubpass,
+		G_bHeadless ? 2 : 1,
+		UiDependencies.data()
+		);
+
+	G_UiRenderPass = G_Device.createRenderPass(UiRenderPassCI, nullptr, G_DLD);
+	if (!G_UiRenderPass)
+		throw std::runtime_error("Failed to create UI renderpass");
+}
+
+
+
+void InitSwapchain()
+{
+	CreateSwapchain();
+}
+
+bool CreateSurfaceSwapchain()
+{
+#ifdef _WIN32
+	RECT rc = {};
+	::GetClientRect(G_Hwnd, &rc);
+	G_WindowSize = vk::Extent2D{static_cast<std::uint32_t>(rc.right - rc.left), static_cast<std::uint32_t>(rc.bottom - rc.top)};
+#endif
+
+	// Handing the old swapchain over lets the driver recycle its images. It is retired by the create call even if that fails.
+	const vk::SwapchainKHR OldSwapchain = G_Swapchain;
+	const std::uint32_t OldImageCount = OldSwapchain ? static_cast<std::uint32_t>(G_Device.getSwapchainImagesKHR(OldSwapchain, G_DLD).size()) : 0;
+	bool bCreated = false;
+
+	try {
+
+		const vk::SurfaceCapabilitiesKHR SurfaceCapabilities = G_PhysicalDevice.getSurfaceCapabilitiesKHR(G_Surface, G_DLD);
+
+		G_SwapchainExtent = SurfaceCapabilities.currentExtent;
+		if (G_SwapchainExtent.width == std::numeric_limits<std::uint32_t>::max()) {
+			G_SwapchainExtent.width = G_WindowSize.width;
+			G_SwapchainExtent.width = std::min(SurfaceCapabilities.maxImageExtent.width,std::max(SurfaceCapabilities.minImageExtent.width, G_SwapchainExtent.width));
+		}
+		if (G_SwapchainExtent.height == std::numeric_limits<std::uint32_t>::max()) {
+			G_SwapchainExtent.height = G_WindowSize.height;
+			G_SwapchainExtent.height = std::min(SurfaceCapabilities.maxImageExtent.height,std::max(SurfaceCapabilities.minImageExtent.height, G_SwapchainExtent.height));
+		}
+		if (G_SwapchainExtent.width == 0 || G_SwapchainExtent.height == 0) return false;
+
+		G_Swapchain = nullptr;
+
+		if (G_GraphicsQueueFamilyIndex.value() != G_PresentQueueFamilyIndex.value()) {
+			const std::uint32_t QueueFamilyIndices[] = { G_GraphicsQueueFamilyIndex.value(), G_PresentQueueFamilyIndex.value()};
+			const vk::SwapchainCreateInfoKHR swapchainCI = vk::SwapchainCreateInfoKHR(
+				{},
+				G_Surface,
+				G_SurfaceImageCount,
+				G_SurfaceFormat.format,
+				G_SurfaceFormat.colorSpace,
+				G_SwapchainExtent,
+				1,
+				vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferDst,
+				vk::SharingMode::eConcurrent,
+				2,
+				QueueFamilyIndices,
+				SurfaceCapabilities.currentTransform,
+				vk::CompositeAlphaFlagBitsKHR::eOpaque,
+				G_SurfacePresentMode,
+				vk::True,
+				OldSwapchain
+				);
+			G_Swapchain = G_Device.createSwapchainKHR(swapchainCI, nullptr, G_DLD);
+		}
+		else {
+			const vk::SwapchainCreateInfoKHR swapchainCI = vk::SwapchainCreateInfoKHR(
+				{},
+				G_Surface,
+				G_SurfaceImageCount,
+				G_SurfaceFormat.format,
+				G_SurfaceFormat.colorSpace,
+				G_SwapchainExtent,
+				1,
+				vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferDst,
+				vk::SharingMode::eExclusive,
+				{},
+				{},
+				SurfaceCapabilities.currentTransform,
+				vk::CompositeAlphaFlagBitsKHR::eOpaque,
+				G_SurfacePresentMode,
+				vk::True,
+				OldSwapchain
+				);
+			G_Swapchain = G_Device.createSwapchainKHR(swapchainCI, nullptr, G_DLD);
+		}
+
+		bCreated = bool(G_Swapchain);
+
+	} catch(...) {
+		bCreated = false;
+	}
+
+	// The frame timeline only covers rendering: presents still queued on the old swapchain are not signalled by it,
+	// and without VK_EXT_swapchain_maintenance1 there is no present fence to wait on. As a conservative stand-in,
+	// wait until as many further frames as the old swapchain had images, plus the frames in flight, have completed,
+	// by which point every present queued before the recreation has been superseded on the new swapchain.
+	if (OldSwapchain && OldSwapchain != G_Swapchain) {
+		G_RetireQueue.Retire(G_FrameScheduler.GetSubmittedValue() + OldImageCount + G_FramesInFlight, [OldSwapchain]() {
+			G_Device.destroySwapchainKHR(OldSwapchain, nullptr, G_DLD);
+		});
+	}
+
+	G_SwapchainOK = bCreated;
+	return bCreated;
+}
+
+bool CreateOffscreenImages()
+{
+	G_SwapchainExtent = G_HeadlessExtent;
+
+	G_SwapchainImages.resize(G_SurfaceImageCount);
+	G_OffscreenImageAllocations.resize(G_SurfaceImageCount);
+	std::fill(G_SwapchainImages.begin(), G_SwapchainImages.end(), nullptr);
+	std::fill(G_OffscreenImageAllocations.begin(), G_OffscreenImageAllocations.end(), DeviceAllocation{});
+
+	for (std::size_t i = 0; i < G_SwapchainImages.size(); i++) {
+		const vk::ImageCreateInfo ImageCI = vk::ImageCreateInfo(
+			{},
+			vk::ImageType::e2D,
+			G_SurfaceFormat.format,
+			vk::Extent3D{G_SwapchainExtent.width, G_SwapchainExtent.height, 1},
+			1,
+			1,
+			vk::SampleCountFlagBits::e1,
+			vk::ImageTiling::eOptimal,
+			vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst,
+			vk::SharingMode::eExclusive,
+			{},
+			vk::ImageLayout::eUndefined
+			);
+
+		G_SwapchainImages[i] = G_Device.createImage(ImageCI, nullptr, G_DLD);
+		if (!G_SwapchainImages[i]) return false;
+
+		const vk::MemoryRequirements ImageMemReqs = G_Device.getImageMemoryRequirements(G_SwapchainImages[i], G_DLD);
+
+		G_OffscreenImageAllocations[i] = G_DeviceAllocator.Allocate(ImageMemReqs, vk::MemoryPropertyFlagBits::eDeviceLocal, DeviceAllocator::ResourceKind::eImage);
+		if (!G_OffscreenImageAllocations[i]) return false;
+
+		G_Device.bindImageMemory(G_SwapchainImages[i], G_OffscreenImageAllocations[i].Memory, G_OffscreenImageAllocations[i].Offset, G_DLD);
+	}
+
+	G_SwapchainOK = true;
+	return true;
+}
+
+void CreateSwapchain()
+{
+	if (G_SwapchainOK) {
+		DestroySwapchain();
+	}
+
+	if (G_bHeadless) {
+		if (!CreateOffscreenImages()) {
+			DestroySwapchain();
+			return;
+		}
+	} else {
+		if (!CreateSurfaceSwapchain()) return;
+
+		G_SwapchainImages = G_Device.getSwapchainImagesKHR(G_Swapchain, G_DLD);
+	}
+
+	if (G_SwapchainImages.empty()) {
+		DestroySwapchain();
+		return;
+	}
+
+	const std::size_t NumImages = G_SwapchainImages.size();
+	G_SwapchainImageViews.resize(NumImages);
+	std::fill(G_SwapchainImageViews.begin(), G_SwapchainImageViews.end(), nullptr);
+
+	for (std::size_t i = 0; i < NumImages; ++i) {
+		const vk::ImageViewCreateInfo ImageViewCI = vk::ImageViewCreateInfo(
+			{},
+			G_SwapchainImages[i],
+			vk::ImageViewType::e2D,
+			G_SurfaceFormat.format,
+			vk::ComponentMapping(),
+			vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1)
+			);
+
+		G_SwapchainImageViews[i] = G_Device.createImageView(ImageViewCI, nullptr, G_DLD);
+		if (!G_SwapchainImageViews[i]) {
+			DestroySwapchain();
+			return;
+		}
+	}
+
+	// Depth and MSAA color never leave the render pass, so tilers can keep them in on-chip memory only.
+	const vk::ImageUsageFlags TransientUsage = vk::ImageUsageFlagBits::eTransientAttachment;
+
+	G_AttachmentStats = AttachmentStats{};
+	G_AttachmentStats.FrameCount = G_FramesInFlight;
+	G_AttachmentStats.ImageCount = static_cast<std::uint32_t>(NumImages);
+
+	for (std::uint32_t i = 0; i < G_FramesInFlight; i++) {
+		std::vector<vk::ImageView> Attachments;
+
+		if (G_SampleCount != vk::SampleCountFlagBits::e1) {
+			if (!CreateAttachment(G_SurfaceFormat.format, G_SampleCount, vk::ImageUsageFlagBits::eColorAttachment | TransientUsage, vk::ImageAspectFlagBits::eColor, G_ColorBuffers[i])) {
+				DestroySwapchain();
+				return;
+			}
+			Attachments.push_back(G_ColorBuffers[i].View);
+		}
+
+		// Single-sampled; the upscale blit reads it after the pass, so it cannot be transient.
+		if (!CreateAttachment(G_SurfaceFormat.format, vk::SampleCountFlagBits::e1, vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc, vk::ImageAspectFlagBits::eColor, G_SceneColors[i])) {
+			DestroySwapchain();
+			return;
+		}
+		Attachments.push_back(G_SceneColors[i].View);
+
+		if (!CreateAttachment(G_DepthFormat, G_SampleCount, vk::ImageUsageFlagBits::eDepthStencilAttachment | TransientUsage, vk::ImageAspectFlagBits::eDepth, G_DepthBuffers[i])) {
+			DestroySwapchain();
+			return;
+		}
+		Attachments.push_back(G_DepthBuffers[i].View);
+
+		for (const Attachment* Transient : {&G_ColorBuffers[i], &G_DepthBuffers[i]}) {
+			G_AttachmentStats.TransientBytes += Transient->Allocation.Size;
+			G_AttachmentStats.LazilyAllocatedBytes += Transient->bLazilyAllocated ? Transient->Allocation.Size : 0;
+		}
+		G_AttachmentStats.SceneColorBytes += G_SceneColors[i].Allocation.Size;
+
+		const vk::FramebufferCreateInfo FramebufferCI = vk::FramebufferCreateInfo(
+			{},
+			G_RenderPass,
+			static_cast<std::uint32_t>(Attachments.size()),
+			Attachments.data(),
+			G_SwapchainExtent.width,
+			G_SwapchainExtent.height,
+			1
+			);
+
+		G_Framebuffers[i] = G_Device.createFramebuffer(FramebufferCI, nullptr, G_DLD);
+		if (!G_Framebuffers[i]) {
+			DestroySwapchain();
+			return;
+		}
+	}
+
+	G_UiFramebuffers.resize(NumImages);
+	std::fill(G_UiFramebuffers.begin(), G_UiFramebuffers.end(), nullptr);
+
+	for (std::size_t i = 0; i < NumImages; ++i) {
+		const vk::FramebufferCreateInfo FramebufferCI = vk::FramebufferCreateInfo(
+			{},
+			G_UiRenderPass,
+			1,
+			&G_SwapchainImageViews[i],
+			G_SwapchainExtent.width,
+			G_SwapchainExtent.height,
+			1
+			);
+
+		G_UiFramebuffers[i] = G_Device.createFramebuffer(FramebufferCI, nullptr, G_DLD);
+		if (!G_UiFramebuffers[i]) {
+			DestroySwapchain();
+			return;
+		}
+	}
+}
+
+void DestroySwapchain()
+{
+	G_SwapchainOK = false;
+
+	if (G_Device) {
+		// The viewport and projection are baked into the cached scene commands.
+		G_CommandCache.Invalidate();
+
+		// Frames still in flight may reference all of this, so it is released through the retire queue.
+		// The swapchain handle itself stays in G_Swapchain to be handed over to its replacement.
+		std::vector<vk::Framebuffer> Framebuffers(G_Framebuffers.begin(), G_Framebuffers.end());
+		Framebuffers.insert(Framebuffers.end(), G_UiFramebuffers.begin(), G_UiFramebuffers.end());
+		G_Framebuffers = {};
+		G_UiFramebuffers.clear();
+
+		std::vector<Attachment> Attachments;
+		for (std::uint32_t i = 0; i < G_MaxFramesInFlight; i++) {
+			Attachments.push_back(G_SceneColors[i]);
+			Attachments.push_back(G_DepthBuffers[i]);
+			Attachments.push_back(G_ColorBuffers[i]);
+			G_SceneColors[i] = Attachment{};
+			G_DepthBuffers[i] = Attachment{};
+			G_ColorBuffers[i] = Attachment{};
+		}
+
+		std::vector<vk::ImageView> ImageViews = G_SwapchainImageViews;
+		G_SwapchainImageViews.clear();
+
+		// Offscreen targets are ours to free; swapchain images belong to the swapchain.
+		std::vector<vk::Image> OffscreenImages;
+		if (G_bHeadless) {
+			OffscreenImages = G_SwapchainImages;
+		}
+		std::vector<DeviceAllocation> OffscreenAllocations = G_OffscreenImageAllocations;
+		G_SwapchainImages.clear();
+		G_OffscreenImageAllocations.clear();
+
+		G_RetireQueue.Retire(G_FrameScheduler.GetSubmittedValue(), [Framebuffers, Attachments, ImageViews, OffscreenImages, OffscreenAllocations]() mutable {
+			for (vk::Framebuffer Item : Framebuffers) {
+				if (Item) G_Device.destroyFramebuffer(Item, nullptr, G_DLD);
+			}
+			for (Attachment& Item : Attachments) {
+				DestroyAttachment(Item);
+			}
+			for (vk::ImageView Item : ImageViews) {
+				if (Item) G_Device.destroyImageView(Item, nullptr, G_DLD);
+			}
+			for (vk::Image Item : OffscreenImages) {
+				if (Item) G_Device.destroyImage(Item, nullptr, G_DLD);
+			}
+			for (DeviceAllocation& Item : OffscreenAllocations) {
+				G_DeviceAllocator.Free(Item);
+			}
+		});
+	}
+}
+
+bool CreateAttachment(vk::Format Format, vk::SampleCountFlagBits Samples, vk::ImageUsageFlags Usage, vk::ImageAspectFlags Aspect, Attachment& OutAttachment)
+{
+	const vk::ImageCreateInfo ImageCI = vk::ImageCreateInfo(
+		{},
+		vk::ImageType::e2D,
+		Format,
+		vk::Extent3D{G_SwapchainExtent.width, G_SwapchainExtent.height, 1},
+		1,
+		1,
+		Samples,
+		vk::ImageTiling::eOptimal,
+		Usage,
+		vk::SharingMode::eExclusive,
+		{},
+		vk::ImageLayout::eUndefined
+	);
+
+	OutAttachment.Image = G_Device.createImage(ImageCI, nullptr, G_DLD);
+	if (!OutAttachment.Image) {
+		return false;
+	}
+
+	const vk::MemoryRequirements ImageMemReqs = G_Device.getImageMemoryRequirements(OutAttachment.Image, G_DLD);
+
+	// Lazily allocated memory is only offered by tiled GPUs; everywhere else transient images still need real backing.
+	const vk::MemoryPropertyFlags LazyProperties = vk::MemoryPropertyFlagBits::eDeviceLocal | vk::MemoryPropertyFlagBits::eLazilyAllocated;
+	OutAttachment.bLazilyAllocated = (Usage & vk::ImageUsageFlagBits::eTransientAttachment) && HasMemoryType(ImageMemReqs.memoryTypeBits, LazyProperties);
+
+	OutAttachment.Allocation = G_DeviceAllocator.Allocate(ImageMemReqs, OutAttachment.bLazilyAllocated ? LazyProperties : vk::MemoryPropertyFlagBits::eDeviceLocal, DeviceAllocator::ResourceKind::eImage);
+	if (!OutAttachment.Allocation) {
+		return false;
+	}
+
+	G_Device.bindImageMemory(OutAttachment.Image, OutAttachment.Allocation.Memory, OutAttachment.Allocation.Offset, G_DLD);
+
+	const vk::ImageViewCreateInfo ImageViewCI = vk::ImageViewCreateInfo(
+		{},
+		OutAttachment.Image,
+		vk::ImageViewType::e2D,
+		Format,
+		{},
+		vk::ImageSubresourceRange{Aspect, 0, 1, 0, 1}
+	);
+
+	OutAttachment.View = G_Device.createImageView(ImageViewCI, nullptr, G_DLD);
+	return bool(OutAttachment.View);
+}
+
+void DestroyAttachment(Attachment& TargetAttachment)
+{
+	if (TargetAttachment.View) {
+		G_Device.destroyImageView(TargetAttachment.View, nullptr, G_DLD);
+	}
+	G_DeviceAllocator.Free(TargetAttachment.Allocation);
+	if (TargetAttachment.Image) {
+		G_Device.destroyImage(TargetAttachment.Image, nullptr, G_DLD);
+	}
+	TargetAttachment = Attachment{};
+}
+
+vk::DeviceSize QueryCommittedAttachmentBytes()
+{
+	// Sub-allocated attachments share a block, so each memory object is only counted once.
+	std::vector<vk::DeviceMemory> Counted;
+	vk::DeviceSize Committed = 0;
+
+	for (std::uint32_t i = 0; i < G_FramesInFlight; i++) {
+		for (const Attachment* Transient : {&G_ColorBuffers[i], &G_DepthBuffers[i]}) {
+			if (!Transient->bLazilyAllocated || std::find(Counted.begin(), Counted.end(), Transient->Allocation.Memory) != Counted.end()) {
+				continue;
+			}
+			Counted.push_back(Transient->Allocation.Memory);
+			Committed += G_Device.getMemoryCommitment(Transient->Allocation.Memory, G_DLD);
+		}
+	}
+
+	return Committed;
+}
+
+void RecreateSwapchain()
+{
+	TRACE_SCOPE("RecreateSwapchain");
+	const auto StartTime = std::chrono::high_resolution_clock::now();
+
+	DestroySwapchain();
+	CreateSwapchain();
+
+	const auto EndTime = std::chrono::high_resolution_clock::now();
+	G_SwapchainRecreateMilliseconds = float(std::chrono::duration_cast<std::chrono::microseconds>(EndTime - StartTime).count()) / 1000.0f;
+	G_SwapchainRecreations++;
+}
+
+void ShutdownSwapchain()
+{
+	DestroySwapchain();
+
+	if (G_Swapchain) {
+		G_Device.destroySwapchainKHR(G_Swapchain, nullptr, G_DLD);
+		G_Swapchain = nullptr;
+	}
+
+	// ShutdownVulkan idles the device first.
+	G_RetireQueue.Flush();
+}
+
+void InitImGui()
+{
+	static constexpr vk::DescriptorPoolSize PoolSizes[1] = {
+		vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, 10),
+	};
+	static constexpr vk::DescriptorPoolCreateInfo DescriptorPoolCI = vk::DescriptorPoolCreateInfo(
+		vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet,
+		10,
+		1,
+		PoolSizes
+	);
+	G_ImguiDescriptorPool = G_Device.createDescriptorPool(DescriptorPoolCI, nullptr, G_DLD);
+
+
+	IMGUI_CHECKVERSION();
+	G_ImGuiContext = ImGui::CreateContext();
+	ImGui::SetCurrentContext(G_ImGuiContext);
+	ImGuiIO& io = ImGui::GetIO(); (void)io;
+	io.ConfigFlags |= ImGuiConfigFlags_NavEnableKeyboard;     // Enable Keyboard Controls
+	io.ConfigFlags |= ImGuiConfigFlags_NavEnableGamepad;      // Enable Gamepad Controls
+
+	//G_ConsolasFont = io.Fonts->AddFontFromFileTTF("C:\\Windows\\Fonts\\consola.ttf", 20.0f, NULL, io.Fonts->GetGlyphRangesDefault());
+
+#ifdef _WIN32
+	ImGui_ImplWin32_Init(G_Hwnd);
+#endif
+
+	auto VkLoaderFunction = [](const char* function_name, void* user_data) -> PFN_vkVoidFunction {
+		auto pfn = G_DLD.vkGetInstanceProcAddr(G_VkInstance, function_name);
+		if (!pfn) pfn = G_DLD.vkGetDeviceProcAddr(G_Device, function_name);
+		return pfn;
+	};
+	ImGui_ImplVulkan_LoadFunctions(VkLoaderFunction, nullptr);
+
+	auto VkCheckError = [](VkResult err){};
+
+	ImGui_ImplVulkan_InitInfo VkInitInfo;
+	VkInitInfo.Instance            = G_VkInstance;
+	VkInitInfo.PhysicalDevice      = G_PhysicalDevice;
+	VkInitInfo.Device              = G_Device;
+	VkInitInfo.QueueFamily         = G_GraphicsQueueFamilyIndex.value();
+	VkInitInfo.Queue               = G_GraphicsQueue;
+	VkInitInfo.DescriptorPool      = G_ImguiDescriptorPool;
+	VkInitInfo.RenderPass          = G_UiRenderPass;
+	VkInitInfo.MinImageCount       = 2;
+	VkInitInfo.ImageCount          = std::max(2U, G_SurfaceImageCount);
+	VkInitInfo.MSAASamples         = VK_SAMPLE_COUNT_1_BIT;
+	VkInitInfo.PipelineCache       = G_PipelineCache;
+	VkInitInfo.Subpass             = 0;
+	VkInitInfo.UseDynamicRendering = false;
+	VkInitInfo.Allocator           = nullptr;
+	VkInitInfo.CheckVkResultFn     = VkCheckError;
+	VkInitInfo.MinAllocationSize   = 1024 * 1024;
+	ImGui_ImplVulkan_Init(&VkInitInfo);
+
+
+
+	ImGui::SetCurrentContext(nullptr);
+}
+
+void ShutdownImGui()
+{
+	if (!G_ImGuiContext) return;
+
+	ImGui::SetCurrentContext(G_ImGuiContext);
+
+	ImGui_ImplVulkan_Shutdown();
+
+	if (G_ImguiDescriptorPool) {
+		G_Device.destroyDescriptorPool(G_ImguiDescriptorPool, nullptr, G_DLD);
+		G_ImguiDescriptorPool = nullptr;
+	}
+
+#ifdef _WIN32
+	ImGui_ImplWin32_Shutdown();
+#endif
+
+	ImGui::DestroyContext(G_ImGuiContext);
+	ImGui::SetCurrentContext(nullptr);
+	G_ImGuiContext = nullptr;
+}
+
+static std::uint64_t HashPipelineCacheData(const std::uint8_t* Data, std::size_t Size)
+{
+	// FNV-1a; only needs to catch truncated or corrupted files.
+	std::uint64_t Hash = 14695981039346656037ull;
+	for (std::size_t i = 0; i < Size; i++) {
+		Hash = (Hash ^ Data[i]) * 1099511628211ull;
+	}
+	return Hash;
+}
+
+PipelineCacheFileHeader MakePipelineCacheHeader()
+{
+	vk::PhysicalDeviceIDProperties IDProperties = vk::PhysicalDeviceIDProperties{};
+	vk::PhysicalDeviceProperties2 Properties2 = vk::PhysicalDeviceProperties2{};
+	Properties2.setPNext(&IDProperties);
+	G_PhysicalDevice.getProperties2(&Properties2, G_DLD);
+
+	PipelineCacheFileHeader Header;
+	Header.Magic         = G_PipelineCacheMagic;
+	Header.HeaderSize    = sizeof(PipelineCacheFileHeader);
+	Header.VendorID      = Properties2.properties.vendorID;
+	Header.DeviceID      = Properties2.properties.deviceID;
+	Header.DriverVersion = Properties2.properties.driverVersion;
+	std::memcpy(Header.PipelineCacheUUID, Properties2.properties.pipelineCacheUUID.data(), VK_UUID_SIZE);
+	std::memcpy(Header.DriverUUID, IDProperties.driverUUID.data(), VK_UUID_SIZE);
+	return Header;
+}
+
+void InitPipelineCache()
+{
+	std::vector<std::uint8_t> InitialData;
+
+	std::ifstream Ifs = std::ifstream(G_PipelineCacheFileName, std::ios::binary | std::ios::in);
+	if (!Ifs.is_open()) {
+		G_PipelineStats.CacheStatus = "none";
 	} else {
+		const std::vector<std::uint8_t> Buf = std::vector<std::uint8_t>(std::istreambuf_iterator<char>(Ifs), std::istreambuf_iterator<char>());
+		Ifs.close();
+
+		// Anything that does not match this exact device and driver is thrown away rather than handed to the driver.
+		const PipelineCacheFileHeader Expected = MakePipelineCacheHeader();
+		PipelineCacheFileHeader Header;
+		if (Buf.size() >= sizeof(PipelineCacheFileHeader)) {
+			std::memcpy(&Header, Buf.data(), sizeof(PipelineCacheFileHeader));
+		}
 
-		const std::array<vk::AttachmentDescription, 3> attachments = {
-			vk::AttachmentDescription(
-				{},
-				G_SurfaceFormat.format,
-				G_SampleCount,
-				vk::AttachmentLoadOp::eClear,
-				vk::AttachmentStoreOp::eDontCare,
-				vk::AttachmentLoadOp::eDontCare,
-				vk::AttachmentStoreOp::eDontCare,
-				vk::ImageLayout::eUndefined,
-				vk::ImageLayout::eColorAttachmentOptimal
-				),
-			vk::AttachmentDescription(
-				{},
-				G_SurfaceFormat.format,
-				vk::SampleCountFlagBits::e1,
-				vk::AttachmentLoadOp::eDontCare,
-				vk::AttachmentStoreOp::eStore,
-				vk::AttachmentLoadOp::eDontCare,
-				vk::AttachmentStoreOp::eDontCare,
-				vk::ImageLayout::eUndefined,
-				vk::ImageLayout::ePresentSrcKHR
-				),
-			vk::AttachmentDescription(
-				{},
-				G_DepthFormat,
-				G_SampleCount,
-				vk::AttachmentLoadOp::eClear,
-				vk::AttachmentStoreOp::eDontCare,
-				vk::AttachmentLoadOp::eDontCare,
-				vk::AttachmentStoreOp::eDontCare,
-				vk::ImageLayout::eUndefined,
-				vk::ImageLayout::eDepthStencilAttachmentOptimal
-				),
-			};
+		if (Buf.size() < sizeof(PipelineCacheFileHeader)) {
+			G_PipelineStats.CacheStatus = "rejected: truncated";
+		} else if (Header.Magic != Expected.Magic || Header.HeaderSize != Expected.HeaderSize) {
+			G_PipelineStats.CacheStatus = "rejected: bad header";
+		} else if (Header.VendorID != Expected.VendorID || Header.DeviceID != Expected.DeviceID || Header.DriverVersion != Expected.DriverVersion) {
+			G_PipelineStats.CacheStatus = "rejected: different device or driver";
+		} else if (std::memcmp(Header.PipelineCacheUUID, Expected.PipelineCacheUUID, VK_UUID_SIZE) != 0 || std::memcmp(Header.DriverUUID, Expected.DriverUUID, VK_UUID_SIZE) != 0) {
+			G_PipelineStats.CacheStatus = "rejected: cache UUID mismatch";
+		} else if (Header.DataSize != Buf.size() - sizeof(PipelineCacheFileHeader)) {
+			G_PipelineStats.CacheStatus = "rejected: size mismatch";
+		} else if (Header.DataHash != HashPipelineCacheData(Buf.data() + sizeof(PipelineCacheFileHeader), std::size_t(Header.DataSize))) {
+			G_PipelineStats.CacheStatus = "rejected: checksum mismatch";
+		} else {
+			InitialData.assign(Buf.begin() + sizeof(PipelineCacheFileHeader), Buf.end());
+			G_PipelineStats.CacheStatus = "loaded";
+		}
+	}
+
+	G_PipelineStats.LoadedBytes = InitialData.size();
+
+	const vk::PipelineCacheCreateInfo PipelineCacheCI = vk::PipelineCacheCreateInfo({}, InitialData.size(), InitialData.data());
+	G_PipelineCache = G_Device.createPipelineCache(PipelineCacheCI, nullptr, G_DLD);
+}
+
+void ShutdownPipelineCache()
+{
+	if (!G_PipelineCache) return;
+
+	const std::vector<std::uint8_t> Data = G_Device.getPipelineCacheData(G_PipelineCache, G_DLD);
+	G_Device.destroyPipelineCache(G_PipelineCache, nullptr, G_DLD);
+	G_PipelineCache = nullptr;
+
+	if (Data.empty() || G_PipelineCacheFileName.empty()) return;
+
+	PipelineCacheFileHeader Header = MakePipelineCacheHeader();
+	Header.DataSize = Data.size();
+	Header.DataHash = HashPipelineCacheData(Data.data(), Data.size());
+
+	// Write next to the target and rename over it, so a crash mid-write never leaves a half file behind.
+	const std::string TempFileName = G_PipelineCacheFileName + ".tmp";
+	{
+		std::ofstream Ofs = std::ofstream(TempFileName, std::ios::binary | std::ios::out | std::ios::trunc);
+		if (!Ofs.is_open()) return;
+		Ofs.write(reinterpret_cast<const char*>(&Header), sizeof(Header));
+		Ofs.write(reinterpret_cast<const char*>(Data.data()), std::streamsize(Data.size()));
+		if (!Ofs) return;
+	}
+
+	std::error_code Error;
+	std::filesystem::rename(TempFileName, G_PipelineCacheFileName, Error);
+	if (!Error) {
+		G_PipelineStats.SavedBytes = Data.size();
+	}
+}
+
+void InitPipeline(TaskGroup& PipelineTasks)
+{
+	static constexpr vk::DescriptorSetLayoutBinding DescriptorSetLayoutBinding = vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eStorageBufferDynamic, 1, vk::ShaderStageFlagBits::eVertex, nullptr);
+	static constexpr vk::DescriptorSetLayoutCreateInfo DescriptorSetLayoutCI = vk::DescriptorSetLayoutCreateInfo({}, 1, &DescriptorSetLayoutBinding);
+	G_SkinsDescriptorSetLayout = G_Device.createDescriptorSetLayout(DescriptorSetLayoutCI, nullptr, G_DLD);
+
+	static constexpr vk::DescriptorSetLayoutBinding DrawDataSetLayoutBinding = vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eVertex, nullptr);
+	static constexpr vk::DescriptorSetLayoutCreateInfo DrawDataSetLayoutCI = vk::DescriptorSetLayoutCreateInfo({}, 1, &DrawDataSetLayoutBinding);
+	G_DrawDataDescriptorSetLayout = G_Device.createDescriptorSetLayout(DrawDataSetLayoutCI, nullptr, G_DLD);
+
+	static constexpr vk::DescriptorSetLayoutBinding MorphSetLayoutBindings[2] = {
+		vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eVertex, nullptr),
+		vk::DescriptorSetLayoutBinding(1, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eVertex, nullptr),
+	};
+	static constexpr vk::DescriptorSetLayoutCreateInfo MorphSetLayoutCI = vk::DescriptorSetLayoutCreateInfo({}, 2, MorphSetLayoutBindings);
+	G_MorphDescriptorSetLayout = G_Device.createDescriptorSetLayout(MorphSetLayoutCI, nullptr, G_DLD);
 
-		static constexpr std::array<vk::AttachmentReference, 1> ColorAttachmentRefs = {
-			vk::AttachmentReference(0, vk::ImageLayout::eColorAttachmentOptimal),
+	// Set 3 holds whichever baked animation data is in use: palette rows or the vertex animation atlas.
+	static constexpr vk::DescriptorSetLayoutBinding BakedAnimationSetLayoutBinding = vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eVertex, nullptr);
+	static constexpr vk::DescriptorSetLayoutCreateInfo BakedAnimationSetLayoutCI = vk::DescriptorSetLayoutCreateInfo({}, 1, &BakedAnimationSetLayoutBinding);
+	G_BakedAnimationDescriptorSetLayout = G_Device.createDescriptorSetLayout(BakedAnimationSetLayoutCI, nullptr, G_DLD);
+
+	const vk::DescriptorSetLayout SetLayouts[4] = {G_SkinsDescriptorSetLayout, G_DrawDataDescriptorSetLayout, G_MorphDescriptorSetLayout, G_BakedAnimationDescriptorSetLayout};
+	static constexpr vk::PushConstantRange PushConstantRange = vk::PushConstantRange(vk::ShaderStageFlagBits::eVertex, 0, sizeof(DirectX::XMFLOAT4X4));
+	const vk::PipelineLayoutCreateInfo PipelineLayoutCI = vk::PipelineLayoutCreateInfo{{}, 4, SetLayouts, 1, &PushConstantRange};
+	G_PipelineLayout = G_Device.createPipelineLayout(PipelineLayoutCI, nullptr, G_DLD);
+
+	static constexpr vk::DescriptorSetLayoutBinding CullSetLayoutBindings[4] = {
+		vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute, nullptr),
+		vk::DescriptorSetLayoutBinding(1, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute, nullptr),
+		vk::DescriptorSetLayoutBinding(2, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute, nullptr),
+		vk::DescriptorSetLayoutBinding(3, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute, nullptr),
+	};
+	static constexpr vk::DescriptorSetLayoutCreateInfo CullSetLayoutCI = vk::DescriptorSetLayoutCreateInfo({}, 4, CullSetLayoutBindings);
+	G_CullDescriptorSetLayout = G_Device.createDescriptorSetLayout(CullSetLayoutCI, nullptr, G_DLD);
+
+	// Six frustum planes, the draw count and the compaction flag.
+	static constexpr vk::PushConstantRange CullPushConstantRange = vk::PushConstantRange(vk::ShaderStageFlagBits::eCompute, 0, 6 * sizeof(DirectX::XMFLOAT4) + 2 * sizeof(std::uint32_t));
+	const vk::PipelineLayoutCreateInfo CullPipelineLayoutCI = vk::PipelineLayoutCreateInfo{{}, 1, &G_CullDescriptorSetLayout, 1, &CullPushConstantRange};
+	G_CullPipelineLayout = G_Device.createPipelineLayout(CullPipelineLayoutCI, nullptr, G_DLD);
+
+	// Pipeline caches are internally synchronized, so both compiles can share G_PipelineCache.
+	PipelineTasks.Run([]() {
+		TRACE_SCOPE("CreateGraphicsPipeline");
+		const auto StartTime = std::chrono::high_resolution_clock::now();
+
+		vk::ShaderModule ShaderModuleVS = CreateShader("DefaultVS.spv");
+		vk::ShaderModule ShaderModuleFS = CreateShader("DefaultFS.spv");
+
+		const std::array<vk::PipelineShaderStageCreateInfo, 2> ShaderStageCIs = {
+			vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eVertex, ShaderModuleVS, "main"),
+			vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eFragment, ShaderModuleFS, "main"),
 		};
-		static constexpr std::array<vk::AttachmentReference, 1> ResolveAttachmentRefs = {
-			vk::AttachmentReference(1, vk::ImageLayout::eColorAttachmentOptimal),
+
+		static constexpr vk::VertexInputBindingDescription VertexInputBindingDescriptions[1] = {
+			vk::VertexInputBindingDescription(0, sizeof(VkGltfModel::Vertex), vk::VertexInputRate::eVertex),
 		};
-		static constexpr std::array<vk::AttachmentReference, 1> DepthAttachmentRefs = {
-			vk::AttachmentReference(2, vk::ImageLayout::eDepthStencilAttachmentOptimal),
+		static constexpr vk::VertexInputAttributeDescription VertexInputAttributeDescriptions[7] = {
+			vk::VertexInputAttributeDescription(0, 0, vk::Format::eR32G32B32Sfloat,    0),
+			vk::VertexInputAttributeDescription(1, 0, vk::Format::eR32G32B32Sfloat,    sizeof(DirectX::XMFLOAT3)),
+			vk::VertexInputAttributeDescription(2, 0, vk::Format::eR32G32Sfloat,       sizeof(DirectX::XMFLOAT3) + sizeof(DirectX::XMFLOAT3)),
+			vk::VertexInputAttributeDescription(3, 0, vk::Format::eR32G32B32A32Uint,   sizeof(DirectX::XMFLOAT3) + sizeof(DirectX::XMFLOAT3) + sizeof(DirectX::XMFLOAT2)),
+			vk::VertexInputAttributeDescription(4, 0, vk::Format::eR32G32B32A32Sfloat, sizeof(DirectX::XMFLOAT3) + sizeof(DirectX::XMFLOAT3) + sizeof(DirectX::XMFLOAT2) + sizeof(DirectX::XMUINT4)),
+			vk::VertexInputAttributeDescription(5, 0, vk::Format::eR32G32B32A32Uint,   sizeof(DirectX::XMFLOAT3) + sizeof(DirectX::XMFLOAT3) + sizeof(DirectX::XMFLOAT2) + sizeof(DirectX::XMUINT4) + sizeof(DirectX::XMFLOAT4)),
+			vk::VertexInputAttributeDescription(6, 0, vk::Format::eR32G32B32A32Sfloat, sizeof(DirectX::XMFLOAT3) + sizeof(DirectX::XMFLOAT3) + sizeof(DirectX::XMFLOAT2) + sizeof(DirectX::XMUINT4) + sizeof(DirectX::XMFLOAT4) + sizeof(DirectX::XMUINT4)),
 		};
+		static constexpr vk::PipelineVertexInputStateCreateInfo VertexInputStateCI = vk::PipelineVertexInputStateCreateInfo({}, 1, VertexInputBindingDescriptions, 7, VertexInputAttributeDescriptions);
+
+		static constexpr vk::PipelineInputAssemblyStateCreateInfo InputAssemblyCI = vk::PipelineInputAssemblyStateCreateInfo({}, vk::PrimitiveTopology::eTriangleList);
+		static constexpr vk::PipelineTessellationStateCreateInfo TesselationStateCI = vk::PipelineTessellationStateCreateInfo();
+
+		const vk::Viewport Viewport(0.0f, 0.0f, float(G_SwapchainExtent.width), float(G_SwapchainExtent.height));
+		const vk::Rect2D Scissor(vk::Offset2D(), vk::Extent2D(G_SwapchainExtent.width, G_SwapchainExtent.height));
+		const vk::PipelineViewportStateCreateInfo ViewportStateCI = vk::PipelineViewportStateCreateInfo({}, 1, &Viewport, 1, &Scissor);
+
+		static constexpr vk::PipelineRasterizationStateCreateInfo RasterizationStateCI = vk::PipelineRasterizationStateCreateInfo({}, {}, {}, vk::PolygonMode::eFill, vk::CullModeFlagBits::eBack, vk::FrontFace::eClockwise, {}, {}, {}, {}, 1.0f);
+		const vk::PipelineMultisampleStateCreateInfo MultisampleCI = vk::PipelineMultisampleStateCreateInfo({}, G_SampleCount);
+
+		static constexpr vk::PipelineDepthStencilStateCreateInfo DepthStencilCI = vk::PipelineDepthStencilStateCreateInfo({}, vk::True, vk::True, vk::CompareOp::eLess, vk::False, vk::False, {}, {}, 0.0f, 1.0f);
+		static constexpr vk::PipelineColorBlendAttachmentState ColorBlendAttachmentState = vk::PipelineColorBlendAttachmentState({}, {}, {}, {}, {}, {}, {}, vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA);
+		static constexpr vk::PipelineColorBlendStateCreateInfo BlendStateCI = vk::PipelineColorBlendStateCreateInfo({}, {}, {}, 1, &ColorBlendAttachmentState);
+
+		static constexpr std::array<vk::DynamicState, 2> DynamicStates = { vk::DynamicState::eViewport, vk::DynamicState::eScissor};
+		static constexpr vk::PipelineDynamicStateCreateInfo DynamicStateCI = vk::PipelineDynamicStateCreateInfo({}, static_cast<std::uint32_t>(DynamicStates.size()), DynamicStates.data());
+
+		const vk::GraphicsPipelineCreateInfo GraphicsPipelineCI = vk::GraphicsPipelineCreateInfo(
+			vk::PipelineCreateFlags(),
+			ShaderStageCIs,
+			&VertexInputStateCI,
+			&InputAssemblyCI,
+			&TesselationStateCI,
+			&ViewportStateCI,
+			&RasterizationStateCI,
+			&MultisampleCI,
+			&DepthStencilCI,
+			&BlendStateCI,
+			&DynamicStateCI,
+			G_PipelineLayout,
+			G_RenderPass,
+			0
+		);
 
-		static constexpr vk::SubpassDescription subpass = vk::SubpassDescription(
-			{},
-			vk::PipelineBindPoint::eGraphics,
-			0,
-			nullptr,
-			1,
-			&ColorAttachmentRefs[0],
-			&ResolveAttachmentRefs[0],
-			&DepthAttachmentRefs[0],
-			0,
-			nullptr
-			);
+		G_Pipeline = G_Device.createGraphicsPipeline(G_PipelineCache, GraphicsPipelineCI, nullptr, G_DLD).value;
 
-		const vk::RenderPassCreateInfo renderPassCI = vk::RenderPassCreateInfo(
+		// The vertex animation variant reads everything from the atlas by gl_VertexIndex, so it takes no vertex input.
+		if (G_VertexAnimationAtlasSettings.bEnabled) {
+			vk::ShaderModule ShaderModuleVatVS = CreateShader("VatVS.spv");
+			const std::array<vk::PipelineShaderStageCreateInfo, 2> VatShaderStageCIs = {
+				vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eVertex, ShaderModuleVatVS, "main"),
+				ShaderStageCIs[1],
+			};
+			static constexpr vk::PipelineVertexInputStateCreateInfo VatVertexInputStateCI = vk::PipelineVertexInputStateCreateInfo();
+
+			vk::GraphicsPipelineCreateInfo VatPipelineCI = GraphicsPipelineCI;
+			VatPipelineCI.setStageCount(static_cast<std::uint32_t>(VatShaderStageCIs.size()));
+			VatPipelineCI.setPStages(VatShaderStageCIs.data());
+			VatPipelineCI.setPVertexInputState(&VatVertexInputStateCI);
+			G_VatPipeline = G_Device.createGraphicsPipeline(G_PipelineCache, VatPipelineCI, nullptr, G_DLD).value;
+
+			G_Device.destroyShaderModule(ShaderModuleVatVS, nullptr, G_DLD);
+		}
+
+		G_Device.destroyShaderModule(ShaderModuleVS, nullptr, G_DLD);
+		G_Device.destroyShaderModule(ShaderModuleFS, nullptr, G_DLD);
+
+		const auto EndTime = std::chrono::high_resolution_clock::now();
+		G_PipelineStats.GraphicsMilliseconds = float(std::chrono::duration_cast<std::chrono::microseconds>(EndTime - StartTime).count()) / 1000.0f;
+	});
+
+	PipelineTasks.Run([]() {
+		TRACE_SCOPE("CreateCullPipeline");
+		const auto StartTime = std::chrono::high_resolution_clock::now();
+
+		vk::ShaderModule ShaderModuleCS = CreateShader("CullCS.spv");
+		const vk::ComputePipelineCreateInfo ComputePipelineCI = vk::ComputePipelineCreateInfo(
 			{},
-			static_cast<std::uint32_t>(attachments.size()),
-			attachments.data(),
-			1,
-			&subpass
-			);
+			vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eCompute, ShaderModuleCS, "main"),
+			G_CullPipelineLayout
+		);
+		G_CullPipeline = G_Device.createComputePipeline(G_PipelineCache, ComputePipelineCI, nullptr, G_DLD).value;
+		G_Device.destroyShaderModule(ShaderModuleCS, nullptr, G_DLD);
 
-		G_RenderPass = G_Device.createRenderPass(renderPassCI, nullptr, G_DLD);
-		if (!G_RenderPass)
-			throw std::runtime_error("Failed to create multisampled renderpass");
+		const auto EndTime = std::chrono::high_resolution_clock::now();
+		G_PipelineStats.ComputeMilliseconds = float(std::chrono::duration_cast<std::chrono::microseconds>(EndTime - StartTime).count()) / 1000.0f;
+	});
+
+	G_CommandCache.Invalidate();
+}
+
+void ShutdownPipeline()
+{
+	if (G_CullPipeline) {
+		G_Device.destroyPipeline(G_CullPipeline, nullptr, G_DLD);
+		G_CullPipeline = nullptr;
+	}
+
+	if (G_CullPipelineLayout) {
+		G_Device.destroyPipelineLayout(G_CullPipelineLayout, nullptr, G_DLD);
+		G_CullPipelineLayout = nullptr;
+	}
+
+	if (G_CullDescriptorSetLayout) {
+		G_Device.destroyDescriptorSetLayout(G_CullDescriptorSetLayout, nullptr, G_DLD);
+		G_CullDescriptorSetLayout = nullptr;
+	}
+
+	if (G_Pipeline) {
+		G_Device.destroyPipeline(G_Pipeline, nullptr, G_DLD);
+		G_Pipeline = nullptr;
+	}
+
+	if (G_VatPipeline) {
+		G_Device.destroyPipeline(G_VatPipeline, nullptr, G_DLD);
+		G_VatPipeline = nullptr;
+	}
+
+	if (G_PipelineLayout) {
+		G_Device.destroyPipelineLayout(G_PipelineLayout, nullptr, G_DLD);
+		G_PipelineLayout = nullptr;
+	}
+
+	if (G_SkinsDescriptorSetLayout) {
+
+		G_Device.destroyDescriptorSetLayout(G_SkinsDescriptorSetLayout, nullptr, G_DLD);
+		G_SkinsDescriptorSetLayout = nullptr;
+	}
+
+	if (G_DrawDataDescriptorSetLayout) {
+		G_Device.destroyDescriptorSetLayout(G_DrawDataDescriptorSetLayout, nullptr, G_DLD);
+		G_DrawDataDescriptorSetLayout = nullptr;
+	}
+
+	if (G_MorphDescriptorSetLayout) {
+		G_Device.destroyDescriptorSetLayout(G_MorphDescriptorSetLayout, nullptr, G_DLD);
+		G_MorphDescriptorSetLayout = nullptr;
+	}
+
+	if (G_BakedAnimationDescriptorSetLayout) {
+		G_Device.destroyDescriptorSetLayout(G_BakedAnimationDescriptorSetLayout, nullptr, G_DLD);
+		G_BakedAnimationDescriptorSetLayout = nullptr;
 	}
 }
 
+void InitModel()
+{
+	// Both entry points get here through InitVulkan, so the benchmark runs windowed and headless alike.
+	if (G_bImportBenchmark) {
+		G_ImportBenchmarkResults = RunImportBenchmark();
+	}
+
+	const bool bBakeVertexAnimation = G_VertexAnimationAtlasSettings.bEnabled || !G_VertexAnimationAtlasSettings.ExportFileName.empty();
+	if (!G_GltfModel.LoadFromFile(G_ModelFileName, *G_ThreadPool, G_bReleaseSourceData, G_ClipCacheSettings.bEnabled, bBakeVertexAnimation)) {
+		throw std::runtime_error("Failed to load the model");
+	}
+	if (G_ClipCacheSettings.bEnabled) {
+		G_ClipCache.Start(G_ClipCacheSettings, G_GltfModel);
+	}
 
+	InitModelInstances();
 
-void InitSwapchain()
+	// Get the clips the instances start on decoding before the first frame asks for them.
+	if (G_ClipCache.IsRunning()) {
+		for (const ModelInstance& Instance : G_ModelInstances) {
+			G_ClipCache.Acquire(Instance.AnimationIndex);
+		}
+	}
+
+	// Vertex animation needs no palettes at all, so it overrides every palette path.
+	G_VertexAnimationAtlas.Init(G_VertexAnimationAtlasSettings, G_GltfModel, *G_ThreadPool);
+	G_GltfModel.ReleaseHostGeometry();
+	if (G_VertexAnimationAtlasSettings.bEnabled) {
+		G_BakedPalettesSettings.bEnabled = false;
+		G_PoseCacheSettings.bEnabled = false;
+		G_AnimationSimulationSettings.bEnabled = false;
+	}
+
+	// Baked playback costs next to nothing per instance and bakes into a buffer the render thread owns, so it
+	// replaces both pose sharing and the simulation thread.
+	if (G_BakedPalettesSettings.bEnabled) {
+		G_PoseCacheSettings.bEnabled = false;
+		G_AnimationSimulationSettings.bEnabled = false;
+	}
+	G_BakedPalettes.Init(G_BakedPalettesSettings, G_GltfModel);
+
+	G_PoseCache.Init(G_PoseCacheSettings);
+	const bool bInstancePalettes = !G_BakedPalettes.IsEnabled() && !G_VertexAnimationAtlas.IsEnabled();
+	const std::uint32_t InstancePaletteMatrices = bInstancePalettes ? G_GltfModel.M_PaletteMatrixCount * static_cast<std::uint32_t>(G_ModelInstances.size()) : 0;
+	G_PaletteRing.Init(InstancePaletteMatrices + GetPaletteRemapMatrixCount());
+	if (G_AnimationSimulationSettings.bEnabled) {
+		G_AnimationSimulation.Start(G_AnimationSimulationSettings, G_PoseCacheSettings, G_GltfModel, G_ModelInstances);
+	}
+
+	// The end of the load is the one point where nothing has been recorded against the model's buffers yet.
+	G_GltfModel.DefragmentBuffers();
+
+	G_DrawList.Init();
+	G_DrawList.Build(G_GltfModel, G_ModelInstances);
+	G_CommandCache.Invalidate();
+}
+
+void ShutdownModel()
 {
-	CreateSwapchain();
+	G_AnimationSimulation.Stop();
+	G_ClipCache.Stop();
+	G_DrawList.Shutdown();
+	G_PaletteRing.Shutdown();
+	G_BakedPalettes.Shutdown();
+	G_VertexAnimationAtlas.Shutdown();
+	G_ModelInstances.clear();
+	G_GltfModel.Shutdown();
 }
 
-void CreateSwapchain()
+void InitModelInstances()
 {
-	if (G_SwapchainOK) {
-		DestroySwapchain();
+	G_ModelInstances.resize(G_InstanceCount);
+
+	// A square grid around the origin; a single instance keeps the original framing.
+	const std::uint32_t GridSide = static_cast<std::uint32_t>(std::ceil(std::sqrt(float(G_InstanceCount))));
+	static constexpr float Spacing = 1.2f;
+	const float GridOrigin = -0.5f * Spacing * float(GridSide - 1);
+
+	for (std::uint32_t i = 0; i < G_InstanceCount; i++) {
+		ModelInstance& Instance = G_ModelInstances[i];
+
+		const float X = GridOrigin + Spacing * float(i % GridSide);
+		const float Z = GridOrigin + Spacing * float(i / GridSide);
+		const DirectX::XMMATRIX MatModel = DirectX::XMMatrixMultiply(DirectX::XMMatrixRotationY(DirectX::XMConvertToRadians(30.0f)), DirectX::XMMatrixTranslation(X, 0.0f, -Z));
+		DirectX::XMStoreFloat4x4(&Instance.Transform, MatModel);
+
+		// Golden-ratio phase offsets so neighbours don't run in lockstep.
+		Instance.AnimationIndex = G_GltfModel.M_Animations.empty() ? 0 : std::min(G_AnimationClip, static_cast<std::uint32_t>(G_GltfModel.M_Animations.size()) - 1);
+		Instance.AnimationTime = G_GltfModel.WrapAnimationTime(Instance.AnimationIndex, 0.618034f * 10.0f * float(i) + G_AnimationStartTime);
 	}
+}
 
-	RECT rc = {};
-	::GetClientRect(G_Hwnd, &rc);
-	G_WindowSize = vk::Extent2D{static_cast<std::uint32_t>(rc.right - rc.left), static_cast<std::uint32_t>(rc.bottom - rc.top)};
+std::uint32_t GetPaletteRemapMatrixCount()
+{
+	// One 32-bit palette base per instance, 16 to a matrix, or one four-word FrameRef per instance when baked.
+	const std::uint32_t InstanceCount = static_cast<std::uint32_t>(G_ModelInstances.size());
+	if (G_VertexAnimationAtlasSettings.bEnabled) return (1 + std::max(G_VertexAnimationAtlas.GetStats().ClipCount, 1U) + 15) / 16;
+	if (G_BakedPalettesSettings.bEnabled) return (InstanceCount + 3) / 4;
+	return G_PoseCacheSettings.bEnabled ? (InstanceCount + 15) / 16 : 0;
+}
 
-	try {
+void UpdateModelInstances(float DeltaTime)
+{
+	TRACE_SCOPE("UpdateModelInstances");
+	static VkGltfModel::Pose PoseScratch;
 
-		const vk::SurfaceCapabilitiesKHR SurfaceCapabilities = G_PhysicalDevice.getSurfaceCapabilitiesKHR(G_Surface, G_DLD);
+	G_PaletteRing.BeginFrame(G_CurrentFrame);
 
-		G_SwapchainExtent = SurfaceCapabilities.currentExtent;
-		if (G_SwapchainExtent.width == std::numeric_limits<std::uint32_t>::max()) {
-			G_SwapchainExtent.width = G_WindowSize.width;
-			G_SwapchainExtent.width = std::min(SurfaceCapabilities.maxImageExtent.width,std::max(SurfaceCapabilities.minImageExtent.width, G_SwapchainExtent.width));
-		}
-		if (G_SwapchainExtent.height == std::numeric_limits<std::uint32_t>::max()) {
-			G_SwapchainExtent.height = G_WindowSize.height;
-			G_SwapchainExtent.height = std::min(SurfaceCapabilities.maxImageExtent.height,std::max(SurfaceCapabilities.minImageExtent.height, G_SwapchainExtent.height));
-		}
-		if (G_SwapchainExtent.width == 0 || G_SwapchainExtent.height == 0) return;
+	// The remap table must be the slice's first allocation: DrawData::PaletteSlot indexes it from word 0.
+	std::uint32_t* RemapWords = nullptr;
+	if (G_PoseCacheSettings.bEnabled || G_BakedPalettesSettings.bEnabled || G_VertexAnimationAtlasSettings.bEnabled) {
+		DirectX::XMFLOAT4X4* RemapMatrices = nullptr;
+		G_PaletteRing.Allocate(GetPaletteRemapMatrixCount(), RemapMatrices);
+		RemapWords = reinterpret_cast<std::uint32_t*>(RemapMatrices);
+	}
 
-		if (G_GraphicsQueueFamilyIndex.value() != G_PresentQueueFamilyIndex.value()) {
-			const std::uint32_t QueueFamilyIndices[] = { G_GraphicsQueueFamilyIndex.value(), G_PresentQueueFamilyIndex.value()};
-			const vk::SwapchainCreateInfoKHR swapchainCI = vk::SwapchainCreateInfoKHR(
-				{},
-				G_Surface,
-				G_SurfaceImageCount,
-				G_SurfaceFormat.format,
-				G_SurfaceFormat.colorSpace,
-				G_SwapchainExtent,
-				1,
-				vk::ImageUsageFlagBits::eColorAttachment,
-				vk::SharingMode::eConcurrent,
-				2,
-				QueueFamilyIndices,
-				SurfaceCapabilities.currentTransform,
-				vk::CompositeAlphaFlagBitsKHR::eOpaque,
-				G_SurfacePresentMode,
-				vk::True
-				);
-			G_Swapchain = G_Device.createSwapchainKHR(swapchainCI, nullptr, G_DLD);
+	if (G_VertexAnimationAtlas.IsEnabled()) {
+		// Vat.vert reads the atlas stride and every clip's clock from the head of the slice; the instances never change.
+		G_VertexAnimationAtlas.Advance(DeltaTime);
+		const VertexAnimationAtlas::Stats& VatStats = G_VertexAnimationAtlas.GetStats();
+		RemapWords[0] = VatStats.VertexCount;
+		for (std::uint32_t c = 0; c < VatStats.ClipCount; c++) {
+			RemapWords[1 + c] = std::bit_cast<std::uint32_t>(G_VertexAnimationAtlas.GetClipClock(c));
 		}
-		else {
-			const vk::SwapchainCreateInfoKHR swapchainCI = vk::SwapchainCreateInfoKHR(
-				{},
-				G_Surface,
-				G_SurfaceImageCount,
-				G_SurfaceFormat.format,
-				G_SurfaceFormat.colorSpace,
-				G_SwapchainExtent,
-				1,
-				vk::ImageUsageFlagBits::eColorAttachment,
-				vk::SharingMode::eExclusive,
-				{},
-				{},
-				SurfaceCapabilities.currentTransform,
-				vk::CompositeAlphaFlagBitsKHR::eOpaque,
-				G_SurfacePresentMode,
-				vk::True
-				);
-			G_Swapchain = G_Device.createSwapchainKHR(swapchainCI, nullptr, G_DLD);
+
+		G_PaletteRing.EndFrame();
+		return;
+	}
+
+	if (G_BakedPalettes.IsEnabled()) {
+		for (std::size_t i = 0; i < G_ModelInstances.size(); i++) {
+			ModelInstance& Instance = G_ModelInstances[i];
+			Instance.AnimationTime = G_GltfModel.WrapAnimationTime(Instance.AnimationIndex, Instance.AnimationTime + DeltaTime);
+
+			const BakedPalettes::FrameRef Ref = G_BakedPalettes.Resolve(Instance.AnimationIndex, Instance.AnimationTime);
+			RemapWords[4 * i + 0] = Ref.Row0;
+			RemapWords[4 * i + 1] = Ref.Row1;
+			RemapWords[4 * i + 2] = std::bit_cast<std::uint32_t>(Ref.Alpha);
+			RemapWords[4 * i + 3] = 0;
 		}
 
-		if (!G_Swapchain)return;
-		G_SwapchainOK = true;
+		G_PaletteRing.EndFrame();
+		return;
+	}
+
+	if (G_AnimationSimulation.IsRunning()) {
+		// The palettes are already evaluated; all that is left here is the copy.
+		const AnimationSimulation::PoseSnapshot& Snapshot = G_AnimationSimulation.AcquireSnapshot();
+		G_FrameTelemetry.Record(FrameTelemetry::Metric::eSnapshotAge, std::chrono::steady_clock::now() - Snapshot.PublishTime);
 
+		DirectX::XMFLOAT4X4* DstPalette = nullptr;
+		const std::uint32_t Base = G_PaletteRing.Allocate(Snapshot.MatrixCount, DstPalette);
+		if (Snapshot.MatrixCount > 0) {
+			std::memcpy(DstPalette, Snapshot.Palettes.data(), std::size_t(Snapshot.MatrixCount) * sizeof(DirectX::XMFLOAT4X4));
+		}
+		for (std::size_t i = 0; i < G_ModelInstances.size(); i++) {
+			const std::uint32_t Offset = Snapshot.InstanceOffsets.empty() ? static_cast<std::uint32_t>(i) * G_GltfModel.M_PaletteMatrixCount : Snapshot.InstanceOffsets[i];
+			G_ModelInstances[i].PaletteBase = Base + Offset;
+			if (RemapWords) RemapWords[i] = Base + Offset;
+		}
 
-	} catch(...) {
+		G_PaletteRing.EndFrame();
 		return;
 	}
 
-	G_SwapchainImages = G_Device.getSwapchainImagesKHR(G_Swapchain, G_DLD);
-	if (G_SwapchainImages.empty()) {
-		DestroySwapchain();
+	if (G_PoseCache.IsEnabled()) {
+		G_PoseCache.BeginFrame();
+		for (std::size_t i = 0; i < G_ModelInstances.size(); i++) {
+			ModelInstance& Instance = G_ModelInstances[i];
+			Instance.AnimationTime = G_GltfModel.WrapAnimationTime(Instance.AnimationIndex, Instance.AnimationTime + DeltaTime);
+
+			Instance.PaletteBase = G_PoseCache.Resolve(G_GltfModel, Instance, [&Instance](float SampleTime) {
+				DirectX::XMFLOAT4X4* DstPalette = nullptr;
+				const std::uint32_t Base = G_PaletteRing.Allocate(G_GltfModel.M_PaletteMatrixCount, DstPalette);
+				G_GltfModel.EvaluatePose(Instance.AnimationIndex, SampleTime, PoseScratch);
+				G_GltfModel.UpdateJoints(PoseScratch, DstPalette);
+				return Base;
+			});
+			RemapWords[i] = Instance.PaletteBase;
+		}
+		G_PoseCache.EndFrame();
+
+		G_PaletteRing.EndFrame();
 		return;
 	}
 
-	const std::size_t NumImages = G_SwapchainImages.size();
-	G_SwapchainImageViews.resize(NumImages);
-	std::fill(G_SwapchainImageViews.begin(), G_SwapchainImageViews.end(), nullptr);
+	for (auto& Instance : G_ModelInstances) {
+		Instance.AnimationTime = G_GltfModel.WrapAnimationTime(Instance.AnimationIndex, Instance.AnimationTime + DeltaTime);
 
-	for (std::size_t i = 0; i < NumImages; ++i) {
-		const vk::ImageViewCreateInfo ImageViewCI = vk::ImageViewCreateInfo(
-			{},
-			G_SwapchainImages[i],
-			vk::ImageViewType::e2D,
-			G_SurfaceFormat.format,
-			vk::ComponentMapping(),
-			vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1)
-			);
+		DirectX::XMFLOAT4X4* DstPalette = nullptr;
+		Instance.PaletteBase = G_PaletteRing.Allocate(G_GltfModel.M_PaletteMatrixCount, DstPalette);
 
-		G_SwapchainImageViews[i] = G_Device.createImageView(ImageViewCI, nullptr, G_DLD);
-		if (!G_SwapchainImageViews[i]) {
-			DestroySwapchain();
-			return;
-		}
+		G_GltfModel.EvaluatePose(Instance.AnimationIndex, Instance.AnimationTime, PoseScratch);
+		G_GltfModel.UpdateJoints(PoseScratch, DstPalette);
 	}
 
-	if (G_SampleCount != vk::SampleCountFlagBits::e1) {
+	G_PaletteRing.EndFrame();
+}
 
-		G_ColorBufferImages.resize(NumImages);
-		G_ColorBufferDeviceMemories.resize(NumImages);
-		G_ColorBufferImageViews.resize(NumImages);
-		std::fill(G_ColorBufferImages.begin(), G_ColorBufferImages.end(), nullptr);
-		std::fill(G_ColorBufferDeviceMemories.begin(), G_ColorBufferDeviceMemories.end(), nullptr);
-		std::fill(G_ColorBufferImageViews.begin(), G_ColorBufferImageViews.end(), nullptr);
+void PoseCache::Init(const Settings& InSettings)
+{
+	M_Settings = InSettings;
+	M_Palettes.clear();
+	M_Lookups = 0;
+	M_Hits = 0;
+	M_FrameInstances = 0;
+	M_FramePoses = 0;
+}
 
+void PoseCache::BeginFrame()
+{
+	// clear() keeps the buckets, so after the first frame this never allocates.
+	M_Palettes.clear();
+	M_FrameLookups = 0;
+	M_FrameHits = 0;
+}
 
-		for (std::size_t i = 0; i < NumImages; i++) {
+void PoseCache::EndFrame()
+{
+	M_Lookups.fetch_add(M_FrameLookups, std::memory_order_relaxed);
+	M_Hits.fetch_add(M_FrameHits, std::memory_order_relaxed);
+	M_FrameInstances.store(M_FrameLookups, std::memory_order_relaxed);
+	M_FramePoses.store(static_cast<std::uint32_t>(M_Palettes.size()), std::memory_order_relaxed);
+}
 
-			const vk::ImageCreateInfo ImageCI = vk::ImageCreateInfo(
-				{},
-				vk::ImageType::e2D,
-				G_SurfaceFormat.format,
-				vk::Extent3D{G_SwapchainExtent.width, G_SwapchainExtent.height, 1},
-				1,
-				1,
-				G_SampleCount,
-				vk::ImageTiling::eOptimal,
-				vk::ImageUsageFlagBits::eColorAttachment,
-				vk::SharingMode::eExclusive,
-				{},
-				vk::ImageLayout::eUndefined
-				);
+PoseCache::Stats PoseCache::GetStats() const
+{
+	Stats Result;
+	Result.Lookups = M_Lookups.load(std::memory_order_relaxed);
+	Result.Hits = M_Hits.load(std::memory_order_relaxed);
+	Result.FrameInstances = M_FrameInstances.load(std::memory_order_relaxed);
+	Result.FramePoses = M_FramePoses.load(std::memory_order_relaxed);
+	return Result;
+}
 
-			G_ColorBufferImages[i] = G_Device.createImage(ImageCI, nullptr, G_DLD);
-			if (!G_ColorBufferImages[i]) {
-				DestroySwapchain();
-				return;
-			}
+void BakedPalettes::Init(const Settings& InSettings, const VkGltfModel& Model)
+{
+	M_Settings = InSettings;
+	M_Model = &Model;
+	M_ClipFirstRow.clear();
+	M_ClipFrameCount.clear();
+	M_ClipFrameRate.clear();
+	M_RowsBaked = 0;
+	M_BakeTime = {};
+
+	// Row 0 is the rest pose, for clips whose keys are still streaming in.
+	M_RowStride = std::max(Model.M_MorphWeightOffset * 3 + (Model.M_MorphTargetCount + 3) / 4, 1U);
+	M_RowCount = 1;
+	// Rows are spread evenly from the start to the end of each clip, so the first and last land exactly on its ends
+	// and every pair is the same time apart; that spacing is the clip's frame rate, at least SampleRate.
+	if (M_Settings.bEnabled) {
+		for (const auto& Anim : Model.M_Animations) {
+			const float Duration = std::max(Anim.End - Anim.Start, 0.0f);
+			const std::uint32_t FrameCount = static_cast<std::uint32_t>(std::ceil(Duration * M_Settings.SampleRate)) + 1;
+			M_ClipFirstRow.push_back(M_RowCount);
+			M_ClipFrameCount.push_back(FrameCount);
+			M_ClipFrameRate.push_back((FrameCount > 1) ? float(FrameCount - 1) / Duration : 0.0f);
+			M_RowCount += FrameCount;
+		}
+	}
+	M_RowBaked.assign(M_RowCount, 0);
+
+	const vk::DeviceSize ByteSize = M_Settings.bEnabled ? vk::DeviceSize(M_RowCount) * M_RowStride * sizeof(DirectX::XMFLOAT4) : sizeof(DirectX::XMFLOAT4);
+	const vk::BufferCreateInfo BufferCI = vk::BufferCreateInfo({}, ByteSize, vk::BufferUsageFlagBits::eStorageBuffer, vk::SharingMode::eExclusive, 0, nullptr);
+	M_Buffer = G_Device.createBuffer(BufferCI, nullptr, G_DLD);
+
+	// Same placement as the palette ring: rows are written from the CPU once and read by every frame after.
+	const vk::MemoryRequirements MemReqs = G_Device.getBufferMemoryRequirements(M_Buffer, G_DLD);
+	const vk::MemoryPropertyFlags DeviceLocalFlags = vk::MemoryPropertyFlagBits::eDeviceLocal | vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+	M_bDeviceLocal = HasMemoryType(MemReqs.memoryTypeBits, DeviceLocalFlags);
+	M_Allocation = G_DeviceAllocator.Allocate(MemReqs, M_bDeviceLocal ? DeviceLocalFlags : (vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent), DeviceAllocator::ResourceKind::eBuffer);
+	G_Device.bindBufferMemory(M_Buffer, M_Allocation.Memory, M_Allocation.Offset, G_DLD);
+
+	const vk::DescriptorPoolSize PoolSize(vk::DescriptorType::eStorageBuffer, 1);
+	const vk::DescriptorPoolCreateInfo DescriptorPoolCI = vk::DescriptorPoolCreateInfo({}, 1, 1, &PoolSize);
+	M_DescriptorPool = G_Device.createDescriptorPool(DescriptorPoolCI, nullptr, G_DLD);
+
+	const vk::DescriptorSetAllocateInfo DescriptorSetAI = vk::DescriptorSetAllocateInfo(M_DescriptorPool, 1, &G_BakedAnimationDescriptorSetLayout);
+	M_DescriptorSet = G_Device.allocateDescriptorSets(DescriptorSetAI, G_DLD)[0];
+
+	const vk::DescriptorBufferInfo DescriptorBI = vk::DescriptorBufferInfo(M_Buffer, 0, vk::WholeSize);
+	const vk::WriteDescriptorSet Write = vk::WriteDescriptorSet(M_DescriptorSet, 0, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &DescriptorBI, nullptr);
+	G_Device.updateDescriptorSets(Write, nullptr, G_DLD);
+
+	if (M_Settings.bEnabled) {
+		M_PaletteScratch.resize(std::max(Model.M_PaletteMatrixCount, 1U));
+		M_RowScratch.resize(M_RowStride);
+		BakeRow(nullptr, 0, 0.0f, 0);
+	}
+}
 
-			const vk::MemoryRequirements ImageMemReqs = G_Device.getImageMemoryRequirements(G_ColorBufferImages[i], G_DLD);
-			const std::uint32_t ImageMemoryTypeIndex = FindMemoryTypeIndex(ImageMemReqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
-			const vk::MemoryAllocateInfo ImageMemoryAI = vk::MemoryAllocateInfo{ImageMemReqs.size, ImageMemoryTypeIndex};
+void BakedPalettes::Shutdown()
+{
+	if (M_DescriptorPool) {
+		G_Device.destroyDescriptorPool(M_DescriptorPool, nullptr, G_DLD);
+		M_DescriptorPool = nullptr;
+		M_DescriptorSet = nullptr;
+	}
 
-			G_ColorBufferDeviceMemories[i] = G_Device.allocateMemory(ImageMemoryAI, nullptr, G_DLD);
-			if (!G_ColorBufferDeviceMemories[i]) {
-				DestroySwapchain();
-				return;
-			}
+	if (M_Buffer) {
+		G_Device.destroyBuffer(M_Buffer, nullptr, G_DLD);
+		M_Buffer = nullptr;
+	}
+	G_DeviceAllocator.Free(M_Allocation);
 
-			G_Device.bindImageMemory(G_ColorBufferImages[i], G_ColorBufferDeviceMemories[i], 0, G_DLD);
+	M_Model = nullptr;
+	M_RowBaked.clear();
+}
 
-			const vk::ImageViewCreateInfo ImageViewCI = vk::ImageViewCreateInfo(
-				{},
-				G_ColorBufferImages[i],
-				vk::ImageViewType::e2D,
-				G_SurfaceFormat.format,
-				{},
-				vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1}
-				);
+BakedPalettes::FrameRef BakedPalettes::Resolve(std::uint32_t AnimationIndex, float Time)
+{
+	if (AnimationIndex >= M_ClipFirstRow.size()) return FrameRef{};
+
+	const VkGltfModel::Animation& Anim = M_Model->M_Animations[AnimationIndex];
+	const std::uint32_t FrameCount = M_ClipFrameCount[AnimationIndex];
+	const float         FrameRate  = M_ClipFrameRate[AnimationIndex];
+	const float         Position   = std::max(Time - Anim.Start, 0.0f) * FrameRate;
+	const std::uint32_t Frame0     = std::min(static_cast<std::uint32_t>(Position), FrameCount - 1);
+	const std::uint32_t Frame1     = std::min(Frame0 + 1, FrameCount - 1);
+	const std::uint32_t Row0       = M_ClipFirstRow[AnimationIndex] + Frame0;
+	const std::uint32_t Row1       = M_ClipFirstRow[AnimationIndex] + Frame1;
+
+	if (!M_RowBaked[Row0] || !M_RowBaked[Row1]) {
+		const std::shared_ptr<const VkGltfModel::AnimationClip> Clip = M_Model->AcquireClip(AnimationIndex);
+		if (!Clip) return FrameRef{};
+
+		// Clamped so rounding never samples the last frame past the end of the clip.
+		if (!M_RowBaked[Row0]) BakeRow(Clip.get(), AnimationIndex, (FrameRate > 0.0f) ? std::min(Anim.Start + float(Frame0) / FrameRate, Anim.End) : Anim.Start, Row0);
+		if (!M_RowBaked[Row1]) BakeRow(Clip.get(), AnimationIndex, (FrameRate > 0.0f) ? std::min(Anim.Start + float(Frame1) / FrameRate, Anim.End) : Anim.Start, Row1);
+	}
 
-			G_ColorBufferImageViews[i] = G_Device.createImageView(ImageViewCI, nullptr, G_DLD);
-			if (!G_ColorBufferImageViews[i]) {
-				DestroySwapchain();
-				return;
-			}
-		}
+	FrameRef Ref;
+	Ref.Row0 = Row0 * M_RowStride;
+	Ref.Row1 = Row1 * M_RowStride;
+	Ref.Alpha = (Frame1 > Frame0) ? std::clamp(Position - float(Frame0), 0.0f, 1.0f) : 0.0f;
+	return Ref;
+}
+
+void BakedPalettes::BakeRow(const VkGltfModel::AnimationClip* Clip, std::uint32_t AnimationIndex, float Time, std::uint32_t Row)
+{
+	TRACE_SCOPE("BakePaletteRow");
+	const auto StartTime = std::chrono::steady_clock::now();
+
+	DirectX::XMFLOAT4X4* Palette = reinterpret_cast<DirectX::XMFLOAT4X4*>(M_PaletteScratch.data());
+	M_Model->EvaluatePose(AnimationIndex, Clip, Time, M_PoseScratch);
+	M_Model->UpdateJoints(M_PoseScratch, Palette);
+
+	// Transposed, the palette matrix's last row is 0,0,0,1; only the first three are kept.
+	for (std::uint32_t j = 0; j < M_Model->M_MorphWeightOffset; j++) {
+		const DirectX::XMMATRIX Transposed = DirectX::XMMatrixTranspose(DirectX::XMLoadFloat4x4(&Palette[j]));
+		DirectX::XMStoreFloat4(&M_RowScratch[j * 3 + 0], Transposed.r[0]);
+		DirectX::XMStoreFloat4(&M_RowScratch[j * 3 + 1], Transposed.r[1]);
+		DirectX::XMStoreFloat4(&M_RowScratch[j * 3 + 2], Transposed.r[2]);
+	}
+	float* Weights = reinterpret_cast<float*>(M_RowScratch.data() + M_Model->M_MorphWeightOffset * 3);
+	for (std::uint32_t t = 0; t < M_Model->M_MorphTargetCount; t++) {
+		Weights[t] = M_PoseScratch.MorphWeights[t];
 	}
 
+	// One sequential copy suits write-combined memory better than scattered stores.
+	DirectX::XMFLOAT4* Dst = static_cast<DirectX::XMFLOAT4*>(M_Allocation.Mapped) + std::size_t(Row) * M_RowStride;
+	std::memcpy(Dst, M_RowScratch.data(), std::size_t(M_RowStride) * sizeof(DirectX::XMFLOAT4));
 
-	G_DepthBufferImages.resize(NumImages);
-	G_DepthBufferDeviceMemories.resize(NumImages);
-	G_DepthBufferImageViews.resize(NumImages);
-	std::fill(G_DepthBufferImages.begin(), G_DepthBufferImages.end(), nullptr);
-	std::fill(G_DepthBufferDeviceMemories.begin(), G_DepthBufferDeviceMemories.end(), nullptr);
-	std::fill(G_DepthBufferImageViews.begin(), G_DepthBufferImageViews.end(), nullptr);
+	M_RowBaked[Row] = 1;
+	M_RowsBaked++;
+	M_BakeTime += std::chrono::steady_clock::now() - StartTime;
+}
 
+void VertexAnimationAtlas::Init(const Settings& InSettings, const VkGltfModel& Model, ThreadPool& Pool)
+{
+	M_Settings = InSettings;
+	M_Clips.clear();
+	M_Stats = Stats{};
+	M_Clock = 0.0;
+	if (!M_Settings.bEnabled && M_Settings.ExportFileName.empty()) return;
 
-	for (std::size_t i = 0; i < NumImages; i++) {
+	TRACE_SCOPE("BakeVertexAnimation");
+	const auto StartTime = std::chrono::steady_clock::now();
 
-		const vk::ImageCreateInfo ImageCI = vk::ImageCreateInfo(
-			{},
-			vk::ImageType::e2D,
-			G_DepthFormat,
-			vk::Extent3D{G_SwapchainExtent.width, G_SwapchainExtent.height, 1},
-			1,
-			1,
-			G_SampleCount,
-			vk::ImageTiling::eOptimal,
-			vk::ImageUsageFlagBits::eDepthStencilAttachment,
-			vk::SharingMode::eExclusive,
-			{},
-			vk::ImageLayout::eUndefined
-		);
+	if (Model.M_HostVertices.empty()) {
+		throw std::runtime_error("Vertex animation needs the model's host geometry");
+	}
+	const std::uint32_t VertexCount = static_cast<std::uint32_t>(Model.M_HostVertices.size());
+
+	// Same frame placement as the baked palettes: evenly from the start to the end of the clip, at least SampleRate.
+	std::uint32_t FrameCount = 0;
+	for (const auto& Anim : Model.M_Animations) {
+		const float Duration = std::max(Anim.End - Anim.Start, 0.0f);
+		ClipRange Range;
+		Range.FirstFrame = FrameCount;
+		Range.FrameCount = static_cast<std::uint32_t>(std::ceil(Duration * M_Settings.SampleRate)) + 1;
+		Range.FrameRate = (Range.FrameCount > 1) ? float(Range.FrameCount - 1) / Duration : 0.0f;
+		Range.StartTime = std::min(Anim.Start, Anim.End);
+		M_Clips.push_back(Range);
+		FrameCount += Range.FrameCount;
+	}
+	// A model without clips still gets its rest pose as a one-frame clip.
+	if (M_Clips.empty()) {
+		M_Clips.push_back(ClipRange{});
+		FrameCount = 1;
+	}
 
-		G_DepthBufferImages[i] = G_Device.createImage(ImageCI, nullptr, G_DLD);
-		if (!G_DepthBufferImages[i]) {
-			DestroySwapchain();
-			return;
+	// Each vertex is skinned with the skin of the node drawing it, the same pairing DrawList::Build makes.
+	static constexpr std::uint32_t NoSkin = ~0U;
+	std::vector<std::uint32_t> VertexPaletteBases(VertexCount, NoSkin);
+	std::vector<std::uint8_t> VertexMorphed(VertexCount, 0);
+	for (const auto& Node : Model.M_LinearNodes) {
+		if (Node->Skin < 0) continue;
+		for (const auto& Primitive : Node->MeshData.Primitives) {
+			for (std::uint32_t v = Primitive.FirstVertex; v < Primitive.FirstVertex + Primitive.VertexCount; v++) {
+				VertexPaletteBases[v] = Model.M_Skins[Node->Skin].PaletteOffset;
+				VertexMorphed[v] = (Node->MorphTargetCount > 0 && Model.M_MorphTargetCount > 0) ? 1 : 0;
+			}
 		}
+	}
 
-		const vk::MemoryRequirements ImageMemReqs = G_Device.getImageMemoryRequirements(G_DepthBufferImages[i], G_DLD);
-		const std::uint32_t ImageMemoryTypeIndex = FindMemoryTypeIndex(ImageMemReqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
-		const vk::MemoryAllocateInfo ImageMemoryAI = vk::MemoryAllocateInfo{ImageMemReqs.size, ImageMemoryTypeIndex};
+	// Frames are independent, so each one is a task.
+	std::vector<AtlasVertex> Atlas(std::size_t(FrameCount) * VertexCount);
+	{
+		TaskGroup Tasks(Pool);
+		for (std::uint32_t c = 0; c < static_cast<std::uint32_t>(M_Clips.size()); c++) {
+			const ClipRange& Range = M_Clips[c];
+
+			// Streamed clips are decoded here directly rather than through the cache; the bake needs all of them once.
+			std::shared_ptr<const VkGltfModel::AnimationClip> Clip;
+			float EndTime = 0.0f;
+			if (c < Model.M_Animations.size()) {
+				Clip = Model.M_Animations[c].Clip ? Model.M_Animations[c].Clip : Model.DecodeClip(c);
+				EndTime = Model.M_Animations[c].End;
+			}
 
-		G_DepthBufferDeviceMemories[i] = G_Device.allocateMemory(ImageMemoryAI, nullptr, G_DLD);
-		if (!G_DepthBufferDeviceMemories[i]) {
-			DestroySwapchain();
-			return;
+			for (std::uint32_t f = 0; f < Range.FrameCount; f++) {
+				const float Time = (Range.FrameRate > 0.0f) ? std::min(Range.StartTime + float(f) / Range.FrameRate, EndTime) : Range.StartTime;
+				AtlasVertex* Dst = Atlas.data() + std::size_t(Range.FirstFrame + f) * VertexCount;
+				Tasks.Run([this, &Model, &VertexPaletteBases, &VertexMorphed, Clip, c, Time, Dst]() {
+					BakeFrame(Model, c, Clip.get(), Time, VertexPaletteBases, VertexMorphed, Dst);
+				});
+			}
 		}
+		Tasks.Wait();
+	}
 
-		G_Device.bindImageMemory(G_DepthBufferImages[i], G_DepthBufferDeviceMemories[i], 0, G_DLD);
-
-		const vk::ImageViewCreateInfo ImageViewCI = vk::ImageViewCreateInfo(
-			{},
-			G_DepthBufferImages[i],
-			vk::ImageViewType::e2D,
-			G_DepthFormat,
-			{},
-			vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eDepth, 0, 1, 0, 1}
-		);
+	M_Stats.VertexCount = VertexCount;
+	M_Stats.FrameCount = FrameCount;
+	M_Stats.ClipCount = static_cast<std::uint32_t>(M_Clips.size());
+	M_Stats.AtlasBytes = Atlas.size() * sizeof(AtlasVertex);
+	M_Stats.BakedVertices = Atlas.size();
+	M_Stats.BakeMilliseconds = float(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - StartTime).count()) / 1000.0f;
 
-		G_DepthBufferImageViews[i] = G_Device.createImageView(ImageViewCI, nullptr, G_DLD);
-		if (!G_DepthBufferImageViews[i]) {
-			DestroySwapchain();
-			return;
-		}
+	if (!M_Settings.ExportFileName.empty()) {
+		Export(Atlas);
+		M_Stats.bExported = true;
 	}
 
-	if (G_SampleCount == vk::SampleCountFlagBits::e1) {
+	if (!M_Settings.bEnabled) return;
 
-		G_Framebuffers.resize(NumImages);
-		std::fill(G_Framebuffers.begin(), G_Framebuffers.end(), nullptr);
+	M_AtlasBufferTuple = CreateBuffer(vk::BufferUsageFlagBits::eStorageBuffer, M_Stats.AtlasBytes, Atlas.data(), true, &M_UploadToken);
+	G_UploadManager.Flush();
 
-		for (std::size_t i = 0; i < NumImages; ++i) {
-			const std::vector<vk::ImageView> Attachments = {
-				G_SwapchainImageViews[i],
-				G_DepthBufferImageViews[i]
-			};
+	const vk::DescriptorPoolSize PoolSize(vk::DescriptorType::eStorageBuffer, 1);
+	const vk::DescriptorPoolCreateInfo DescriptorPoolCI = vk::DescriptorPoolCreateInfo({}, 1, 1, &PoolSize);
+	M_DescriptorPool = G_Device.createDescriptorPool(DescriptorPoolCI, nullptr, G_DLD);
 
-			const vk::FramebufferCreateInfo FramebufferCI = vk::FramebufferCreateInfo(
-				{},
-				G_RenderPass,
-				static_cast<std::uint32_t>(Attachments.size()),
-				Attachments.data(),
-				G_SwapchainExtent.width,
-				G_SwapchainExtent.height,
-				1
-				);
+	const vk::DescriptorSetAllocateInfo DescriptorSetAI = vk::DescriptorSetAllocateInfo(M_DescriptorPool, 1, &G_BakedAnimationDescriptorSetLayout);
+	M_DescriptorSet = G_Device.allocateDescriptorSets(DescriptorSetAI, G_DLD)[0];
 
-			G_Framebuffers[i] = G_Device.createFramebuffer(FramebufferCI, nullptr, G_DLD);
-			if (!G_Framebuffers[i]) {
-				DestroySwapchain();
-				return;
-			}
-		}
+	const vk::DescriptorBufferInfo DescriptorBI = vk::DescriptorBufferInfo(std::get<0>(M_AtlasBufferTuple), 0, vk::WholeSize);
+	const vk::WriteDescriptorSet Write = vk::WriteDescriptorSet(M_DescriptorSet, 0, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &DescriptorBI, nullptr);
+	G_Device.updateDescriptorSets(Write, nullptr, G_DLD);
+}
 
-	} else {
+void VertexAnimationAtlas::Shutdown()
+{
+	// The atlas may still be the destination of an in-flight copy.
+	if (M_UploadToken) {
+		G_UploadManager.Wait(M_UploadToken);
+		M_UploadToken = 0;
+	}
 
-		G_Framebuffers.resize(NumImages);
-		std::fill(G_Framebuffers.begin(), G_Framebuffers.end(), nullptr);
+	if (M_DescriptorPool) {
+		G_Device.destroyDescriptorPool(M_DescriptorPool, nullptr, G_DLD);
+		M_DescriptorPool = nullptr;
+		M_DescriptorSet = nullptr;
+	}
 
-		for (std::size_t i = 0; i < NumImages; ++i) {
-			const std::vector<vk::ImageView> Attachments = {
-				G_ColorBufferImageViews[i],
-				G_SwapchainImageViews[i],
-				G_DepthBufferImageViews[i]
-			};
+	if (std::get<0>(M_AtlasBufferTuple)) {
+		DestroyBuffer(M_AtlasBufferTuple);
+	}
+	M_Clips.clear();
+}
 
-			const vk::FramebufferCreateInfo FramebufferCI = vk::FramebufferCreateInfo(
-				{},
-				G_RenderPass,
-				static_cast<std::uint32_t>(Attachments.size()),
-				Attachments.data(),
-				G_SwapchainExtent.width,
-				G_SwapchainExtent.height,
-				1
-				);
+float VertexAnimationAtlas::GetClipClock(std::uint32_t ClipIndex) const
+{
+	const ClipRange Range = GetClipRange(ClipIndex);
+	if (Range.FrameCount < 2) return 0.0f;
+	return float(std::fmod(M_Clock * double(Range.FrameRate), double(Range.FrameCount - 1)));
+}
 
-			G_Framebuffers[i] = G_Device.createFramebuffer(FramebufferCI, nullptr, G_DLD);
-			if (!G_Framebuffers[i]) {
-				DestroySwapchain();
-				return;
+void VertexAnimationAtlas::BakeFrame(const VkGltfModel& Model, std::uint32_t AnimationIndex, const VkGltfModel::AnimationClip* Clip, float Time,
+	const std::vector<std::uint32_t>& VertexPaletteBases, const std::vector<std::uint8_t>& VertexMorphed, AtlasVertex* Dst) const
+{
+	TRACE_SCOPE("BakeVertexAnimationFrame");
+
+	// UpdateJoints streams whole matrices, so the palette has to be 16-byte aligned.
+	VkGltfModel::Pose Pose;
+	std::vector<DirectX::XMMATRIX> PaletteStorage(std::max(Model.M_PaletteMatrixCount, 1U));
+	DirectX::XMFLOAT4X4* Palette = reinterpret_cast<DirectX::XMFLOAT4X4*>(PaletteStorage.data());
+	Model.EvaluatePose(AnimationIndex, Clip, Time, Pose);
+	Model.UpdateJoints(Pose, Palette);
+
+	// Octahedral mapping of a unit normal, packed like GLSL packSnorm2x16.
+	const auto EncodeNormal = [](DirectX::FXMVECTOR Normal) {
+		DirectX::XMFLOAT3 N;
+		DirectX::XMStoreFloat3(&N, Normal);
+		const float L1 = std::abs(N.x) + std::abs(N.y) + std::abs(N.z);
+		float X = (L1 > 0.0f) ? N.x / L1 : 0.0f;
+		float Y = (L1 > 0.0f) ? N.y / L1 : 0.0f;
+		if (N.z < 0.0f) {
+			const float FoldedX = (1.0f - std::abs(Y)) * (X >= 0.0f ? 1.0f : -1.0f);
+			const float FoldedY = (1.0f - std::abs(X)) * (Y >= 0.0f ? 1.0f : -1.0f);
+			X = FoldedX;
+			Y = FoldedY;
+		}
+		const auto PackSnorm16 = [](float Value) {
+			return static_cast<std::uint32_t>(static_cast<std::uint16_t>(static_cast<std::int16_t>(std::round(std::clamp(Value, -1.0f, 1.0f) * 32767.0f))));
+		};
+		return PackSnorm16(X) | (PackSnorm16(Y) << 16);
+	};
+
+	// Mirrors Default.vert: morph first, blend the eight joint matrices, then transform. The normal takes the
+	// inverse transpose of the skin alone; Vat.vert applies the model matrix's own, which composes to the same.
+	const std::uint32_t VertexCount = static_cast<std::uint32_t>(Model.M_HostVertices.size());
+	for (std::uint32_t v = 0; v < VertexCount; v++) {
+		const VkGltfModel::Vertex& In = Model.M_HostVertices[v];
+		DirectX::XMVECTOR Position = DirectX::XMLoadFloat3(&In.Pos);
+		DirectX::XMVECTOR Normal = DirectX::XMLoadFloat3(&In.Normal);
+
+		if (VertexMorphed[v]) {
+			const VkGltfModel::MorphRange& Range = Model.M_HostMorphRanges[v];
+			for (std::uint32_t i = Range.First; i < Range.First + Range.Count; i++) {
+				const VkGltfModel::MorphDelta& Delta = Model.M_HostMorphDeltas[i];
+				const float Weight = Pose.MorphWeights[Delta.Target];
+				if (Weight != 0.0f) {
+					Position = DirectX::XMVectorMultiplyAdd(DirectX::XMVectorReplicate(Weight), DirectX::XMLoadFloat3(&Delta.Position), Position);
+					Normal = DirectX::XMVectorMultiplyAdd(DirectX::XMVectorReplicate(Weight), DirectX::XMLoadFloat3(&Delta.Normal), Normal);
+				}
 			}
 		}
 
+		if (VertexPaletteBases[v] != ~0U) {
+			const std::uint32_t Base = VertexPaletteBases[v];
+			const DirectX::XMMATRIX SkinMat =
+				DirectX::XMLoadFloat4x4(&Palette[Base + In.JointIndices0.x]) * In.JointWeights0.x +
+				DirectX::XMLoadFloat4x4(&Palette[Base + In.JointIndices0.y]) * In.JointWeights0.y +
+				DirectX::XMLoadFloat4x4(&Palette[Base + In.JointIndices0.z]) * In.JointWeights0.z +
+				DirectX::XMLoadFloat4x4(&Palette[Base + In.JointIndices0.w]) * In.JointWeights0.w +
+				DirectX::XMLoadFloat4x4(&Palette[Base + In.JointIndices1.x]) * In.JointWeights1.x +
+				DirectX::XMLoadFloat4x4(&Palette[Base + In.JointIndices1.y]) * In.JointWeights1.y +
+				DirectX::XMLoadFloat4x4(&Palette[Base + In.JointIndices1.z]) * In.JointWeights1.z +
+				DirectX::XMLoadFloat4x4(&Palette[Base + In.JointIndices1.w]) * In.JointWeights1.w;
+
+			Position = DirectX::XMVector3Transform(Position, SkinMat);
+			Normal = DirectX::XMVector3TransformNormal(Normal, DirectX::XMMatrixTranspose(DirectX::XMMatrixInverse(nullptr, SkinMat)));
+		}
 
+		DirectX::XMStoreFloat3(&Dst[v].Position, Position);
+		Dst[v].Normal = EncodeNormal(DirectX::XMVector3Normalize(Normal));
 	}
 }
 
-void DestroySwapchain()
+void VertexAnimationAtlas::Export(const std::vector<AtlasVertex>& Atlas) const
 {
-	G_SwapchainOK = false;
+	FileHeader Header;
+	Header.VertexCount = M_Stats.VertexCount;
+	Header.FrameCount = M_Stats.FrameCount;
+	Header.ClipCount = M_Stats.ClipCount;
+	Header.SampleRate = M_Settings.SampleRate;
+
+	std::ofstream Ofs = std::ofstream(M_Settings.ExportFileName, std::ios::binary | std::ios::out | std::ios::trunc);
+	if (!Ofs.is_open()) {
+		throw std::runtime_error("Could not open vertex animation file " + M_Settings.ExportFileName);
+	}
+	Ofs.write(reinterpret_cast<const char*>(&Header), sizeof(Header));
+	Ofs.write(reinterpret_cast<const char*>(M_Clips.data()), std::streamsize(M_Clips.size() * sizeof(ClipRange)));
+	Ofs.write(reinterpret_cast<const char*>(Atlas.data()), std::streamsize(Atlas.size() * sizeof(AtlasVertex)));
+	if (!Ofs) {
+		throw std::runtime_error("Failed to write vertex animation file " + M_Settings.ExportFileName);
+	}
+}
 
-	if (G_Device) {
-		G_Device.waitIdle(G_DLD);
+BakedPalettes::Stats BakedPalettes::GetStats() const
+{
+	Stats Result;
+	Result.RowCount = M_RowCount;
+	Result.RowsBaked = M_RowsBaked;
+	Result.RowStride = M_RowStride;
+	Result.BufferBytes = M_Settings.bEnabled ? vk::DeviceSize(M_RowCount) * M_RowStride * sizeof(DirectX::XMFLOAT4) : 0;
+	Result.UncompressedBytes = (M_Settings.bEnabled && M_Model) ? vk::DeviceSize(M_RowCount) * M_Model->M_PaletteMatrixCount * sizeof(DirectX::XMFLOAT4X4) : 0;
+	Result.BakeMilliseconds = float(std::chrono::duration_cast<std::chrono::microseconds>(M_BakeTime).count()) / 1000.0f;
+	Result.bDeviceLocal = M_bDeviceLocal;
+	return Result;
+}
 
-		for(auto& Item : G_Framebuffers) {
-			if (Item) {
-				G_Device.destroyFramebuffer(Item, nullptr, G_DLD);
-				Item = nullptr;
-			}
-			G_Framebuffers.clear();
-		}
+void AnimationSimulation::Start(const Settings& InSettings, const PoseCache::Settings& PoseCacheSettings, const VkGltfModel& Model, const std::vector<ModelInstance>& Instances)
+{
+	Stop();
 
-		for(auto& Item : G_DepthBufferImageViews) {
-			if (Item) {
-				G_Device.destroyImageView(Item, nullptr, G_DLD);
-				Item = nullptr;
-			}
-			G_DepthBufferImageViews.clear();
-		}
-		for(auto& Item : G_DepthBufferDeviceMemories) {
-			if (Item) {
-				G_Device.freeMemory(Item, nullptr, G_DLD);
-				Item = nullptr;
-			}
-			G_DepthBufferDeviceMemories.clear();
-		}
-		for(auto& Item : G_DepthBufferImages) {
-			if (Item) {
-				G_Device.destroyImage(Item, nullptr, G_DLD);
-				Item = nullptr;
-			}
-			G_DepthBufferImages.clear();
-		}
+	M_Settings = InSettings;
+	M_Model = &Model;
+	M_Instances = Instances;
+	M_PoseCache.Init(PoseCacheSettings);
 
+	// Sized for the worst case of no two instances sharing a pose.
+	for (PoseSnapshot& Snapshot : M_Snapshots.GetAllBuffers()) {
+		Snapshot.Palettes.resize(std::size_t(Model.M_PaletteMatrixCount) * Instances.size());
+		Snapshot.InstanceOffsets.resize(M_PoseCache.IsEnabled() ? Instances.size() : 0);
+	}
 
-		for(auto& Item : G_ColorBufferImageViews) {
-			if (Item) {
-				G_Device.destroyImageView(Item, nullptr, G_DLD);
-				Item = nullptr;
-			}
-			G_ColorBufferImageViews.clear();
-		}
-		for(auto& Item : G_ColorBufferDeviceMemories) {
-			if (Item) {
-				G_Device.freeMemory(Item, nullptr, G_DLD);
-				Item = nullptr;
-			}
-			G_ColorBufferDeviceMemories.clear();
-		}
-		for(auto& Item : G_ColorBufferImages) {
-			if (Item) {
-				G_Device.destroyImage(Item, nullptr, G_DLD);
-				Item = nullptr;
-			}
-			G_ColorBufferImages.clear();
-		}
+	M_Ticks = 0;
+	M_MergedTicks = 0;
+	M_SnapshotsTaken = 0;
+	M_SnapshotsReused = 0;
 
-		for(auto& Item : G_SwapchainImageViews) {
-			if (Item) {
-				G_Device.destroyImageView(Item, nullptr, G_DLD);
-				Item = nullptr;
-			}
-			G_SwapchainImageViews.clear();
-		}
+	Tick(0.0f);
 
-		G_SwapchainImages.clear();
+	M_bStop = false;
+	M_Thread = std::thread(&AnimationSimulation::ThreadMain, this);
+}
+
+void AnimationSimulation::Stop()
+{
+	if (!M_Thread.joinable()) return;
+
+	M_bStop = true;
+	M_Thread.join();
+}
 
-		if (G_Swapchain) {
-			G_Device.destroySwapchainKHR(G_Swapchain, nullptr, G_DLD);
-			G_Swapchain = nullptr;
+void AnimationSimulation::ThreadMain()
+{
+	const auto TickPeriod = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(1.0f / M_Settings.TickRate));
+	auto LastTickTime = std::chrono::steady_clock::now();
+	auto NextTick = LastTickTime + TickPeriod;
+
+	while (!M_bStop.load(std::memory_order_relaxed)) {
+		std::this_thread::sleep_until(NextTick);
+
+		// Each tick advances by the time that really passed, so late wakeups and stalls never leave the clips behind.
+		const auto TickTime = std::chrono::steady_clock::now();
+		Tick(std::min(std::chrono::duration<float>(TickTime - LastTickTime).count(), MaxTickDelta));
+		LastTickTime = TickTime;
+
+		// After a stall, fold the missed ticks into the next one instead of bursting to catch up.
+		NextTick += TickPeriod;
+		const auto Now = std::chrono::steady_clock::now();
+		if (NextTick < Now) {
+			M_MergedTicks.fetch_add(static_cast<std::uint64_t>((Now - NextTick) / TickPeriod) + 1, std::memory_order_relaxed);
+			NextTick = Now + TickPeriod;
 		}
 	}
 }
 
-void RecreateSwapchain()
+void AnimationSimulation::Tick(float DeltaTime)
 {
-	DestroySwapchain();
-	CreateSwapchain();
+	TRACE_SCOPE("AnimationTick");
+	const auto StartTime = std::chrono::steady_clock::now();
+
+	PoseSnapshot& Snapshot = M_Snapshots.GetWriteBuffer();
+	if (M_PoseCache.IsEnabled()) {
+		Snapshot.MatrixCount = 0;
+		M_PoseCache.BeginFrame();
+		for (std::size_t i = 0; i < M_Instances.size(); i++) {
+			ModelInstance& Instance = M_Instances[i];
+			Instance.AnimationTime = M_Model->WrapAnimationTime(Instance.AnimationIndex, Instance.AnimationTime + DeltaTime);
+
+			Snapshot.InstanceOffsets[i] = M_PoseCache.Resolve(*M_Model, Instance, [this, &Instance, &Snapshot](float SampleTime) {
+				const std::uint32_t Offset = Snapshot.MatrixCount;
+				M_Model->EvaluatePose(Instance.AnimationIndex, SampleTime, M_PoseScratch);
+				M_Model->UpdateJoints(M_PoseScratch, Snapshot.Palettes.data() + Offset);
+				Snapshot.MatrixCount += M_Model->M_PaletteMatrixCount;
+				return Offset;
+			});
+		}
+		M_PoseCache.EndFrame();
+	} else {
+		for (std::size_t i = 0; i < M_Instances.size(); i++) {
+			ModelInstance& Instance = M_Instances[i];
+			Instance.AnimationTime = M_Model->WrapAnimationTime(Instance.AnimationIndex, Instance.AnimationTime + DeltaTime);
+
+			M_Model->EvaluatePose(Instance.AnimationIndex, Instance.AnimationTime, M_PoseScratch);
+			M_Model->UpdateJoints(M_PoseScratch, Snapshot.Palettes.data() + i * M_Model->M_PaletteMatrixCount);
+		}
+		Snapshot.MatrixCount = static_cast<std::uint32_t>(Snapshot.Palettes.size());
+	}
+
+	const auto EndTime = std::chrono::steady_clock::now();
+	Snapshot.Tick = M_Ticks.fetch_add(1, std::memory_order_relaxed) + 1;
+	Snapshot.PublishTime = EndTime;
+
+#if defined(_XM_SSE_INTRINSICS_)
+	// UpdateJoints uses streaming stores, which the release in Publish does not order.
+	_mm_sfence();
+#endif
+	M_Snapshots.Publish();
+
+	M_LastTickNanoseconds.store(static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(EndTime - StartTime).count()), std::memory_order_relaxed);
 }
 
-void ShutdownSwapchain()
+const AnimationSimulation::PoseSnapshot& AnimationSimulation::AcquireSnapshot()
 {
-	DestroySwapchain();
+	if (M_Snapshots.Acquire()) {
+		M_SnapshotsTaken++;
+	} else {
+		M_SnapshotsReused++;
+	}
+
+	const PoseSnapshot& Snapshot = M_Snapshots.GetReadBuffer();
+	M_SnapshotAge = std::chrono::steady_clock::now() - Snapshot.PublishTime;
+	return Snapshot;
 }
 
-void InitImGui()
+AnimationSimulation::Stats AnimationSimulation::GetStats() const
 {
-	static constexpr vk::DescriptorPoolSize PoolSizes[1] = {
-		vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, 10),
-	};
-	static constexpr vk::DescriptorPoolCreateInfo DescriptorPoolCI = vk::DescriptorPoolCreateInfo(
-		vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet,
-		10,
-		1,
-		PoolSizes
-	);
-	G_ImguiDescriptorPool = G_Device.createDescriptorPool(DescriptorPoolCI, nullptr, G_DLD);
+	Stats Result;
+	Result.Ticks = M_Ticks.load(std::memory_order_relaxed);
+	Result.MergedTicks = M_MergedTicks.load(std::memory_order_relaxed);
+	Result.LastTickMilliseconds = float(M_LastTickNanoseconds.load(std::memory_order_relaxed)) / 1000000.0f;
+	Result.SnapshotsTaken = M_SnapshotsTaken;
+	Result.SnapshotsReused = M_SnapshotsReused;
+	Result.SnapshotAgeMilliseconds = float(std::chrono::duration_cast<std::chrono::microseconds>(M_SnapshotAge).count()) / 1000.0f;
+	return Result;
+}
 
+void ClipCache::Start(const Settings& InSettings, VkGltfModel& Model)
+{
+	Stop();
+
+	M_Settings = InSettings;
+	M_Model = &Model;
+	M_Entries.assign(Model.M_Animations.size(), Entry{});
+	M_Lru.clear();
+	M_Requests.clear();
+	M_ResidentBytes = 0;
+
+	M_Hits = 0;
+	M_Misses = 0;
+	M_Evictions = 0;
+	M_Decodes = 0;
+
+	M_bStop = false;
+	M_bDecoding = false;
+	Model.M_ClipCache = this;
+	M_Thread = std::thread(&ClipCache::ThreadMain, this);
+}
 
-	IMGUI_CHECKVERSION();
-	G_ImGuiContext = ImGui::CreateContext();
-	ImGui::SetCurrentContext(G_ImGuiContext);
-	ImGuiIO& io = ImGui::GetIO(); (void)io;
-	io.ConfigFlags |= ImGuiConfigFlags_NavEnableKeyboard;     // Enable Keyboard Controls
-	io.ConfigFlags |= ImGuiConfigFlags_NavEnableGamepad;      // Enable Gamepad Controls
+void ClipCache::Stop()
+{
+	if (!M_Thread.joinable()) return;
 
-	//G_ConsolasFont = io.Fonts->AddFontFromFileTTF("C:\\Windows\\Fonts\\consola.ttf", 20.0f, NULL, io.Fonts->GetGlyphRangesDefault());
+	{
+		std::lock_guard<std::mutex> Lock(M_Mutex);
+		M_bStop = true;
+	}
+	M_WakeUp.notify_one();
+	M_Thread.join();
+
+	M_Model->M_ClipCache = nullptr;
+	M_Model = nullptr;
+	M_Entries.clear();
+	M_Lru.clear();
+	M_Requests.clear();
+	M_ResidentBytes = 0;
+}
 
-	ImGui_ImplWin32_Init(G_Hwnd);
+std::shared_ptr<const VkGltfModel::AnimationClip> ClipCache::Acquire(std::uint32_t AnimationIndex)
+{
+	std::lock_guard<std::mutex> Lock(M_Mutex);
+	if (AnimationIndex >= M_Entries.size()) return nullptr;
+
+	Entry& Item = M_Entries[AnimationIndex];
+	if (Item.Clip) {
+		M_Hits++;
+		M_Lru.splice(M_Lru.begin(), M_Lru, Item.LruIt);
+		return Item.Clip;
+	}
 
-	auto VkLoaderFunction = [](const char* function_name, void* user_data) -> PFN_vkVoidFunction {
-		auto pfn = G_DLD.vkGetInstanceProcAddr(G_VkInstance, function_name);
-		if (!pfn) pfn = G_DLD.vkGetDeviceProcAddr(G_Device, function_name);
-		return pfn;
-	};
-	ImGui_ImplVulkan_LoadFunctions(VkLoaderFunction, nullptr);
+	M_Misses++;
+	if (!Item.bPending) {
+		Item.bPending = true;
+		M_Requests.push_back(AnimationIndex);
+		M_WakeUp.notify_one();
+	}
+	return nullptr;
+}
 
-	auto VkCheckError = [](VkResult err){};
+void ClipCache::WaitForPending()
+{
+	if (!M_Thread.joinable()) return;
 
-	ImGui_ImplVulkan_InitInfo VkInitInfo;
-	VkInitInfo.Instance            = G_VkInstance;
-	VkInitInfo.PhysicalDevice      = G_PhysicalDevice;
-	VkInitInfo.Device              = G_Device;
-	VkInitInfo.QueueFamily         = G_GraphicsQueueFamilyIndex.value();
-	VkInitInfo.Queue               = G_GraphicsQueue;
-	VkInitInfo.DescriptorPool      = G_ImguiDescriptorPool;
-	VkInitInfo.RenderPass          = G_RenderPass;
-	VkInitInfo.MinImageCount       = 2;
-	VkInitInfo.ImageCount          = 2;
-	VkInitInfo.MSAASamples         = static_cast<VkSampleCountFlagBits>(G_SampleCount);
-	VkInitInfo.PipelineCache       = nullptr;
-	VkInitInfo.Subpass             = 0;
-	VkInitInfo.UseDynamicRendering = false;
-	VkInitInfo.Allocator           = nullptr;
-	VkInitInfo.CheckVkResultFn     = VkCheckError;
-	VkInitInfo.MinAllocationSize   = 1024 * 1024;
-	ImGui_ImplVulkan_Init(&VkInitInfo);
+	std::unique_lock<std::mutex> Lock(M_Mutex);
+	M_Decoded.wait(Lock, [this]() { return M_Requests.empty() && !M_bDecoding; });
+}
 
+void ClipCache::ThreadMain()
+{
+	std::unique_lock<std::mutex> Lock(M_Mutex);
+	while (true) {
+		M_WakeUp.wait(Lock, [this]() { return M_bStop || !M_Requests.empty(); });
+		if (M_bStop) break;
+
+		const std::uint32_t AnimationIndex = M_Requests.front();
+		M_Requests.pop_front();
+		M_bDecoding = true;
+
+		// The source document is read-only once loaded, so decoding needs no lock.
+		Lock.unlock();
+		const auto StartTime = std::chrono::steady_clock::now();
+		std::shared_ptr<const VkGltfModel::AnimationClip> Clip = M_Model->DecodeClip(AnimationIndex);
+		const auto EndTime = std::chrono::steady_clock::now();
+		Lock.lock();
+
+		Entry& Item = M_Entries[AnimationIndex];
+		Item.bPending = false;
+		Item.Clip = std::move(Clip);
+		M_Lru.push_front(AnimationIndex);
+		Item.LruIt = M_Lru.begin();
+		M_ResidentBytes += Item.Clip->Bytes;
+		M_Decodes++;
+		M_LastDecodeTime = EndTime - StartTime;
+		EvictOverBudget();
+
+		M_bDecoding = false;
+		M_Decoded.notify_all();
+	}
+}
 
+void ClipCache::EvictOverBudget()
+{
+	// The clip just decoded is at the front and always stays, even if it alone is over budget.
+	while (M_ResidentBytes > M_Settings.BudgetBytes && M_Lru.size() > 1) {
+		Entry& Item = M_Entries[M_Lru.back()];
+		M_Lru.pop_back();
+		M_ResidentBytes -= Item.Clip->Bytes;
+		Item.Clip.reset();
+		M_Evictions++;
+	}
+}
 
-	ImGui::SetCurrentContext(nullptr);
+ClipCache::Stats ClipCache::GetStats() const
+{
+	std::lock_guard<std::mutex> Lock(M_Mutex);
+
+	Stats Result;
+	Result.Hits = M_Hits;
+	Result.Misses = M_Misses;
+	Result.Evictions = M_Evictions;
+	Result.Decodes = M_Decodes;
+	Result.ResidentClips = static_cast<std::uint32_t>(M_Lru.size());
+	Result.ResidentBytes = M_ResidentBytes;
+	Result.PendingDecodes = static_cast<std::uint32_t>(M_Requests.size()) + (M_bDecoding ? 1 : 0);
+	Result.LastDecodeMilliseconds = float(std::chrono::duration_cast<std::chrono::microseconds>(M_LastDecodeTime).count()) / 1000.0f;
+	return Result;
 }
 
-void ShutdownImGui()
+std::vector<VkGltfModel::LoadStats> RunImportBenchmark()
 {
-	ImGui::SetCurrentContext(G_ImGuiContext);
+	static constexpr std::array<std::uint32_t, 5> ThreadCounts = {1, 2, 4, 8, 16};
+	std::vector<VkGltfModel::LoadStats> Results;
 
-	ImGui_ImplVulkan_Shutdown();
+	std::ofstream Ofs = std::ofstream("ImportBenchmark.csv", std::ios::out | std::ios::trunc);
+	Ofs << "Threads,Primitives,Samplers,ParseMs,NodesMs,DecodeMs,UploadMs,TotalMs\n";
 
-	if (G_ImguiDescriptorPool) {
-		G_Device.destroyDescriptorPool(G_ImguiDescriptorPool, nullptr, G_DLD);
-		G_ImguiDescriptorPool = nullptr;
-	}
+	for (std::uint32_t ThreadCount : ThreadCounts) {
+		ThreadPool Pool(ThreadCount);
+		VkGltfModel Model;
 
-	ImGui_ImplWin32_Shutdown();
+		if (!Model.LoadFromFile(G_ModelFileName, Pool)) {
+			throw std::runtime_error("Failed to load the model");
+		}
 
-	ImGui::DestroyContext(G_ImGuiContext);
-	ImGui::SetCurrentContext(nullptr);
-	G_ImGuiContext = nullptr;
+		const VkGltfModel::LoadStats& Stats = Model.M_LoadStats;
+		Ofs << Stats.ThreadCount << ',' << Stats.NumPrimitives << ',' << Stats.NumSamplers << ','
+			<< Stats.ParseMs << ',' << Stats.NodesMs << ',' << Stats.DecodeMs << ',' << Stats.UploadMs << ',' << Stats.TotalMs << '\n';
+		Results.push_back(Stats);
+
+		Model.Shutdown();
+	}
+
+	return Results;
 }
 
-void InitPipeline()
-{
-	static constexpr vk::DescriptorSetLayoutBinding DescriptorSetLayoutBinding = vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eVertex, nullptr);
-	static constexpr vk::DescriptorSetLayoutCreateInfo DescriptorSetLayoutCI = vk::DescriptorSetLayoutCreateInfo({}, 1, &DescriptorSetLayoutBinding);
-	G_SkinsDescriptorSetLayout = G_Device.createDescriptorSetLayout(DescriptorSetLayoutCI, nullptr, G_DLD);
 
-	static constexpr vk::PushConstantRange PushConstantRanges[2] = {
-		vk::PushConstantRange(vk::ShaderStageFlagBits::eVertex, 0, 2 * sizeof(DirectX::XMFLOAT4X4)),
-		vk::PushConstantRange(vk::ShaderStageFlagBits::eFragment, 2 * sizeof(DirectX::XMFLOAT4X4), sizeof(DirectX::XMFLOAT3)),
-	};
-	static constexpr vk::PipelineLayoutCreateInfo PipelineLayoutCI = vk::PipelineLayoutCreateInfo{{}, 1, &G_SkinsDescriptorSetLayout, 2, PushConstantRanges};
-	G_PipelineLayout = G_Device.createPipelineLayout(PipelineLayoutCI, nullptr, G_DLD);
 
-	vk::ShaderModule ShaderModuleVS = CreateShader("DefaultVS.spv");
-	vk::ShaderModule ShaderModuleFS = CreateShader("DefaultFS.spv");
-
-	const std::array<vk::PipelineShaderStageCreateInfo, 2> ShaderStageCIs = {
-		vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eVertex, ShaderModuleVS, "main"),
-		vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eFragment, ShaderModuleFS, "main"),
-	};
-
-	static constexpr vk::VertexInputBindingDescription VertexInputBindingDescriptions[1] = {
-		vk::VertexInputBindingDescription(0, sizeof(VkGltfModel::Vertex), vk::VertexInputRate::eVertex),
-	};
-	static constexpr vk::VertexInputAttributeDescription VertexInputAttributeDescriptions[7] = {
-		vk::VertexInputAttributeDescription(0, 0, vk::Format::eR32G32B32Sfloat,    0),
-		vk::VertexInputAttributeDescription(1, 0, vk::Format::eR32G32B32Sfloat,    sizeof(DirectX::XMFLOAT3)),
-		vk::VertexInputAttributeDescription(2, 0, vk::Format::eR32G32Sfloat,       sizeof(DirectX::XMFLOAT3) + sizeof(DirectX::XMFLOAT3)),
-		vk::VertexInputAttributeDescription(3, 0, vk::Format::eR32G32B32A32Uint,   sizeof(DirectX::XMFLOAT3) + sizeof(DirectX::XMFLOAT3) + sizeof(DirectX::XMFLOAT2)),
-		vk::VertexInputAttributeDescription(4, 0, vk::Format::eR32G32B32A32Sfloat, sizeof(DirectX::XMFLOAT3) + sizeof(DirectX::XMFLOAT3) + sizeof(DirectX::XMFLOAT2) + sizeof(DirectX::XMUINT4)),
-		vk::VertexInputAttributeDescription(5, 0, vk::Format::eR32G32B32A32Uint,   sizeof(DirectX::XMFLOAT3) + sizeof(DirectX::XMFLOAT3) + sizeof(DirectX::XMFLOAT2) + sizeof(DirectX::XMUINT4) + sizeof(DirectX::XMFLOAT4)),
-		vk::VertexInputAttributeDescription(6, 0, vk::Format::eR32G32B32A32Sfloat, sizeof(DirectX::XMFLOAT3) + sizeof(DirectX::XMFLOAT3) + sizeof(DirectX::XMFLOAT2) + sizeof(DirectX::XMUINT4) + sizeof(DirectX::XMFLOAT4) + sizeof(DirectX::XMUINT4)),
-	};
-	static constexpr vk::PipelineVertexInputStateCreateInfo VertexInputStateCI = vk::PipelineVertexInputStateCreateInfo({}, 1, VertexInputBindingDescriptions, 7, VertexInputAttributeDescriptions);
-
-	static constexpr vk::PipelineInputAssemblyStateCreateInfo InputAssemblyCI = vk::PipelineInputAssemblyStateCreateInfo({}, vk::PrimitiveTopology::eTriangleList);
-	static constexpr vk::PipelineTessellationStateCreateInfo TesselationStateCI = vk::PipelineTessellationStateCreateInfo();
-
-	const vk::Viewport Viewport(0.0f, 0.0f, float(G_SwapchainExtent.width), float(G_SwapchainExtent.height));
-	const vk::Rect2D Scissor(vk::Offset2D(), vk::Extent2D(G_SwapchainExtent.width, G_SwapchainExtent.height));
-	static const vk::PipelineViewportStateCreateInfo ViewportStateCI = vk::PipelineViewportStateCreateInfo({}, 1, &Viewport, 1, &Scissor);
-
-	static constexpr vk::PipelineRasterizationStateCreateInfo RasterizationStateCI = vk::PipelineRasterizationStateCreateInfo({}, {}, {}, vk::PolygonMode::eFill, vk::CullModeFlagBits::eBack, vk::FrontFace::eClockwise, {}, {}, {}, {}, 1.0f);
-	const vk::PipelineMultisampleStateCreateInfo MultisampleCI = vk::PipelineMultisampleStateCreateInfo({}, G_SampleCount);
-
-	static constexpr vk::PipelineDepthStencilStateCreateInfo DepthStencilCI = vk::PipelineDepthStencilStateCreateInfo({}, vk::True, vk::True, vk::CompareOp::eLess, vk::False, vk::False, {}, {}, 0.0f, 1.0f);
-	static constexpr vk::PipelineColorBlendAttachmentState ColorBlendAttachmentState = vk::PipelineColorBlendAttachmentState({}, {}, {}, {}, {}, {}, {}, vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA);
-	static constexpr vk::PipelineColorBlendStateCreateInfo BlendStateCI = vk::PipelineColorBlendStateCreateInfo({}, {}, {}, 1, &ColorBlendAttachmentState);
-
-	static constexpr std::array<vk::DynamicState, 2> DynamicStates = { vk::DynamicState::eViewport, vk::DynamicState::eScissor};
-	static constexpr vk::PipelineDynamicStateCreateInfo DynamicStateCI = vk::PipelineDynamicStateCreateInfo({}, static_cast<std::uint32_t>(DynamicStates.size()), DynamicStates.data());
-
-	const vk::GraphicsPipelineCreateInfo GraphicsPipelineCI = vk::GraphicsPipelineCreateInfo(
-		vk::PipelineCreateFlags(),
-		ShaderStageCIs,
-		&VertexInputStateCI,
-		&InputAssemblyCI,
-		&TesselationStateCI,
-		&ViewportStateCI,
-		&RasterizationStateCI,
-		&MultisampleCI,
-		&DepthStencilCI,
-		&BlendStateCI,
-		&DynamicStateCI,
-		G_PipelineLayout,
-		G_RenderPass,
-		0
-	);
+ThreadPool::ThreadPool(std::uint32_t ThreadCount)
+{
+	if (ThreadCount == 0) {
+		ThreadCount = std::max(1U, std::thread::hardware_concurrency());
+	}
 
-	G_Pipeline = G_Device.createGraphicsPipeline({}, GraphicsPipelineCI, nullptr, G_DLD).value;
+	// A single-threaded pool runs every task inline on the submitting thread.
+	if (ThreadCount == 1) return;
 
-	G_Device.destroyShaderModule(ShaderModuleVS, nullptr, G_DLD);
-	G_Device.destroyShaderModule(ShaderModuleFS, nullptr, G_DLD);
+	M_Threads.reserve(ThreadCount);
+	for (std::uint32_t i = 0; i < ThreadCount; i++) {
+		M_Threads.emplace_back(&ThreadPool::WorkerLoop, this);
+	}
 }
 
-void ShutdownPipeline()
+ThreadPool::~ThreadPool()
 {
-	if (G_Pipeline) {
-		G_Device.destroyPipeline(G_Pipeline, nullptr, G_DLD);
-		G_Pipeline = nullptr;
+	{
+		std::lock_guard<std::mutex> Lock(M_Mutex);
+		M_bStop = true;
 	}
+	M_Condition.notify_all();
 
-	if (G_PipelineLayout) {
-		G_Device.destroyPipelineLayout(G_PipelineLayout, nullptr, G_DLD);
-		G_PipelineLayout = nullptr;
+	for (auto& Thread : M_Threads) {
+		Thread.join();
 	}
+}
 
-	if (G_SkinsDescriptorSetLayout) {
+void ThreadPool::WorkerLoop()
+{
+	for (;;) {
+		std::function<void()> Task;
+		{
+			std::unique_lock<std::mutex> Lock(M_Mutex);
+			M_Condition.wait(Lock, [this]() { return M_bStop || !M_Tasks.empty(); });
+			if (M_bStop && M_Tasks.empty()) return;
 
-		G_Device.destroyDescriptorSetLayout(G_SkinsDescriptorSetLayout, nullptr, G_DLD);
-		G_SkinsDescriptorSetLayout = nullptr;
+			Task = std::move(M_Tasks.front());
+			M_Tasks.pop_front();
+		}
+		Task();
 	}
 }
 
-void InitModel()
+thread_local TraceRecorder::ThreadBuffer* TraceRecorder::M_ThreadBuffer = nullptr;
+
+TraceRecorder::ThreadBuffer* TraceRecorder::RegisterThread()
 {
-	if (!G_GltfModel.LoadFromFile("Bot_Running.glb")) {
-		throw std::runtime_error("Failed to load the model");
+	auto Buffer = std::make_unique<ThreadBuffer>();
+	Buffer->Events = std::make_unique<Event[]>(G_TraceEventsPerThread);
+
+	std::lock_guard<std::mutex> Lock(M_Mutex);
+	Buffer->ThreadIndex = static_cast<std::uint32_t>(M_ThreadBuffers.size());
+	M_ThreadBuffer = Buffer.get();
+	M_ThreadBuffers.push_back(std::move(Buffer));
+	return M_ThreadBuffer;
+}
+
+std::size_t TraceRecorder::WriteChromeTrace(const std::string& FileName) const
+{
+	std::vector<std::pair<std::uint32_t, Event>> Events;
+	{
+		std::lock_guard<std::mutex> Lock(M_Mutex);
+		for (const auto& Buffer : M_ThreadBuffers) {
+			const std::uint64_t Count = Buffer->WriteCount.load(std::memory_order_acquire);
+			const std::uint64_t First = (Count > G_TraceEventsPerThread) ? Count - G_TraceEventsPerThread : 0;
+
+			const std::size_t CopyStart = Events.size();
+			for (std::uint64_t i = First; i < Count; i++) {
+				Events.emplace_back(Buffer->ThreadIndex, Buffer->Events[i % G_TraceEventsPerThread]);
+			}
+
+			// The owner may have lapped the copy; whatever it reached since is suspect. It may also be midway
+			// through writing event CountAfter, whose slot still held event CountAfter - N, so that one goes too.
+			const std::uint64_t CountAfter = Buffer->WriteCount.load(std::memory_order_acquire);
+			const std::uint64_t FirstValid = (CountAfter + 1 > G_TraceEventsPerThread) ? CountAfter + 1 - G_TraceEventsPerThread : 0;
+			if (FirstValid > First) {
+				const std::size_t Stale = static_cast<std::size_t>(std::min(FirstValid, Count) - First);
+				Events.erase(Events.begin() + CopyStart, Events.begin() + CopyStart + Stale);
+			}
+		}
+	}
+
+	std::ofstream Ofs = std::ofstream(FileName, std::ios::out | std::ios::trunc);
+	if (!Ofs.is_open()) {
+		throw std::runtime_error("Could not open " + FileName);
+	}
+
+	// Complete ("X") events with microsecond timestamps.
+	Ofs << std::fixed << std::setprecision(3);
+	Ofs << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	for (std::size_t i = 0; i < Events.size(); i++) {
+		const auto& [ThreadIndex, TraceEvent] = Events[i];
+		Ofs << (i ? ",\n" : "\n")
+			<< "{\"name\":\"" << TraceEvent.Name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << ThreadIndex
+			<< ",\"ts\":" << double(TraceEvent.BeginNs) / 1000.0
+			<< ",\"dur\":" << double(TraceEvent.EndNs - TraceEvent.BeginNs) / 1000.0 << '}';
 	}
+	Ofs << "\n]}\n";
+
+	return Events.size();
 }
 
-void ShutdownModel()
+TraceRecorder::Stats TraceRecorder::GetStats() const
 {
-	G_GltfModel.Shutdown();
+	std::lock_guard<std::mutex> Lock(M_Mutex);
+
+	Stats Result;
+	Result.ThreadCount = static_cast<std::uint32_t>(M_ThreadBuffers.size());
+	for (const auto& Buffer : M_ThreadBuffers) {
+		const std::uint64_t Count = Buffer->WriteCount.load(std::memory_order_relaxed);
+		Result.EventsRecorded += Count;
+		Result.EventsOverwritten += (Count > G_TraceEventsPerThread) ? Count - G_TraceEventsPerThread : 0;
+	}
+	return Result;
 }
 
 
@@ -1886,8 +7526,16 @@ VkGltfModel::~VkGltfModel()
 
 }
 
-bool VkGltfModel::LoadFromFile(std::string FileName)
+bool VkGltfModel::LoadFromFile(std::string FileName, ThreadPool& Pool, bool bReleaseSourceData, bool bStreamClips, bool bKeepHostGeometry)
 {
+	TRACE_SCOPE("LoadFromFile");
+	using Clock = std::chrono::high_resolution_clock;
+	const auto ElapsedMs = [](Clock::time_point From, Clock::time_point To) {
+		return float(std::chrono::duration_cast<std::chrono::microseconds>(To - From).count()) / 1000.0f;
+	};
+
+	const Clock::time_point StartTime = Clock::now();
+
 	tinygltf::TinyGLTF Loader;
 
 	std::string StrErr;
@@ -1899,18 +7547,76 @@ bool VkGltfModel::LoadFromFile(std::string FileName)
 			return false;
 		}
 	}
+	M_bHasSourceData = true;
+	M_bStreamClips = bStreamClips;
+
+	const Clock::time_point ParseTime = Clock::now();
+
+	// Building the node tree is cheap and everything else depends on it, so it stays serial.
+	// It also assigns every primitive its final vertex/index range in the same order the
+	// serial importer used, which keeps the uploaded buffers identical for any thread count.
+	M_NodesByIndex.resize(M_Model.nodes.size());
+
+	std::vector<PrimitiveJob> PrimitiveJobs;
+
+	const tinygltf::Scene& Scene = M_Model.scenes[0];
+	for (std::size_t i = 0; i < Scene.nodes.size(); i++) {
+		const tinygltf::Node& Node = M_Model.nodes[Scene.nodes[i]];
+		LoadNode(Node, nullptr, Scene.nodes[i], PrimitiveJobs);
+	}
+
+	std::uint32_t NumIndices = 0;
+	std::uint32_t NumVertices = 0;
+	if (!PrimitiveJobs.empty()) {
+		NumIndices = PrimitiveJobs.back().FirstIndex + PrimitiveJobs.back().IndexCount;
+		NumVertices = PrimitiveJobs.back().FirstVertex + PrimitiveJobs.back().VertexCount;
+	}
+
+	std::vector<std::uint32_t> HostIndexBuffer(NumIndices);
+	std::vector<VkGltfModel::Vertex> HostVertexBuffer(NumVertices);
+
+	// Morph deltas are gathered per primitive and stitched into one per-vertex table afterwards.
+	std::vector<MorphRange> HostMorphRanges(M_MorphTargetCount > 0 ? NumVertices : 0);
+	std::vector<std::vector<MorphDelta>> JobMorphDeltas(M_MorphTargetCount > 0 ? PrimitiveJobs.size() : 0);
+
+	const Clock::time_point NodesTime = Clock::now();
+
+	{
+		TaskGroup Tasks(Pool);
+
+		for (std::size_t i = 0; i < PrimitiveJobs.size(); i++) {
+			const PrimitiveJob& Job = PrimitiveJobs[i];
+			Tasks.Run([this, &Job, &HostVertexBuffer, &HostIndexBuffer]() {
+				LoadPrimitive(Job, HostVertexBuffer.data() + Job.FirstVertex, HostIndexBuffer.data() + Job.FirstIndex);
+			});
+
+			if (M_MorphTargetCount > 0 && !M_Model.meshes[Job.Mesh].primitives[Job.PrimitiveIndex].targets.empty()) {
+				Tasks.Run([this, &Job, &HostMorphRanges, &JobMorphDeltas, i]() {
+					LoadMorphTargets(Job, HostMorphRanges.data() + Job.FirstVertex, JobMorphDeltas[i]);
+				});
+			}
+		}
+		LoadSkins(Tasks);
+		LoadAnimations(Tasks);
+
+		Tasks.Wait();
+	}
 
-	std::vector<std::uint32_t> HostIndexBuffer;
-	std::vector<VkGltfModel::Vertex> HostVertexBuffer;
+	for (auto& Anim : M_Animations) {
+		if (!Anim.Clip) continue;
+		for (auto& Sampler : Anim.Clip->Samplers) {
+			for (auto input : Sampler.Inputs) {
+				Anim.Start = std::min(Anim.Start, input);
+				Anim.End = std::max(Anim.End, input);
+			}
+		}
+		Anim.Clip->Bytes = Anim.Clip->ComputeBytes();
+	}
 
-	const tinygltf::Scene& Scene = M_Model.scenes[0];
-	for (std::size_t i = 0; i < Scene.nodes.size(); i++) {
-		const tinygltf::Node Node = M_Model.nodes[Scene.nodes[i]];
-		LoadNode(Node, nullptr, Scene.nodes[i], HostIndexBuffer, HostVertexBuffer);
+	const Clock::time_point DecodeTime = Clock::now();
 
-	}
-	LoadSkins();
-	LoadAnimations();
+	InitSkinPalettes();
+	ComputeBounds(HostVertexBuffer);
 
 //	for (auto Node : M_Nodes)
 //	{
@@ -1918,14 +7624,72 @@ bool VkGltfModel::LoadFromFile(std::string FileName)
 //	}
 //	UpdateAnimation(0.1f);
 
-	M_VertexBufferTuple = CreateBuffer(vk::BufferUsageFlagBits::eVertexBuffer, HostVertexBuffer.size() * sizeof(Vertex), HostVertexBuffer.data(), true);
-	M_IndexBufferTuple = CreateBuffer(vk::BufferUsageFlagBits::eIndexBuffer, HostIndexBuffer.size() * sizeof(std::uint32_t), HostIndexBuffer.data(), true);
+	std::vector<MorphDelta> HostMorphDeltas;
+	M_MorphStats = MorphStats{};
+	M_MorphStats.TargetCount = M_MorphTargetCount;
+	for (std::size_t i = 0; i < JobMorphDeltas.size(); i++) {
+		const PrimitiveJob& Job = PrimitiveJobs[i];
+		const std::uint32_t Base = static_cast<std::uint32_t>(HostMorphDeltas.size());
+		for (std::uint32_t v = Job.FirstVertex; v < Job.FirstVertex + Job.VertexCount; v++) {
+			HostMorphRanges[v].First += Base;
+			M_MorphStats.AffectedVertices += (HostMorphRanges[v].Count > 0) ? 1 : 0;
+		}
+		HostMorphDeltas.insert(HostMorphDeltas.end(), JobMorphDeltas[i].begin(), JobMorphDeltas[i].end());
+		M_MorphStats.DenseBytes += std::uint64_t(M_Model.meshes[Job.Mesh].primitives[Job.PrimitiveIndex].targets.size()) * Job.VertexCount * 2 * sizeof(DirectX::XMFLOAT3);
+	}
+	M_MorphStats.DeltaCount = HostMorphDeltas.size();
+
+	// Models without morphs still bind set 2, so they get one-element placeholders the shader never reads.
+	if (HostMorphRanges.empty()) HostMorphRanges.push_back(MorphRange{0, 0});
+	if (HostMorphDeltas.empty()) HostMorphDeltas.push_back(MorphDelta{});
+
+	// All copies land in the same batch; the last token covers the earlier buffers as well.
+	M_VertexBufferTuple = CreateBuffer(vk::BufferUsageFlagBits::eVertexBuffer, HostVertexBuffer.size() * sizeof(Vertex), HostVertexBuffer.data(), true, &M_UploadToken);
+	M_IndexBufferTuple = CreateBuffer(vk::BufferUsageFlagBits::eIndexBuffer, HostIndexBuffer.size() * sizeof(std::uint32_t), HostIndexBuffer.data(), true, &M_UploadToken);
+	M_MorphRangeBufferTuple = CreateBuffer(vk::BufferUsageFlagBits::eStorageBuffer, HostMorphRanges.size() * sizeof(MorphRange), HostMorphRanges.data(), true, &M_UploadToken);
+	M_MorphDeltaBufferTuple = CreateBuffer(vk::BufferUsageFlagBits::eStorageBuffer, HostMorphDeltas.size() * sizeof(MorphDelta), HostMorphDeltas.data(), true, &M_UploadToken);
+	G_UploadManager.Flush();
+
+	M_MovableBuffers = {
+		MovableBuffer{&M_VertexBufferTuple, vk::BufferUsageFlagBits::eVertexBuffer, HostVertexBuffer.size() * sizeof(Vertex)},
+		MovableBuffer{&M_IndexBufferTuple, vk::BufferUsageFlagBits::eIndexBuffer, HostIndexBuffer.size() * sizeof(std::uint32_t)},
+		MovableBuffer{&M_MorphRangeBufferTuple, vk::BufferUsageFlagBits::eStorageBuffer, HostMorphRanges.size() * sizeof(MorphRange)},
+		MovableBuffer{&M_MorphDeltaBufferTuple, vk::BufferUsageFlagBits::eStorageBuffer, HostMorphDeltas.size() * sizeof(MorphDelta)},
+	};
+	for (MovableBuffer& Item : M_MovableBuffers) {
+		G_DeviceAllocator.SetOwner(std::get<1>(*Item.BufferTuple), &Item);
+	}
+
+	M_MorphStats.SparseBytes = (M_MorphTargetCount > 0) ? HostMorphRanges.size() * sizeof(MorphRange) + HostMorphDeltas.size() * sizeof(MorphDelta) : 0;
+	CreateMorphDescriptorSet();
+
+	// The staging copies were taken at upload, so these can move.
+	if (bKeepHostGeometry) {
+		M_HostVertices = std::move(HostVertexBuffer);
+		M_HostMorphRanges = std::move(HostMorphRanges);
+		M_HostMorphDeltas = std::move(HostMorphDeltas);
+	}
+
+	if (bReleaseSourceData) {
+		ReleaseSourceData();
+	}
+
+	const Clock::time_point EndTime = Clock::now();
+
+	M_LoadStats.ThreadCount = Pool.GetThreadCount();
+	M_LoadStats.NumPrimitives = PrimitiveJobs.size();
+	M_LoadStats.ParseMs = ElapsedMs(StartTime, ParseTime);
+	M_LoadStats.NodesMs = ElapsedMs(ParseTime, NodesTime);
+	M_LoadStats.DecodeMs = ElapsedMs(NodesTime, DecodeTime);
+	M_LoadStats.UploadMs = ElapsedMs(DecodeTime, EndTime);
+	M_LoadStats.TotalMs = ElapsedMs(StartTime, EndTime);
 
 	return true;
 }
 
-void VkGltfModel::LoadNode(const tinygltf::Node &InputNode,  std::shared_ptr<VkGltfModel::Node> NodeParent, std::uint32_t NodeIndex, std::vector<uint32_t> &HostIndexBuffer, std::vector<Vertex> &HostVertexBuffer)
+void VkGltfModel::LoadNode(const tinygltf::Node &InputNode,  std::shared_ptr<VkGltfModel::Node> NodeParent, std::uint32_t NodeIndex, std::vector<PrimitiveJob> &PrimitiveJobs)
 {
+	TRACE_SCOPE("LoadNode");
 	std::shared_ptr<VkGltfModel::Node> Node(new VkGltfModel::Node());
 	Node->Parent = NodeParent;
 	Node->Index = NodeIndex;
@@ -1947,193 +7711,288 @@ void VkGltfModel::LoadNode(const tinygltf::Node &InputNode,  std::shared_ptr<VkG
 		std::copy_n(InputNode.matrix.begin(), 16, reinterpret_cast<float*>(&Node->Matrix));
 	}
 
+	Node->LinearIndex = static_cast<std::uint32_t>(M_LinearNodes.size());
 	M_LinearNodes.push_back(Node);
+	if (NodeIndex < M_NodesByIndex.size()) {
+		M_NodesByIndex[NodeIndex] = Node;
+	}
 
 	if (InputNode.children.size() > 0)
 	{
 		for (size_t i = 0; i < InputNode.children.size(); i++)
 		{
-			LoadNode(M_Model.nodes[InputNode.children[i]], Node, InputNode.children[i], HostIndexBuffer, HostVertexBuffer);
+			LoadNode(M_Model.nodes[InputNode.children[i]], Node, InputNode.children[i], PrimitiveJobs);
 		}
 	}
 
 	if (InputNode.mesh > -1) {
 
-		const tinygltf::Mesh Mesh = M_Model.meshes[InputNode.mesh];
+		const tinygltf::Mesh& Mesh = M_Model.meshes[InputNode.mesh];
+
+		// Each node gets its own weight range, so two nodes sharing a mesh can still be posed apart.
+		std::size_t TargetCount = 0;
+		for (const auto& GlTFPrimitive : Mesh.primitives) {
+			TargetCount = std::max(TargetCount, GlTFPrimitive.targets.size());
+		}
+		if (TargetCount > 0) {
+			Node->FirstMorphTarget = M_MorphTargetCount;
+			Node->MorphTargetCount = static_cast<std::uint32_t>(TargetCount);
+			M_MorphTargetCount += Node->MorphTargetCount;
+
+			const std::vector<double>& Weights = !InputNode.weights.empty() ? InputNode.weights : Mesh.weights;
+			M_DefaultMorphWeights.resize(M_MorphTargetCount, 0.0f);
+			for (std::size_t t = 0; t < std::min(TargetCount, Weights.size()); t++) {
+				M_DefaultMorphWeights[Node->FirstMorphTarget + t] = static_cast<float>(Weights[t]);
+			}
+		}
 
 		for (std::size_t i = 0; i < Mesh.primitives.size(); i++)
 		{
 			const tinygltf::Primitive &GlTFPrimitive = Mesh.primitives[i];
-			std::uint32_t              FirstIndex    = static_cast<std::uint32_t>(HostIndexBuffer.size());
-			std::uint32_t              FirstVertex   = static_cast<std::uint32_t>(HostVertexBuffer.size());
-			std::uint32_t              IndexCount    = 0;
-			std::size_t                VertexCount         = 0;
-			std::vector<Vertex>        LocalVertexBuffer;
-			std::vector<std::uint32_t> LocalIndexBuffer;
-
-			if (GlTFPrimitive.attributes.find("POSITION") != GlTFPrimitive.attributes.end())
-			{
-				const tinygltf::Accessor&   Accessor = M_Model.accessors[GlTFPrimitive.attributes.find("POSITION")->second];
-				const tinygltf::BufferView& View     = M_Model.bufferViews[Accessor.bufferView];
-				auto PositionBufferDataPtr           = reinterpret_cast<const std::uint8_t*>(&(M_Model.buffers[View.buffer].data[Accessor.byteOffset + View.byteOffset]));
-				VertexCount                          = Accessor.count;
-
-				LocalVertexBuffer.reserve(VertexCount);
-
-				std::vector<DirectX::XMFLOAT3> LocalPositionBuffer;
-				LocalPositionBuffer.resize(VertexCount);
-				LoadAccessorData<float, 3>(PositionBufferDataPtr, VertexCount, Accessor.type, Accessor.componentType, reinterpret_cast<float*>(LocalPositionBuffer.data()));
 
-				for (std::size_t v = 0; v < VertexCount; v++) {
-					LocalVertexBuffer.emplace_back(Vertex{});
-					Vertex& Vtx = LocalVertexBuffer.back();
-					std::memset(&Vtx, 0, sizeof(Vertex));
+			const auto PositionIt = GlTFPrimitive.attributes.find("POSITION");
+			if (PositionIt == GlTFPrimitive.attributes.end()) continue;
 
-					Vtx.Pos = LocalPositionBuffer[v];
-				}
+			PrimitiveJob Job{};
+			Job.Mesh           = InputNode.mesh;
+			Job.PrimitiveIndex = i;
+			Job.FirstIndex     = PrimitiveJobs.empty() ? 0 : PrimitiveJobs.back().FirstIndex + PrimitiveJobs.back().IndexCount;
+			Job.FirstVertex    = PrimitiveJobs.empty() ? 0 : PrimitiveJobs.back().FirstVertex + PrimitiveJobs.back().VertexCount;
+			Job.VertexCount    = static_cast<std::uint32_t>(M_Model.accessors[PositionIt->second].count);
+			Job.IndexCount     = (GlTFPrimitive.indices > -1) ? static_cast<std::uint32_t>(M_Model.accessors[GlTFPrimitive.indices].count) : 0;
+			Job.FirstMorphTarget = Node->FirstMorphTarget;
+			PrimitiveJobs.push_back(Job);
 
-			} else {
-				continue;
-			}
+			Primitive primitive{};
+			primitive.FirstIndex    = Job.FirstIndex;
+			primitive.IndexCount    = Job.IndexCount;
+			primitive.FirstVertex   = Job.FirstVertex;
+			primitive.VertexCount   = Job.VertexCount;
+			Node->MeshData.Primitives.push_back(primitive);
+		}
+	}
 
-			if (GlTFPrimitive.attributes.find("NORMAL") != GlTFPrimitive.attributes.end())
-			{
-				const tinygltf::Accessor&   Accessor = M_Model.accessors[GlTFPrimitive.attributes.find("NORMAL")->second];
-				const tinygltf::BufferView& View     = M_Model.bufferViews[Accessor.bufferView];
-				auto NormalBufferDataPtr            = reinterpret_cast<const std::uint8_t*>(&(M_Model.buffers[View.buffer].data[Accessor.byteOffset + View.byteOffset]));
+	if (NodeParent)
+	{
+		NodeParent->Children.push_back(Node);
+	}
+	else
+	{
+		M_Nodes.push_back(Node);
+	}
+}
 
-				std::vector<DirectX::XMFLOAT3> LocalNormalBuffer;
-				LocalNormalBuffer.resize(Accessor.count);
-				LoadAccessorData<float, 3>(NormalBufferDataPtr, Accessor.count, Accessor.type, Accessor.componentType, reinterpret_cast<float*>(LocalNormalBuffer.data()));
+void VkGltfModel::LoadPrimitive(const PrimitiveJob& Job, VkGltfModel::Vertex* DstVertices, std::uint32_t* DstIndices) const
+{
+	TRACE_SCOPE("LoadPrimitive");
+	const tinygltf::Primitive& GlTFPrimitive = M_Model.meshes[Job.Mesh].primitives[Job.PrimitiveIndex];
+	const std::size_t          VertexCount   = Job.VertexCount;
+
+	const auto FindAccessorData = [&](const char* AttributeName) -> const tinygltf::Accessor* {
+		const auto It = GlTFPrimitive.attributes.find(AttributeName);
+		if (It == GlTFPrimitive.attributes.end()) return nullptr;
+		return &M_Model.accessors[It->second];
+	};
+	const auto AccessorDataPtr = [&](const tinygltf::Accessor& Accessor) {
+		const tinygltf::BufferView& View = M_Model.bufferViews[Accessor.bufferView];
+		return reinterpret_cast<const std::uint8_t*>(&(M_Model.buffers[View.buffer].data[Accessor.byteOffset + View.byteOffset]));
+	};
 
-				const std::size_t CopyCount = std::min(VertexCount, Accessor.count);
-				for (std::size_t v = 0; v < CopyCount; v++) {
-					LocalVertexBuffer[v].Normal = LocalNormalBuffer[v];
-				}
-			}
+	if (const tinygltf::Accessor* Accessor = FindAccessorData("POSITION"))
+	{
+		std::vector<DirectX::XMFLOAT3> LocalPositionBuffer;
+		LocalPositionBuffer.resize(VertexCount);
+		LoadAccessorData<float, 3>(AccessorDataPtr(*Accessor), VertexCount, Accessor->type, Accessor->componentType, reinterpret_cast<float*>(LocalPositionBuffer.data()));
 
+		for (std::size_t v = 0; v < VertexCount; v++) {
+			DstVertices[v].Pos = LocalPositionBuffer[v];
+		}
+	}
 
-			if (GlTFPrimitive.attributes.find("TEXCOORD_0") != GlTFPrimitive.attributes.end())
-			{
-				const tinygltf::Accessor&   Accessor = M_Model.accessors[GlTFPrimitive.attributes.find("TEXCOORD_0")->second];
-				const tinygltf::BufferView& View     = M_Model.bufferViews[Accessor.bufferView];
-				auto TexCoordBufferDataPtr           = reinterpret_cast<const std::uint8_t*>(&(M_Model.buffers[View.buffer].data[Accessor.byteOffset + View.byteOffset]));
+	if (const tinygltf::Accessor* Accessor = FindAccessorData("NORMAL"))
+	{
+		std::vector<DirectX::XMFLOAT3> LocalNormalBuffer;
+		LocalNormalBuffer.resize(Accessor->count);
+		LoadAccessorData<float, 3>(AccessorDataPtr(*Accessor), Accessor->count, Accessor->type, Accessor->componentType, reinterpret_cast<float*>(LocalNormalBuffer.data()));
 
-				std::vector<DirectX::XMFLOAT2> LocalTexCoordBuffer;
-				LocalTexCoordBuffer.resize(Accessor.count);
-				LoadAccessorData<float, 2>(TexCoordBufferDataPtr, Accessor.count, Accessor.type, Accessor.componentType, reinterpret_cast<float*>(LocalTexCoordBuffer.data()));
+		const std::size_t CopyCount = std::min(VertexCount, Accessor->count);
+		for (std::size_t v = 0; v < CopyCount; v++) {
+			DstVertices[v].Normal = LocalNormalBuffer[v];
+		}
+	}
 
-				const std::size_t CopyCount = std::min(VertexCount, Accessor.count);
-				for (std::size_t v = 0; v < CopyCount; v++) {
-					LocalVertexBuffer[v].Uv = LocalTexCoordBuffer[v];
-				}
+	if (const tinygltf::Accessor* Accessor = FindAccessorData("TEXCOORD_0"))
+	{
+		std::vector<DirectX::XMFLOAT2> LocalTexCoordBuffer;
+		LocalTexCoordBuffer.resize(Accessor->count);
+		LoadAccessorData<float, 2>(AccessorDataPtr(*Accessor), Accessor->count, Accessor->type, Accessor->componentType, reinterpret_cast<float*>(LocalTexCoordBuffer.data()));
 
-			}
+		const std::size_t CopyCount = std::min(VertexCount, Accessor->count);
+		for (std::size_t v = 0; v < CopyCount; v++) {
+			DstVertices[v].Uv = LocalTexCoordBuffer[v];
+		}
+	}
 
-			if (GlTFPrimitive.attributes.find("JOINTS_0") != GlTFPrimitive.attributes.end())
-			{
-				const tinygltf::Accessor&   Accessor = M_Model.accessors[GlTFPrimitive.attributes.find("JOINTS_0")->second];
-				const tinygltf::BufferView& View     = M_Model.bufferViews[Accessor.bufferView];
-				auto JointIndicesBufferDataPtr0      = reinterpret_cast<const std::uint8_t*>(&(M_Model.buffers[View.buffer].data[Accessor.byteOffset + View.byteOffset]));
+	if (const tinygltf::Accessor* Accessor = FindAccessorData("JOINTS_0"))
+	{
+		std::vector<DirectX::XMUINT4> LocalJointIndicesBuffer0;
+		LocalJointIndicesBuffer0.resize(Accessor->count);
+		LoadAccessorData<std::uint32_t, 4>(AccessorDataPtr(*Accessor), Accessor->count, Accessor->type, Accessor->componentType, reinterpret_cast<std::uint32_t*>(LocalJointIndicesBuffer0.data()));
 
-				std::vector<DirectX::XMUINT4> LocalJointIndicesBuffer0;
-				LocalJointIndicesBuffer0.resize(Accessor.count);
-				LoadAccessorData<std::uint32_t, 4>(JointIndicesBufferDataPtr0, Accessor.count, Accessor.type, Accessor.componentType, reinterpret_cast<std::uint32_t*>(LocalJointIndicesBuffer0.data()));
+		const std::size_t CopyCount = std::min(VertexCount, Accessor->count);
+		for (std::size_t v = 0; v < CopyCount; v++) {
+			DstVertices[v].JointIndices0 = LocalJointIndicesBuffer0[v];
+		}
+	}
 
-				const std::size_t CopyCount = std::min(VertexCount, Accessor.count);
-				for (std::size_t v = 0; v < CopyCount; v++) {
-					LocalVertexBuffer[v].JointIndices0 = LocalJointIndicesBuffer0[v];
-				}
+	if (const tinygltf::Accessor* Accessor = FindAccessorData("WEIGHTS_0"))
+	{
+		std::vector<DirectX::XMFLOAT4> LocalJointWeightsBuffer0;
+		LocalJointWeightsBuffer0.resize(Accessor->count);
+		LoadAccessorData<float, 4>(AccessorDataPtr(*Accessor), Accessor->count, Accessor->type, Accessor->componentType, reinterpret_cast<float*>(LocalJointWeightsBuffer0.data()));
 
-			}
+		const std::size_t CopyCount = std::min(VertexCount, Accessor->count);
+		for (std::size_t v = 0; v < CopyCount; v++) {
+			DstVertices[v].JointWeights0 = LocalJointWeightsBuffer0[v];
+		}
+	}
 
-			if (GlTFPrimitive.attributes.find("WEIGHTS_0") != GlTFPrimitive.attributes.end())
-			{
-				const tinygltf::Accessor&   Accessor = M_Model.accessors[GlTFPrimitive.attributes.find("WEIGHTS_0")->second];
-				const tinygltf::BufferView& View     = M_Model.bufferViews[Accessor.bufferView];
-				auto JointWeightsBufferDataPtr0      = reinterpret_cast<const std::uint8_t*>(&(M_Model.buffers[View.buffer].data[Accessor.byteOffset + View.byteOffset]));
+	if (const tinygltf::Accessor* Accessor = FindAccessorData("JOINTS_1"))
+	{
+		std::vector<DirectX::XMUINT4> LocalJointIndicesBuffer1;
+		LocalJointIndicesBuffer1.resize(Accessor->count);
+		LoadAccessorData<std::uint32_t, 4>(AccessorDataPtr(*Accessor), Accessor->count, Accessor->type, Accessor->componentType, reinterpret_cast<std::uint32_t*>(LocalJointIndicesBuffer1.data()));
 
-				std::vector<DirectX::XMFLOAT4> LocalJointWeightsBuffer0;
-				LocalJointWeightsBuffer0.resize(Accessor.count);
-				LoadAccessorData<float, 4>(JointWeightsBufferDataPtr0, Accessor.count, Accessor.type, Accessor.componentType, reinterpret_cast<float*>(LocalJointWeightsBuffer0.data()));
+		const std::size_t CopyCount = std::min(VertexCount, Accessor->count);
+		for (std::size_t v = 0; v < CopyCount; v++) {
+			DstVertices[v].JointIndices1 = LocalJointIndicesBuffer1[v];
+		}
+	}
 
-				const std::size_t CopyCount = std::min(VertexCount, Accessor.count);
-				for (std::size_t v = 0; v < CopyCount; v++) {
-					LocalVertexBuffer[v].JointWeights0 = LocalJointWeightsBuffer0[v];
-				}
-			}
+	if (const tinygltf::Accessor* Accessor = FindAccessorData("WEIGHTS_1"))
+	{
+		std::vector<DirectX::XMFLOAT4> LocalJointWeightsBuffer1;
+		LocalJointWeightsBuffer1.resize(Accessor->count);
+		LoadAccessorData<float, 4>(AccessorDataPtr(*Accessor), Accessor->count, Accessor->type, Accessor->componentType, reinterpret_cast<float*>(LocalJointWeightsBuffer1.data()));
 
-			if (GlTFPrimitive.attributes.find("JOINTS_1") != GlTFPrimitive.attributes.end())
-			{
-				const tinygltf::Accessor&   Accessor = M_Model.accessors[GlTFPrimitive.attributes.find("JOINTS_1")->second];
-				const tinygltf::BufferView& View     = M_Model.bufferViews[Accessor.bufferView];
-				auto JointIndicesBufferDataPtr1      = reinterpret_cast<const std::uint8_t*>(&(M_Model.buffers[View.buffer].data[Accessor.byteOffset + View.byteOffset]));
+		const std::size_t CopyCount = std::min(VertexCount, Accessor->count);
+		for (std::size_t v = 0; v < CopyCount; v++) {
+			DstVertices[v].JointWeights1 = LocalJointWeightsBuffer1[v];
+		}
+	}
 
-				std::vector<DirectX::XMUINT4> LocalJointIndicesBuffer1;
-				LocalJointIndicesBuffer1.resize(Accessor.count);
-				LoadAccessorData<std::uint32_t, 4>(JointIndicesBufferDataPtr1, Accessor.count, Accessor.type, Accessor.componentType, reinterpret_cast<std::uint32_t*>(LocalJointIndicesBuffer1.data()));
+	if (Job.IndexCount > 0)
+	{
+		const tinygltf::Accessor& Accessor = M_Model.accessors[GlTFPrimitive.indices];
+		LoadAccessorData<std::uint32_t, 1>(AccessorDataPtr(Accessor), Accessor.count, Accessor.type, Accessor.componentType, DstIndices);
+	}
+}
 
-				const std::size_t CopyCount = std::min(VertexCount, Accessor.count);
-				for (std::size_t v = 0; v < CopyCount; v++) {
-					LocalVertexBuffer[v].JointIndices1 = LocalJointIndicesBuffer1[v];
-				}
+void VkGltfModel::LoadMorphTargets(const PrimitiveJob& Job, MorphRange* DstRanges, std::vector<MorphDelta>& DstDeltas) const
+{
+	TRACE_SCOPE("LoadMorphTargets");
+	const tinygltf::Primitive& GlTFPrimitive = M_Model.meshes[Job.Mesh].primitives[Job.PrimitiveIndex];
+	const std::size_t          VertexCount   = Job.VertexCount;
+
+	std::vector<DirectX::XMFLOAT3> Positions(VertexCount);
+	std::vector<DirectX::XMFLOAT3> Normals(VertexCount);
+	std::vector<std::uint32_t>     DeltaVertices;
+
+	for (std::size_t t = 0; t < GlTFPrimitive.targets.size(); t++) {
+		const auto& Target = GlTFPrimitive.targets[t];
+		std::fill(Positions.begin(), Positions.end(), DirectX::XMFLOAT3{});
+		std::fill(Normals.begin(), Normals.end(), DirectX::XMFLOAT3{});
+
+		const auto PositionIt = Target.find("POSITION");
+		if (PositionIt != Target.end()) LoadMorphAccessor(PositionIt->second, VertexCount, Positions.data());
+		const auto NormalIt = Target.find("NORMAL");
+		if (NormalIt != Target.end()) LoadMorphAccessor(NormalIt->second, VertexCount, Normals.data());
+
+		// Faces move a small patch of vertices per target; everything else is dropped here.
+		for (std::size_t v = 0; v < VertexCount; v++) {
+			const DirectX::XMFLOAT3& P = Positions[v];
+			const DirectX::XMFLOAT3& N = Normals[v];
+			if (P.x == 0.0f && P.y == 0.0f && P.z == 0.0f && N.x == 0.0f && N.y == 0.0f && N.z == 0.0f) continue;
+
+			DstDeltas.push_back(MorphDelta{P, Job.FirstMorphTarget + static_cast<std::uint32_t>(t), N, 0.0f});
+			DeltaVertices.push_back(static_cast<std::uint32_t>(v));
+		}
+	}
 
-			}
+	// Group by vertex; targets were appended in order, so a stable sort keeps them ascending within each vertex.
+	std::vector<std::uint32_t> Order(DstDeltas.size());
+	for (std::uint32_t i = 0; i < Order.size(); i++) Order[i] = i;
+	std::stable_sort(Order.begin(), Order.end(), [&DeltaVertices](std::uint32_t A, std::uint32_t B) { return DeltaVertices[A] < DeltaVertices[B]; });
+
+	std::vector<MorphDelta> Sorted(DstDeltas.size());
+	for (std::size_t v = 0; v < VertexCount; v++) DstRanges[v] = MorphRange{0, 0};
+	for (std::uint32_t i = 0; i < Order.size(); i++) {
+		Sorted[i] = DstDeltas[Order[i]];
+		MorphRange& Range = DstRanges[DeltaVertices[Order[i]]];
+		if (Range.Count == 0) Range.First = i;
+		Range.Count++;
+	}
+	DstDeltas = std::move(Sorted);
+}
 
-			if (GlTFPrimitive.attributes.find("WEIGHTS_1") != GlTFPrimitive.attributes.end())
-			{
-				const tinygltf::Accessor&   Accessor = M_Model.accessors[GlTFPrimitive.attributes.find("WEIGHTS_1")->second];
-				const tinygltf::BufferView& View     = M_Model.bufferViews[Accessor.bufferView];
-				auto JointWeightsBufferDataPtr1      = reinterpret_cast<const std::uint8_t*>(&(M_Model.buffers[View.buffer].data[Accessor.byteOffset + View.byteOffset]));
+void VkGltfModel::LoadMorphAccessor(int AccessorIndex, std::size_t VertexCount, DirectX::XMFLOAT3* DstValues) const
+{
+	const tinygltf::Accessor& Accessor = M_Model.accessors[AccessorIndex];
+	const std::size_t         Count    = std::min(VertexCount, Accessor.count);
+
+	// Without a buffer view the base is all zeros and only the sparse entries carry data.
+	if (Accessor.bufferView > -1) {
+		const tinygltf::BufferView& View = M_Model.bufferViews[Accessor.bufferView];
+		const std::uint8_t* DataPtr = &M_Model.buffers[View.buffer].data[Accessor.byteOffset + View.byteOffset];
+		LoadAccessorData<float, 3>(DataPtr, Count, Accessor.type, Accessor.componentType, reinterpret_cast<float*>(DstValues));
+	}
 
-				std::vector<DirectX::XMFLOAT4> LocalJointWeightsBuffer1;
-				LocalJointWeightsBuffer1.resize(Accessor.count);
-				LoadAccessorData<float, 4>(JointWeightsBufferDataPtr1, Accessor.count, Accessor.type, Accessor.componentType, reinterpret_cast<float*>(LocalJointWeightsBuffer1.data()));
+	if (!Accessor.sparse.isSparse || Accessor.sparse.count <= 0) return;
 
-				const std::size_t CopyCount = std::min(VertexCount, Accessor.count);
-				for (std::size_t v = 0; v < CopyCount; v++) {
-					LocalVertexBuffer[v].JointWeights1 = LocalJointWeightsBuffer1[v];
-				}
-			}
+	const std::size_t SparseCount = static_cast<std::size_t>(Accessor.sparse.count);
+	std::vector<std::uint32_t>     Indices(SparseCount);
+	std::vector<DirectX::XMFLOAT3> Values(SparseCount);
 
-			const tinygltf::Accessor &  Accessor   = M_Model.accessors[GlTFPrimitive.indices];
-			const tinygltf::BufferView& BufferView = M_Model.bufferViews[Accessor.bufferView];
-			const tinygltf::Buffer&     Buffer     = M_Model.buffers[BufferView.buffer];
-			auto IndexBufferDataPtr                = reinterpret_cast<const std::uint8_t*>(&(Buffer.data[Accessor.byteOffset + BufferView.byteOffset]));
+	const tinygltf::BufferView& IndexView = M_Model.bufferViews[Accessor.sparse.indices.bufferView];
+	const tinygltf::BufferView& ValueView = M_Model.bufferViews[Accessor.sparse.values.bufferView];
+	LoadAccessorData<std::uint32_t, 1>(&M_Model.buffers[IndexView.buffer].data[Accessor.sparse.indices.byteOffset + IndexView.byteOffset], SparseCount, TINYGLTF_TYPE_SCALAR, Accessor.sparse.indices.componentType, Indices.data());
+	LoadAccessorData<float, 3>(&M_Model.buffers[ValueView.buffer].data[Accessor.sparse.values.byteOffset + ValueView.byteOffset], SparseCount, Accessor.type, Accessor.componentType, reinterpret_cast<float*>(Values.data()));
 
-			IndexCount += static_cast<std::uint32_t>(Accessor.count);
+	for (std::size_t i = 0; i < SparseCount; i++) {
+		if (Indices[i] < Count) DstValues[Indices[i]] = Values[i];
+	}
+}
 
-			LocalIndexBuffer.resize(Accessor.count);
-			LoadAccessorData<std::uint32_t, 1>(IndexBufferDataPtr, Accessor.count, Accessor.type, Accessor.componentType, reinterpret_cast<std::uint32_t*>(LocalIndexBuffer.data()));
+void VkGltfModel::CreateMorphDescriptorSet()
+{
+	const vk::DescriptorPoolSize PoolSize(vk::DescriptorType::eStorageBuffer, 2);
+	const vk::DescriptorPoolCreateInfo DescriptorPoolCI = vk::DescriptorPoolCreateInfo({}, 1, 1, &PoolSize);
+	M_MorphDescriptorPool = G_Device.createDescriptorPool(DescriptorPoolCI, nullptr, G_DLD);
 
-			std::copy(LocalVertexBuffer.begin(), LocalVertexBuffer.end(), std::back_inserter(HostVertexBuffer));
-			std::copy(LocalIndexBuffer.begin(), LocalIndexBuffer.end(), std::back_inserter(HostIndexBuffer));
+	const vk::DescriptorSetAllocateInfo DescriptorSetAI = vk::DescriptorSetAllocateInfo(M_MorphDescriptorPool, 1, &G_MorphDescriptorSetLayout);
+	M_MorphDescriptorSet = G_Device.allocateDescriptorSets(DescriptorSetAI, G_DLD)[0];
 
-			Primitive primitive{};
-			primitive.FirstIndex    = FirstIndex;
-			primitive.IndexCount    = IndexCount;
-			primitive.FirstVertex   = FirstVertex;
-			Node->Mesh.Primitives.push_back(primitive);
-		}
-	}
+	WriteMorphDescriptorSet();
+}
 
-	if (NodeParent)
-	{
-		NodeParent->Children.push_back(Node);
-	}
-	else
-	{
-		M_Nodes.push_back(Node);
-	}
+void VkGltfModel::WriteMorphDescriptorSet()
+{
+	const vk::DescriptorBufferInfo DescriptorBIs[2] = {
+		vk::DescriptorBufferInfo(std::get<0>(M_MorphRangeBufferTuple), 0, vk::WholeSize),
+		vk::DescriptorBufferInfo(std::get<0>(M_MorphDeltaBufferTuple), 0, vk::WholeSize),
+	};
+	const vk::WriteDescriptorSet Write = vk::WriteDescriptorSet(M_MorphDescriptorSet, 0, 0, 2, vk::DescriptorType::eStorageBuffer, nullptr, DescriptorBIs, nullptr);
+	G_Device.updateDescriptorSets(Write, nullptr, G_DLD);
 }
 
-void VkGltfModel::LoadSkins()
+void VkGltfModel::LoadSkins(TaskGroup& Tasks)
 {
+	TRACE_SCOPE("LoadSkins");
 	M_Skins.resize(M_Model.skins.size());
 
 	for (std::size_t i = 0; i < M_Model.skins.size(); i++)
 	{
-		tinygltf::Skin glTFSkin = M_Model.skins[i];
+		const tinygltf::Skin& glTFSkin = M_Model.skins[i];
 
 		M_Skins[i].Name = glTFSkin.name;
 		M_Skins[i].SkeletonRoot = NodeFromIndex(glTFSkin.skeleton);
@@ -2150,108 +8009,182 @@ void VkGltfModel::LoadSkins()
 
 		if (glTFSkin.inverseBindMatrices > -1)
 		{
-			const tinygltf::Accessor&   Accessor   = M_Model.accessors[glTFSkin.inverseBindMatrices];
-			const tinygltf::BufferView& BufferView = M_Model.bufferViews[Accessor.bufferView];
-			const tinygltf::Buffer&     Buffer     = M_Model.buffers[BufferView.buffer];
-			auto                        DataPtr    = reinterpret_cast<const std::uint8_t*>(&Buffer.data[Accessor.byteOffset + BufferView.byteOffset]);
-
-			M_Skins[i].InverseBindMatrices.resize(Accessor.count);
-			LoadAccessorData<float, 16>(DataPtr, Accessor.count, Accessor.type, Accessor.componentType, reinterpret_cast<float*>(M_Skins[i].InverseBindMatrices.data()));
-
-			for (auto& Item : M_Skins[i].Ssbo) {
-				Item = CreateBuffer(vk::BufferUsageFlagBits::eStorageBuffer, sizeof(DirectX::XMFLOAT4X4) * M_Skins[i].InverseBindMatrices.size(), M_Skins[i].InverseBindMatrices.data());
-			}
+			Tasks.Run([this, i]() {
+				TRACE_SCOPE("LoadInverseBindMatrices");
+				const tinygltf::Accessor&   Accessor   = M_Model.accessors[M_Model.skins[i].inverseBindMatrices];
+				const tinygltf::BufferView& BufferView = M_Model.bufferViews[Accessor.bufferView];
+				const tinygltf::Buffer&     Buffer     = M_Model.buffers[BufferView.buffer];
+				auto                        DataPtr    = reinterpret_cast<const std::uint8_t*>(&Buffer.data[Accessor.byteOffset + BufferView.byteOffset]);
 
-			for (std::size_t m = 0; m < G_MaxFramesInFlight; m++) {
-				M_Skins[i].SsboMapped[m] = G_Device.mapMemory(std::get<1>(M_Skins[i].Ssbo[m]), 0, vk::WholeSize, {}, G_DLD);
-			}
+				M_Skins[i].InverseBindMatrices.resize(Accessor.count);
+				LoadAccessorData<float, 16>(DataPtr, Accessor.count, Accessor.type, Accessor.componentType, reinterpret_cast<float*>(M_Skins[i].InverseBindMatrices.data()));
+			});
 		}
 	}
+}
+
+void VkGltfModel::InitSkinPalettes()
+{
+	// Every instance gets one contiguous palette holding all skins back to back.
+	M_PaletteMatrixCount = 0;
+	for (auto& Item : M_Skins) {
+		Item.PaletteOffset = M_PaletteMatrixCount;
+		M_PaletteMatrixCount += static_cast<std::uint32_t>(Item.Joints.size());
+	}
 
-	const vk::DescriptorPoolSize PoolSize(vk::DescriptorType::eStorageBuffer, M_Skins.size() * G_MaxFramesInFlight);
-	const vk::DescriptorPoolCreateInfo DescriptorPoolCI = vk::DescriptorPoolCreateInfo({}, M_Skins.size() * G_MaxFramesInFlight, 1, &PoolSize);
-	M_SkinsDescriptorPool = G_Device.createDescriptorPool(DescriptorPoolCI, nullptr, G_DLD);
+	M_MorphWeightOffset = M_PaletteMatrixCount;
+	M_PaletteMatrixCount += (M_MorphTargetCount + 15) / 16;
+}
 
+void VkGltfModel::ComputeBounds(const std::vector<VkGltfModel::Vertex>& HostVertices)
+{
+	// Skin the first frame of the first clip on the CPU; the sphere is padded to cover the rest of the motion.
+	// The cache does not exist yet when streaming, so the first clip is decoded just for this.
+	Pose BoundsPose;
+	const std::shared_ptr<const AnimationClip> BoundsClip = M_Animations.empty() ? nullptr : (M_Animations[0].Clip ? M_Animations[0].Clip : DecodeClip(0));
+	EvaluatePose(0, BoundsClip.get(), M_Animations.empty() ? 0.0f : M_Animations[0].Start, BoundsPose);
+
+	// XMMATRIX storage keeps the 16-byte alignment the palette's streaming stores expect.
+	std::vector<DirectX::XMMATRIX> PaletteStorage(std::max(M_PaletteMatrixCount, 1U));
+	DirectX::XMFLOAT4X4* Palette = reinterpret_cast<DirectX::XMFLOAT4X4*>(PaletteStorage.data());
+	UpdateJoints(BoundsPose, Palette);
+
+	float Min[3] = {std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max()};
+	float Max[3] = {-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max()};
+
+	for (const auto& Node : M_LinearNodes) {
+		if (Node->Skin < 0) continue;
+		const DirectX::XMFLOAT4X4* SkinPalette = Palette + M_Skins[Node->Skin].PaletteOffset;
+		const std::size_t          NumJoints   = M_Skins[Node->Skin].Joints.size();
+
+		for (const auto& Primitive : Node->MeshData.Primitives) {
+			for (std::uint32_t v = Primitive.FirstVertex; v < Primitive.FirstVertex + Primitive.VertexCount && v < HostVertices.size(); v++) {
+				const Vertex& Vert = HostVertices[v];
+
+				const std::uint32_t Joints[8] = {Vert.JointIndices0.x, Vert.JointIndices0.y, Vert.JointIndices0.z, Vert.JointIndices0.w, Vert.JointIndices1.x, Vert.JointIndices1.y, Vert.JointIndices1.z, Vert.JointIndices1.w};
+				const float Weights[8] = {Vert.JointWeights0.x, Vert.JointWeights0.y, Vert.JointWeights0.z, Vert.JointWeights0.w, Vert.JointWeights1.x, Vert.JointWeights1.y, Vert.JointWeights1.z, Vert.JointWeights1.w};
+
+				DirectX::XMMATRIX SkinMatrix = DirectX::XMMatrixIdentity();
+				bool bFirstJoint = true;
+				for (std::size_t j = 0; j < 8; j++) {
+					if (Weights[j] == 0.0f || Joints[j] >= NumJoints) continue;
+					const DirectX::XMMATRIX Weighted = DirectX::XMLoadFloat4x4(&SkinPalette[Joints[j]]) * Weights[j];
+					SkinMatrix = bFirstJoint ? Weighted : (SkinMatrix + Weighted);
+					bFirstJoint = false;
+				}
 
-	for (std::size_t i = 0; i < M_Model.skins.size(); i++) {
-		for (std::size_t m = 0; m < G_MaxFramesInFlight; m++) {
-			const vk::DescriptorSetAllocateInfo DescriptorSetAI = vk::DescriptorSetAllocateInfo(M_SkinsDescriptorPool, 1, &G_SkinsDescriptorSetLayout);
-			M_Skins[i].DescriptorSet[m] = G_Device.allocateDescriptorSets(DescriptorSetAI, G_DLD)[0];
+				DirectX::XMFLOAT3 Position;
+				DirectX::XMStoreFloat3(&Position, DirectX::XMVector3Transform(DirectX::XMLoadFloat3(&Vert.Pos), SkinMatrix));
 
-			const vk::DescriptorBufferInfo DescriptorBI = vk::DescriptorBufferInfo(std::get<0>(M_Skins[i].Ssbo[m]), 0, vk::WholeSize);
-			const vk::WriteDescriptorSet Write = vk::WriteDescriptorSet(M_Skins[i].DescriptorSet[m], 0, 0, 1,vk::DescriptorType::eStorageBuffer, nullptr, &DescriptorBI, nullptr);
-			G_Device.updateDescriptorSets(Write, nullptr, G_DLD);
+				Min[0] = std::min(Min[0], Position.x); Max[0] = std::max(Max[0], Position.x);
+				Min[1] = std::min(Min[1], Position.y); Max[1] = std::max(Max[1], Position.y);
+				Min[2] = std::min(Min[2], Position.z); Max[2] = std::max(Max[2], Position.z);
+			}
 		}
 	}
 
+	if (Min[0] > Max[0]) {
+		M_BoundingSphere = DirectX::XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f);
+		return;
+	}
+
+	const float HalfX = 0.5f * (Max[0] - Min[0]);
+	const float HalfY = 0.5f * (Max[1] - Min[1]);
+	const float HalfZ = 0.5f * (Max[2] - Min[2]);
+	M_BoundingSphere = DirectX::XMFLOAT4(Min[0] + HalfX, Min[1] + HalfY, Min[2] + HalfZ, 1.25f * std::sqrt(HalfX * HalfX + HalfY * HalfY + HalfZ * HalfZ));
 }
 
-void VkGltfModel::LoadAnimations()
+void VkGltfModel::LoadAnimations(TaskGroup& Tasks)
 {
+	TRACE_SCOPE("LoadAnimations");
 	M_Animations.resize(M_Model.animations.size());
+	M_LoadStats.NumSamplers = 0;
 
 	for (std::size_t i = 0; i < M_Model.animations.size(); i++)
 	{
-		tinygltf::Animation GltfAnimation = M_Model.animations[i];
-		M_Animations[i].Name              = GltfAnimation.name;
-
-		M_Animations[i].Samplers.resize(GltfAnimation.samplers.size());
-		for (size_t j = 0; j < GltfAnimation.samplers.size(); j++)
-		{
-			tinygltf::AnimationSampler GlTFSampler = GltfAnimation.samplers[j];
-			AnimationSampler &         DstSampler  = M_Animations[i].Samplers[j];
-			DstSampler.Interpolation               = GlTFSampler.interpolation;
-
-			{
-				const tinygltf::Accessor&   Accessor   = M_Model.accessors[GlTFSampler.input];
-				const tinygltf::BufferView& BufferView = M_Model.bufferViews[Accessor.bufferView];
-				const tinygltf::Buffer &    Buffer     = M_Model.buffers[BufferView.buffer];
-				auto                        DataPtr    = reinterpret_cast<const std::uint8_t*>(&Buffer.data[Accessor.byteOffset + BufferView.byteOffset]);
-
-				std::vector<float> LocalBuffer;
-				LocalBuffer.resize(Accessor.count);
-				LoadAccessorData<float, 1>(DataPtr, Accessor.count, Accessor.type, Accessor.componentType, reinterpret_cast<float*>(LocalBuffer.data()));
-				std::copy(LocalBuffer.begin(), LocalBuffer.end(), std::back_inserter(DstSampler.Inputs));
-
-				for (auto input : M_Animations[i].Samplers[j].Inputs)
-				{
-					if (input < M_Animations[i].Start)
-					{
-						M_Animations[i].Start = input;
-					};
-					if (input > M_Animations[i].End)
-					{
-						M_Animations[i].End = input;
+		const tinygltf::Animation& GltfAnimation = M_Model.animations[i];
+		M_Animations[i].Name                     = GltfAnimation.name;
+		M_LoadStats.NumSamplers                 += GltfAnimation.samplers.size();
+
+		if (M_bStreamClips) {
+			// Only the time range is needed up front; glTF requires min/max on sampler inputs, so the keys stay untouched.
+			for (const tinygltf::AnimationSampler& GlTFSampler : GltfAnimation.samplers) {
+				const tinygltf::Accessor& Accessor = M_Model.accessors[GlTFSampler.input];
+				if (!Accessor.minValues.empty() && !Accessor.maxValues.empty()) {
+					M_Animations[i].Start = std::min(M_Animations[i].Start, static_cast<float>(Accessor.minValues[0]));
+					M_Animations[i].End = std::max(M_Animations[i].End, static_cast<float>(Accessor.maxValues[0]));
+				} else {
+					AnimationSampler Sampler;
+					DecodeSampler(GlTFSampler, Sampler);
+					for (auto input : Sampler.Inputs) {
+						M_Animations[i].Start = std::min(M_Animations[i].Start, input);
+						M_Animations[i].End = std::max(M_Animations[i].End, input);
 					}
 				}
 			}
-
+		} else {
+			M_Animations[i].Clip = std::make_shared<AnimationClip>();
+			M_Animations[i].Clip->Samplers.resize(GltfAnimation.samplers.size());
+			for (size_t j = 0; j < GltfAnimation.samplers.size(); j++)
 			{
-				const tinygltf::Accessor&   Accessor   = M_Model.accessors[GlTFSampler.output];
-				const tinygltf::BufferView& BufferView = M_Model.bufferViews[Accessor.bufferView];
-				const tinygltf::Buffer &    Buffer     = M_Model.buffers[BufferView.buffer];
-				auto                        DataPtr    = reinterpret_cast<const std::uint8_t*>(&Buffer.data[Accessor.byteOffset + BufferView.byteOffset]);
-
-				std::vector<DirectX::XMFLOAT4> LocalBuffer;
-				LocalBuffer.resize(Accessor.count);
-				LoadAccessorData<float, 4>(DataPtr, Accessor.count, Accessor.type, Accessor.componentType, reinterpret_cast<float*>(LocalBuffer.data()));
-				std::copy(LocalBuffer.begin(), LocalBuffer.end(), std::back_inserter(DstSampler.OutputsVec4));
-
+				Tasks.Run([this, i, j]() {
+					DecodeSampler(M_Model.animations[i].samplers[j], M_Animations[i].Clip->Samplers[j]);
+				});
 			}
 		}
 
 		M_Animations[i].Channels.resize(GltfAnimation.channels.size());
 		for (size_t j = 0; j < GltfAnimation.channels.size(); j++)
 		{
-			tinygltf::AnimationChannel GltfChannel = GltfAnimation.channels[j];
-			AnimationChannel&          DstChannel  = M_Animations[i].Channels[j];
-			DstChannel.Path                        = ChannelPathFromString(GltfChannel.target_path);
-			DstChannel.SamplerIndex                = GltfChannel.sampler;
-			DstChannel.Node                        = NodeFromIndex(GltfChannel.target_node);
+			const tinygltf::AnimationChannel& GltfChannel = GltfAnimation.channels[j];
+			AnimationChannel&                 DstChannel  = M_Animations[i].Channels[j];
+			DstChannel.Path                               = ChannelPathFromString(GltfChannel.target_path);
+			DstChannel.SamplerIndex                       = GltfChannel.sampler;
+			DstChannel.TargetNode                         = NodeFromIndex(GltfChannel.target_node);
 		}
 	}
 }
 
+void VkGltfModel::DecodeSampler(const tinygltf::AnimationSampler& GlTFSampler, AnimationSampler& DstSampler) const
+{
+	TRACE_SCOPE("LoadAnimationSampler");
+	DstSampler.Interpolation = GlTFSampler.interpolation;
+
+	{
+		const tinygltf::Accessor&   Accessor   = M_Model.accessors[GlTFSampler.input];
+		const tinygltf::BufferView& BufferView = M_Model.bufferViews[Accessor.bufferView];
+		const tinygltf::Buffer &    Buffer     = M_Model.buffers[BufferView.buffer];
+		auto                        DataPtr    = reinterpret_cast<const std::uint8_t*>(&Buffer.data[Accessor.byteOffset + BufferView.byteOffset]);
+
+		DstSampler.Inputs.resize(Accessor.count);
+		LoadAccessorData<float, 1>(DataPtr, Accessor.count, Accessor.type, Accessor.componentType, DstSampler.Inputs.data());
+	}
+
+	{
+		const tinygltf::Accessor&   Accessor   = M_Model.accessors[GlTFSampler.output];
+		const tinygltf::BufferView& BufferView = M_Model.bufferViews[Accessor.bufferView];
+		const tinygltf::Buffer &    Buffer     = M_Model.buffers[BufferView.buffer];
+		auto                        DataPtr    = reinterpret_cast<const std::uint8_t*>(&Buffer.data[Accessor.byteOffset + BufferView.byteOffset]);
+
+		DstSampler.OutputsVec4.resize(Accessor.count);
+		LoadAccessorData<float, 4>(DataPtr, Accessor.count, Accessor.type, Accessor.componentType, reinterpret_cast<float*>(DstSampler.OutputsVec4.data()));
+	}
+}
+
+std::shared_ptr<VkGltfModel::AnimationClip> VkGltfModel::DecodeClip(std::uint32_t AnimationIndex) const
+{
+	TRACE_SCOPE("DecodeClip");
+	const tinygltf::Animation& GltfAnimation = M_Model.animations[AnimationIndex];
+
+	std::shared_ptr<AnimationClip> Clip = std::make_shared<AnimationClip>();
+	Clip->Samplers.resize(GltfAnimation.samplers.size());
+	for (std::size_t j = 0; j < GltfAnimation.samplers.size(); j++) {
+		DecodeSampler(GltfAnimation.samplers[j], Clip->Samplers[j]);
+	}
+	Clip->Bytes = Clip->ComputeBytes();
+	return Clip;
+}
+
 std::shared_ptr<VkGltfModel::Node> VkGltfModel::FindNode(std::shared_ptr<Node> Parent, std::uint32_t Index) const
 {
 	std::shared_ptr<Node> NodeFound = nullptr;
@@ -2272,6 +8205,10 @@ std::shared_ptr<VkGltfModel::Node> VkGltfModel::FindNode(std::shared_ptr<Node> P
 
 std::shared_ptr<VkGltfModel::Node> VkGltfModel::NodeFromIndex(std::uint32_t Index) const
 {
+	if (Index < M_NodesByIndex.size()) {
+		return M_NodesByIndex[Index];
+	}
+
 	std::shared_ptr<Node> NodeFound = nullptr;
 	for (auto &Node : M_Nodes)
 	{
@@ -2284,149 +8221,264 @@ std::shared_ptr<VkGltfModel::Node> VkGltfModel::NodeFromIndex(std::uint32_t Inde
 	return NodeFound;
 }
 
-DirectX::XMMATRIX VkGltfModel::GetNodeMatrix(std::shared_ptr<Node> Node)
+float VkGltfModel::WrapAnimationTime(std::uint32_t AnimationIndex, float Time) const
 {
-	DirectX::XMMATRIX                  NodeMatrix = Node->GetLocalMatrix();
-	std::shared_ptr<VkGltfModel::Node> CurrentParent = Node->Parent;
-	while (CurrentParent)
-	{
-		NodeMatrix    = DirectX::XMMatrixMultiply(NodeMatrix, CurrentParent->GetLocalMatrix()) ;
-		CurrentParent = CurrentParent->Parent;
+	if (AnimationIndex >= M_Animations.size()) return 0.0f;
+
+	const Animation& Anim = M_Animations[AnimationIndex];
+	const float Duration = Anim.End - Anim.Start;
+	if (Duration <= 0.0f) return Anim.Start;
+
+	return Anim.Start + std::fmod(std::max(Time - Anim.Start, 0.0f), Duration);
+}
+
+std::shared_ptr<const VkGltfModel::AnimationClip> VkGltfModel::AcquireClip(std::uint32_t AnimationIndex) const
+{
+	if (AnimationIndex >= M_Animations.size()) return nullptr;
+	if (M_Animations[AnimationIndex].Clip) return M_Animations[AnimationIndex].Clip;
+	return M_ClipCache ? M_ClipCache->Acquire(AnimationIndex) : nullptr;
+}
+
+void VkGltfModel::EvaluatePose(std::uint32_t AnimationIndex, float Time, Pose& OutPose) const
+{
+	// Holding the reference keeps the keys alive even if the cache evicts the clip meanwhile.
+	const std::shared_ptr<const AnimationClip> Clip = AcquireClip(AnimationIndex);
+	EvaluatePose(AnimationIndex, Clip.get(), Time, OutPose);
+}
+
+void VkGltfModel::EvaluatePose(std::uint32_t AnimationIndex, const AnimationClip* Clip, float Time, Pose& OutPose) const
+{
+	TRACE_SCOPE("EvaluatePose");
+	const std::size_t NumNodes = M_LinearNodes.size();
+	OutPose.Translations.resize(NumNodes);
+	OutPose.Rotations.resize(NumNodes);
+	OutPose.Scales.resize(NumNodes);
+	OutPose.Globals.resize(NumNodes);
+
+	for (std::size_t i = 0; i < NumNodes; i++) {
+		OutPose.Translations[i] = M_LinearNodes[i]->Translation;
+		OutPose.Rotations[i] = M_LinearNodes[i]->Rotation;
+		OutPose.Scales[i] = M_LinearNodes[i]->Scale;
+	}
+	OutPose.MorphWeights.assign(M_DefaultMorphWeights.begin(), M_DefaultMorphWeights.end());
+
+	// Without keys (a clip still streaming in) the instance holds its rest pose.
+	if (AnimationIndex < M_Animations.size() && Clip) {
+		const Animation& Anim = M_Animations[AnimationIndex];
+
+		for (auto &Channel : Anim.Channels)
+		{
+			const AnimationSampler &Sampler = Clip->Samplers[Channel.SamplerIndex];
+			const std::uint32_t     Target  = Channel.TargetNode->LinearIndex;
+
+			for (std::size_t i = 0; i + 1 < Sampler.Inputs.size(); i++)
+			{
+				if ((Time >= Sampler.Inputs[i]) && (Time <= Sampler.Inputs[i + 1]))
+				{
+					const float a = (Time - Sampler.Inputs[i]) / (Sampler.Inputs[i + 1] - Sampler.Inputs[i]);
+					switch(Channel.Path)
+					{
+					case ChannelPath::eTranslation:
+					{
+						const DirectX::XMVECTOR TranslationVec = DirectX::XMVectorLerp(DirectX::XMLoadFloat4(&Sampler.OutputsVec4[i]), DirectX::XMLoadFloat4(&Sampler.OutputsVec4[i + 1]), a);
+						DirectX::XMStoreFloat3(&OutPose.Translations[Target], TranslationVec);
+					}
+					break;
+					case ChannelPath::eRotation:
+					{
+						const DirectX::XMVECTOR q1 = DirectX::XMLoadFloat4(&Sampler.OutputsVec4[i]);
+						const DirectX::XMVECTOR q2 = DirectX::XMLoadFloat4(&Sampler.OutputsVec4[i + 1]);
+
+						const DirectX::XMVECTOR RotationVec = DirectX::XMVector4Normalize(DirectX::XMQuaternionSlerp(q1, q2, a));
+						DirectX::XMStoreFloat4(&OutPose.Rotations[Target], RotationVec);
+					}
+					break;
+					case ChannelPath::eScale:
+					{
+						const DirectX::XMVECTOR ScaleVec = DirectX::XMVectorLerp(DirectX::XMLoadFloat4(&Sampler.OutputsVec4[i]), DirectX::XMLoadFloat4(&Sampler.OutputsVec4[i + 1]), a);
+						DirectX::XMStoreFloat3(&OutPose.Scales[Target], ScaleVec);
+					}
+					break;
+					case ChannelPath::eWeights:
+					{
+						// One scalar per target and keyframe, keyframe-major.
+						const std::size_t NumTargets = Channel.TargetNode->MorphTargetCount;
+						if ((i + 2) * NumTargets > Sampler.OutputsVec4.size()) break;
+						for (std::size_t t = 0; t < NumTargets; t++) {
+							const float w0 = Sampler.OutputsVec4[i * NumTargets + t].x;
+							const float w1 = Sampler.OutputsVec4[(i + 1) * NumTargets + t].x;
+							OutPose.MorphWeights[Channel.TargetNode->FirstMorphTarget + t] = w0 + (w1 - w0) * a;
+						}
+					}
+					break;
+					default:
+						break;
+					}
+
+					break;
+				}
+			}
+		}
+	}
+
+	// M_LinearNodes is in pre-order, so a parent's global matrix is always ready before its children.
+	for (std::size_t i = 0; i < NumNodes; i++) {
+		const Node& CurrentNode = *M_LinearNodes[i];
+
+		const DirectX::XMMATRIX XmMatrixScale       = DirectX::XMMatrixScalingFromVector(DirectX::XMLoadFloat3(&OutPose.Scales[i]));
+		const DirectX::XMMATRIX XmMatrixRotation    = DirectX::XMMatrixRotationQuaternion(DirectX::XMLoadFloat4(&OutPose.Rotations[i]));
+		const DirectX::XMMATRIX XmMatrixTranslation = DirectX::XMMatrixTranslationFromVector(DirectX::XMLoadFloat3(&OutPose.Translations[i]));
+		const DirectX::XMMATRIX XmLocalMatrix       = DirectX::XMMatrixMultiply(DirectX::XMLoadFloat4x4(&CurrentNode.Matrix), DirectX::XMMatrixMultiply(XmMatrixScale, DirectX::XMMatrixMultiply(XmMatrixRotation, XmMatrixTranslation)));
+
+		OutPose.Globals[i] = CurrentNode.Parent ? DirectX::XMMatrixMultiply(XmLocalMatrix, OutPose.Globals[CurrentNode.Parent->LinearIndex]) : XmLocalMatrix;
 	}
-	return NodeMatrix;
 }
 
-void VkGltfModel::UpdateJoints(std::shared_ptr<Node> Node)
+void VkGltfModel::UpdateJoints(const Pose& InPose, DirectX::XMFLOAT4X4* DstPalette) const
 {
-	if (Node->Skin > -1)
+	TRACE_SCOPE("UpdateJoints");
+	for (const Skin& NodeSkin : M_Skins)
 	{
-		const DirectX::XMMATRIX InverseTransform = DirectX::XMMatrixInverse(nullptr, GetNodeMatrix(Node));
-		const Skin&             NodeSkin         = M_Skins[Node->Skin];
-		const std::size_t       NumJoints        = NodeSkin.Joints.size();
+		DirectX::XMFLOAT4X4* SkinPalette = DstPalette + NodeSkin.PaletteOffset;
+		const std::size_t    NumJoints   = NodeSkin.Joints.size();
 
-		std::vector<DirectX::XMFLOAT4X4> JointMatrices(NumJoints);
 		for (std::size_t i = 0; i < NumJoints; i++)
 		{
-			DirectX::XMMATRIX JointMatrix = DirectX::XMMatrixMultiply(DirectX::XMLoadFloat4x4(&NodeSkin.InverseBindMatrices[i]), GetNodeMatrix(NodeSkin.Joints[i]));
-			//JointMatrix = DirectX::XMMatrixMultiply(JointMatrix, InverseTransform);
-			DirectX::XMStoreFloat4x4(&JointMatrices[i], JointMatrix);
+			const DirectX::XMMATRIX& JointGlobal = InPose.Globals[NodeSkin.Joints[i]->LinearIndex];
+			const DirectX::XMMATRIX  JointMatrix = (i < NodeSkin.InverseBindMatrices.size()) ? DirectX::XMMatrixMultiply(DirectX::XMLoadFloat4x4(&NodeSkin.InverseBindMatrices[i]), JointGlobal) : JointGlobal;
+			PaletteRing::StoreMatrix(&SkinPalette[i], JointMatrix);
 		}
-
-		const vk::DeviceSize ByteSize = JointMatrices.size() * sizeof(DirectX::XMFLOAT4X4);
-		std::memcpy(NodeSkin.SsboMapped[G_CurrentFrame], JointMatrices.data(), ByteSize);
 	}
 
-	for (auto &Child : Node->Children)
-	{
-		UpdateJoints(Child);
+	// Weight t lands in column-major JointMatrices[base + t / 16][(t % 16) / 4][t % 4] on the GPU.
+	for (std::uint32_t Block = 0; Block * 16 < M_MorphTargetCount; Block++) {
+		DirectX::XMFLOAT4X4 Weights{};
+		const std::uint32_t Count = std::min(16U, M_MorphTargetCount - Block * 16);
+		std::copy_n(InPose.MorphWeights.begin() + Block * 16, Count, &Weights.m[0][0]);
+		PaletteRing::StoreMatrix(&DstPalette[M_MorphWeightOffset + Block], DirectX::XMLoadFloat4x4(&Weights));
 	}
 }
 
-void VkGltfModel::UpdateAnimation(float DeltaTime)
+void VkGltfModel::ReleaseSourceData()
 {
-	if (M_Animations.empty()) return;
-
-	Animation &Anim = M_Animations[0];
-	Anim.CurrentTime += DeltaTime;
-	while (Anim.CurrentTime > Anim.End)
-	{
-		Anim.CurrentTime -= (Anim.End - Anim.Start);
+	// Everything the renderer needs has been cooked into M_Nodes, M_Skins, M_Animations and
+	// the GPU buffers by now; the parsed document, its raw buffers and decoded images are dead weight.
+	tinygltf::Model Empty;
+	if (M_bStreamClips) {
+		// Streamed clips still decode from the document, so the parts they read stay behind.
+		std::swap(Empty.animations, M_Model.animations);
+		std::swap(Empty.accessors, M_Model.accessors);
+		std::swap(Empty.bufferViews, M_Model.bufferViews);
+		std::swap(Empty.buffers, M_Model.buffers);
 	}
+	std::swap(M_Model, Empty);
+	M_bHasSourceData = false;
+}
 
-	for (auto &Channel : Anim.Channels)
-	{
-		AnimationSampler &Sampler = Anim.Samplers[Channel.SamplerIndex];
+void VkGltfModel::ReleaseHostGeometry()
+{
+	std::vector<Vertex>().swap(M_HostVertices);
+	std::vector<MorphRange>().swap(M_HostMorphRanges);
+	std::vector<MorphDelta>().swap(M_HostMorphDeltas);
+}
 
-		for (std::size_t i = 0; i < Sampler.Inputs.size() - 1; i++)
-		{
-			if ((Anim.CurrentTime >= Sampler.Inputs[i]) && (Anim.CurrentTime <= Sampler.Inputs[i + 1]))
-			{
-				const float a = (Anim.CurrentTime - Sampler.Inputs[i]) / (Sampler.Inputs[i + 1] - Sampler.Inputs[i]);
-				switch(Channel.Path)
-				{
-				case ChannelPath::eTranslation:
-				{
-					const DirectX::XMVECTOR TranslationVec = DirectX::XMVectorLerp(DirectX::XMLoadFloat4(&Sampler.OutputsVec4[i]), DirectX::XMLoadFloat4(&Sampler.OutputsVec4[i + 1]), a);
-					DirectX::XMStoreFloat3(&Channel.Node->Translation, TranslationVec);
+VkGltfModel::MemoryStats VkGltfModel::GetMemoryStats() const
+{
+	MemoryStats Stats;
 
-				}
-				break;
-				case ChannelPath::eRotation:
-				{
-					const DirectX::XMVECTOR q1 = DirectX::XMVectorSet(Sampler.OutputsVec4[i].x, Sampler.OutputsVec4[i].y, Sampler.OutputsVec4[i].z, Sampler.OutputsVec4[i].w);
-					const DirectX::XMVECTOR q2 = DirectX::XMVectorSet(Sampler.OutputsVec4[i+1].x, Sampler.OutputsVec4[i+1].y, Sampler.OutputsVec4[i+1].z, Sampler.OutputsVec4[i+1].w);
+	const auto AddHost = [&Stats](MemoryCategory Category, std::uint64_t Bytes) { Stats.HostBytes[static_cast<std::size_t>(Category)] += Bytes; };
+	const auto AddDevice = [&Stats](MemoryCategory Category, const DeviceAllocation& Allocation) {
+		Stats.DeviceBytes[static_cast<std::size_t>(Category)] += Allocation.Size;
+	};
 
-					const DirectX::XMVECTOR RotationVec = DirectX::XMVector4Normalize(DirectX::XMQuaternionSlerp(q1, q2, a));
-					DirectX::XMStoreFloat4(&Channel.Node->Rotation, RotationVec);
-				}
-				break;
-				case ChannelPath::eScale:
-				{
-					const DirectX::XMVECTOR ScaleVec = DirectX::XMVectorLerp(DirectX::XMLoadFloat4(&Sampler.OutputsVec4[i]), DirectX::XMLoadFloat4(&Sampler.OutputsVec4[i + 1]), a);
-					DirectX::XMStoreFloat3(&Channel.Node->Scale, ScaleVec);
-				}
-				break;
-				default:
-					break;
-				}
+	AddDevice(MemoryCategory::eVertices, std::get<1>(M_VertexBufferTuple));
+	AddDevice(MemoryCategory::eIndices, std::get<1>(M_IndexBufferTuple));
+	AddDevice(MemoryCategory::eMorphTargets, std::get<1>(M_MorphRangeBufferTuple));
+	AddDevice(MemoryCategory::eMorphTargets, std::get<1>(M_MorphDeltaBufferTuple));
+	AddHost(MemoryCategory::eMorphTargets, M_DefaultMorphWeights.capacity() * sizeof(float));
+	AddHost(MemoryCategory::eVertices, M_HostVertices.capacity() * sizeof(Vertex));
+	AddHost(MemoryCategory::eMorphTargets, M_HostMorphRanges.capacity() * sizeof(MorphRange) + M_HostMorphDeltas.capacity() * sizeof(MorphDelta));
+
+	for (const auto& Anim : M_Animations) {
+		AddHost(MemoryCategory::eClips, sizeof(Animation) + Anim.Name.capacity());
+		AddHost(MemoryCategory::eClips, Anim.Channels.capacity() * sizeof(AnimationChannel));
+		if (Anim.Clip) AddHost(MemoryCategory::eClips, Anim.Clip->Bytes);
+	}
+	if (M_ClipCache) {
+		AddHost(MemoryCategory::eClips, M_ClipCache->GetStats().ResidentBytes);
+	}
 
-				break;
-			}
-		}
+	for (const auto& Skin : M_Skins) {
+		AddHost(MemoryCategory::ePalettes, Skin.InverseBindMatrices.capacity() * sizeof(DirectX::XMFLOAT4X4));
+		AddHost(MemoryCategory::ePalettes, Skin.Joints.capacity() * sizeof(std::shared_ptr<Node>));
 	}
 
-	for (auto &Node : M_Nodes)
-	{
-		UpdateJoints(Node);
+	if (M_bHasSourceData || M_bStreamClips) {
+		for (const auto& Buffer : M_Model.buffers) AddHost(MemoryCategory::eSourceData, Buffer.data.capacity());
+		for (const auto& Image : M_Model.images) AddHost(MemoryCategory::eSourceData, Image.image.capacity());
+
+		AddHost(MemoryCategory::eSourceData,
+			M_Model.accessors.capacity() * sizeof(tinygltf::Accessor) +
+			M_Model.bufferViews.capacity() * sizeof(tinygltf::BufferView) +
+			M_Model.nodes.capacity() * sizeof(tinygltf::Node) +
+			M_Model.meshes.capacity() * sizeof(tinygltf::Mesh) +
+			M_Model.skins.capacity() * sizeof(tinygltf::Skin) +
+			M_Model.animations.capacity() * sizeof(tinygltf::Animation) +
+			M_Model.materials.capacity() * sizeof(tinygltf::Material) +
+			M_Model.textures.capacity() * sizeof(tinygltf::Texture));
 	}
+
+	return Stats;
 }
 
+std::uint32_t VkGltfModel::DefragmentBuffers()
+{
+	TRACE_SCOPE("DefragmentModelBuffers");
+	if (!std::get<0>(M_VertexBufferTuple)) return 0;
+
+	// The moves copy from the old ranges, so the upload has to have landed in them.
+	G_UploadManager.Wait(M_UploadToken);
+
+	std::uint32_t MoveCount = 0;
+	std::vector<std::uint32_t> MemoryTypeIndices;
+	for (const MovableBuffer& Item : M_MovableBuffers) {
+		const std::uint32_t MemoryTypeIndex = std::get<1>(*Item.BufferTuple).MemoryTypeIndex;
+		if (std::find(MemoryTypeIndices.begin(), MemoryTypeIndices.end(), MemoryTypeIndex) != MemoryTypeIndices.end()) continue;
+		MemoryTypeIndices.push_back(MemoryTypeIndex);
+
+		MoveCount += G_DeviceAllocator.Defragment(MemoryTypeIndex, [](void* Owner, const DeviceAllocation&, const DeviceAllocation& To) {
+			return MoveBuffer(*static_cast<MovableBuffer*>(Owner), To);
+		});
+	}
+
+	// The morph set still points at the old buffers.
+	if (MoveCount > 0 && M_MorphDescriptorSet) {
+		WriteMorphDescriptorSet();
+	}
+	return MoveCount;
+}
 
 void VkGltfModel::Shutdown()
 {
 	if (G_Device) {
 
-		if (M_SkinsDescriptorPool) {
-			G_Device.destroyDescriptorPool(M_SkinsDescriptorPool, nullptr, G_DLD);
-			M_SkinsDescriptorPool = nullptr;
-		}
-
-		for (std::size_t i = 0; i < M_Skins.size(); i++) {
-
-			for (std::size_t m = 0; m < G_MaxFramesInFlight; m++) {
-				if (M_Skins[i].SsboMapped[m]) {
-					G_Device.unmapMemory(std::get<1>(M_Skins[i].Ssbo[m]), G_DLD);
-					M_Skins[i].SsboMapped[m] = nullptr;
-				}
+		// Buffers may still be the destination of an in-flight copy.
+		G_UploadManager.Wait(M_UploadToken);
+		M_UploadToken = 0;
 
-				if (std::get<1>(M_Skins[i].Ssbo[m])) {
-					G_Device.freeMemory(std::get<1>(M_Skins[i].Ssbo[m]), nullptr, G_DLD);
-					std::get<1>(M_Skins[i].Ssbo[m]) = nullptr;
-				}
-				if (std::get<0>(M_Skins[i].Ssbo[m])) {
-					G_Device.destroyBuffer(std::get<0>(M_Skins[i].Ssbo[m]), nullptr, G_DLD);
-					std::get<0>(M_Skins[i].Ssbo[m]) = nullptr;
-				}
-			}
+		if (M_MorphDescriptorPool) {
+			G_Device.destroyDescriptorPool(M_MorphDescriptorPool, nullptr, G_DLD);
+			M_MorphDescriptorPool = nullptr;
+			M_MorphDescriptorSet = nullptr;
 		}
 
-		if (std::get<1>(M_IndexBufferTuple)) {
-			G_Device.freeMemory(std::get<1>(M_IndexBufferTuple), nullptr, G_DLD);
-			std::get<1>(M_IndexBufferTuple) = nullptr;
-		}
-		if (std::get<1>(M_VertexBufferTuple)) {
-			G_Device.freeMemory(std::get<1>(M_VertexBufferTuple), nullptr, G_DLD);
-			std::get<1>(M_VertexBufferTuple) = nullptr;
-		}
-		if (std::get<0>(M_IndexBufferTuple)) {
-			G_Device.destroyBuffer(std::get<0>(M_IndexBufferTuple), nullptr, G_DLD);
-			std::get<0>(M_IndexBufferTuple) = nullptr;
-		}
-		if (std::get<0>(M_VertexBufferTuple)) {
-			G_Device.destroyBuffer(std::get<0>(M_VertexBufferTuple), nullptr, G_DLD);
-			std::get<0>(M_VertexBufferTuple) = nullptr;
-		}
+		DestroyBuffer(M_MorphDeltaBufferTuple);
+		DestroyBuffer(M_MorphRangeBufferTuple);
+		DestroyBuffer(M_IndexBufferTuple);
+		DestroyBuffer(M_VertexBufferTuple);
 	}
+
+	ReleaseHostGeometry();
 }
 
 
@@ -1,3 +1,5 @@
 "%VK_SDK_PATH%/Bin/glslc" Default.vert -o DefaultVS.spv
 "%VK_SDK_PATH%/Bin/glslc" Default.frag -o DefaultFS.spv
+"%VK_SDK_PATH%/Bin/glslc" Vat.vert -o VatVS.spv
+"%VK_SDK_PATH%/Bin/glslc" Cull.comp -o CullCS.spv
 pause
\ No newline at end of file
@@ -3,20 +3,17 @@
 
 layout(location = 0) in vec3 OutPosition;
 layout(location = 1) in vec3 OutNormal;
+layout(location = 2) flat in vec3 OutColor;
 
 layout(location = 0) out vec4 FragColor;
 
-layout(push_constant) uniform FPushConsts {
-	layout(offset = 128) vec3 Color;
-} PushConsts;
-
 
 void main()
 {
 	vec3 LightDirection = normalize(vec3(0.0f, 0.0f, 1.0f));
 
 	float Mod = dot(normalize(OutNormal), LightDirection);
-	vec3 Color = PushConsts.Color * ((Mod * 0.8f) + 0.2f);
+	vec3 Color = OutColor * ((Mod * 0.8f) + 0.2f);
 
 	FragColor = vec4(Color, 1.0f) ;
 }
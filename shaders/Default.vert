@@ -14,30 +14,141 @@ layout(std430, set = 0, binding = 0) readonly buffer FJointMatrices {
 	mat4 JointMatrices[];
 };
 
+// The same slice seen as words, for the shared-pose remap table at its head.
+layout(std430, set = 0, binding = 0) readonly buffer FPaletteWords {
+	uint PaletteWords[];
+};
+
+struct FDrawData {
+	mat4 Model;
+	vec4 Color;
+	vec4 BoundingSphere;
+	uint PaletteBase;
+	uint MorphWeightBase;
+	uint PaletteSlot;
+	uint BakedSlot;
+	uint VatFirstFrame;
+	uint VatFrameCount;
+	uint VatClip;
+	float VatFrameOffset;
+};
+
+layout(std430, set = 1, binding = 0) readonly buffer FDrawDatas {
+	FDrawData Draws[];
+};
+
+struct FMorphDelta {
+	vec3 Position;
+	uint Target;
+	vec3 Normal;
+	float Padding;
+};
+
+// Per vertex (First, Count) into MorphDeltas; only vertices a target moves have entries.
+layout(std430, set = 2, binding = 0) readonly buffer FMorphRanges {
+	uvec2 MorphRanges[];
+};
+
+layout(std430, set = 2, binding = 1) readonly buffer FMorphDeltas {
+	FMorphDelta MorphDeltas[];
+};
+
+// Baked rows: each joint as the top three rows of its transposed matrix, then the morph weights, 4 to a vec4.
+layout(std430, set = 3, binding = 0) readonly buffer FBakedRows {
+	vec4 BakedRows[];
+};
+
+// With a baked slot the head of the palette slice holds (Row0, Row1, Alpha, 0) per instance.
+layout(std430, set = 0, binding = 0) readonly buffer FBakedFrames {
+	uvec4 BakedFrames[];
+};
+
+const uint NO_MORPH_WEIGHTS = 0xFFFFFFFFu;
+const uint NO_PALETTE_SLOT = 0xFFFFFFFFu;
+const uint NO_BAKED_SLOT = 0xFFFFFFFFu;
+
 layout(push_constant) uniform FPushConsts {
 	mat4 ProjectionView;
-	mat4 Model;
 } PushConsts;
 
 layout(location = 0) out vec3 OutPosition;
 layout(location = 1) out vec3 OutNormal;
+layout(location = 2) flat out vec3 OutColor;
+
+FDrawData Draw;
+uint InstanceBase;
+uvec2 BakedRow;
+float BakedAlpha;
+
+mat4 FetchJointMatrix(uint Joint)
+{
+	if (Draw.BakedSlot == NO_BAKED_SLOT) {
+		return JointMatrices[InstanceBase + Joint];
+	}
+
+	uint Offset = Joint * 3;
+	vec4 R0 = mix(BakedRows[BakedRow.x + Offset + 0], BakedRows[BakedRow.y + Offset + 0], BakedAlpha);
+	vec4 R1 = mix(BakedRows[BakedRow.x + Offset + 1], BakedRows[BakedRow.y + Offset + 1], BakedAlpha);
+	vec4 R2 = mix(BakedRows[BakedRow.x + Offset + 2], BakedRows[BakedRow.y + Offset + 2], BakedAlpha);
+	return transpose(mat4(R0, R1, R2, vec4(0.0f, 0.0f, 0.0f, 1.0f)));
+}
+
+float FetchMorphWeight(uint Target)
+{
+	if (Draw.BakedSlot == NO_BAKED_SLOT) {
+		return JointMatrices[InstanceBase + Draw.MorphWeightBase + Target / 16][(Target % 16) / 4][Target % 4];
+	}
+
+	uint Offset = Draw.MorphWeightBase * 3 + Target / 4;
+	return mix(BakedRows[BakedRow.x + Offset][Target % 4], BakedRows[BakedRow.y + Offset][Target % 4], BakedAlpha);
+}
 
 void main()
 {
+	// firstInstance carries the draw index, both for direct and indirect draws.
+	Draw = Draws[gl_InstanceIndex];
+
+	// Instances sharing a pose point at the same palette; the bases in Draw are then relative to it.
+	InstanceBase = (Draw.PaletteSlot != NO_PALETTE_SLOT) ? PaletteWords[Draw.PaletteSlot] : 0;
+	if (Draw.BakedSlot != NO_BAKED_SLOT) {
+		uvec4 Frame = BakedFrames[Draw.BakedSlot];
+		BakedRow = Frame.xy;
+		BakedAlpha = uintBitsToFloat(Frame.z);
+	}
+
+	// Weights are packed 16 to a palette matrix; targets at rest cost one weight fetch and nothing else.
+	vec3 MorphedPosition = Position;
+	vec3 MorphedNormal = Normal;
+	if (Draw.MorphWeightBase != NO_MORPH_WEIGHTS) {
+		uvec2 Range = MorphRanges[gl_VertexIndex];
+		for (uint i = Range.x; i < Range.x + Range.y; i++) {
+			uint Target = MorphDeltas[i].Target;
+			float Weight = FetchMorphWeight(Target);
+			if (Weight != 0.0f) {
+				MorphedPosition += Weight * MorphDeltas[i].Position;
+				MorphedNormal += Weight * MorphDeltas[i].Normal;
+			}
+		}
+	}
+
+	uvec4 Joints0 = JointIndices0 + Draw.PaletteBase;
+	uvec4 Joints1 = JointIndices1 + Draw.PaletteBase;
+
 	mat4 SkinMat =
-		JointWeights0.x * JointMatrices[JointIndices0.x] +
-		JointWeights0.y * JointMatrices[JointIndices0.y] +
-		JointWeights0.z * JointMatrices[JointIndices0.z] +
-		JointWeights0.w * JointMatrices[JointIndices0.w] +
-		JointWeights1.x * JointMatrices[JointIndices1.x] +
-		JointWeights1.y * JointMatrices[JointIndices1.y] +
-		JointWeights1.z * JointMatrices[JointIndices1.z] +
-		JointWeights1.w * JointMatrices[JointIndices1.w];
+		JointWeights0.x * FetchJointMatrix(Joints0.x) +
+		JointWeights0.y * FetchJointMatrix(Joints0.y) +
+		JointWeights0.z * FetchJointMatrix(Joints0.z) +
+		JointWeights0.w * FetchJointMatrix(Joints0.w) +
+		JointWeights1.x * FetchJointMatrix(Joints1.x) +
+		JointWeights1.y * FetchJointMatrix(Joints1.y) +
+		JointWeights1.z * FetchJointMatrix(Joints1.z) +
+		JointWeights1.w * FetchJointMatrix(Joints1.w);
 
 
-	gl_Position = PushConsts.ProjectionView * PushConsts.Model * SkinMat * vec4(Position, 1.0f);
+	gl_Position = PushConsts.ProjectionView * Draw.Model * SkinMat * vec4(MorphedPosition, 1.0f);
 	OutPosition = vec3(gl_Position) * gl_Position.w;
-	OutNormal = transpose(inverse(mat3(PushConsts.Model * SkinMat))) * Normal;
+	OutNormal = transpose(inverse(mat3(Draw.Model * SkinMat))) * MorphedNormal;
+	OutColor = Draw.Color.rgb;
 }
 
 
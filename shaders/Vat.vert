@@ -0,0 +1,81 @@
+#version 460
+
+// Vertex animation playback: positions and normals were skinned ahead of time, so there are no vertex
+// attributes and no palette; gl_VertexIndex alone finds the vertex in the atlas.
+
+struct FDrawData {
+	mat4 Model;
+	vec4 Color;
+	vec4 BoundingSphere;
+	uint PaletteBase;
+	uint MorphWeightBase;
+	uint PaletteSlot;
+	uint BakedSlot;
+	uint VatFirstFrame;
+	uint VatFrameCount;
+	uint VatClip;
+	float VatFrameOffset;
+};
+
+layout(std430, set = 1, binding = 0) readonly buffer FDrawDatas {
+	FDrawData Draws[];
+};
+
+// Head of the frame's palette slice: the vertex count of one atlas frame, then each clip's clock in its own
+// frames, already wrapped to the clip's loop.
+layout(std430, set = 0, binding = 0) readonly buffer FVatFrame {
+	uint VatVertexCount;
+	float VatClipClocks[];
+};
+
+struct FAtlasVertex {
+	vec3 Position;
+	uint Normal;
+};
+
+layout(std430, set = 3, binding = 0) readonly buffer FAtlas {
+	FAtlasVertex Atlas[];
+};
+
+layout(push_constant) uniform FPushConsts {
+	mat4 ProjectionView;
+} PushConsts;
+
+layout(location = 0) out vec3 OutPosition;
+layout(location = 1) out vec3 OutNormal;
+layout(location = 2) flat out vec3 OutColor;
+
+vec3 DecodeOctahedral(uint Packed)
+{
+	vec2 E = unpackSnorm2x16(Packed);
+	vec3 N = vec3(E, 1.0f - abs(E.x) - abs(E.y));
+	if (N.z < 0.0f) {
+		N.xy = (1.0f - abs(N.yx)) * vec2(N.x >= 0.0f ? 1.0f : -1.0f, N.y >= 0.0f ? 1.0f : -1.0f);
+	}
+	return normalize(N);
+}
+
+void main()
+{
+	// firstInstance carries the draw index, both for direct and indirect draws.
+	FDrawData Draw = Draws[gl_InstanceIndex];
+
+	uint VertexCount = VatVertexCount;
+
+	// The last frame of a clip is its loop point, so a loop is one frame shorter than the clip.
+	float Period = float(Draw.VatFrameCount - 1);
+	float Frame = mod(VatClipClocks[Draw.VatClip] + Draw.VatFrameOffset, max(Period, 1.0f));
+	uint Frame0 = min(uint(Frame), Draw.VatFrameCount - 1);
+	uint Frame1 = min(Frame0 + 1, Draw.VatFrameCount - 1);
+	float Alpha = clamp(Frame - float(Frame0), 0.0f, 1.0f);
+
+	FAtlasVertex A = Atlas[(Draw.VatFirstFrame + Frame0) * VertexCount + gl_VertexIndex];
+	FAtlasVertex B = Atlas[(Draw.VatFirstFrame + Frame1) * VertexCount + gl_VertexIndex];
+	vec3 SkinnedPosition = mix(A.Position, B.Position, Alpha);
+	vec3 SkinnedNormal = mix(DecodeOctahedral(A.Normal), DecodeOctahedral(B.Normal), Alpha);
+
+	gl_Position = PushConsts.ProjectionView * Draw.Model * vec4(SkinnedPosition, 1.0f);
+	OutPosition = vec3(gl_Position) * gl_Position.w;
+	OutNormal = transpose(inverse(mat3(Draw.Model))) * SkinnedNormal;
+	OutColor = Draw.Color.rgb;
+}